@@ -0,0 +1,462 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync command path microbenchmarks     ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// drives the string helpers, the tokenizer and every command handler
+// in isolation, on a simulated register bank, and reports ns/op and
+// instructions/op (when the host has the counters); built with the
+// server sources by make bench (see ../Makefile), checked against
+// baseline.txt by make bench-check
+//
+// usage:
+//
+//   chopbench [-n iterations] [-r runs] [-c cpu] [-v]
+//             [-b baseline [-t percent]] [-w baseline] [pattern ...]
+//
+// each case runs -r times -n iterations and the best run is reported;
+// with patterns, only the cases whose name contains one of them
+// -w writes the results as a baseline, -b compares with one; baselines
+// are only meaningful on the machine (and build) they were taken on
+// with -t, a case more than percent slower than its baseline (in
+// instructions when both have them, else in ns) is marked SLOWER and
+// the exit status is 2 (make bench-check)
+// -v prints the answer of every command once, to check that the case
+// measures the intended path and not an error
+//
+// every command is parsed from a fresh copy of its text, as parse()
+// edits it in place; the "copy" case is the cost of that copy alone
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "server.h"
+#include "perfcount.h"
+
+#define BENCH_ITERS     20000
+#define BENCH_RUNS      5
+#define BENCH_MAXCASES  128
+#define BENCH_MAXNAME   80
+#define BENCH_NDEVS     2
+
+typedef void (*benchfn)(char *buf);
+
+struct benchcase
+  {
+  const char *name;
+  const char *text;         // input of fn
+  benchfn     fn;
+  };
+
+struct result
+  {
+  char   name[BENCH_MAXNAME];
+  double ns, insn;          // per op; insn<0 if not measured
+  };
+
+/***  globals  ***/
+static int              nullfd;
+static struct perfcount pc;
+static struct result    base[BENCH_MAXCASES];
+static int              nbase;
+
+
+//-------------------------------------------------------------------
+
+static void bench_copy(char *buf)
+  {
+  (void)buf;
+  }
+
+
+//-------------------------------------------------------------------
+
+static void bench_trimstring(char *buf)
+  {
+  trimstring(buf);
+  }
+
+
+//-------------------------------------------------------------------
+
+static void bench_upstring(char *buf)
+  {
+  upstring(buf);
+  }
+
+
+//-------------------------------------------------------------------
+
+static void bench_tok_command(char *buf)
+  {
+  struct toker tk;
+  struct span  p;
+
+  tok_init(&tk, buf);
+  (void)tok_command(&tk, &p);
+  }
+
+
+//-------------------------------------------------------------------
+
+// what run_command() does, without sending the answer
+
+static void bench_parse(char *buf)
+  {
+  curpend=pend_alloc(nullfd);
+  if(curpend==NULL)
+    return;
+  curpart=0;
+  parse(buf, curpend->part[0], MAXANS, nullfd);
+  curpend->used=false;
+  curpend=NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+static const struct benchcase cases[] =
+  {
+  { "copy",                 "PHSETPOINT_NS?",                 bench_copy },
+  { "trimstring",           "  phsetpoint_ns 16  ",           bench_trimstring },
+  { "upstring",             "phsetpoint_ns 16",               bench_upstring },
+  { "tok_command",          "PHSETPOINT_NS 16",               bench_tok_command },
+  // a miss goes through the whole dispatch chain
+  { NULL, "NOSUCH?",                                          bench_parse },
+  { NULL, "  phsetpoint_ns?  ",                               bench_parse },
+  { NULL, "*IDN?",                                            bench_parse },
+  { NULL, "*STB?",                                            bench_parse },
+  { NULL, "DEVICES?",                                         bench_parse },
+  { NULL, "REG? 3",                                           bench_parse },
+  { NULL, "REG 3 0",                                          bench_parse },
+  { NULL, "SYNCHRONIZER?",                                    bench_parse },
+  { NULL, "SYNCHRONIZER ON",                                  bench_parse },
+  { NULL, "PHSETPOINT_NS?",                                   bench_parse },
+  { NULL, "PHSETPOINT_NS 16",                                 bench_parse },
+  { NULL, "PHSETPOINT_NS 0.024US",                            bench_parse },
+  { NULL, "PHSETPOINT_NS? DEADLINE 50",                       bench_parse },
+  { NULL, "BUNCHMARKER_PRESCALER?",                           bench_parse },
+  { NULL, "BUNCHMARKER_PRESCALER 10",                         bench_parse },
+  { NULL, "CHOPPER_PRESCALER?",                               bench_parse },
+  { NULL, "CHOPPER_PRESCALER 4",                              bench_parse },
+  { NULL, "TRIGOUT_PH?",                                      bench_parse },
+  { NULL, "TRIGOUT_PH 3",                                     bench_parse },
+  { NULL, "UNWRAP?",                                          bench_parse },
+  { NULL, "UNWRAP ON",                                        bench_parse },
+  { NULL, "UNW_RES?",                                         bench_parse },
+  { NULL, "UNW_THR?",                                         bench_parse },
+  { NULL, "UNW_THR 100",                                      bench_parse },
+  { NULL, "SIGGEN_DF_HZ?",                                    bench_parse },
+  { NULL, "SIGGEN_DF_HZ 1.5",                                 bench_parse },
+  { NULL, "GAIN?",                                            bench_parse },
+  { NULL, "GAIN 1.5",                                         bench_parse },
+  { NULL, "FLOCK?",                                           bench_parse },
+  { NULL, "PHLOCK?",                                          bench_parse },
+  { NULL, "STICKYLOL?",                                       bench_parse },
+  { NULL, "MECOS_CMD?",                                       bench_parse },
+  { NULL, "PHERR?",                                           bench_parse },
+  { NULL, "BUNCHFREQ?",                                       bench_parse },
+  { NULL, "CHOPFREQ?",                                        bench_parse },
+  { NULL, "TELEMETRY?",                                       bench_parse },
+  { NULL, "HTTP?",                                            bench_parse },
+  { NULL, "CAN:TXQ?",                                         bench_parse },
+  { NULL, "CAN:STATS?",                                       bench_parse },
+  { NULL, "REALTIME?",                                        bench_parse },
+  { NULL, "SUPERVISOR?",                                      bench_parse },
+  { NULL, "CONFIGURE?",                                       bench_parse },
+  { NULL, "CONFIGURE BUNCHMARKER_PRESCALER 10 TRIGOUT_PH 3 GAIN 1.5", bench_parse },
+  // no CAN interface: the request fails at once
+  { NULL, "MECOS:HZ_ACT?",                                    bench_parse },
+  { NULL, "DEV1:PHSETPOINT_NS?",                              bench_parse },
+  { NULL, "ALL:PHERR?",                                       bench_parse },
+  { NULL, "ALL:CONFIGURE?",                                   bench_parse },
+  };
+
+#define NCASES ((int)(sizeof(cases)/sizeof(cases[0])))
+
+
+//-------------------------------------------------------------------
+
+static const char *case_name(const struct benchcase *c)
+  {
+  return (c->name!=NULL)? c->name : c->text;
+  }
+
+
+//-------------------------------------------------------------------
+
+static double now_ns(void)
+  {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec*1e9+(double)ts.tv_nsec;
+  }
+
+
+//-------------------------------------------------------------------
+
+// best of runs; the copy of the input is part of every iteration
+
+static void run_case(const struct benchcase *c, long iters, int runs, struct result *r)
+  {
+  char   buf[MAXMSG+1];
+  size_t len;
+  double t0, t;
+  uint64_t n;
+  long   i;
+  int    k;
+
+  len=strlen(c->text);
+  snprintf(r->name, sizeof(r->name), "%s", case_name(c));
+  r->ns=-1;
+  r->insn=-1;
+
+  // warm up caches and branch predictors
+  for(i=0; i<iters/10; i++)
+    {
+    memcpy(buf, c->text, len+1);
+    c->fn(buf);
+    }
+
+  for(k=0; k<runs; k++)
+    {
+    perf_start(&pc);
+    t0=now_ns();
+    for(i=0; i<iters; i++)
+      {
+      memcpy(buf, c->text, len+1);
+      c->fn(buf);
+      }
+    t=now_ns()-t0;
+    n=perf_stop(&pc);
+
+    if(r->ns<0 || t/iters<r->ns)
+      r->ns=t/iters;
+    if(pc.fd>=0 && (r->insn<0 || (double)n/iters<r->insn))
+      r->insn=(double)n/iters;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// lines of "<name>\t<ns/op>\t<insn/op>"; # comments
+
+static int read_baseline(const char *fname)
+  {
+  FILE *f;
+  char  line[256], *t1, *t2;
+
+  if((f=fopen(fname, "r"))==NULL)
+    {
+    perror(fname);
+    return -1;
+    }
+  nbase=0;
+  while(fgets(line, sizeof(line), f)!=NULL && nbase<BENCH_MAXCASES)
+    {
+    if(line[0]=='#' || (t1=strchr(line, '\t'))==NULL || (t2=strchr(t1+1, '\t'))==NULL)
+      continue;
+    *t1=0;
+    snprintf(base[nbase].name, BENCH_MAXNAME, "%.*s", BENCH_MAXNAME-1, line);
+    base[nbase].ns=strtod(t1+1, NULL);
+    base[nbase].insn=strtod(t2+1, NULL);
+    nbase++;
+    }
+  fclose(f);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+static const struct result *find_baseline(const char *name)
+  {
+  int i;
+
+  for(i=0; i<nbase; i++)
+    if(strcmp(base[i].name, name)==0)
+      return &base[i];
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+static bool selected(const char *name, char *const pats[], int npats)
+  {
+  int i;
+
+  if(npats==0)
+    return true;
+  for(i=0; i<npats; i++)
+    if(strstr(name, pats[i])!=NULL)
+      return true;
+  return false;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the server with its register bank in memory and no CAN
+
+static int bench_init(void)
+  {
+  int i;
+
+  config_defaults();
+  cfg.ndevs=BENCH_NDEVS;
+  for(i=1; i<cfg.ndevs; i++)
+    {
+    cfg.dev[i]=cfg.dev[0];
+    cfg.dev[i].regbase=cfg.dev[0].regbase+(unsigned long)i*0x10000;
+    }
+  if(init_devices()!=0)
+    {
+    fprintf(stderr, "Can't set up the simulated register bank\n");
+    return -1;
+    }
+  if((nullfd=open("/dev/null", O_WRONLY))<0)
+    {
+    perror("/dev/null");
+    return -1;
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+static void usage(void)
+  {
+  fprintf(stderr, "usage: chopbench [-n iterations] [-r runs] [-c cpu] [-v] [-b baseline [-t percent]] [-w baseline] [pattern ...]\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+  {
+  struct result   res[BENCH_MAXCASES];
+  const struct result *b;
+  const char *basefile = NULL, *outfile = NULL;
+  long   iters = BENCH_ITERS;
+  int    runs = BENCH_RUNS, cpu = -1, nres, nslower = 0, opt, i;
+  double tol = -1, delta;
+  bool   verbose = false;
+  cpu_set_t set;
+  FILE  *f;
+  char   buf[MAXMSG+1], *nl;
+
+  while((opt=getopt(argc, argv, "n:r:c:vb:t:w:"))!=-1)
+    switch(opt)
+      {
+      case 'n': iters=atol(optarg); break;
+      case 'r': runs=atoi(optarg); break;
+      case 'c': cpu=atoi(optarg); break;
+      case 'v': verbose=true; break;
+      case 'b': basefile=optarg; break;
+      case 't': tol=atof(optarg); break;
+      case 'w': outfile=optarg; break;
+      default:  usage(); return 1;
+      }
+  if(iters<=0 || runs<=0 || (tol>=0 && basefile==NULL))
+    {
+    usage();
+    return 1;
+    }
+
+  if(cpu>=0)
+    {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set)!=0)
+      perror("sched_setaffinity");
+    }
+  if(basefile!=NULL && read_baseline(basefile)!=0)
+    return 1;
+  if(bench_init()!=0)
+    return 1;
+  perf_open(&pc);
+
+  printf("%-58s %10s %10s", "case", "ns/op", "insn/op");
+  if(basefile!=NULL)
+    printf(" %10s %8s %10s %8s", "base ns", "delta", "base insn", "delta");
+  printf("\n");
+
+  nres=0;
+  for(i=0; i<NCASES && nres<BENCH_MAXCASES; i++)
+    {
+    if(!selected(case_name(&cases[i]), argv+optind, argc-optind))
+      continue;
+
+    if(verbose && cases[i].fn==bench_parse)
+      {
+      snprintf(buf, sizeof(buf), "%s", cases[i].text);
+      curpend=pend_alloc(nullfd);
+      curpart=0;
+      parse(buf, curpend->part[0], MAXANS, nullfd);
+      if((nl=strchr(curpend->part[0], '\n'))!=NULL)
+        *nl=0;
+      printf("  %s -> %s\n", cases[i].text, curpend->part[0]);
+      curpend->used=false;
+      curpend=NULL;
+      }
+
+    run_case(&cases[i], iters, runs, &res[nres]);
+    printf("%-58s %10.1f", res[nres].name, res[nres].ns);
+    if(res[nres].insn>=0)
+      printf(" %10.0f", res[nres].insn);
+    else
+      printf(" %10s", "-");
+    if(basefile!=NULL && (b=find_baseline(res[nres].name))!=NULL)
+      {
+      delta=100.0*(res[nres].ns-b->ns)/b->ns;
+      printf(" %10.1f %+7.1f%%", b->ns, delta);
+      if(b->insn>0 && res[nres].insn>=0)
+        {
+        delta=100.0*(res[nres].insn-b->insn)/b->insn;
+        printf(" %10.0f %+7.1f%%", b->insn, delta);
+        }
+      if(tol>=0 && delta>tol)
+        {
+        printf(" SLOWER");
+        nslower++;
+        }
+      }
+    printf("\n");
+    nres++;
+    }
+
+  if(outfile!=NULL)
+    {
+    if((f=fopen(outfile, "w"))==NULL)
+      {
+      perror(outfile);
+      return 1;
+      }
+    fprintf(f, "# chopbench -n %ld -r %d; <case>\\t<ns/op>\\t<insn/op> (-1: no counter)\n", iters, runs);
+    for(i=0; i<nres; i++)
+      fprintf(f, "%s\t%.1f\t%.0f\n", res[i].name, res[i].ns, res[i].insn);
+    fclose(f);
+    }
+
+  perf_close(&pc);
+  if(tol>=0)
+    {
+    printf("%d of %d cases more than %.0f%% slower than %s\n", nslower, nres, tol, basefile);
+    if(nslower>0)
+      return 2;
+    }
+  return 0;
+  }
@@ -0,0 +1,71 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync bench: hardware counters         ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "perfcount.h"
+
+
+//-------------------------------------------------------------------
+
+int perf_open(struct perfcount *pc)
+  {
+  struct perf_event_attr pa;
+
+  memset(&pa, 0, sizeof(pa));
+  pa.type=PERF_TYPE_HARDWARE;
+  pa.size=sizeof(pa);
+  pa.config=PERF_COUNT_HW_INSTRUCTIONS;
+  pa.disabled=1;
+  pa.exclude_kernel=1;
+  pa.exclude_hv=1;
+
+  pc->fd=(int)syscall(SYS_perf_event_open, &pa, 0, -1, -1, 0);
+  if(pc->fd<0)
+    {
+    perror("perf_event_open(instructions)");
+    return -1;
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void perf_start(struct perfcount *pc)
+  {
+  if(pc->fd<0)
+    return;
+  ioctl(pc->fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(pc->fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+
+//-------------------------------------------------------------------
+
+// instructions since perf_start(); 0 if not available
+
+uint64_t perf_stop(struct perfcount *pc)
+  {
+  uint64_t n;
+
+  if(pc->fd<0)
+    return 0;
+  ioctl(pc->fd, PERF_EVENT_IOC_DISABLE, 0);
+  if(read(pc->fd, &n, sizeof(n))!=sizeof(n))
+    return 0;
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+void perf_close(struct perfcount *pc)
+  {
+  if(pc->fd>=0)
+    close(pc->fd);
+  pc->fd=-1;
+  }
@@ -0,0 +1,38 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync bench: hardware counters         ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// instructions retired by this thread in user space, through
+// perf_event_open(); not every host has them (no PMU in a VM,
+// perf_event_paranoid > 2): then perf_open() fails and the bench only
+// reports time
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+struct perfcount
+  {
+  int fd;                 // -1 if not available
+  };
+
+
+/******* protos *******/
+
+int      perf_open(struct perfcount *pc);
+void     perf_start(struct perfcount *pc);
+uint64_t perf_stop(struct perfcount *pc);
+void     perf_close(struct perfcount *pc);
+
+#endif
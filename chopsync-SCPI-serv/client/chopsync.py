@@ -0,0 +1,472 @@
+"""chopsync client library
+
+Talks to the chopsync server over TCP or AF_UNIX; one connection is
+opened once and kept::
+
+    import chopsync
+
+    with chopsync.Client("chopsync1") as c:          # or path="/run/chopsync.sock"
+        print(c.get("PHSETPOINT_NS"))                # 16.0 (ns)
+        c.query("PHSETPOINT_NS 24").check()
+        setp, err, lock = c.pipeline(["PHSETPOINT_NS?", "PHERR?", "PHLOCK?"])
+        print(setp.ns(), err.ns(), lock.onoff())
+
+Commands are sent with a newline, so the server runs them one by one in
+the order they were sent and they can be pipelined: send() queues any
+number and recv() takes the answers in the same order; pipeline() does
+both for a list of commands, in one write.
+
+An answer is one line, or "OK: <n> lines" and n more lines (HELP
+too).  Reply decodes the typed values of the answers: ns(), hz(),
+onoff(), number(); dev(n) picks one device out of an ALL: answer.
+
+The server may have closed an idle connection (restart, upgrade):
+query() and pipeline() check it before sending and connect again, so
+that nothing is ever sent twice.
+
+Subscriptions: the state of every device comes as UDP multicast
+telemetry (TELEMETRY in the server configuration); Client.subscribe()
+finds group and port with TELEMETRY? and returns a Telemetry whose
+frames are decoded datagrams::
+
+    for frame in c.subscribe():
+        print(frame.seq, frame.devs[0].pherr_ns)
+"""
+
+import re
+import select
+import socket
+import struct
+import time
+
+PORT = 8888
+MAXCMD = 512            # server MAXMSG
+MAXINFLIGHT = 64
+
+# telemetry, as telemetry.h of the server
+TM_MAGIC = 0x4353594E
+TM_VERSION = 1
+TM_HDR = struct.Struct(">IHHIIQ")
+TM_DEV = struct.Struct(">BBHiiiIIHHHHIi" + "IH" * 6)
+TM_MAXDGRAM = 1472
+TM_AGE_INVALID = 0xFFFF
+MECOS_OBJECTS = ("HZ_SETP", "HZ_ACT", "LIFTUP", "ROTATION", "FAULT", "STABLE")
+
+_MULTI = re.compile(r"OK: (\d+) lines$")
+_NUMBER = r"[-+]?(?:\d+\.?\d*|\.\d+)(?:[eE][-+]?\d+)?"
+
+# how get() decodes the answer of a query
+_KINDS = {
+    "PHSETPOINT_NS": "ns", "PHERR": "ns",
+    "BUNCHFREQ": "Hz", "CHOPFREQ": "Hz",
+    "MECOS:HZ_SETP": "Hz", "MECOS:HZ_SETPOINT": "Hz",
+    "MECOS:HZ_ACT": "Hz", "MECOS:HZ_ACTUAL": "Hz",
+    "TELEMETRY:RATE": "Hz", "HTTP:RATE": "Hz",
+    "SYNCH": "onoff", "SYNCHRONIZER": "onoff", "UNWRAP": "onoff",
+    "UNWRAPPER": "onoff", "UNW_RES": "onoff", "FLOCK": "onoff",
+    "PHLOCK": "onoff", "STICKYLOL": "onoff", "MECOS:LIFTUP": "onoff",
+    "MECOS:ROT": "onoff", "MECOS:ROTATION": "onoff",
+    "MECOS:FAULT": "onoff", "MECOS:STABLE": "onoff",
+    "G": "number", "GAIN": "number", "SIGGEN_DF_HZ": "number",
+    "UNW_THR": "int", "TRIGOUT_PH": "int", "MECOS_CMD": "int",
+    "BUNCHMARKER_PRESCALER": "int", "CHOPPER_PRESCALER": "int",
+}
+
+
+class ChopsyncError(Exception):
+    """An ERR answer, or an answer that does not hold what was asked."""
+
+    def __init__(self, message, reply=None):
+        super().__init__(message)
+        self.reply = reply
+
+
+class Reply:
+    """One answer of the server."""
+
+    def __init__(self, text):
+        self.text = text
+        first, _, rest = text.partition("\n")
+        self.ok = first.startswith("OK:")
+        if self.ok:
+            self.message = first[3:].lstrip()
+        elif first.startswith("ERR:"):
+            self.message = first[4:].lstrip()
+        else:
+            self.message = first
+        m = _MULTI.match(first)
+        self.lines = rest.splitlines() if m else []
+
+    def __repr__(self):
+        return "Reply(%r)" % self.text
+
+    def __bool__(self):
+        return self.ok
+
+    def check(self):
+        """self, or ChopsyncError for an ERR answer."""
+        if not self.ok:
+            raise ChopsyncError(self.message, self)
+        return self
+
+    def _search(self, pattern, what):
+        self.check()
+        m = re.search(pattern, self.message)
+        if m is None:
+            raise ChopsyncError("no %s in %r" % (what, self.message), self)
+        return m.group(1)
+
+    def number(self):
+        """The first number: "OK: 1.500000", "OK: new gain is 6.000000"."""
+        return float(self._search(r"(?<![\w.])(" + _NUMBER + ")", "number"))
+
+    def unit(self, unit):
+        """The number followed by unit: "OK: 16 ns", "OK: 500 Hz"."""
+        return float(self._search(r"(?<![\w.])(" + _NUMBER + ") " + re.escape(unit) + r"\b", unit))
+
+    def ns(self):
+        return self.unit("ns")
+
+    def hz(self):
+        return self.unit("Hz")
+
+    def onoff(self):
+        """"OK: ON", "OK: OFF (not configured)", "OK: SYNCHRONIZER is now ON"."""
+        self.check()
+        m = re.match(r"(ON|OFF)\b", self.message) or re.search(r"\b(ON|OFF)$", self.message)
+        if m is None:
+            raise ChopsyncError("no ON/OFF in %r" % self.message, self)
+        return m.group(1) == "ON"
+
+    def dev(self, n):
+        """The answer of device n out of an ALL: answer."""
+        tag = "DEV%d " % n
+        if self.lines:
+            if not any(l.startswith("DEV") for l in self.lines):
+                if n != 0:
+                    raise ChopsyncError("no device %d in the answer" % n, self)
+                return self
+            mine = [l[len(tag):] for l in self.lines if l.startswith(tag)]
+            if not mine:
+                raise ChopsyncError("no device %d in the answer" % n, self)
+            return Reply("OK: %d lines\n" % len(mine) + "".join(l + "\n" for l in mine))
+        first = self.text.rstrip("\n")
+        if not first.startswith("DEV"):
+            if n != 0:
+                raise ChopsyncError("no device %d in the answer" % n, self)
+            return self
+        for part in re.split(r"; (?=DEV\d+ )", first):
+            if part.startswith(tag):
+                return Reply(part[len(tag):] + "\n")
+        raise ChopsyncError("no device %d in the answer" % n, self)
+
+    def devs(self):
+        """{device: Reply} of an ALL: answer."""
+        out = {}
+        if self.lines:
+            for l in self.lines:
+                m = re.match(r"DEV(\d+) ", l)
+                if m:
+                    out.setdefault(int(m.group(1)), None)
+        else:
+            out = {int(m.group(1)): None for m in re.finditer(r"(?:^|; )DEV(\d+) ", self.text)}
+        if not out:
+            return {0: self}
+        return {n: self.dev(n) for n in sorted(out)}
+
+
+class Client:
+    """A persistent connection to the server; not thread safe."""
+
+    def __init__(self, host="localhost", port=PORT, path=None, timeout=5.0):
+        self.host = host
+        self.port = port
+        self.path = path
+        self.timeout = timeout
+        self.sock = None
+        self.inflight = 0
+        self.sent = self.received = self.reconnects = 0
+        self._rbuf = b""
+        self._wbuf = []
+        self.connect()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    # ---- connection
+
+    def connect(self):
+        """(Re)open the connection; whatever was in flight is lost."""
+        if self.sock is not None:
+            self.sock.close()
+            self.reconnects += 1
+        self.sock = None
+        self.inflight = 0
+        self._rbuf = b""
+        self._wbuf = []
+        if self.path is not None:
+            s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            # '@' is an abstract socket, as in the server configuration
+            addr = "\0" + self.path[1:] if self.path.startswith("@") else self.path
+        else:
+            s = None
+            addr = None
+        try:
+            if s is not None:
+                s.settimeout(self.timeout)
+                s.connect(addr)
+            else:
+                s = socket.create_connection((self.host, self.port), self.timeout)
+                # commands are small and answers awaited: no Nagle delay
+                s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        except OSError:
+            if s is not None:
+                s.close()
+            raise
+        self.sock = s
+
+    def alive(self):
+        """False if the server has closed the connection; only meaningful
+        with nothing in flight."""
+        if self.sock is None:
+            return False
+        try:
+            # a socket with a timeout would wait for data before the peek
+            r, _, _ = select.select([self.sock], [], [], 0)
+            return not r or self.sock.recv(1, socket.MSG_PEEK) != b""
+        except OSError:
+            return False
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+        self.sock = None
+        self.inflight = 0
+
+    def _ensure(self):
+        if self.inflight == 0 and not self.alive():
+            self.connect()
+
+    # ---- pipelining
+
+    def send(self, cmd):
+        """Queue one command; it goes out with the next flush()/recv()."""
+        if self.sock is None:
+            raise ChopsyncError("not connected")
+        if "\n" in cmd or len(cmd.encode()) >= MAXCMD:
+            raise ValueError("bad command %r" % cmd)
+        if self.inflight >= MAXINFLIGHT:
+            raise ChopsyncError("more than %d commands in flight" % MAXINFLIGHT)
+        self._wbuf.append(cmd.encode() + b"\n")
+        self.inflight += 1
+        self.sent += 1
+
+    def flush(self):
+        if self._wbuf:
+            data = b"".join(self._wbuf)
+            self._wbuf = []
+            try:
+                self.sock.sendall(data)
+            except OSError:
+                self.close()
+                raise
+
+    def _answer_len(self):
+        end = self._rbuf.find(b"\n")
+        if end < 0:
+            return 0
+        m = _MULTI.match(self._rbuf[:end].decode(errors="replace"))
+        off = end + 1
+        for _ in range(int(m.group(1)) if m else 0):
+            end = self._rbuf.find(b"\n", off)
+            if end < 0:
+                return 0
+            off = end + 1
+        return off
+
+    def recv(self, timeout=None):
+        """The next answer, in the order the commands were sent."""
+        self.flush()
+        if self.inflight == 0:
+            raise ChopsyncError("nothing in flight")
+        timeout = self.timeout if timeout is None else timeout
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            n = self._answer_len()
+            if n:
+                break
+            left = None if deadline is None else deadline - time.monotonic()
+            if left is not None and left <= 0:
+                raise TimeoutError("no answer from the server")
+            r, _, _ = select.select([self.sock], [], [], left)
+            if not r:
+                continue
+            data = self.sock.recv(65536)
+            if not data:
+                self.close()
+                raise ConnectionResetError("server closed the connection")
+            self._rbuf += data
+        text, self._rbuf = self._rbuf[:n], self._rbuf[n:]
+        self.inflight -= 1
+        self.received += 1
+        return Reply(text.decode(errors="replace"))
+
+    def query(self, cmd, timeout=None):
+        """One command, one Reply."""
+        self._ensure()
+        self.send(cmd)
+        return self.recv(timeout)
+
+    def pipeline(self, cmds, timeout=None):
+        """Several commands in one write; their Replies, in order."""
+        cmds = list(cmds)
+        if len(cmds) > MAXINFLIGHT - self.inflight:
+            raise ChopsyncError("more than %d commands in flight" % MAXINFLIGHT)
+        self._ensure()
+        for c in cmds:
+            self.send(c)
+        timeout = self.timeout if timeout is None else timeout
+        deadline = None if timeout is None else time.monotonic() + timeout
+        out = []
+        for _ in cmds:
+            left = None if deadline is None else max(0.0, deadline - time.monotonic())
+            out.append(self.recv(left))
+        return out
+
+    # ---- typed access
+
+    def get(self, name, dev=None):
+        """The decoded value of query name?: ns and Hz as float, ON/OFF as
+        bool, counts as int; dev picks a device (DEV<n>:)."""
+        key = name.upper().rstrip("?")
+        kind = _KINDS.get(key)
+        if kind is None:
+            raise ValueError("don't know how to decode %s?" % key)
+        prefix = "" if dev is None else "DEV%d:" % dev
+        r = self.query(prefix + key + "?").check()
+        if kind == "ns":
+            return r.ns()
+        if kind == "Hz":
+            return r.hz()
+        if kind == "onoff":
+            return r.onoff()
+        if kind == "int":
+            return int(r.number())
+        return r.number()
+
+    def set(self, name, value, dev=None):
+        """name <value>; ON/OFF for bools.  The Reply, checked."""
+        if isinstance(value, bool):
+            value = "ON" if value else "OFF"
+        prefix = "" if dev is None else "DEV%d:" % dev
+        return self.query("%s%s %s" % (prefix, name, value)).check()
+
+    def subscribe(self, ifaddr=None):
+        """Telemetry of the server, as configured on it."""
+        r = self.query("TELEMETRY?").check()
+        m = re.search(r"(\d+\.\d+\.\d+\.\d+):(\d+)", r.message)
+        if m is None:
+            raise ChopsyncError("telemetry is not configured", r)
+        return Telemetry(m.group(1), int(m.group(2)), ifaddr)
+
+
+class TelemetryDevice:
+    """State of one device in a telemetry datagram."""
+
+    __slots__ = ("dev", "flock", "phlock", "stickylol", "synch", "unwrap",
+                 "unwres", "can", "status", "phsetp_ns", "pherr_ns",
+                 "mecos_cmd", "bunchfreq", "chopfreq", "bunch_presc",
+                 "chop_presc", "trigout", "gain", "unwthr", "siggen_df_hz",
+                 "mecos", "mecos_age_ms")
+
+    def __repr__(self):
+        return "TelemetryDevice(%s)" % ", ".join("%s=%r" % (k, getattr(self, k)) for k in self.__slots__)
+
+
+class TelemetryFrame:
+    """One telemetry datagram; lost counts the datagrams missed before it."""
+
+    __slots__ = ("version", "seq", "rate_hz", "t_ns", "lost", "devs")
+
+    def __repr__(self):
+        return "TelemetryFrame(seq=%d, rate_hz=%d, t_ns=%d, lost=%d, devs=%r)" % (
+            self.seq, self.rate_hz, self.t_ns, self.lost, self.devs)
+
+
+def decode_telemetry(data):
+    """A TelemetryFrame, or None if data is not a telemetry datagram."""
+    if len(data) < TM_HDR.size:
+        return None
+    magic, version, ndevs, seq, rate, t_ns = TM_HDR.unpack_from(data)
+    if magic != TM_MAGIC or version != TM_VERSION or len(data) < TM_HDR.size + ndevs * TM_DEV.size:
+        return None
+    f = TelemetryFrame()
+    f.version, f.seq, f.rate_hz, f.t_ns, f.lost = version, seq, rate, t_ns, 0
+    f.devs = []
+    for i in range(ndevs):
+        v = TM_DEV.unpack_from(data, TM_HDR.size + i * TM_DEV.size)
+        d = TelemetryDevice()
+        d.dev, flags, d.status = v[0], v[1], v[2]
+        d.flock, d.phlock, d.stickylol, d.synch, d.unwrap, d.unwres, d.can = (
+            bool(flags & (1 << b)) for b in range(7))
+        d.phsetp_ns = v[3]
+        d.pherr_ns = v[4] / 16.0
+        d.mecos_cmd = v[5]
+        d.bunchfreq, d.chopfreq = v[6], v[7]
+        d.bunch_presc, d.chop_presc, d.trigout = v[8], v[9], v[10]
+        d.gain = v[11] / 4096.0
+        d.unwthr = v[12]
+        d.siggen_df_hz = v[13] / 2199.0
+        d.mecos = dict(zip(MECOS_OBJECTS, v[14::2]))
+        d.mecos_age_ms = {k: (None if a == TM_AGE_INVALID else a)
+                          for k, a in zip(MECOS_OBJECTS, v[15::2])}
+        f.devs.append(d)
+    return f
+
+
+class Telemetry:
+    """Member of a telemetry multicast group; iterate for the frames."""
+
+    def __init__(self, group, port, ifaddr=None, timeout=None):
+        self.group = group
+        self.port = port
+        self.timeout = timeout
+        self._seq = None
+        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        # several subscribers on one host
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        s.bind((group, port))
+        mreq = socket.inet_aton(group) + socket.inet_aton(ifaddr or "0.0.0.0")
+        s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+        self.sock = s
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __iter__(self):
+        while True:
+            yield self.recv()
+
+    def recv(self, timeout=None):
+        """The next frame; TimeoutError after timeout seconds."""
+        timeout = self.timeout if timeout is None else timeout
+        while True:
+            r, _, _ = select.select([self.sock], [], [], timeout)
+            if not r:
+                raise TimeoutError("no telemetry")
+            f = decode_telemetry(self.sock.recv(TM_MAXDGRAM))
+            if f is None:
+                continue
+            if self._seq is not None:
+                f.lost = (f.seq - self._seq - 1) & 0xFFFFFFFF
+            self._seq = f.seq
+            return f
+
+    def close(self):
+        self.sock.close()
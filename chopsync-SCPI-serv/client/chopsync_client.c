@@ -0,0 +1,844 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync client library                   ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "chopsync_client.h"
+
+
+//-------------------------------------------------------------------
+
+int cs_connect_tcp(struct cs_conn *c, const char *host, int port)
+  {
+  memset(c, 0, sizeof(*c));
+  c->fd=-1;
+  c->local=false;
+  snprintf(c->host, sizeof(c->host), "%s", host);
+  c->port=(port>0)? port : CS_PORT;
+  return cs_reconnect(c);
+  }
+
+
+//-------------------------------------------------------------------
+
+// a path starting with '@' is an abstract socket, as in the server
+// configuration
+
+int cs_connect_unix(struct cs_conn *c, const char *path)
+  {
+  memset(c, 0, sizeof(*c));
+  c->fd=-1;
+  c->local=true;
+  if(strlen(path)>=sizeof(c->path))
+    {
+    errno=ENAMETOOLONG;
+    return -1;
+    }
+  strcpy(c->path, path);
+  return cs_reconnect(c);
+  }
+
+
+//-------------------------------------------------------------------
+
+// (re)open the connection; whatever was in flight is lost
+
+int cs_reconnect(struct cs_conn *c)
+  {
+  struct addrinfo hints, *res, *ai;
+  struct sockaddr_un sun;
+  socklen_t len;
+  char port[16];
+  int  fd, one, ret;
+
+  if(c->fd>=0)
+    {
+    close(c->fd);
+    c->fd=-1;
+    c->reconnects++;
+    }
+  c->inflight=0;
+  c->wlen=0;
+  c->rlen=0;
+
+  if(c->local)
+    {
+    fd=socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(fd<0)
+      return -1;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family=AF_UNIX;
+    len=offsetof(struct sockaddr_un, sun_path)+strlen(c->path);
+    memcpy(sun.sun_path, c->path, strlen(c->path));
+    if(c->path[0]=='@')
+      sun.sun_path[0]=0;
+    else
+      len++;
+    if(connect(fd, (struct sockaddr *)&sun, len)<0)
+      {
+      close(fd);
+      return -1;
+      }
+    c->fd=fd;
+    return 0;
+    }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family=AF_UNSPEC;
+  hints.ai_socktype=SOCK_STREAM;
+  snprintf(port, sizeof(port), "%d", c->port);
+  ret=getaddrinfo(c->host, port, &hints, &res);
+  if(ret!=0)
+    {
+    errno=EHOSTUNREACH;
+    return -1;
+    }
+  fd=-1;
+  for(ai=res; ai!=NULL; ai=ai->ai_next)
+    {
+    fd=socket(ai->ai_family, ai->ai_socktype|SOCK_CLOEXEC, ai->ai_protocol);
+    if(fd<0)
+      continue;
+    if(connect(fd, ai->ai_addr, ai->ai_addrlen)==0)
+      break;
+    close(fd);
+    fd=-1;
+    }
+  freeaddrinfo(res);
+  if(fd<0)
+    return -1;
+  // commands are small and answers awaited: no Nagle delay
+  one=1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c->fd=fd;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// false if the server has closed the connection; only meaningful with
+// nothing in flight
+
+bool cs_alive(struct cs_conn *c)
+  {
+  char b;
+  ssize_t n;
+
+  if(c->fd<0)
+    return false;
+  n=recv(c->fd, &b, 1, MSG_PEEK|MSG_DONTWAIT);
+  if(n==0)
+    return false;
+  if(n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)
+    return false;
+  return true;
+  }
+
+
+//-------------------------------------------------------------------
+
+void cs_close(struct cs_conn *c)
+  {
+  if(c->fd>=0)
+    close(c->fd);
+  c->fd=-1;
+  c->inflight=0;
+  c->wlen=0;
+  c->rlen=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// queue one command; it goes out with the next cs_flush()/cs_recv()
+
+int cs_send(struct cs_conn *c, const char *cmd)
+  {
+  size_t len;
+
+  if(c->fd<0)
+    {
+    errno=ENOTCONN;
+    return -1;
+    }
+  len=strlen(cmd);
+  if(len>=CS_MAXCMD || memchr(cmd, '\n', len)!=NULL)
+    {
+    errno=EINVAL;
+    return -1;
+    }
+  if(c->inflight>=CS_MAXINFLIGHT)
+    {
+    errno=ENOBUFS;
+    return -1;
+    }
+  memcpy(c->wbuf+c->wlen, cmd, len);
+  c->wbuf[c->wlen+len]='\n';
+  c->wlen+=len+1;
+  c->inflight++;
+  c->sent++;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int cs_flush(struct cs_conn *c)
+  {
+  size_t off;
+  ssize_t n;
+
+  for(off=0; off<c->wlen; off+=n)
+    {
+    n=send(c->fd, c->wbuf+off, c->wlen-off, MSG_NOSIGNAL);
+    if(n<0)
+      {
+      if(errno==EINTR)
+        {
+        n=0;
+        continue;
+        }
+      cs_close(c);
+      return -1;
+      }
+    }
+  c->wlen=0;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// length of the first line of s, without the '\n'; -1 if incomplete
+
+static long cs_linelen(const char *s, size_t len)
+  {
+  const char *e;
+
+  e=memchr(s, '\n', len);
+  return (e==NULL)? -1 : (long)(e-s);
+  }
+
+
+//-------------------------------------------------------------------
+
+// n of an "OK: <n> lines" line, -1 if it is not one
+
+static int cs_multi(const char *s, size_t len)
+  {
+  size_t i;
+  int n;
+
+  if(len<4 || memcmp(s, "OK: ", 4)!=0)
+    return -1;
+  for(i=4, n=0; i<len && isdigit((unsigned char)s[i]) && n<100000; i++)
+    n=n*10+(s[i]-'0');
+  if(i==4 || len-i!=6 || memcmp(s+i, " lines", 6)!=0)
+    return -1;
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+// bytes of the complete answer at the start of s, 0 if incomplete
+
+static size_t cs_answer_len(const char *s, size_t len, int *nlines)
+  {
+  size_t off;
+  long n;
+  int i, k;
+
+  n=cs_linelen(s, len);
+  if(n<0)
+    return 0;
+  k=cs_multi(s, (size_t)n);
+  *nlines=(k>0)? k : 0;
+  off=(size_t)n+1;
+  for(i=0; i<*nlines; i++)
+    {
+    n=cs_linelen(s+off, len-off);
+    if(n<0)
+      return 0;
+    off+=(size_t)n+1;
+    }
+  return off;
+  }
+
+
+//-------------------------------------------------------------------
+
+static void cs_fill(struct cs_reply *r)
+  {
+  r->ok=(strncmp(r->text, "OK:", 3)==0);
+  r->msg=r->text;
+  if(r->ok)
+    r->msg+=3;
+  else if(strncmp(r->text, "ERR:", 4)==0)
+    r->msg+=4;
+  while(*r->msg==' ')
+    r->msg++;
+  }
+
+
+//-------------------------------------------------------------------
+
+static long cs_ms_since(const struct timespec *t0)
+  {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec-t0->tv_sec)*1000L+(t.tv_nsec-t0->tv_nsec)/1000000L;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the next answer, in the order the commands were sent; timeout_ms < 0
+// waits forever
+
+int cs_recv(struct cs_conn *c, struct cs_reply *r, int timeout_ms)
+  {
+  struct pollfd pfd;
+  struct timespec t0;
+  size_t len;
+  ssize_t n;
+  long left;
+  int nlines;
+
+  if(c->wlen>0 && cs_flush(c)!=0)
+    return -1;
+  if(c->fd<0 || c->inflight==0)
+    {
+    errno=(c->fd<0)? ENOTCONN : EINVAL;
+    return -1;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(;;)
+    {
+    len=cs_answer_len(c->rbuf, c->rlen, &nlines);
+    if(len>0)
+      break;
+    if(c->rlen>=CS_MAXANS)
+      {
+      cs_close(c);
+      errno=EMSGSIZE;
+      return -1;
+      }
+    left=(timeout_ms<0)? -1 : timeout_ms-cs_ms_since(&t0);
+    if(timeout_ms>=0 && left<=0)
+      {
+      errno=ETIMEDOUT;
+      return -1;
+      }
+    pfd.fd=c->fd;
+    pfd.events=POLLIN;
+    if(poll(&pfd, 1, (int)left)<0)
+      {
+      if(errno==EINTR)
+        continue;
+      return -1;
+      }
+    if(!(pfd.revents & (POLLIN|POLLHUP|POLLERR)))
+      continue;
+    n=recv(c->fd, c->rbuf+c->rlen, CS_MAXANS-c->rlen, 0);
+    if(n<=0)
+      {
+      if(n<0 && errno==EINTR)
+        continue;
+      cs_close(c);
+      errno=ECONNRESET;
+      return -1;
+      }
+    c->rlen+=(size_t)n;
+    }
+
+  memcpy(r->text, c->rbuf, len);
+  r->text[len]=0;
+  r->len=len;
+  r->nlines=nlines;
+  cs_fill(r);
+  c->rlen-=len;
+  memmove(c->rbuf, c->rbuf+len, c->rlen);
+  c->inflight--;
+  c->received++;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one command, one answer; an idle connection the server has closed is
+// opened again before sending
+
+int cs_query(struct cs_conn *c, const char *cmd, struct cs_reply *r, int timeout_ms)
+  {
+  if(c->inflight==0 && !cs_alive(c) && cs_reconnect(c)!=0)
+    return -1;
+  if(cs_send(c, cmd)!=0)
+    return -1;
+  return cs_recv(c, r, timeout_ms);
+  }
+
+
+//-------------------------------------------------------------------
+
+// n commands in one write, n answers into r[]; returns how many
+// answers arrived (n unless an error stopped it)
+
+int cs_pipeline(struct cs_conn *c, const char *const *cmds, int n, struct cs_reply *r, int timeout_ms)
+  {
+  struct timespec t0;
+  long left;
+  int i;
+
+  if(n>CS_MAXINFLIGHT-c->inflight)
+    {
+    errno=ENOBUFS;
+    return -1;
+    }
+  if(c->inflight==0 && !cs_alive(c) && cs_reconnect(c)!=0)
+    return -1;
+  for(i=0; i<n; i++)
+    if(cs_send(c, cmds[i])!=0)
+      {
+      // nothing has gone out yet
+      c->wlen=0;
+      c->inflight-=i;
+      return -1;
+      }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(i=0; i<n; i++)
+    {
+    left=(timeout_ms<0)? -1 : timeout_ms-cs_ms_since(&t0);
+    if(timeout_ms>=0 && left<0)
+      left=0;
+    if(cs_recv(c, &r[i], (int)left)!=0)
+      break;
+    }
+  return i;
+  }
+
+
+//-------------------------------------------------------------------
+
+int cs_ok(const struct cs_reply *r)
+  {
+  return r->ok? 0 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the first number of an OK answer: "OK: 1.500000", "OK: new gain is 6.000000"
+
+int cs_number(const struct cs_reply *r, double *v)
+  {
+  const char *p;
+  char *e;
+
+  if(!r->ok)
+    return -1;
+  for(p=r->msg; *p!=0 && *p!='\n'; p++)
+    {
+    if(!isdigit((unsigned char)*p) && !((*p=='+' || *p=='-') && isdigit((unsigned char)p[1])))
+      continue;
+    if(p>r->msg && (isalnum((unsigned char)p[-1]) || p[-1]=='_'))
+      continue;
+    *v=strtod(p, &e);
+    if(e!=p)
+      return 0;
+    }
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the number followed by " <unit>": "OK: 16 ns", "OK: 500 Hz"
+
+int cs_unit(const struct cs_reply *r, const char *unit, double *v)
+  {
+  const char *p;
+  char *e;
+  size_t ul;
+  double x;
+
+  if(!r->ok)
+    return -1;
+  ul=strlen(unit);
+  for(p=r->msg; *p!=0 && *p!='\n'; p++)
+    {
+    if(!isdigit((unsigned char)*p) && !((*p=='+' || *p=='-') && isdigit((unsigned char)p[1])))
+      continue;
+    if(p>r->msg && (isalnum((unsigned char)p[-1]) || p[-1]=='.'))
+      continue;
+    x=strtod(p, &e);
+    if(e==p)
+      continue;
+    if(*e==' ' && strncmp(e+1, unit, ul)==0 && !isalnum((unsigned char)e[1+ul]))
+      {
+      *v=x;
+      return 0;
+      }
+    p=e-1;
+    }
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+int cs_ns(const struct cs_reply *r, double *ns)
+  {
+  return cs_unit(r, "ns", ns);
+  }
+
+
+//-------------------------------------------------------------------
+
+int cs_hz(const struct cs_reply *r, double *hz)
+  {
+  return cs_unit(r, "Hz", hz);
+  }
+
+
+//-------------------------------------------------------------------
+
+// "OK: ON", "OK: OFF (not configured)", "OK: SYNCHRONIZER is now ON"
+
+int cs_onoff(const struct cs_reply *r, bool *on)
+  {
+  const char *p, *e;
+
+  if(!r->ok)
+    return -1;
+  p=r->msg;
+  if(strncmp(p, "ON", 2)==0 && !isalnum((unsigned char)p[2]))
+    {
+    *on=true;
+    return 0;
+    }
+  if(strncmp(p, "OFF", 3)==0 && !isalnum((unsigned char)p[3]))
+    {
+    *on=false;
+    return 0;
+    }
+  // last word of the line
+  e=strchr(p, '\n');
+  if(e==NULL)
+    e=p+strlen(p);
+  if(e-p>=3 && strncmp(e-3, " ON", 3)==0)
+    *on=true;
+  else if(e-p>=4 && strncmp(e-4, " OFF", 4)==0)
+    *on=false;
+  else
+    return -1;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// line i of a multi-line answer (after "OK: <n> lines"), or of a single
+// line answer with i==0; not 0-terminated
+
+const char *cs_line(const struct cs_reply *r, int i, size_t *len)
+  {
+  const char *p, *e;
+
+  p=r->text;
+  if(r->nlines>0)
+    {
+    if(i<0 || i>=r->nlines)
+      return NULL;
+    i++;
+    }
+  else if(i!=0)
+    return NULL;
+  for(; i>0; i--)
+    p=strchr(p, '\n')+1;
+  e=strchr(p, '\n');
+  *len=(e!=NULL)? (size_t)(e-p) : strlen(p);
+  return p;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the answer of one device out of an ALL: answer; an answer without
+// DEV<n> prefixes is all device 0's
+
+int cs_dev(const struct cs_reply *r, int dev, struct cs_reply *part)
+  {
+  char tag[16];
+  const char *p, *e, *l;
+  size_t tl, len, n;
+  int k;
+
+  // one device: no prefixes
+  if((r->nlines>0 && strstr(r->text, "\nDEV")==NULL) || (r->nlines==0 && strncmp(r->text, "DEV", 3)!=0))
+    {
+    if(dev!=0)
+      return -1;
+    *part=*r;
+    cs_fill(part);
+    return 0;
+    }
+
+  tl=(size_t)snprintf(tag, sizeof(tag), "DEV%d ", dev);
+  if(r->nlines>0)
+    {
+    // "OK: <n> lines", then "DEV<n> <line>": count the lines of dev,
+    // then copy them after a header of their own
+    k=0;
+    for(p=strchr(r->text, '\n')+1; (e=strchr(p, '\n'))!=NULL; p=e+1)
+      if((size_t)(e-p)>=tl && memcmp(p, tag, tl)==0)
+        k++;
+    if(k==0)
+      return -1;
+    len=(size_t)snprintf(part->text, sizeof(part->text), "OK: %d lines\n", k);
+    for(p=strchr(r->text, '\n')+1; (e=strchr(p, '\n'))!=NULL; p=e+1)
+      {
+      n=(size_t)(e-p);
+      if(n<tl || memcmp(p, tag, tl)!=0)
+        continue;
+      memcpy(part->text+len, p+tl, n-tl);
+      len+=n-tl;
+      part->text[len++]='\n';
+      }
+    part->text[len]=0;
+    part->nlines=k;
+    }
+  else
+    {
+    // "DEV0 <answer>; DEV1 <answer>"
+    l=r->text;
+    while(l!=NULL && strncmp(l, tag, tl)!=0)
+      {
+      l=strstr(l, "; DEV");
+      if(l!=NULL)
+        l+=2;
+      }
+    if(l==NULL)
+      return -1;
+    l+=tl;
+    e=strstr(l, "; DEV");
+    if(e==NULL)
+      e=l+strcspn(l, "\n");
+    len=(size_t)(e-l);
+    memcpy(part->text, l, len);
+    part->text[len++]='\n';
+    part->text[len]=0;
+    part->nlines=0;
+    }
+  part->len=len;
+  cs_fill(part);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// join a telemetry group; ifaddr NULL: any interface
+
+int cs_tm_open(struct cs_tm *t, const char *group, int port, const char *ifaddr)
+  {
+  struct sockaddr_in sin;
+  struct ip_mreq mreq;
+  int fd, one;
+
+  memset(t, 0, sizeof(*t));
+  t->fd=-1;
+  memset(&mreq, 0, sizeof(mreq));
+  if(inet_aton(group, &mreq.imr_multiaddr)==0)
+    {
+    errno=EINVAL;
+    return -1;
+    }
+  mreq.imr_interface.s_addr=htonl(INADDR_ANY);
+  if(ifaddr!=NULL && inet_aton(ifaddr, &mreq.imr_interface)==0)
+    {
+    errno=EINVAL;
+    return -1;
+    }
+
+  fd=socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+  if(fd<0)
+    return -1;
+  // several subscribers on one host
+  one=1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family=AF_INET;
+  sin.sin_port=htons(port);
+  sin.sin_addr=mreq.imr_multiaddr;
+  if(bind(fd, (struct sockaddr *)&sin, sizeof(sin))<0 ||
+     setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))<0)
+    {
+    close(fd);
+    return -1;
+    }
+  t->fd=fd;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// group and port from TELEMETRY? ("OK: ON 239.0.0.1:5000 10 Hz ...")
+
+int cs_tm_subscribe(struct cs_tm *t, struct cs_conn *c, const char *ifaddr)
+  {
+  struct cs_reply *r;
+  char group[32];
+  int  port, ret;
+
+  r=malloc(sizeof(*r));
+  if(r==NULL)
+    return -1;
+  ret=cs_query(c, "TELEMETRY?", r, 2000);
+  if(ret==0 && (!r->ok || sscanf(r->msg, "%*s %31[0-9.]:%d", group, &port)!=2))
+    {
+    errno=ENOENT;
+    ret=-1;
+    }
+  free(r);
+  if(ret!=0)
+    return -1;
+  return cs_tm_open(t, group, port, ifaddr);
+  }
+
+
+//-------------------------------------------------------------------
+
+static uint16_t cs_get16(const unsigned char *p)
+  {
+  return (uint16_t)(p[0]<<8 | p[1]);
+  }
+
+
+//-------------------------------------------------------------------
+
+static uint32_t cs_get32(const unsigned char *p)
+  {
+  return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+  }
+
+
+//-------------------------------------------------------------------
+
+int cs_tm_decode(const unsigned char *buf, size_t len, struct cs_tm_frame *f)
+  {
+  struct cs_tm_dev *d;
+  const unsigned char *p;
+  unsigned int i, k, flags;
+
+  if(len<CS_TM_HDRLEN || cs_get32(buf)!=CS_TM_MAGIC)
+    return -1;
+  f->version=cs_get16(buf+4);
+  f->ndevs=cs_get16(buf+6);
+  if(f->version!=CS_TM_VERSION || f->ndevs>CS_MAXDEV || len<CS_TM_HDRLEN+f->ndevs*CS_TM_DEVLEN)
+    return -1;
+  f->seq=cs_get32(buf+8);
+  f->rate_hz=cs_get32(buf+12);
+  f->t_ns=(uint64_t)cs_get32(buf+16)<<32 | cs_get32(buf+20);
+
+  for(i=0; i<f->ndevs; i++)
+    {
+    p=buf+CS_TM_HDRLEN+i*CS_TM_DEVLEN;
+    d=&f->dev[i];
+    d->dev=p[0];
+    flags=p[1];
+    d->flock=(flags & 0x01)!=0;
+    d->phlock=(flags & 0x02)!=0;
+    d->stickylol=(flags & 0x04)!=0;
+    d->synch=(flags & 0x08)!=0;
+    d->unwrap=(flags & 0x10)!=0;
+    d->unwres=(flags & 0x20)!=0;
+    d->can=(flags & 0x40)!=0;
+    d->status=cs_get16(p+2);
+    d->phsetp_ns=(int32_t)cs_get32(p+4);
+    d->pherr_ns=(int32_t)cs_get32(p+8)/16.;
+    d->mecos_cmd=(int32_t)cs_get32(p+12);
+    d->bunchfreq=cs_get32(p+16);
+    d->chopfreq=cs_get32(p+20);
+    d->bunch_presc=cs_get16(p+24);
+    d->chop_presc=cs_get16(p+26);
+    d->trigout=cs_get16(p+28);
+    d->gain=cs_get16(p+30)/4096.;
+    d->unwthr=cs_get32(p+32);
+    d->siggen_df_hz=(int32_t)cs_get32(p+36)/2199.;
+    for(k=0; k<CS_TM_NMECOS; k++)
+      {
+      d->mecos[k]=cs_get32(p+40+k*6);
+      d->mecos_age_ms[k]=cs_get16(p+44+k*6);
+      }
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the next datagram; lost counts the sequence numbers skipped
+
+int cs_tm_recv(struct cs_tm *t, struct cs_tm_frame *f, int timeout_ms)
+  {
+  unsigned char buf[CS_TM_MAXDGRAM];
+  struct pollfd pfd;
+  ssize_t n;
+
+  pfd.fd=t->fd;
+  pfd.events=POLLIN;
+  for(;;)
+    {
+    n=poll(&pfd, 1, timeout_ms);
+    if(n<0 && errno==EINTR)
+      continue;
+    if(n<=0)
+      {
+      if(n==0)
+        errno=ETIMEDOUT;
+      return -1;
+      }
+    n=recv(t->fd, buf, sizeof(buf), 0);
+    if(n<0)
+      return -1;
+    // not ours: wait for the next one
+    if(cs_tm_decode(buf, (size_t)n, f)!=0)
+      continue;
+    f->lost=(t->started)? (uint32_t)(f->seq-t->seq-1) : 0;
+    t->started=true;
+    t->seq=f->seq;
+    return 0;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void cs_tm_close(struct cs_tm *t)
+  {
+  if(t->fd>=0)
+    close(t->fd);
+  t->fd=-1;
+  }
@@ -0,0 +1,148 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync client library                   ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// talks to the chopsync server over TCP or AF_UNIX; one connection is
+// opened once and kept:
+//
+//   struct cs_conn c;
+//   struct cs_reply r;
+//   double ns;
+//
+//   cs_connect_tcp(&c, "chopsync1", 8888);       // or cs_connect_unix()
+//   if(cs_query(&c, "PHSETPOINT_NS?", &r, 1000)==0 && cs_ns(&r, &ns)==0)
+//     ...
+//
+// commands are sent with a '\n', so the server runs them one by one in
+// the order they were sent and they can be pipelined: cs_send() queues
+// any number (up to CS_MAXINFLIGHT) and cs_recv() takes the answers in
+// the same order; cs_pipeline() does both for an array of commands,
+// in one write
+//
+// an answer is one line, or "OK: <n> lines" and n more lines (HELP too)
+// cs_ok()/cs_ns()/cs_hz()/cs_onoff()/cs_number() decode the typed
+// values of the answers ("OK: 16 ns", "OK: 500 Hz", "OK: ON", ...);
+// cs_dev() picks one device out of an ALL: answer
+//
+// the server may have closed an idle connection (restart, upgrade):
+// cs_query() and cs_pipeline() check it before sending and connect
+// again, so that nothing is ever sent twice
+//
+// subscriptions: the state of every device comes as UDP multicast
+// telemetry (TELEMETRY in the server configuration);
+// cs_tm_subscribe() finds group and port with TELEMETRY? and joins,
+// cs_tm_recv() decodes the next datagram
+
+#ifndef CHOPSYNC_CLIENT_H
+#define CHOPSYNC_CLIENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+#define CS_PORT          8888
+#define CS_MAXCMD        512          // server MAXMSG
+#define CS_MAXANS        20480        // ALL: multi-line answers of 8 devices
+#define CS_MAXINFLIGHT   64
+#define CS_MAXHOST       256
+#define CS_MAXDEV        8
+
+// telemetry, as telemetry.h of the server
+#define CS_TM_MAGIC      0x4353594E
+#define CS_TM_VERSION    1
+#define CS_TM_HDRLEN     24
+#define CS_TM_DEVLEN     76
+#define CS_TM_MAXDGRAM   1472
+#define CS_TM_NMECOS     6
+#define CS_TM_AGE_INVALID 0xFFFF
+
+
+struct cs_conn
+  {
+  int           fd;               // -1 when not connected
+  bool          local;
+  char          host[CS_MAXHOST];
+  int           port;
+  char          path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int           inflight;         // sent, answer not received yet
+  size_t        wlen, rlen;
+  char          wbuf[CS_MAXINFLIGHT*(CS_MAXCMD+1)];
+  char          rbuf[CS_MAXANS+1];
+  unsigned long sent, received, reconnects;
+  };
+
+struct cs_reply
+  {
+  bool        ok;                 // OK, not ERR
+  int         nlines;             // lines after "OK: <n> lines"; 0 if one line
+  const char *msg;                // after "OK: " or "ERR: "
+  size_t      len;
+  char        text[CS_MAXANS+1];  // whole answer
+  };
+
+struct cs_tm_dev
+  {
+  unsigned int dev;
+  bool         flock, phlock, stickylol, synch, unwrap, unwres, can;
+  unsigned int status;
+  int32_t      phsetp_ns;
+  double       pherr_ns;
+  int32_t      mecos_cmd;
+  uint32_t     bunchfreq, chopfreq;
+  unsigned int bunch_presc, chop_presc, trigout;
+  double       gain;
+  uint32_t     unwthr;
+  double       siggen_df_hz;
+  uint32_t     mecos[CS_TM_NMECOS];      // HZ_SETP, HZ_ACT, LIFTUP, ROTATION, FAULT, STABLE
+  unsigned int mecos_age_ms[CS_TM_NMECOS];
+  };
+
+struct cs_tm_frame
+  {
+  unsigned int     version, ndevs;
+  uint32_t         seq, rate_hz;
+  uint64_t         t_ns;                 // CLOCK_REALTIME of the server
+  unsigned long    lost;                 // datagrams missed before this one
+  struct cs_tm_dev dev[CS_MAXDEV];
+  };
+
+struct cs_tm
+  {
+  int      fd;
+  bool     started;
+  uint32_t seq;
+  };
+
+
+/******* protos *******/
+
+int   cs_connect_tcp(struct cs_conn *c, const char *host, int port);
+int   cs_connect_unix(struct cs_conn *c, const char *path);
+int   cs_reconnect(struct cs_conn *c);
+bool  cs_alive(struct cs_conn *c);
+void  cs_close(struct cs_conn *c);
+int   cs_send(struct cs_conn *c, const char *cmd);
+int   cs_flush(struct cs_conn *c);
+int   cs_recv(struct cs_conn *c, struct cs_reply *r, int timeout_ms);
+int   cs_query(struct cs_conn *c, const char *cmd, struct cs_reply *r, int timeout_ms);
+int   cs_pipeline(struct cs_conn *c, const char *const *cmds, int n, struct cs_reply *r, int timeout_ms);
+int   cs_ok(const struct cs_reply *r);
+int   cs_number(const struct cs_reply *r, double *v);
+int   cs_unit(const struct cs_reply *r, const char *unit, double *v);
+int   cs_ns(const struct cs_reply *r, double *ns);
+int   cs_hz(const struct cs_reply *r, double *hz);
+int   cs_onoff(const struct cs_reply *r, bool *on);
+const char *cs_line(const struct cs_reply *r, int i, size_t *len);
+int   cs_dev(const struct cs_reply *r, int dev, struct cs_reply *part);
+int   cs_tm_open(struct cs_tm *t, const char *group, int port, const char *ifaddr);
+int   cs_tm_subscribe(struct cs_tm *t, struct cs_conn *c, const char *ifaddr);
+int   cs_tm_decode(const unsigned char *buf, size_t len, struct cs_tm_frame *f);
+int   cs_tm_recv(struct cs_tm *t, struct cs_tm_frame *f, int timeout_ms);
+void  cs_tm_close(struct cs_tm *t);
+
+#endif
@@ -0,0 +1,419 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync register access latency probe    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+_Static_assert(AXI_MAXREG==MAXREG+1, "AXIPROBE takes the registers REG takes");
+
+/***  globals  ***/
+struct axiprobe    axi;
+const char        *axi_state_names[AXI_NSTATES] = { "IDLE", "RUNNING", "DONE", "STOPPED" };
+// written back by AXIPROBE WRITE: unwrapper threshold, phase setpoint,
+// gain, TRIGOUT phase; the control register and the prescalers are
+// left alone
+const unsigned int axi_wregs[] = { 2, 3, 11, 12 };
+// keeps the timed reads from being optimized away
+volatile uint32_t  axi_sink;
+
+
+//-------------------------------------------------------------------
+
+// the tick counter (see axiprobe.h: a timer, not CPU cycles, on
+// aarch64), once every access before it is complete and before any
+// access after it starts
+
+uint64_t axi_ticks(void)
+  {
+#if defined(__aarch64__)
+  uint64_t c;
+
+  __asm__ __volatile__("dsb sy\n\tisb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(c) : : "memory");
+  return c;
+#elif defined(__x86_64__) || defined(__i386__)
+  uint32_t lo, hi;
+
+  __asm__ __volatile__("mfence\n\tlfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) : : "memory");
+  return ((uint64_t)hi<<32) | lo;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+  }
+
+
+//-------------------------------------------------------------------
+
+// ticks per second (CNTFRQ_EL0 for the generic timer), and the cost of
+// reading the counter; everything is reported in ns from these
+
+void axi_calibrate(void)
+  {
+  uint64_t c0, c1;
+  int i;
+#if defined(__aarch64__)
+  uint64_t f;
+
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(f));
+  axi.hz=(double)f;
+#elif defined(__x86_64__) || defined(__i386__)
+  struct timespec t0, t1, d;
+
+  d.tv_sec=0;
+  d.tv_nsec=AXI_CALIB_MS*1000000L;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+  c0=axi_ticks();
+  nanosleep(&d, NULL);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+  c1=axi_ticks();
+  axi.hz=(c1-c0)/((t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9);
+#else
+  axi.hz=1e9;
+#endif
+
+  axi.ovh=UINT64_MAX;
+  for(i=0; i<1000; i++)
+    {
+    c0=axi_ticks();
+    c1=axi_ticks();
+    if(c1-c0<axi.ovh)
+      axi.ovh=c1-c0;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+uint32_t axi_ns(uint64_t c0, uint64_t c1)
+  {
+  uint64_t d;
+  double ns;
+
+  d=c1-c0;
+  d=(d>axi.ovh)? d-axi.ovh : 0;
+  ns=d*1e9/axi.hz;
+  return (ns>UINT32_MAX)? UINT32_MAX : (uint32_t)ns;
+  }
+
+
+//-------------------------------------------------------------------
+
+void axi_add(struct axi_hist *h, uint32_t ns)
+  {
+  loghist_add(h->bin, AXI_NBINS, AXI_BIN0_NS, ns);
+  if(h->n==0 || ns<h->min_ns)
+    h->min_ns=ns;
+  if(ns>h->max_ns)
+    h->max_ns=ns;
+  h->sum_ns+=ns;
+  h->n++;
+  }
+
+
+//-------------------------------------------------------------------
+
+// -1 if there are no samples
+
+long axi_percentile(const struct axi_hist *h, double pct)
+  {
+  return loghist_percentile(h->bin, AXI_NBINS, AXI_BIN0_NS, h->n, h->min_ns, h->max_ns, pct);
+  }
+
+
+//-------------------------------------------------------------------
+
+// outliers are in the bins AXI_OUTLIER_X times the median and up; with
+// log2 bins, that many octaves above the bin of the median
+
+void axi_outliers(struct axi_hist *h)
+  {
+  unsigned long cum;
+  int k, kmed, up;
+
+  h->outliers=0;
+  if(h->n==0)
+    return;
+  for(up=0; (1<<up)<AXI_OUTLIER_X; up++)
+    ;
+  cum=0;
+  for(kmed=0; kmed<AXI_NBINS-1 && (cum+=h->bin[kmed])<(h->n+1)/2; kmed++)
+    ;
+  for(k=kmed+up; k<AXI_NBINS; k++)
+    h->outliers+=h->bin[k];
+  }
+
+
+//-------------------------------------------------------------------
+
+// keep the AXI_NWORST slowest accesses, slowest first
+
+void axi_worst(uint32_t ns, int reg, bool write)
+  {
+  int k;
+
+  if(axi.nworst==AXI_NWORST && ns<=axi.worst[AXI_NWORST-1].ns)
+    return;
+  if(axi.nworst<AXI_NWORST)
+    axi.nworst++;
+  for(k=axi.nworst-1; k>0 && axi.worst[k-1].ns<ns; k--)
+    axi.worst[k]=axi.worst[k-1];
+  axi.worst[k].ns=ns;
+  axi.worst[k].reg=reg;
+  axi.worst[k].write=write;
+  axi.worst[k].t_ns=journal_now();
+  }
+
+
+//-------------------------------------------------------------------
+
+bool axi_writable(unsigned int reg)
+  {
+  size_t i;
+
+  for(i=0; i<sizeof(axi_wregs)/sizeof(axi_wregs[0]); i++)
+    if(axi_wregs[i]==reg)
+      return true;
+  return false;
+  }
+
+
+//-------------------------------------------------------------------
+
+// returns -1 if a probe is running or the thread can't be started
+
+int axi_start(int dev, unsigned int lo, unsigned int hi, long n, bool write)
+  {
+  pthread_attr_t attr;
+  int ret;
+
+  if(atomic_load(&axi.state)==AXI_RUNNING || lo>hi || hi>=AXI_MAXREG)
+    return -1;
+  memset(axi.rd, 0, sizeof(axi.rd));
+  memset(axi.wr, 0, sizeof(axi.wr));
+  memset(&axi.blk, 0, sizeof(axi.blk));
+  memset(&axi.smp, 0, sizeof(axi.smp));
+  axi.nworst=0;
+  axi.elapsed=0;
+  axi.dev=dev;
+  axi.lo=lo;
+  axi.hi=hi;
+  axi.n=n;
+  axi.write=write;
+  atomic_store(&axi.progress, 0);
+  atomic_store(&axi.stop, false);
+  atomic_store(&axi.state, AXI_RUNNING);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ret=pthread_create(&axi.thread, &attr, axi_main, NULL);
+  pthread_attr_destroy(&attr);
+  if(ret!=0)
+    {
+    fprintf(stderr, "AXI probe: can't start thread (%s)\n", strerror(ret));
+    atomic_store(&axi.state, AXI_IDLE);
+    return -1;
+    }
+  fprintf(stderr, "AXI probe: DEV%d registers %u-%u, %ld rounds%s\n", dev, lo, hi, n, write? ", writes too" : "");
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the probe thread; nothing else touches the results until the state
+// says it is over
+
+void *axi_main(void *arg)
+  {
+  struct timespec t0, t1;
+  struct chopdev *d;
+  volatile uint32_t *bank;
+  uint64_t c0, c1;
+  uint32_t v, sum, ns;
+  unsigned int r;
+  long i;
+  int k;
+
+  (void)arg;
+  d=&devs[axi.dev];
+  bank=d->regbank;
+  journal_thread(JOURNAL_SRC_AXIPROBE, 0);
+  axi_calibrate();
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(i=0; i<axi.n && !atomic_load_explicit(&axi.stop, memory_order_relaxed); i++)
+    {
+    for(r=axi.lo; r<=axi.hi; r++)
+      {
+      c0=axi_ticks();
+      v=bank[r];
+      c1=axi_ticks();
+      axi_sink=v;
+      ns=axi_ns(c0, c1);
+      axi_add(&axi.rd[r], ns);
+      axi_worst(ns, (int)r, false);
+      }
+    atomic_store_explicit(&axi.progress, i+1, memory_order_relaxed);
+    }
+
+  // one register after the other: the journal folds the rewrites of
+  // each into one entry
+  for(r=axi.lo; r<=axi.hi && axi.write; r++)
+    for(i=0; i<axi.n && axi_writable(r) && !atomic_load_explicit(&axi.stop, memory_order_relaxed); i++)
+      {
+      // what somebody else writes meanwhile stays
+      pthread_mutex_lock(&d->reglock);
+      v=bank[r];
+      c0=axi_ticks();
+      bank[r]=v;
+      c1=axi_ticks();
+      journal_reg(axi.dev, r, bank, v);
+      pthread_mutex_unlock(&d->reglock);
+      ns=axi_ns(c0, c1);
+      axi_add(&axi.wr[r], ns);
+      axi_worst(ns, (int)r, true);
+      }
+
+  sum=0;
+  for(i=0; i<AXI_BURSTS && !atomic_load_explicit(&axi.stop, memory_order_relaxed); i++)
+    {
+    c0=axi_ticks();
+    for(r=axi.lo; r<=axi.hi; r++)
+      sum+=bank[r];
+    c1=axi_ticks();
+    ns=axi_ns(c0, c1);
+    axi_add(&axi.blk, ns);
+    axi_worst(ns, -1, false);
+
+    c0=axi_ticks();
+    for(k=0; k<SMP_NREGS; k++)
+      sum+=bank[smp_regs[k]];
+    c1=axi_ticks();
+    axi_add(&axi.smp, axi_ns(c0, c1));
+    }
+  axi_sink=sum;
+
+  for(r=axi.lo; r<=axi.hi; r++)
+    {
+    axi_outliers(&axi.rd[r]);
+    axi_outliers(&axi.wr[r]);
+    }
+  axi_outliers(&axi.blk);
+  axi_outliers(&axi.smp);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  axi.elapsed=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+  atomic_store(&axi.state, atomic_load(&axi.stop)? AXI_STOPPED : AXI_DONE);
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// all of h into all; the outliers stay those of each register
+
+void axi_sum(struct axi_hist *all, const struct axi_hist *h)
+  {
+  int k;
+
+  if(h->n==0)
+    return;
+  for(k=0; k<AXI_NBINS; k++)
+    all->bin[k]+=h->bin[k];
+  if(all->n==0 || h->min_ns<all->min_ns)
+    all->min_ns=h->min_ns;
+  if(h->max_ns>all->max_ns)
+    all->max_ns=h->max_ns;
+  all->sum_ns+=h->sum_ns;
+  all->n+=h->n;
+  all->outliers+=h->outliers;
+  }
+
+
+//-------------------------------------------------------------------
+
+// REG 5 READ n 100000 min 96 p50 120 p99 240 max 3400 mean 125.3 outliers 12
+
+void axi_format(const char *what, const struct axi_hist *h, struct out *o)
+  {
+  out_str(o, what);
+  out_str(o, " n ");
+  out_uint(o, h->n);
+  out_str(o, " min ");
+  out_uint(o, h->min_ns);
+  out_str(o, " p50 ");
+  out_int(o, axi_percentile(h, 50.), false);
+  out_str(o, " p99 ");
+  out_int(o, axi_percentile(h, 99.), false);
+  out_str(o, " max ");
+  out_uint(o, h->max_ns);
+  out_str(o, " mean ");
+  out_fix(o, (h->n>0)? (int64_t)(h->sum_ns*10/h->n) : 0, 1, false);
+  out_str(o, " outliers ");
+  out_uint(o, h->outliers);
+  out_str(o, "\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+// line k of AXIPROBE:DATA?: the reads of every register, the writes,
+// the bursts (a probe stopped early may have none), then the slowest accesses; false past the end
+
+bool axi_line(int k, struct out *o)
+  {
+  struct axi_worst *w;
+  char what[32];
+  unsigned int r;
+
+  for(r=axi.lo; r<=axi.hi; r++)
+    if(k--==0)
+      {
+      snprintf(what, sizeof(what), "REG %u READ", r);
+      axi_format(what, &axi.rd[r], o);
+      return true;
+      }
+  for(r=axi.lo; r<=axi.hi; r++)
+    if(axi.wr[r].n>0 && k--==0)
+      {
+      snprintf(what, sizeof(what), "REG %u WRITE", r);
+      axi_format(what, &axi.wr[r], o);
+      return true;
+      }
+  if(axi.blk.n>0 && k--==0)
+    {
+    snprintf(what, sizeof(what), "BLOCK %u-%u", axi.lo, axi.hi);
+    axi_format(what, &axi.blk, o);
+    return true;
+    }
+  if(axi.smp.n>0 && k--==0)
+    {
+    axi_format("SAMPLER", &axi.smp, o);
+    return true;
+    }
+  if(k>=axi.nworst)
+    return false;
+
+  // WORST 3400 ns REG 5 READ at 1234.567890
+  w=&axi.worst[k];
+  out_str(o, "WORST ");
+  out_uint(o, w->ns);
+  out_str(o, " ns ");
+  if(w->reg<0)
+    out_str(o, "BLOCK");
+  else
+    {
+    out_str(o, "REG ");
+    out_uint(o, (uint64_t)w->reg);
+    out_str(o, w->write? " WRITE" : " READ");
+    }
+  out_str(o, " at ");
+  out_fix(o, (int64_t)(w->t_ns/1000), 6, false);
+  out_str(o, "\n");
+  return true;
+  }
@@ -0,0 +1,131 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync register access latency probe    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// AXIPROBE times the accesses to a device's register bank with the
+// finest counter at hand, to see how long the fabric makes us wait:
+//
+//   single reads of every register in <lo>-<hi>, round robin so that a
+//   busy spell of the fabric hits all of them alike
+//   with WRITE, the value just read written back to the registers that
+//   take a rewrite without side effects (axi_wregs[]), under the
+//   register lock so that nothing written meanwhile is undone; the
+//   write is timed to its completion (barrier), not to the store
+//   bursts: the whole block <lo>-<hi>, and the registers the sampler
+//   reads every sample (smp_regs[]), back to back; their time gives
+//   the highest sample rate the bus allows
+//
+// every access goes into a histogram (log2 bins, AXI_BIN0_NS wide at
+// the bottom) with min, max and mean; one slower than AXI_OUTLIER_X
+// times the median of its register is an outlier, and the AXI_NWORST
+// slowest accesses are kept with their CLOCK_MONOTONIC time, to put
+// next to the journal and the captures
+//
+// the counter is CNTVCT_EL0 on aarch64: the generic timer, not a cycle
+// counter (the PMU one is not readable from user space by default), at
+// CNTFRQ_EL0 ticks per second, 10 ns or so on the ZynqMP; the TSC on
+// x86, CLOCK_MONOTONIC_RAW elsewhere; ticks are turned into ns and the
+// tick is reported as the resolution, nothing shorter can be told apart
+// the cost of reading the counter is measured first and taken off
+// every sample
+// the probe runs in a thread of its own, on the CPU of the main thread
+// (it inherits its affinity), while the sampler goes on as usual: what
+// it sees is what the sampler sees
+
+#ifndef AXIPROBE_H
+#define AXIPROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "device.h"
+#include "scpi.h"
+#include "loghist.h"
+
+#define AXI_MAXREG       13         // registers 0..MAXREG, as REG
+#define AXI_DEFAULT_N    100000     // reads of each register
+#define AXI_MAX_N        10000000
+#define AXI_BURSTS       10000
+#define AXI_NBINS        20
+#define AXI_BIN0_NS      16         // bin 0 is < 16 ns, bin k [16<<(k-1), 16<<k)
+#define AXI_OUTLIER_X    4
+#define AXI_NWORST       8
+#define AXI_CALIB_MS     20
+#define AXI_PAGE         16         // lines per AXIPROBE:DATA? answer (MAXANS)
+
+enum axi_state
+  {
+  AXI_IDLE,
+  AXI_RUNNING,
+  AXI_DONE,
+  AXI_STOPPED,
+  AXI_NSTATES
+  };
+
+struct axi_hist
+  {
+  unsigned long n, outliers;
+  unsigned long bin[AXI_NBINS];
+  uint32_t      min_ns, max_ns;
+  double        sum_ns;
+  };
+
+struct axi_worst
+  {
+  uint64_t t_ns;                // CLOCK_MONOTONIC
+  uint32_t ns;
+  int      reg;                 // -1: block burst
+  bool     write;
+  };
+
+struct axiprobe
+  {
+  atomic_int        state;
+  atomic_bool       stop;
+  atomic_long       progress;   // rounds done
+  pthread_t         thread;
+  // run, set by axi_start()
+  int               dev;
+  unsigned int      lo, hi;
+  long              n;
+  bool              write;
+  // counter
+  double            hz;         // ticks per second
+  uint64_t          ovh;        // ticks of reading the counter twice
+  // results, complete once the state is DONE or STOPPED
+  struct axi_hist   rd[AXI_MAXREG], wr[AXI_MAXREG];
+  struct axi_hist   blk, smp;
+  struct axi_worst  worst[AXI_NWORST];
+  int               nworst;
+  double            elapsed;    // s
+  };
+
+extern struct axiprobe axi;
+extern const char     *axi_state_names[AXI_NSTATES];
+extern const unsigned int axi_wregs[];
+
+
+/******* protos *******/
+
+uint64_t axi_ticks(void);
+void     axi_calibrate(void);
+uint32_t axi_ns(uint64_t c0, uint64_t c1);
+void     axi_add(struct axi_hist *h, uint32_t ns);
+long     axi_percentile(const struct axi_hist *h, double pct);
+void     axi_outliers(struct axi_hist *h);
+void     axi_worst(uint32_t ns, int reg, bool write);
+bool     axi_writable(unsigned int reg);
+int      axi_start(int dev, unsigned int lo, unsigned int hi, long n, bool write);
+void    *axi_main(void *arg);
+void     axi_sum(struct axi_hist *all, const struct axi_hist *h);
+void     axi_format(const char *what, const struct axi_hist *h, struct out *o);
+bool     axi_line(int k, struct out *o);
+
+#endif
@@ -2,7 +2,7 @@
  ***                                            ***
  ***  chopsync CAN interface to MECOS           ***
  ***                                            ***
- ***  latest rev: aug  8 2024                   ***
+ ***  latest rev: oct 18 2026                   ***
  ***                                            ***
  **************************************************/ 
 // code derived from inno-maker USB-CAN interface sample code:
@@ -12,89 +12,682 @@
 // https://www.kernel.org/doc/Documentation/networking/can.txt
 
 #include "can.h"
+#include "canlink.h"
+#include "upgrade.h"
+#include "journal.h"
 
 /***  globals  ***/
-int can_sock;
+const struct mecos_objdef mecos_objs[MECOS_NOBJ] =
+  {
+  [MECOS_OBJ_HZ_SETP]  = { 0x20, 0x00, 0x00, "HZ_SETP" },
+  [MECOS_OBJ_HZ_ACT]   = { 0x20, 0x01, 0x00, "HZ_ACT" },
+  [MECOS_OBJ_LIFTED]   = { 0x20, 0x0C, 0x00, "LIFTUP" },
+  [MECOS_OBJ_ROTATING] = { 0x20, 0x80, 0x00, "ROTATION" },
+  [MECOS_OBJ_FAULT]    = { 0x20, 0x87, 0x00, "FAULT" },
+  // CHANGE ME!!!!! we need the right register address from MECOS
+  [MECOS_OBJ_EXTCTL]   = { 0x20, 0x25, 0x00, "STABLE" },
+  };
+
+const char *can_prio_names[CAN_NPRIO] = { "SAFETY", "SETPOINT", "INTERACTIVE", "BACKGROUND" };
+
+// CAN interfaces already brought up, with the number of nodes using them;
+// several MECOS nodes may share one bus, which must be reset only once
+struct can_link can_links[CAN_MAXLINKS];
+
+// MECOS reads waiting for their Ans_MPDO, on all nodes
+struct can_xact can_inflight[CAN_MAXINFLIGHT];
+unsigned long   can_requests, can_coalesced, can_retries;
+
+
+//-------------------------------------------------------------------
 
-int open_can(void)
+// one request on an rtnetlink socket; returns the error of its ack,
+// 0 or -errno
+
+int can_rtnl_req(int sock, struct nlmsghdr *nh)
   {
-  int ret;
-  struct sockaddr_can addr;
-  struct ifreq ifr;
-  struct can_filter rfilter[1];
-  struct timeval tv;
+  char buf[1024];
+  struct nlmsghdr *r;
+  ssize_t n;
+
+  if(send(sock, nh, nh->nlmsg_len, 0)<0)
+    return -errno;
+  n=recv(sock, buf, sizeof(buf), 0);
+  if(n<0)
+    return -errno;
+  r=(struct nlmsghdr *)buf;
+  if(!NLMSG_OK(r, (size_t)n) || r->nlmsg_type!=NLMSG_ERROR)
+    return -EPROTO;
+  return ((struct nlmsgerr *)NLMSG_DATA(r))->error;
+  }
+
+
+//-------------------------------------------------------------------
+
+// an attribute at the end of the message (which has room for it);
+// returned so that a nest can be closed by can_rtnl_end()
+
+struct rtattr *can_rtnl_attr(struct nlmsghdr *nh, int type, const void *data, size_t len)
+  {
+  struct rtattr *rta;
+
+  rta=(struct rtattr *)((char *)nh+NLMSG_ALIGN(nh->nlmsg_len));
+  rta->rta_type=type;
+  rta->rta_len=RTA_LENGTH(len);
+  if(len>0)
+    memcpy(RTA_DATA(rta), data, len);
+  nh->nlmsg_len=NLMSG_ALIGN(nh->nlmsg_len)+RTA_SPACE(len);
+  return rta;
+  }
+
+
+//-------------------------------------------------------------------
+
+void can_rtnl_end(struct nlmsghdr *nh, struct rtattr *nest)
+  {
+  nest->rta_len=(unsigned short)((char *)nh+nh->nlmsg_len-(char *)nest);
+  }
+
+
+//-------------------------------------------------------------------
+
+// down, bitrate, up through rtnetlink, what ifconfig and ip do, without
+// a process or a shell; needs CAP_NET_ADMIN (-EPERM without it)
+// returns 0 or -errno; takes no longer than the kernel's answers
+
+int can_link_rtnl(const char *ifname)
+  {
+  struct
+    {
+    struct nlmsghdr  nh;
+    struct ifinfomsg ifi;
+    char             attrs[128];
+    } req;
+  struct can_bittiming bt;
+  struct rtattr  *info, *data;
+  struct timeval  tv;
+  unsigned int idx;
+  int sock, ret, err, step;
+
+  idx=if_nametoindex(ifname);
+  if(idx==0)
+    return -ENODEV;
+  sock=socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+  if(sock<0)
+    return -errno;
+  // the kernel answers at once; only in case it does not
+  tv.tv_sec=0;
+  tv.tv_usec=200000;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  // the bitrate can only be set while the interface is down; it goes
+  // up again even if the bitrate is refused, as with the commands
+  ret=0;
+  for(step=0; step<3; step++)
+    {
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len=NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type=RTM_NEWLINK;
+    req.nh.nlmsg_flags=NLM_F_REQUEST|NLM_F_ACK;
+    req.nh.nlmsg_seq=step+1;
+    req.ifi.ifi_family=AF_UNSPEC;
+    req.ifi.ifi_index=(int)idx;
+    if(step==1)
+      {
+      memset(&bt, 0, sizeof(bt));
+      bt.bitrate=CAN_BITRATE;
+      info=can_rtnl_attr(&req.nh, IFLA_LINKINFO, NULL, 0);
+      can_rtnl_attr(&req.nh, IFLA_INFO_KIND, "can", 3);
+      data=can_rtnl_attr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+      can_rtnl_attr(&req.nh, IFLA_CAN_BITTIMING, &bt, sizeof(bt));
+      can_rtnl_end(&req.nh, data);
+      can_rtnl_end(&req.nh, info);
+      }
+    else
+      {
+      req.ifi.ifi_change=IFF_UP;
+      req.ifi.ifi_flags=(step==2)? IFF_UP : 0;
+      }
+    err=can_rtnl_req(sock, &req.nh);
+    if(err!=0 && ret==0)
+      ret=err;
+    // not even down (no right to, gone): the rest would fail the same
+    if(err!=0 && step==0)
+      break;
+    }
+  close(sock);
+  return ret;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the sudo commands of can_link_config(), in a child we don't wait
+// for; returns its pid, or -1
+
+pid_t can_link_spawn(const char *ifname)
+  {
+  extern char **environ;
+  char  cmd[256];
+  char *argv[4];
+  pid_t pid;
+  int   ret;
+
+  snprintf(cmd, sizeof(cmd), "sudo ifconfig %s down; sudo ip link set %s type can bitrate %d; sudo ifconfig %s up",
+           ifname, ifname, CAN_BITRATE, ifname);
+  argv[0]="sh";
+  argv[1]="-c";
+  argv[2]=cmd;
+  argv[3]=NULL;
+  ret=posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ);
+  if(ret!=0)
+    {
+    fprintf(stderr, "CAN %s: can't start sudo (%s)\n", ifname, strerror(ret));
+    return -1;
+    }
+  return pid;
+  }
+
+
+//-------------------------------------------------------------------
+
+// bitrate and up, at startup; rtnetlink if we may, else the commands
+// (the link manager never waits for them, see canlink_reopen())
+
+void can_link_config(const char *ifname)
+  {
+  char cmd[128];
+
+  if(can_link_rtnl(ifname)==0)
+    return;
 
   // must close can device before set baud rate!
-  system("sudo ifconfig can0 down");
+  snprintf(cmd, sizeof(cmd), "sudo ifconfig %s down", ifname);
+  system(cmd);
   //below mean depend on iprout tools ,not ip tool with busybox
-  system("sudo ip link set can0 type can bitrate 1000000");
+  snprintf(cmd, sizeof(cmd), "sudo ip link set %s type can bitrate %d", ifname, CAN_BITRATE);
+  system(cmd);
   //system("sudo echo 1000000 > /sys/class/net/can0/can_bittiming/bitrate");
-  system("sudo ifconfig can0 up");
-  
+  snprintf(cmd, sizeof(cmd), "sudo ifconfig %s up", ifname);
+  system(cmd);
+  }
+
+
+//-------------------------------------------------------------------
+
+struct can_link *can_link_up(const char *ifname)
+  {
+  int  i, freeslot;
+  struct can_link *l;
+
+  freeslot=-1;
+  for(i=0; i<CAN_MAXLINKS; i++)
+    {
+    if(can_links[i].users>0 && strcmp(can_links[i].ifname, ifname)==0)
+      {
+      // already configured by another node
+      can_links[i].users++;
+      return &can_links[i];
+      }
+    if(can_links[i].users==0 && freeslot<0)
+      freeslot=i;
+    }
+  if(freeslot<0)
+    {
+    fprintf(stderr, "too many CAN interfaces\n");
+    return NULL;
+    }
+
+  // a bus handed over by the server we replace is up and busy: leave it
+  if(!upgrade_has(UPG_CAN_NODE, ifname))
+    can_link_config(ifname);
+
+  l=&can_links[freeslot];
+  memset(l, 0, sizeof(*l));
+  strcpy(l->ifname, ifname);
+  l->users=1;
+  // our own traffic may use this many bits per second of the bus
+  l->budget_bps=(double)CAN_BITRATE*cfg.can_budget/100.;
+  l->tokens=CAN_BURST_BITS;
+  clock_gettime(CLOCK_MONOTONIC, &l->refill);
+  // until canlink_open() has looked
+  l->state=CAN_LINK_UP;
+  l->since=l->refill;
+
+  // bus health monitor; the server works without it
+  canmon_reset(&l->mon);
+  l->mon.sock=upgrade_take(UPG_CAN_MON, ifname, -1);
+  // without the interface it is bound later, by canlink_reopen()
+  if(l->mon.sock<0)
+    canmon_open(&l->mon, if_nametoindex(ifname));
+  if(l->mon.sock<0)
+    fprintf(stderr, "CAN %s: no bus monitor\n", ifname);
+  return l;
+  }
+
+
+//-------------------------------------------------------------------
+
+int can_link_down(struct can_link *l)
+  {
+  char cmd[128];
+
+  if(l==NULL || l->users==0)
+    return -1;
+
+  // the last node leaving the bus takes it down
+  if(--l->users==0)
+    {
+    canmon_close(&l->mon);
+    snprintf(cmd, sizeof(cmd), "sudo ifconfig %s down", l->ifname);
+    system(cmd);
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// a new socket bound to the node's interface, with the Ans_MPDO filter,
+// put in place of node->sock if there is one, so that the fd stays the
+// same for select(); -1 if the interface is not there
+
+int can_node_bind(struct can_node *node)
+  {
+  int ret, sock;
+  struct sockaddr_can addr;
+  struct ifreq ifr;
+  struct can_filter rfilter[1];
+
   // create socket
-  can_sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-  if(can_sock < 0)
+  sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if(sock < 0)
     {
     perror("Create socket PF_CAN failed!");
     return -1;
     }
 
-  // specify can0 device
-  strcpy(ifr.ifr_name, "can0");
-  ret = ioctl(can_sock, SIOCGIFINDEX, &ifr);
+  // specify can device
+  strcpy(ifr.ifr_name, node->ifname);
+  ret = ioctl(sock, SIOCGIFINDEX, &ifr);
   if(ret < 0)
     {
-    perror("ioctl interface index failed!");
+    close(sock);
     return -1;
     }
 
-  // set receive timeout (mus be done before bind)
-  tv.tv_sec = RX_TIMEOUT_SEC;
-  tv.tv_usec = 0;
-  setsockopt(can_sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
+  // no receive timeout: the socket is drained with non-blocking reads
+  // and transactions time out in can_expire()
 
-  // bind the socket to can0
+  // bind the socket to the can device
   addr.can_family = AF_CAN;
   addr.can_ifindex = ifr.ifr_ifindex;
-  ret = bind(can_sock, (struct sockaddr *)&addr, sizeof(addr));
+  ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
   if(ret < 0)
     {
     perror("bind failed!");
+    close(sock);
     return -1;
     }
 
   // setup receive filter rules
-  // receive only Ans_MPDO messages from MECOS AMB
-  rfilter[0].can_id = 0x2C0;
+  // receive only Ans_MPDO messages from our MECOS AMB
+  rfilter[0].can_id = MECOS_ANS_MPDO + node->nodeoff;
   rfilter[0].can_mask = CAN_SFF_MASK;
-  setsockopt(can_sock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter));
-  //setsockopt(can_sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+  setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter));
+  //setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
 
+  if(node->sock>=0)
+    {
+    if(dup2(sock, node->sock)<0)
+      {
+      perror("CAN socket dup2");
+      close(sock);
+      return -1;
+      }
+    close(sock);
+    }
+  else
+    node->sock=sock;
   return 0;
   }
 
 
 //-------------------------------------------------------------------
 
-int close_can(void)
+// an interface that is not there yet (USB adapter not plugged in) still
+// gets a socket, unbound: the link manager binds it when the interface
+// shows up
+
+int open_can(struct can_node *node)
   {
-  close(can_sock);
-  system("sudo ifconfig can0 down");
+  node->present=false;
+  node->link=can_link_up(node->ifname);
+  if(node->link==NULL)
+    return -1;
+
+  // handed over already bound and filtered
+  node->sock=upgrade_take(UPG_CAN_NODE, node->ifname, (int)node->nodeoff);
+  if(node->sock>=0)
+    {
+    node->present=true;
+    return 0;
+    }
+
+  node->sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if(node->sock < 0)
+    {
+    perror("Create socket PF_CAN failed!");
+    return -1;
+    }
+  if(can_node_bind(node)!=0)
+    fprintf(stderr, "CAN %s: interface not there; waiting for it\n", node->ifname);
+
+  node->present=true;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int close_can(struct can_node *node)
+  {
+  if(!node->present)
+    return 0;
+  close(node->sock);
+  node->present=false;
+  can_link_down(node->link);
   return 0;  
   }
 
 
 //-------------------------------------------------------------------
 
-int can_write_register(unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int val)
+// worst case length on the wire of a standard frame, stuff bits included
+
+int can_frame_bits(int dlc)
+  {
+  return 47 + 8*dlc + (34 + 8*dlc - 1)/4;
+  }
+
+
+//-------------------------------------------------------------------
+
+// add the bits earned since last time to the link budget
+
+void can_refill(struct can_link *l)
+  {
+  struct timespec now;
+  double dt;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  dt=(now.tv_sec-l->refill.tv_sec) + (now.tv_nsec-l->refill.tv_nsec)/1.e9;
+  l->refill=now;
+  l->tokens+=dt*l->budget_bps;
+  if(l->tokens>CAN_BURST_BITS)
+    l->tokens=CAN_BURST_BITS;
+  }
+
+
+//-------------------------------------------------------------------
+
+int can_transmit(struct can_node *node, struct can_frame *frame)
   {
-  struct can_frame frame;
   int nbytes;
 
+  // send message out
+  nbytes = write(node->sock, frame, sizeof(*frame)); 
+  if(nbytes != sizeof(*frame))
+    {
+    // the interface went away or down under us
+    if(nbytes<0 && (errno==ENODEV || errno==ENXIO || errno==ENETDOWN))
+      canlink_lost(node->link, (errno==ENETDOWN)? CAN_LINK_DOWN : CAN_LINK_GONE, strerror(errno));
+    else
+      perror("CAN frame only partially sent\n");
+    return -1;
+    }
+  node->link->tokens-=can_frame_bits(frame->can_dlc);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// transmit scheduler: a frame goes out at once if nothing more urgent
+// is waiting and the link budget allows it, otherwise it is queued
+// in its priority class; safety frames ignore the budget and never wait
+// behind anything but other safety frames
+// x is the read transaction the frame belongs to, if any; done is told
+// how a queued write went (can_tx_done())
+// returns 0 if the frame went out, CAN_QUEUED if it waits, or an error
+
+int can_send(struct can_node *node, struct can_frame *frame, enum can_prio prio, struct can_xact *x, can_done_fn done, void *ctx)
+  {
+  struct can_link  *l;
+  struct can_txq   *q;
+  struct can_txent *e;
+  int p, ahead;
+
+  l=node->link;
+  if(l->state!=CAN_LINK_UP)
+    return CAN_ELINK;
+  can_refill(l);
+
+  ahead=0;
+  for(p=0; p<=(int)prio; p++)
+    ahead+=l->txq[p].count;
+
+  if(ahead==0 && (prio==CAN_PRIO_SAFETY || l->tokens>=can_frame_bits(frame->can_dlc)))
+    {
+    if(can_transmit(node, frame)!=0)
+      return (l->state!=CAN_LINK_UP)? CAN_ELINK : -1;
+    l->txq[prio].sent++;
+    if(x!=NULL)
+      x->queued=false;
+    return 0;
+    }
+
+  q=&l->txq[prio];
+  if(q->count>=CAN_TXQ_LEN)
+    {
+    q->dropped++;
+    return CAN_EBUSY;
+    }
+  e=&q->ent[(q->head+q->count)%CAN_TXQ_LEN];
+  e->node=node;
+  e->frame=*frame;
+  e->x=x;
+  e->done=done;
+  e->ctx=ctx;
+  clock_gettime(CLOCK_MONOTONIC, &e->queued);
+  q->count++;
+  q->deferred++;
+  if(q->count>q->maxdepth)
+    q->maxdepth=q->count;
+  if(x!=NULL)
+    {
+    x->queued=true;
+    x->txent=e;
+    }
+  return CAN_QUEUED;
+  }
+
+
+//-------------------------------------------------------------------
+
+// drop the queued request frame of a finished transaction
+
+void can_cancel(struct can_xact *x)
+  {
+  // the frame stays in its queue as a hole, skipped by can_tx_service()
+  x->txent->node=NULL;
+  x->txent->x=NULL;
+  x->queued=false;
+  }
+
+
+//-------------------------------------------------------------------
+
+// move a queued request to a more urgent class
+
+void can_promote(struct can_xact *x, enum can_prio prio)
+  {
+  struct can_node *node;
+  struct can_frame frame;
+
+  node=x->txent->node;
+  frame=x->txent->frame;
+  can_cancel(x);
+  x->prio=prio;
+  if(can_send(node, &frame, prio, x, NULL, NULL)<0)
+    x->queued=false;
+  if(!x->queued)
+    can_attempt_start(x);
+  }
+
+
+//-------------------------------------------------------------------
+
+// a queued write went out (ret 0) or is dropped (CAN_ELINK, CAN_EFAIL);
+// a drop is journaled as the server's, whoever is running, and the
+// writer, if it waits, is told
+
+void can_tx_done(struct can_txent *e, int ret)
+  {
+  struct journal_who who;
+  unsigned long int  val;
+
+  val=(unsigned long)e->frame.data[4] | ((unsigned long)e->frame.data[5]<<8) |
+      ((unsigned long)e->frame.data[6]<<16) | ((unsigned long)e->frame.data[7]<<24);
+  if(ret!=0)
+    {
+    who=journal_who;
+    journal_thread(JOURNAL_SRC_SERVER, 0);
+    journal_can(e->node->dev, (uint16_t)((e->frame.data[2]<<8) | e->frame.data[1]), e->frame.data[3],
+                false, 0, (uint32_t)val, true);
+    journal_who=who;
+    }
+  if(e->done!=NULL)
+    e->done(e->ctx, ret, val);
+  }
+
+
+//-------------------------------------------------------------------
+
+// send queued frames, most urgent class first, as the budget allows
+
+void can_tx_service(void)
+  {
+  struct can_link  *l;
+  struct can_txq   *q;
+  struct can_txent *e, sent;
+  struct timespec   now;
+  long              wait_us;
+  int               i, p, ret;
+
+  for(i=0; i<CAN_MAXLINKS; i++)
+    {
+    l=&can_links[i];
+    // a link that is down keeps nothing queued, see canlink_fail()
+    if(l->users==0 || l->state!=CAN_LINK_UP)
+      continue;
+    can_refill(l);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for(p=0; p<CAN_NPRIO; p++)
+      {
+      q=&l->txq[p];
+      while(q->count>0)
+        {
+        e=&q->ent[q->head];
+        ret=0;
+        if(e->node!=NULL)
+          {
+          if(p!=CAN_PRIO_SAFETY && l->tokens<can_frame_bits(e->frame.can_dlc))
+            break;
+          // lost the link on the way: canlink_fail() takes the rest
+          if(l->state!=CAN_LINK_UP)
+            break;
+          if((ret=can_transmit(e->node, &e->frame))==0)
+            {
+            q->sent++;
+            wait_us=(now.tv_sec-e->queued.tv_sec)*1000000L + (now.tv_nsec-e->queued.tv_nsec)/1000L;
+            if(wait_us>q->maxwait_us)
+              q->maxwait_us=wait_us;
+            }
+          if(e->x!=NULL)
+            {
+            // the answer timeout runs from the actual transmission
+            e->x->queued=false;
+            can_attempt_start(e->x);
+            }
+          }
+        sent=*e;
+        q->head=(q->head+1)%CAN_TXQ_LEN;
+        q->count--;
+        // a write, once the queue is in order: its answer may send more
+        if(sent.node!=NULL && sent.x==NULL)
+          can_tx_done(&sent, (ret==0)? 0 : (l->state!=CAN_LINK_UP)? CAN_ELINK : CAN_EFAIL);
+        }
+      // lower classes wait until this one is empty
+      if(q->count>0)
+        break;
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// seconds until the budget lets the next queued frame out;
+// returns -1 if no frame is waiting
+
+int can_tx_wait(double *left)
+  {
+  struct can_link *l;
+  double dt;
+  int i, p, found;
+
+  found=-1;
+  for(i=0; i<CAN_MAXLINKS; i++)
+    {
+    l=&can_links[i];
+    if(l->users==0)
+      continue;
+    for(p=0; p<CAN_NPRIO; p++)
+      if(l->txq[p].count>0)
+        {
+        can_refill(l);
+        dt=(can_frame_bits(8)-l->tokens)/l->budget_bps;
+        if(dt<0)
+          dt=0;
+        if(dt<*left)
+          *left=dt;
+        found=0;
+        break;
+        }
+    }
+  return found;
+  }
+
+
+//-------------------------------------------------------------------
+
+// returns 0 if the frame is on the bus, CAN_QUEUED if it waits in the
+// transmit queue (done, if given, is told how it goes), or an error
+
+int can_write_register(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int val, enum can_prio prio, can_done_fn done, void *ctx)
+  {
+  struct can_frame frame;
+  unsigned long int old;
+  long age;
+  bool have_old;
+  int ret, obj;
+
   memset(&frame, 0, sizeof(struct can_frame));
 
   // assembly message data
-  frame.can_id = 0x1C0;
+  frame.can_id = MECOS_WR_MPDO + node->nodeoff;
   // payload length in byte (0..8)
   frame.can_dlc = 8;
   frame.data[0] = 0xC0;
@@ -106,31 +699,35 @@ int can_write_register(unsigned char addr_hi, unsigned char addr_lo, unsigned ch
   frame.data[6] = (unsigned char)((val>>16) & 0x000000FF);
   frame.data[7] = (unsigned char)((val>>24) & 0x000000FF);
 
-  // send message out
-  nbytes = write(can_sock, &frame, sizeof(frame)); 
-  if(nbytes != sizeof(frame))
-    {
-    perror("CAN frame only partially sent\n");
-    return -1;
-    }
+  // send message out, or queue it behind more urgent traffic
+  ret=can_send(node, &frame, prio, NULL, done, ctx);
 
-  return 0;
+  // the value it replaces is the one last read, if it is a known object
+  old=0;
+  have_old=false;
+  for(obj=0; obj<MECOS_NOBJ && !have_old; obj++)
+    if(mecos_objs[obj].addr_hi==addr_hi && mecos_objs[obj].addr_lo==addr_lo && mecos_objs[obj].subindex==subindex)
+      have_old=(can_cache_read(node, obj, &old, &age)==0);
+  journal_can(node->dev, (uint16_t)((addr_hi<<8) | addr_lo), subindex, have_old, (uint32_t)old, (uint32_t)val, ret<0);
+  return ret;
   }
 
 
 //-------------------------------------------------------------------
 
-int can_read_register(unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int *val)
+// send a REQ_MPDO; the answer is collected by can_receive()
+
+int can_send_request(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, enum can_prio prio, struct can_xact *x)
   {
   struct can_frame frame;
-  int nbytes;
+  int ret;
 
   memset(&frame, 0, sizeof(struct can_frame));
   
   // send request to MECOS using a REQ_MPDO message
 
   // assembly message data
-  frame.can_id = 0x340;
+  frame.can_id = MECOS_REQ_MPDO + node->nodeoff;
   // payload length in byte (0..8)
   frame.can_dlc = 4;
   frame.data[0] = 0xC0;
@@ -138,134 +735,553 @@ int can_read_register(unsigned char addr_hi, unsigned char addr_lo, unsigned cha
   frame.data[2] = addr_hi;
   frame.data[3] = subindex;
 
-  // send message out
-  nbytes = write(can_sock, &frame, sizeof(frame)); 
-  if(nbytes != sizeof(frame))
+  // queued or not, x->queued tells
+  ret=can_send(node, &frame, prio, x, NULL, NULL);
+  return (ret==CAN_QUEUED)? 0 : ret;
+  }
+
+
+//-------------------------------------------------------------------
+
+void can_ts_add_us(struct timespec *ts, long us)
+  {
+  ts->tv_sec+=us/1000000L;
+  ts->tv_nsec+=(us%1000000L)*1000L;
+  if(ts->tv_nsec>=1000000000L)
     {
-    perror("CAN frame only partially sent\n");
+    ts->tv_sec++;
+    ts->tv_nsec-=1000000000L;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// a-b in us
+
+long can_ts_diff_us(const struct timespec *a, const struct timespec *b)
+  {
+  return (a->tv_sec-b->tv_sec)*1000000L + (a->tv_nsec-b->tv_nsec)/1000L;
+  }
+
+
+//-------------------------------------------------------------------
+
+// timeout of the first attempt to read an object, from the round trips
+// seen so far on this node
+
+long can_rto_us(struct can_node *node, int obj)
+  {
+  struct rtt_hist *h;
+  long rto;
+
+  h=&node->rtt[obj];
+  if(h->n<CAN_RTO_MINSAMPLES)
+    rto=CAN_RTO_INIT_MS*1000L;
+  else
+    rto=rtt_percentile(h, 99.)*CAN_RTO_K;
+  rto<<=node->rto_shift[obj];
+  if(rto<CAN_RTO_MIN_US)
+    rto=CAN_RTO_MIN_US;
+  if(rto>CAN_RTO_MAX_US)
+    rto=CAN_RTO_MAX_US;
+  return rto;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the request frame of x just left: arm the timeout of this attempt
+
+void can_attempt_start(struct can_xact *x)
+  {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  x->sent=now;
+  x->expire=now;
+  can_ts_add_us(&x->expire, x->rto_us<<x->attempt);
+  }
+
+
+//-------------------------------------------------------------------
+
+// start reading a MECOS register; done(ctx, ret, val) is called when the
+// answer arrives or, with CAN_ETIMEOUT, when deadline_ms (0: default
+// CAN_DEADLINE_MS) have passed without one
+// if the same register of the same node is already being read, no new
+// REQ_MPDO is sent: the caller just joins the outstanding request, so a
+// polling storm costs at most one request per object on the bus
+// returns -1 if the request could not be started, CAN_ELINK if the link
+// is down, CAN_EBUSY if there is no room for it now (done is not called)
+
+int can_read_async(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, enum can_prio prio, long deadline_ms, can_done_fn done, void *ctx)
+  {
+  struct can_xact *x, *freex;
+  struct timespec deadline;
+  int i, ret;
+
+  if(!node->present)
     return -1;
+  if(node->link->state!=CAN_LINK_UP)
+    return CAN_ELINK;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  can_ts_add_us(&deadline, ((deadline_ms>0)? deadline_ms : CAN_DEADLINE_MS)*1000L);
+
+  freex=NULL;
+  for(i=0; i<CAN_MAXINFLIGHT; i++)
+    {
+    x=&can_inflight[i];
+    if(!x->used)
+      {
+      if(freex==NULL)
+        freex=x;
+      continue;
+      }
+    if(x->node==node && x->addr_hi==addr_hi && x->addr_lo==addr_lo && x->subindex==subindex)
+      {
+      // single flight: attach to the request already on the bus
+      if(x->nwaiters>=CAN_MAXWAITERS)
+        return CAN_EBUSY;
+      x->waiters[x->nwaiters].done=done;
+      x->waiters[x->nwaiters].ctx=ctx;
+      x->waiters[x->nwaiters].deadline=deadline;
+      x->nwaiters++;
+      can_coalesced++;
+      // an interactive read must not wait behind a background poll
+      if(x->queued && prio<x->prio)
+        can_promote(x, prio);
+      return 0;
+      }
     }
 
-  // now wait for answer
-  // fill in the values we expect as answer, to filter out
-  // other messages on can bus we are not interested in
-  frame.can_id  = 0x2C0;
-  frame.data[0] = 0x40;
-  frame.data[1] = addr_lo;
-  frame.data[2] = addr_hi;
-  frame.data[3] = subindex;
+  if(freex==NULL)
+    {
+    fprintf(stderr, "too many CAN requests in flight\n");
+    return CAN_EBUSY;
+    }
 
-  return(can_wait_answer(&frame, val));
+  x=freex;
+  x->node=node;
+  x->addr_hi=addr_hi;
+  x->addr_lo=addr_lo;
+  x->subindex=subindex;
+  x->prio=prio;
+  x->queued=false;
+  x->attempt=0;
+  x->rto_us=can_rto_us(node, can_xact_obj(x));
+  if((ret=can_send_request(node, addr_hi, addr_lo, subindex, prio, x))!=0)
+    return ret;
+  if(!x->queued)
+    can_attempt_start(x);
+  can_requests++;
+
+  x->used=true;
+  x->nwaiters=1;
+  x->waiters[0].done=done;
+  x->waiters[0].ctx=ctx;
+  x->waiters[0].deadline=deadline;
+  return 0;
   }
 
 
 //-------------------------------------------------------------------
 
-int can_wait_answer(struct can_frame *match_frame, unsigned long int *response)
+// index in mecos_objs[] of the register being read; MECOS_NOBJ if unknown
+
+int can_xact_obj(struct can_xact *x)
   {
-  struct can_frame frame;
-  int nbytes;
-  struct timeval tv1, tv2;
-  double dt;
-  
-  // now wait for MECOS response via an Ans_MPDO message
-  // note that also other CAN nodes may be on the bus, making different
-  // requests to MECOS AMB, so there may be stray Ans_MPDOs on the bus
-  // keep looking for the right one until we time out
-  dt=0;
-  gettimeofday(&tv1, NULL);
-  while(dt<RX_TIMEOUT_SEC)
+  int obj;
+
+  for(obj=0; obj<MECOS_NOBJ; obj++)
+    if(mecos_objs[obj].addr_hi==x->addr_hi && mecos_objs[obj].addr_lo==x->addr_lo &&
+       mecos_objs[obj].subindex==x->subindex)
+      break;
+  return obj;
+  }
+
+
+//-------------------------------------------------------------------
+
+// finish a transaction and notify everybody waiting on it
+// the slot is released first, so callbacks may start new requests
+
+void can_complete(struct can_xact *x, int ret, unsigned long int val)
+  {
+  struct can_waiter waiters[CAN_MAXWAITERS];
+  struct timespec now;
+  int nwaiters, i, obj;
+
+  obj=can_xact_obj(x);
+  if(ret==0)
     {
-    errno=0;
-    // note that read has a timeout previously set via setsockopt
-    nbytes = read(can_sock, &frame, sizeof(frame));
-    if((errno==EAGAIN)||(errno==EWOULDBLOCK))
+    // after a retry we can't tell which copy is being answered, so
+    // only first attempts are timed; a read that needed retries keeps
+    // the timeout backed off instead, in case the bus got slower
+    if(x->attempt==0)
       {
-      perror("Timed out");
-      return -1;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      rtt_add(&x->node->rtt[obj], can_ts_diff_us(&now, &x->sent));
+      x->node->rto_shift[obj]=0;
       }
-    if(nbytes > 0)
+    else if(x->node->rto_shift[obj]<CAN_RTO_MAXSHIFT)
+      x->node->rto_shift[obj]++;
+
+    // keep known objects in the node cache
+    if(obj<MECOS_NOBJ)
+      {
+      atomic_fetch_add_explicit(&x->node->cache_seq, 1, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      x->node->cache[obj].val=val;
+      clock_gettime(CLOCK_MONOTONIC, &x->node->cache[obj].ts);
+      x->node->cache[obj].valid=true;
+      atomic_fetch_add_explicit(&x->node->cache_seq, 1, memory_order_release);
+      }
+    }
+  else if(ret==CAN_ETIMEOUT)
+    {
+    x->node->rtt[obj].timeouts++;
+    fprintf(stderr, "CAN %s: timed out reading 0x%02X%02X.%02X after %d attempts\n",
+            x->node->ifname, x->addr_hi, x->addr_lo, x->subindex, x->attempt+1);
+    }
+
+  nwaiters=x->nwaiters;
+  memcpy(waiters, x->waiters, nwaiters*sizeof(struct can_waiter));
+  if(x->queued)
+    can_cancel(x);
+  x->used=false;
+
+  for(i=0; i<nwaiters; i++)
+    waiters[i].done(waiters[i].ctx, ret, val);
+  }
+
+
+//-------------------------------------------------------------------
+
+// drain the node socket and complete the transactions being answered
+// note that also other CAN nodes may be on the bus, making different
+// requests to MECOS AMB, so there may be stray Ans_MPDOs on the bus
+
+void can_receive(struct can_node *node)
+  {
+  struct can_frame frame;
+  struct can_xact *x;
+  unsigned long int val;
+  ssize_t n;
+  int i;
+
+  while((n=recv(node->sock, &frame, sizeof(frame), MSG_DONTWAIT)) == sizeof(frame))
+    {
+    if( ((frame.can_id&0x1FFFFFFF) != MECOS_ANS_MPDO + node->nodeoff) ||
+        (frame.can_dlc != 8) ||
+        (frame.data[0] != 0x40)
+      )
+      continue;
+
+    for(i=0; i<CAN_MAXINFLIGHT; i++)
       {
-      if(match_frame!=NULL)
+      x=&can_inflight[i];
+      if(x->used && x->node==node &&
+         frame.data[1]==x->addr_lo && frame.data[2]==x->addr_hi && frame.data[3]==x->subindex)
         {
-        if( ((frame.can_id&0x1FFFFFFF) == match_frame->can_id) &&
-            (frame.can_dlc == 8) &&
-            (frame.data[0] == match_frame->data[0]) &&
-            (frame.data[1] == match_frame->data[1]) &&
-            (frame.data[2] == match_frame->data[2]) &&
-            (frame.data[3] == match_frame->data[3])
-          )
-          {
-          // we received the correct message; now decode speed value
-          if(response!=NULL)
-            {
-            *response=((unsigned long int)(frame.data[4]))+
-                      (((unsigned long int)(frame.data[5]))<<8)+
-                      (((unsigned long int)(frame.data[6]))<<16)+
-                      (((unsigned long int)(frame.data[7]))<<24)
-                      ;
-            break;
-            }
-          else
-            {
-            perror("Null ptr passed for CAN readout");
-            return -1;
-            }
-          }
+        // we received the correct message; now decode value
+        val=((unsigned long int)(frame.data[4]))+
+            (((unsigned long int)(frame.data[5]))<<8)+
+            (((unsigned long int)(frame.data[6]))<<16)+
+            (((unsigned long int)(frame.data[7]))<<24)
+            ;
+        can_complete(x, 0, val);
+        break;
         }
+      }
+    }
+
+  // the kernel reports the interface going away on the socket
+  if(n<0 && (errno==ENODEV || errno==ENXIO || errno==ENETDOWN))
+    canlink_lost(node->link, (errno==ENETDOWN)? CAN_LINK_DOWN : CAN_LINK_GONE, strerror(errno));
+  }
+
+
+//-------------------------------------------------------------------
+
+// send the request of x again, waiting twice as long for the answer
+
+void can_retry(struct can_xact *x)
+  {
+  x->attempt++;
+  can_retries++;
+  x->node->rtt[can_xact_obj(x)].retries++;
+  x->queued=false;
+  can_send_request(x->node, x->addr_hi, x->addr_lo, x->subindex, x->prio, x);
+  // a request that could not even be queued just counts as lost
+  if(!x->queued)
+    can_attempt_start(x);
+  }
+
+
+//-------------------------------------------------------------------
+
+// readers past their deadline get CAN_ETIMEOUT; requests not answered
+// within the attempt timeout are sent again while somebody still waits
+// and there are retries left
+
+void can_expire(void)
+  {
+  struct can_waiter expired[CAN_MAXWAITERS];
+  struct can_xact  *x;
+  struct timespec   now;
+  int i, j, k, nexp;
+
+  for(i=0; i<CAN_MAXINFLIGHT; i++)
+    {
+    x=&can_inflight[i];
+    if(!x->used)
+      continue;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    nexp=0;
+    for(j=0, k=0; j<x->nwaiters; j++)
+      if(can_ts_diff_us(&now, &x->waiters[j].deadline)>=0)
+        expired[nexp++]=x->waiters[j];
       else
-        {
-        perror("Null ptr passed for CAN frame match");
-        return -1;
-        }
+        x->waiters[k++]=x->waiters[j];
+    x->nwaiters=k;
+
+    if(x->nwaiters==0)
+      // nobody left to answer to
+      can_complete(x, CAN_ETIMEOUT, 0);
+    else if(!x->queued && can_ts_diff_us(&now, &x->expire)>=0)
+      {
+      if(x->attempt<CAN_MAXRETRIES)
+        can_retry(x);
+      else
+        can_complete(x, CAN_ETIMEOUT, 0);
+      }
+
+    // the slot is settled: callbacks may start new requests
+    for(j=0; j<nexp; j++)
+      expired[j].done(expired[j].ctx, CAN_ETIMEOUT, 0);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// time left before the next deadline or attempt timeout, for select()
+// returns -1 if nothing is in flight
+
+int can_next_timeout(struct timeval *tv)
+  {
+  struct timespec now;
+  struct can_xact *x;
+  double left, dt;
+  int i, j, found;
+
+  found=0;
+  left=CAN_DEADLINE_MS/1000.;
+  // frames held back by the bus budget
+  if(can_tx_wait(&left)==0)
+    found=1;
+  // links to bring back
+  if(canlink_wait(&left)==0)
+    found=1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for(i=0; i<CAN_MAXINFLIGHT; i++)
+    {
+    x=&can_inflight[i];
+    if(!x->used)
+      continue;
+    found=1;
+    for(j=0; j<x->nwaiters; j++)
+      {
+      dt=can_ts_diff_us(&x->waiters[j].deadline, &now)/1.e6;
+      if(dt<left)
+        left=dt;
+      }
+    if(!x->queued)
+      {
+      dt=can_ts_diff_us(&x->expire, &now)/1.e6;
+      if(dt<left)
+        left=dt;
       }
-    
-    gettimeofday(&tv2, NULL);
-    dt= (tv2.tv_sec+tv2.tv_usec/1.e6) - (tv1.tv_sec+tv1.tv_usec/1.e6);
     }
+  if(!found)
+    return -1;
+
+  if(left<0)
+    left=0;
+  tv->tv_sec=(time_t)left;
+  tv->tv_usec=(suseconds_t)((left-tv->tv_sec)*1.e6);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the link whose bus monitor socket is fd, if any
+
+struct can_link *can_link_by_monfd(int fd)
+  {
+  int i;
+
+  for(i=0; i<CAN_MAXLINKS; i++)
+    if(can_links[i].users>0 && can_links[i].mon.sock>=0 && can_links[i].mon.sock==fd)
+      return &can_links[i];
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+void can_sync_done(void *ctx, int ret, unsigned long int val)
+  {
+  struct can_sync *sync = ctx;
+
+  sync->ret=ret;
+  sync->val=val;
+  sync->done=true;
+  }
+
+
+//-------------------------------------------------------------------
+
+// blocking read; it goes through the same in-flight table as the
+// asynchronous requests, so it coalesces with them
 
-  if(dt>=RX_TIMEOUT_SEC)
+int can_read_register(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int *val)
+  {
+  struct can_sync sync;
+  struct timeval tv;
+  fd_set rfds;
+  int ret;
+
+  // nothing left in flight without our answer: it is gone
+  sync.done=false;
+  sync.ret=CAN_ETIMEOUT;
+  if((ret=can_read_async(node, addr_hi, addr_lo, subindex, CAN_PRIO_INTERACTIVE, 0, can_sync_done, &sync))!=0)
+    return ret;
+
+  // now wait for MECOS response via an Ans_MPDO message
+  while(!sync.done)
     {
-    perror("Timed out");
+    if(can_next_timeout(&tv)!=0)
+      break;
+    FD_ZERO(&rfds);
+    FD_SET(node->sock, &rfds);
+    if(select(node->sock+1, &rfds, NULL, NULL, &tv) > 0)
+      can_receive(node);
+    can_tx_service();
+    can_expire();
+    canlink_service();
+    }
+
+  if(sync.ret==0)
+    *val=sync.val;
+  return sync.ret;
+  }
+
+
+//-------------------------------------------------------------------
+
+// read a known MECOS object; the answer also lands in the node cache
+
+int can_read_object(struct can_node *node, enum mecos_obj obj, unsigned long int *val)
+  {
+  const struct mecos_objdef *od;
+
+  od=&mecos_objs[obj];
+  return(can_read_register(node, od->addr_hi, od->addr_lo, od->subindex, val));
+  }
+
+
+//-------------------------------------------------------------------
+
+int can_read_object_async(struct can_node *node, enum mecos_obj obj, enum can_prio prio, long deadline_ms, can_done_fn done, void *ctx)
+  {
+  const struct mecos_objdef *od;
+
+  od=&mecos_objs[obj];
+  return(can_read_async(node, od->addr_hi, od->addr_lo, od->subindex, prio, deadline_ms, done, ctx));
+  }
+
+
+//-------------------------------------------------------------------
+
+// age of a cached MECOS value in ms; -1 if never read
+
+long can_cache_age_ms(struct can_node *node, enum mecos_obj obj)
+  {
+  struct timespec now;
+
+  if(!node->cache[obj].valid)
     return -1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec-node->cache[obj].ts.tv_sec)*1000L +
+         (now.tv_nsec-node->cache[obj].ts.tv_nsec)/1000000L;
+  }
+
+
+//-------------------------------------------------------------------
+
+// cached value and its age, safe from any thread; -1 if never read
+
+int can_cache_read(struct can_node *node, enum mecos_obj obj, unsigned long int *val, long *age_ms)
+  {
+  struct mecos_cache c;
+  struct timespec now;
+  unsigned int s1, s2;
+
+  do
+    {
+    s1=atomic_load_explicit(&node->cache_seq, memory_order_acquire);
+    c=node->cache[obj];
+    atomic_thread_fence(memory_order_acquire);
+    s2=atomic_load_explicit(&node->cache_seq, memory_order_relaxed);
     }
+  while((s1&1) || s1!=s2);
 
+  if(!c.valid)
+    return -1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  *val=c.val;
+  *age_ms=(now.tv_sec-c.ts.tv_sec)*1000L + (now.tv_nsec-c.ts.tv_nsec)/1000000L;
   return 0;
   }
 
 
 //-------------------------------------------------------------------
 
-int can_hz_setpoint_write(unsigned long int setpoint_hz)
+int can_hz_setpoint_write(struct can_node *node, unsigned long int setpoint_hz, can_done_fn done, void *ctx)
   {
-  return(can_write_register(0x20, 0x00, 0x00, setpoint_hz));
+  return(can_write_register(node, 0x20, 0x00, 0x00, setpoint_hz, CAN_PRIO_SETPOINT, done, ctx));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_hz_setpoint_read(unsigned long int *setpoint_hz_ptr)
+int can_hz_setpoint_read(struct can_node *node, unsigned long int *setpoint_hz_ptr)
   {
-  return(can_read_register(0x20, 0x00, 0x00, setpoint_hz_ptr));
+  return(can_read_object(node, MECOS_OBJ_HZ_SETP, setpoint_hz_ptr));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_hz_actual_read(unsigned long int *speed_hz_ptr)
+int can_hz_actual_read(struct can_node *node, unsigned long int *speed_hz_ptr)
   {
-  return(can_read_register(0x20, 0x01, 0x00, speed_hz_ptr));
+  return(can_read_object(node, MECOS_OBJ_HZ_ACT, speed_hz_ptr));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_liftup_state_read(bool *lifted)
+int can_liftup_state_read(struct can_node *node, bool *lifted)
   {
   unsigned long val;
   int ret;
 
-  ret=can_read_register(0x20, 0x0C, 0x00, &val);
+  ret=can_read_object(node, MECOS_OBJ_LIFTED, &val);
   if(ret==0)
     *lifted = (val!=0);
   
@@ -275,32 +1291,33 @@ int can_liftup_state_read(bool *lifted)
 
 //-------------------------------------------------------------------
 
-int can_liftup_state_write(bool lifted)
+int can_liftup_state_write(struct can_node *node, bool lifted, can_done_fn done, void *ctx)
   {
   // different CAN registers are used to lift up or down
+  // bearing state changes always go first
   if(lifted)
-    return(can_write_register(0x20, 0x11, 0x00, 1UL));
+    return(can_write_register(node, 0x20, 0x11, 0x00, 1UL, CAN_PRIO_SAFETY, done, ctx));
   else
-    return(can_write_register(0x20, 0x12, 0x00, 1UL));
+    return(can_write_register(node, 0x20, 0x12, 0x00, 1UL, CAN_PRIO_SAFETY, done, ctx));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_general_fault_read(unsigned long int *fault_ptr)
+int can_general_fault_read(struct can_node *node, unsigned long int *fault_ptr)
   {
-  return(can_read_register(0x20, 0x87, 0x00, fault_ptr));
+  return(can_read_object(node, MECOS_OBJ_FAULT, fault_ptr));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_rotation_state_read(bool *rotating)
+int can_rotation_state_read(struct can_node *node, bool *rotating)
   {
   unsigned long val;
   int ret;
 
-  ret=can_read_register(0x20, 0x80, 0x00, &val);
+  ret=can_read_object(node, MECOS_OBJ_ROTATING, &val);
   if(ret==0)
     *rotating = (val!=0);
   
@@ -310,24 +1327,24 @@ int can_rotation_state_read(bool *rotating)
 
 //-------------------------------------------------------------------
 
-int can_rotation_state_write(bool rotating)
+int can_rotation_state_write(struct can_node *node, bool rotating, can_done_fn done, void *ctx)
   {
   // different CAN registers are used to start or stop rotation
+  // stopping is a safety command, starting is an ordinary one
   if(rotating)
-    return(can_write_register(0x20, 0x0F, 0x00, 1UL));
+    return(can_write_register(node, 0x20, 0x0F, 0x00, 1UL, CAN_PRIO_SETPOINT, done, ctx));
   else
-    return(can_write_register(0x20, 0x10, 0x00, 1UL));
+    return(can_write_register(node, 0x20, 0x10, 0x00, 1UL, CAN_PRIO_SAFETY, done, ctx));
   }
 
 
 //-------------------------------------------------------------------
 
-int can_ext_ctl_enabled_read(bool *enabled)
+int can_ext_ctl_enabled_read(struct can_node *node, bool *enabled)
   {
   unsigned long val;
   int ret;
-  // CHANGE ME!!!!! we need the right register address from MECOS
-  ret=can_read_register(0x20, 0x25, 0x00, &val);
+  ret=can_read_object(node, MECOS_OBJ_EXTCTL, &val);
   if(ret==0)
     *enabled = (val!=0);
   
@@ -2,7 +2,7 @@
  ***                                            ***
  ***  chopsync CAN interface to MECOS           ***
  ***                                            ***
- ***  latest rev: aug  8 2024                   ***
+ ***  latest rev: oct 18 2026                   ***
  ***                                            ***
  **************************************************/ 
 // code derived from inno-maker USB-CAN interface sample code:
@@ -24,31 +24,266 @@
 #include <sys/socket.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/netlink.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#include "config.h"
+#include <time.h>
+#include <stdatomic.h>
+#include "canmon.h"
 // Special address description flags for CAN_ID
 #define CAN_EFF_FLAG 0x80000000U
 #define CAN_RTR_FLAG 0x40000000U
 #define CAN_ERR_FLAG 0x20000000U
 
-#define RX_TIMEOUT_SEC 1
+// a reader waits CAN_DEADLINE_MS for MECOS unless it asks otherwise;
+// within that time a request is sent up to 1+CAN_MAXRETRIES times, each
+// attempt waiting twice as long as the previous one, starting from
+// CAN_RTO_K times the p99 round trip of the object (CAN_RTO_INIT_MS
+// until CAN_RTO_MINSAMPLES answers have been seen)
+#define CAN_DEADLINE_MS     1000
+#define CAN_DEADLINE_MAX_MS 10000
+#define CAN_MAXRETRIES      3
+#define CAN_RTO_INIT_MS     250
+#define CAN_RTO_K           4
+#define CAN_RTO_MINSAMPLES  16
+#define CAN_RTO_MIN_US      2000
+#define CAN_RTO_MAX_US      500000
+#define CAN_RTO_MAXSHIFT    4
+
+// completion codes of the reads
+#define CAN_OK        0
+#define CAN_EFAIL    -1      // request could not be sent
+#define CAN_ETIMEOUT -2      // no answer before the deadline
+#define CAN_ELINK    -3      // the link is down, see canlink.h
+#define CAN_EBUSY    -4      // in-flight table or transmit queue full: later
+#define CAN_QUEUED    1      // a write waits in its transmit queue
+
+#define CAN_DEFAULT_IF   "can0"
+#define CAN_MAXLINKS     8
+#define CAN_MAXINFLIGHT  32
+#define CAN_MAXWAITERS   32
+
+#define CAN_BITRATE        1000000
+#define CAN_DEFAULT_BUDGET 50         // % of the bus for our own traffic
+#define CAN_BURST_BITS     1350       // ten full frames back to back
+#define CAN_TXQ_LEN        64
+
+// link state, as followed by the link manager (canlink.c)
+enum can_link_state
+  {
+  CAN_LINK_UP,
+  CAN_LINK_BUSOFF,             // controller bus-off, or no carrier
+  CAN_LINK_DOWN,               // interface administratively down
+  CAN_LINK_GONE,               // no such interface: adapter unplugged
+  CAN_LINK_NSTATES
+  };
+
+// transmit priority classes, most urgent first
+enum can_prio
+  {
+  CAN_PRIO_SAFETY,
+  CAN_PRIO_SETPOINT,
+  CAN_PRIO_INTERACTIVE,
+  CAN_PRIO_BACKGROUND,
+  CAN_NPRIO
+  };
+
+// MECOS AMB COB-IDs; each node adds its own node id offset
+#define MECOS_WR_MPDO  0x1C0
+#define MECOS_REQ_MPDO 0x340
+#define MECOS_ANS_MPDO 0x2C0
+
+// MECOS objects the server knows about; addresses are in mecos_objs[]
+enum mecos_obj
+  {
+  MECOS_OBJ_HZ_SETP,
+  MECOS_OBJ_HZ_ACT,
+  MECOS_OBJ_LIFTED,
+  MECOS_OBJ_ROTATING,
+  MECOS_OBJ_FAULT,
+  MECOS_OBJ_EXTCTL,
+  MECOS_NOBJ
+  };
+
+struct mecos_objdef
+  {
+  unsigned char addr_hi, addr_lo, subindex;
+  const char   *name;
+  };
+
+// last value successfully read from MECOS for each object
+struct mecos_cache
+  {
+  bool            valid;
+  unsigned long   val;
+  struct timespec ts;      // CLOCK_MONOTONIC time of the answer
+  };
+
+struct can_node;
+struct can_xact;
+
+// completion callback of an asynchronous read; ret is CAN_OK or CAN_ETIMEOUT
+// (of a queued write: 0 once it is on the bus, CAN_ELINK or CAN_EFAIL
+// if it is dropped; val is the value written)
+typedef void (*can_done_fn)(void *ctx, int ret, unsigned long int val);
+
+// a frame waiting for its turn; node==NULL marks a cancelled entry
+struct can_txent
+  {
+  struct can_node  *node;
+  struct can_frame  frame;
+  struct can_xact  *x;
+  can_done_fn       done;      // a write: told when it goes out or not
+  void             *ctx;
+  struct timespec   queued;
+  };
+
+struct can_txq
+  {
+  struct can_txent ent[CAN_TXQ_LEN];
+  int              head, count;
+  int              maxdepth;
+  long             maxwait_us;
+  unsigned long    sent, deferred, dropped;
+  };
+
+// a CAN interface, shared by all the nodes on that bus; the transmit
+// budget is a token bucket in bits, refilled at budget_bps
+struct can_link
+  {
+  char            ifname[IFNAMSIZ];
+  int             users;
+  double          budget_bps;
+  double          tokens;
+  struct timespec refill;
+  struct can_txq  txq[CAN_NPRIO];
+  struct canmon   mon;
+  // link manager
+  enum can_link_state state;
+  struct timespec since;
+  char            why[48];       // what took it down last
+  bool            fail_pending;  // in-flight work not failed yet
+  int             tries;         // reopen attempts since it went down
+  struct timespec next_try;
+  unsigned long   downs, reopens, reopen_fails;
+  pid_t           cfg_pid;       // sudo configuring it in the background
+  };
+
+// one MECOS AMB reachable on a CAN interface
+struct can_node
+  {
+  int                sock;
+  int                dev;            // index in devs[], for the journal
+  char               ifname[IFNAMSIZ];
+  unsigned int       nodeoff;
+  bool               present;
+  struct can_link   *link;
+  struct mecos_cache cache[MECOS_NOBJ];
+  // the cache is also read by the sampler thread: the seqlock counter
+  // is odd while an entry is being written
+  atomic_uint        cache_seq;
+  // round trip of the reads, per object; the extra slot is for
+  // registers that are not in mecos_objs[]
+  struct rtt_hist    rtt[MECOS_NOBJ+1];
+  // timeouts stay doubled this many times after a read needed retries
+  int                rto_shift[MECOS_NOBJ+1];
+  };
+
+struct can_waiter
+  {
+  can_done_fn     done;
+  void           *ctx;
+  struct timespec deadline;    // CLOCK_MONOTONIC
+  };
+
+// a REQ_MPDO on the bus and everybody waiting for its answer
+struct can_xact
+  {
+  bool              used;
+  struct can_node  *node;
+  unsigned char     addr_hi, addr_lo, subindex;
+  enum can_prio     prio;
+  bool              queued;    // request frame still in a transmit queue
+  struct can_txent *txent;
+  int               attempt;   // retries done so far
+  long              rto_us;    // timeout of the first attempt
+  struct timespec   sent;      // last transmission
+  struct timespec   expire;    // end of the current attempt
+  int               nwaiters;
+  struct can_waiter waiters[CAN_MAXWAITERS];
+  };
+
+// result holder for the blocking wrappers
+struct can_sync
+  {
+  bool              done;
+  int               ret;
+  unsigned long int val;
+  };
+
+extern const struct mecos_objdef mecos_objs[MECOS_NOBJ];
+extern const char               *can_prio_names[CAN_NPRIO];
+extern struct can_link           can_links[CAN_MAXLINKS];
+extern struct can_xact           can_inflight[CAN_MAXINFLIGHT];
+extern unsigned long             can_requests, can_coalesced, can_retries;
 
 
 /******* protos *******/
 
-int open_can(void);
-int close_can(void);
-int can_read_register(unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int *val);
-int can_write_register(unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int val);
-int can_wait_answer(struct can_frame *match_frame, unsigned long int *response);
-int can_hz_setpoint_write(unsigned long int setpoint_hz);
-int can_hz_setpoint_read(unsigned long int *setpoint_hz_ptr);
-int can_hz_actual_read(unsigned long int *speed_hz_ptr);
-int can_liftup_state_read(bool *lifted);
-int can_liftup_state_write(bool lifted);
-int can_general_fault_read(unsigned long int *fault_ptr);
-int can_rotation_state_read(bool *rotating);
-int can_rotation_state_write(bool rotating);
-int can_ext_ctl_enabled_read(bool *enabled);
+struct can_link *can_link_up(const char *ifname);
+int can_link_down(struct can_link *l);
+int can_rtnl_req(int sock, struct nlmsghdr *nh);
+struct rtattr *can_rtnl_attr(struct nlmsghdr *nh, int type, const void *data, size_t len);
+void can_rtnl_end(struct nlmsghdr *nh, struct rtattr *nest);
+int can_link_rtnl(const char *ifname);
+pid_t can_link_spawn(const char *ifname);
+void can_link_config(const char *ifname);
+int can_node_bind(struct can_node *node);
+int open_can(struct can_node *node);
+int close_can(struct can_node *node);
+int can_frame_bits(int dlc);
+void can_refill(struct can_link *l);
+int can_transmit(struct can_node *node, struct can_frame *frame);
+int can_send(struct can_node *node, struct can_frame *frame, enum can_prio prio, struct can_xact *x, can_done_fn done, void *ctx);
+void can_cancel(struct can_xact *x);
+void can_promote(struct can_xact *x, enum can_prio prio);
+void can_tx_done(struct can_txent *e, int ret);
+void can_tx_service(void);
+int can_tx_wait(double *left);
+int can_write_register(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int val, enum can_prio prio, can_done_fn done, void *ctx);
+int can_send_request(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, enum can_prio prio, struct can_xact *x);
+void can_ts_add_us(struct timespec *ts, long us);
+long can_ts_diff_us(const struct timespec *a, const struct timespec *b);
+long can_rto_us(struct can_node *node, int obj);
+void can_attempt_start(struct can_xact *x);
+int can_read_async(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, enum can_prio prio, long deadline_ms, can_done_fn done, void *ctx);
+int can_xact_obj(struct can_xact *x);
+void can_complete(struct can_xact *x, int ret, unsigned long int val);
+void can_receive(struct can_node *node);
+void can_retry(struct can_xact *x);
+void can_expire(void);
+int can_next_timeout(struct timeval *tv);
+struct can_link *can_link_by_monfd(int fd);
+void can_sync_done(void *ctx, int ret, unsigned long int val);
+int can_read_register(struct can_node *node, unsigned char addr_hi, unsigned char addr_lo, unsigned char subindex, unsigned long int *val);
+int can_read_object(struct can_node *node, enum mecos_obj obj, unsigned long int *val);
+int can_read_object_async(struct can_node *node, enum mecos_obj obj, enum can_prio prio, long deadline_ms, can_done_fn done, void *ctx);
+long can_cache_age_ms(struct can_node *node, enum mecos_obj obj);
+int can_cache_read(struct can_node *node, enum mecos_obj obj, unsigned long int *val, long *age_ms);
+int can_hz_setpoint_write(struct can_node *node, unsigned long int setpoint_hz, can_done_fn done, void *ctx);
+int can_hz_setpoint_read(struct can_node *node, unsigned long int *setpoint_hz_ptr);
+int can_hz_actual_read(struct can_node *node, unsigned long int *speed_hz_ptr);
+int can_liftup_state_read(struct can_node *node, bool *lifted);
+int can_liftup_state_write(struct can_node *node, bool lifted, can_done_fn done, void *ctx);
+int can_general_fault_read(struct can_node *node, unsigned long int *fault_ptr);
+int can_rotation_state_read(struct can_node *node, bool *rotating);
+int can_rotation_state_write(struct can_node *node, bool rotating, can_done_fn done, void *ctx);
+int can_ext_ctl_enabled_read(struct can_node *node, bool *enabled);
 
 #endif
@@ -0,0 +1,401 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync CAN link manager                 ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+int         canlink_nlsock = -1;
+const char *canlink_state_names[CAN_LINK_NSTATES] = { "UP", "BUS-OFF", "DOWN", "GONE" };
+
+
+//-------------------------------------------------------------------
+
+// the netlink socket for link events, or -1 (then link loss is still
+// seen from the sockets and error frames, only later); every link is
+// looked at once, an interface that is missing from the start goes on
+// the retry list like one that was lost
+
+int canlink_open(void)
+  {
+  struct sockaddr_nl sa;
+  enum can_link_state st;
+  int i;
+
+  canlink_nlsock=socket(AF_NETLINK, SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_ROUTE);
+  if(canlink_nlsock<0)
+    perror("CAN link events");
+  else
+    {
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family=AF_NETLINK;
+    sa.nl_groups=RTMGRP_LINK;
+    if(bind(canlink_nlsock, (struct sockaddr *)&sa, sizeof(sa))<0)
+      {
+      perror("CAN link events bind");
+      close(canlink_nlsock);
+      canlink_nlsock=-1;
+      }
+    }
+
+  for(i=0; i<CAN_MAXLINKS; i++)
+    if(can_links[i].users>0 && (st=canlink_probe(&can_links[i]))!=CAN_LINK_UP)
+      canlink_lost(&can_links[i], st, "at startup");
+  return canlink_nlsock;
+  }
+
+
+//-------------------------------------------------------------------
+
+// what the kernel says about the interface right now
+
+enum can_link_state canlink_probe(struct can_link *l)
+  {
+  struct ifreq ifr;
+  int sock, ret;
+
+  if(if_nametoindex(l->ifname)==0)
+    return CAN_LINK_GONE;
+  sock=socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+  if(sock<0)
+    return l->state;
+  memset(&ifr, 0, sizeof(ifr));
+  strcpy(ifr.ifr_name, l->ifname);
+  ret=ioctl(sock, SIOCGIFFLAGS, &ifr);
+  close(sock);
+  if(ret<0)
+    return (errno==ENODEV)? CAN_LINK_GONE : l->state;
+  if(!(ifr.ifr_flags & IFF_UP))
+    return CAN_LINK_DOWN;
+  // a CAN controller in bus-off has no carrier
+  if(!(ifr.ifr_flags & IFF_RUNNING))
+    return CAN_LINK_BUSOFF;
+  return CAN_LINK_UP;
+  }
+
+
+//-------------------------------------------------------------------
+
+// only marks the link: this is called from inside the transmit loops,
+// the in-flight work is failed later by canlink_service()
+
+void canlink_lost(struct can_link *l, enum can_link_state state, const char *why)
+  {
+  if(state==CAN_LINK_UP || state==l->state)
+    return;
+  fprintf(stderr, "CAN %s: link %s -> %s (%s)\n", l->ifname,
+          canlink_state_names[l->state], canlink_state_names[state], why);
+  snprintf(l->why, sizeof(l->why), "%s", why);
+  if(l->state==CAN_LINK_UP)
+    {
+    l->downs++;
+    l->tries=0;
+    clock_gettime(CLOCK_MONOTONIC, &l->since);
+    l->next_try=l->since;
+    can_ts_add_us(&l->next_try, CANLINK_RETRY_MS*1000L);
+    }
+  l->state=state;
+  l->fail_pending=true;
+  }
+
+
+//-------------------------------------------------------------------
+
+void canlink_up(struct can_link *l)
+  {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(l->state!=CAN_LINK_UP)
+    fprintf(stderr, "CAN %s: link up again after %.1f s\n", l->ifname, can_ts_diff_us(&now, &l->since)/1.e6);
+  l->state=CAN_LINK_UP;
+  l->since=now;
+  l->tries=0;
+  // a fresh burst, the queues are empty
+  l->tokens=CAN_BURST_BITS;
+  l->refill=now;
+  }
+
+
+//-------------------------------------------------------------------
+
+// every read in flight on the link ends with CAN_ELINK and the queued
+// frames are dropped (writes with CAN_ELINK too, see can_tx_done());
+// nothing goes out late when the link comes back
+
+void canlink_fail(struct can_link *l)
+  {
+  struct can_xact  *x;
+  struct can_txq   *q;
+  struct can_txent  e;
+  int i, p, head, count;
+
+  for(i=0; i<CAN_MAXINFLIGHT; i++)
+    {
+    x=&can_inflight[i];
+    if(x->used && x->node->link==l)
+      can_complete(x, CAN_ELINK, 0);
+    }
+  for(p=0; p<CAN_NPRIO; p++)
+    {
+    q=&l->txq[p];
+    head=q->head;
+    count=q->count;
+    q->head=0;
+    q->count=0;
+    // nothing is queued again meanwhile: the link is not up
+    for(i=0; i<count; i++)
+      {
+      e=q->ent[(head+i)%CAN_TXQ_LEN];
+      if(e.node==NULL)
+        continue;
+      q->dropped++;
+      if(e.x==NULL)
+        can_tx_done(&e, CAN_ELINK);
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// link messages from the kernel; what they say about our interfaces
+// is taken as is, one that is back is reopened right away
+
+void canlink_event(void)
+  {
+  canlink_events(0);
+  }
+
+
+//-------------------------------------------------------------------
+
+// all link messages queued; those about interface skip (an ifindex,
+// 0 for none) are ignored
+
+void canlink_events(unsigned int skip)
+  {
+  char buf[8192];
+  struct nlmsghdr  *nh;
+  struct ifinfomsg *ifi;
+  struct rtattr    *rta;
+  struct can_link  *l;
+  enum can_link_state st;
+  const char *name;
+  ssize_t n;
+  int len, i;
+
+  while((n=recv(canlink_nlsock, buf, sizeof(buf), MSG_DONTWAIT))>0)
+    {
+    for(nh=(struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n); nh=NLMSG_NEXT(nh, n))
+      {
+      if(nh->nlmsg_type!=RTM_NEWLINK && nh->nlmsg_type!=RTM_DELLINK)
+        continue;
+      ifi=NLMSG_DATA(nh);
+      if(skip!=0 && ifi->ifi_index==(int)skip)
+        continue;
+      name=NULL;
+      len=IFLA_PAYLOAD(nh);
+      for(rta=IFLA_RTA(ifi); RTA_OK(rta, len); rta=RTA_NEXT(rta, len))
+        if(rta->rta_type==IFLA_IFNAME)
+          name=RTA_DATA(rta);
+      if(name==NULL)
+        continue;
+
+      l=NULL;
+      for(i=0; i<CAN_MAXLINKS; i++)
+        if(can_links[i].users>0 && strcmp(can_links[i].ifname, name)==0)
+          l=&can_links[i];
+      if(l==NULL)
+        continue;
+
+      if(nh->nlmsg_type==RTM_DELLINK)
+        st=CAN_LINK_GONE;
+      else if(!(ifi->ifi_flags & IFF_UP))
+        st=CAN_LINK_DOWN;
+      else if(!(ifi->ifi_flags & IFF_RUNNING))
+        st=CAN_LINK_BUSOFF;
+      else
+        st=CAN_LINK_UP;
+
+      if(st!=CAN_LINK_UP && l->state!=CAN_LINK_GONE)
+        canlink_lost(l, st, "netlink");
+      else if(l->state!=CAN_LINK_UP && (st==CAN_LINK_UP || nh->nlmsg_type==RTM_NEWLINK))
+        {
+        // plugged in again, or brought up by hand
+        clock_gettime(CLOCK_MONOTONIC, &l->next_try);
+        l->tries=0;
+        }
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// after the bus monitor has read its error frames: bus-off takes the
+// link down, and a controller that restarted by itself (restart-ms)
+// brings it back without us
+
+void canlink_check(struct can_link *l)
+  {
+  if(l->mon.state==CAN_STATE_BUSOFF && l->state==CAN_LINK_UP)
+    canlink_lost(l, CAN_LINK_BUSOFF, "bus-off");
+  else if(l->mon.state!=CAN_STATE_BUSOFF && l->state==CAN_LINK_BUSOFF && canlink_probe(l)==CAN_LINK_UP)
+    canlink_up(l);
+  }
+
+
+//-------------------------------------------------------------------
+
+// configure the interface again and rebind every socket on it
+// returns 0 if the link is up
+// configuring takes a few rtnetlink requests the kernel answers at
+// once; without CAP_NET_ADMIN the sudo commands run in a child, and
+// the sockets are bound on a later try, once it is done
+
+int canlink_reopen(struct can_link *l)
+  {
+  struct timespec now;
+  unsigned int ifindex;
+  enum can_link_state st;
+  long wait_ms;
+  int i, ok, ret;
+  bool configured;
+
+  configured=false;
+  if(l->cfg_pid>0)
+    {
+    if(waitpid(l->cfg_pid, NULL, WNOHANG)==0)
+      {
+      // still at it; its link messages bring us back sooner
+      clock_gettime(CLOCK_MONOTONIC, &l->next_try);
+      can_ts_add_us(&l->next_try, CANLINK_RETRY_MS*1000L);
+      return -1;
+      }
+    l->cfg_pid=0;
+    configured=true;
+    }
+
+  l->tries++;
+  ok=0;
+  st=CAN_LINK_DOWN;
+  ifindex=if_nametoindex(l->ifname);
+  if(ifindex!=0 && !configured)
+    {
+    ret=can_link_rtnl(l->ifname);
+    if((ret==-EPERM || ret==-EACCES) && (l->cfg_pid=can_link_spawn(l->ifname))>0)
+      {
+      clock_gettime(CLOCK_MONOTONIC, &l->next_try);
+      can_ts_add_us(&l->next_try, CANLINK_RETRY_MS*1000L);
+      return -1;
+      }
+    if(l->cfg_pid<0)
+      l->cfg_pid=0;
+    // our own down/up is no news; other interfaces' is
+    if(canlink_nlsock>=0)
+      canlink_events(ifindex);
+    }
+  if(ifindex!=0)
+    {
+    ok=1;
+    for(i=0; i<ndevs; i++)
+      if(devs[i].can.present && devs[i].can.link==l && can_node_bind(&devs[i].can)!=0)
+        ok=0;
+    if(l->mon.sock>=0 && canmon_bind(&l->mon, ifindex)==0)
+      {
+      // the controller was reset with the interface
+      l->mon.state=CAN_STATE_ACTIVE;
+      l->mon.txerr=0;
+      l->mon.rxerr=0;
+      clock_gettime(CLOCK_MONOTONIC, &l->mon.state_since);
+      }
+    }
+
+  if(ok && (st=canlink_probe(l))==CAN_LINK_UP)
+    {
+    l->reopens++;
+    canlink_up(l);
+    return 0;
+    }
+
+  l->reopen_fails++;
+  // sockets that would not bind count as down
+  if(ifindex==0)
+    st=CAN_LINK_GONE;
+  if(st!=l->state)
+    {
+    fprintf(stderr, "CAN %s: link %s -> %s (reopen)\n", l->ifname,
+            canlink_state_names[l->state], canlink_state_names[st]);
+    l->state=st;
+    }
+  wait_ms=CANLINK_RETRY_MS;
+  for(i=1; i<l->tries && wait_ms<CANLINK_RETRY_MAX_MS; i++)
+    wait_ms*=2;
+  if(wait_ms>CANLINK_RETRY_MAX_MS)
+    wait_ms=CANLINK_RETRY_MAX_MS;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  l->next_try=now;
+  can_ts_add_us(&l->next_try, wait_ms*1000L);
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// once per pass of the main loop: fail what was waiting on a link that
+// was lost, and try to bring back the links whose turn it is
+
+void canlink_service(void)
+  {
+  struct can_link *l;
+  struct timespec now;
+  int i;
+
+  for(i=0; i<CAN_MAXLINKS; i++)
+    {
+    l=&can_links[i];
+    if(l->users==0)
+      continue;
+    if(l->fail_pending)
+      {
+      l->fail_pending=false;
+      canlink_fail(l);
+      }
+    if(l->state==CAN_LINK_UP)
+      continue;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(can_ts_diff_us(&now, &l->next_try)>=0)
+      canlink_reopen(l);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// time left before the next reopen, if less than *left
+// returns -1 if every link is up
+
+int canlink_wait(double *left)
+  {
+  struct timespec now;
+  double dt;
+  int i, found;
+
+  found=-1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for(i=0; i<CAN_MAXLINKS; i++)
+    {
+    if(can_links[i].users==0 || (can_links[i].state==CAN_LINK_UP && !can_links[i].fail_pending))
+      continue;
+    found=0;
+    dt=can_links[i].fail_pending? 0 : can_ts_diff_us(&can_links[i].next_try, &now)/1.e6;
+    if(dt<*left)
+      *left=dt;
+    }
+  return found;
+  }
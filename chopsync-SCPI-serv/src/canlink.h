@@ -0,0 +1,63 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync CAN link manager                 ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// the state of every CAN interface in use is followed from three
+// sources: netlink link events (interface removed, down, no carrier),
+// the error frames seen by the bus monitor (controller bus-off) and
+// the errors of the node sockets themselves (ENODEV, ENETDOWN)
+//
+// while a link is not up nothing is sent on it: reads and writes fail
+// at once with CAN_ELINK ("ERR: CAN LINK DOWN" to the client) instead
+// of waiting for their deadline, and what was in flight or queued is
+// failed the same way on the next pass of the main loop
+//
+// a link that is not up is reopened every CANLINK_RETRY_MS, backing off
+// to CANLINK_RETRY_MAX_MS, or at once when netlink reports it back:
+// the interface is configured again (which also restarts a controller
+// that went bus-off) and new sockets are bound and dup2()ed onto the
+// old descriptors, so that nothing else has to know
+// the main loop never waits for the configuration: it is done with
+// rtnetlink, or without the right to, by sudo in a child process
+
+#ifndef CANLINK_H
+#define CANLINK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include "can.h"
+
+#define CANLINK_RETRY_MS     500
+#define CANLINK_RETRY_MAX_MS 8000
+
+extern int         canlink_nlsock;
+extern const char *canlink_state_names[CAN_LINK_NSTATES];
+
+
+/******* protos *******/
+
+int  canlink_open(void);
+enum can_link_state canlink_probe(struct can_link *l);
+void canlink_lost(struct can_link *l, enum can_link_state state, const char *why);
+void canlink_up(struct can_link *l);
+void canlink_fail(struct can_link *l);
+void canlink_event(void);
+void canlink_events(unsigned int skip);
+void canlink_check(struct can_link *l);
+int  canlink_reopen(struct can_link *l);
+void canlink_service(void);
+int  canlink_wait(double *left);
+
+#endif
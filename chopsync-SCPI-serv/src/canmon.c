@@ -0,0 +1,222 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync CAN bus health monitor           ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "can.h"
+
+/***  globals  ***/
+const char *can_state_names[CAN_NSTATES] = { "ERROR-ACTIVE", "ERROR-WARNING", "ERROR-PASSIVE", "BUS-OFF" };
+
+
+//-------------------------------------------------------------------
+
+void canmon_reset(struct canmon *m)
+  {
+  memset(m, 0, sizeof(*m));
+  clock_gettime(CLOCK_MONOTONIC, &m->window_start);
+  m->state_since=m->window_start;
+  m->sock=-1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// without the interface (ifindex 0) the socket is kept unbound, for
+// canmon_bind() to bind it when the interface shows up; returns -1 if
+// the monitor is not bound
+
+int canmon_open(struct canmon *m, int ifindex)
+  {
+  can_err_mask_t errmask;
+
+  canmon_reset(m);
+  m->sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if(m->sock < 0)
+    {
+    perror("CAN monitor socket");
+    return -1;
+    }
+
+  // no CAN_RAW_FILTER: the default filter passes every frame;
+  // error frames must be asked for explicitly
+  errmask = CAN_ERR_MASK;
+  setsockopt(m->sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errmask, sizeof(errmask));
+
+  // ifindex 0 would bind to every CAN interface
+  if(ifindex==0)
+    return -1;
+  return canmon_bind(m, ifindex);
+  }
+
+
+//-------------------------------------------------------------------
+
+// bind to the interface; a socket bound before (to an interface that
+// went away) is replaced by a new one on the same fd
+
+int canmon_bind(struct canmon *m, int ifindex)
+  {
+  struct sockaddr_can addr;
+  can_err_mask_t errmask;
+  int sock;
+
+  if(m->sock<0 || ifindex==0)
+    return -1;
+  sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if(sock < 0)
+    {
+    perror("CAN monitor socket");
+    return -1;
+    }
+  errmask = CAN_ERR_MASK;
+  setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errmask, sizeof(errmask));
+
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifindex;
+  if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || dup2(sock, m->sock) < 0)
+    {
+    perror("CAN monitor bind");
+    close(sock);
+    return -1;
+    }
+  close(sock);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void canmon_close(struct canmon *m)
+  {
+  if(m->sock>=0)
+    close(m->sock);
+  m->sock=-1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// close the load window if it is over; an idle bus is accounted for
+// when the next frame arrives or somebody asks
+
+void canmon_window(struct canmon *m, struct timespec *now)
+  {
+  double dt;
+
+  dt=(now->tv_sec-m->window_start.tv_sec)*1000. + (now->tv_nsec-m->window_start.tv_nsec)/1.e6;
+  if(dt<LOAD_WINDOW_MS)
+    return;
+
+  m->load=100.*m->window_bits/(CAN_BITRATE*dt/1000.);
+  if(m->load>m->load_peak)
+    m->load_peak=m->load;
+  m->window_bits=0;
+  m->window_start=*now;
+  }
+
+
+//-------------------------------------------------------------------
+
+void canmon_error(struct canmon *m, struct can_frame *frame)
+  {
+  enum can_ctrl_state newstate;
+  canid_t cls;
+
+  m->errframes++;
+  cls=frame->can_id & CAN_ERR_MASK;
+  newstate=m->state;
+
+  if(cls & CAN_ERR_TX_TIMEOUT)
+    m->txtimeout++;
+  if(cls & CAN_ERR_LOSTARB)
+    m->arblost++;
+  if(cls & CAN_ERR_PROT)
+    m->proterr++;
+  if(cls & CAN_ERR_ACK)
+    m->ackerr++;
+  if(cls & CAN_ERR_CRTL)
+    {
+    if(frame->data[1] & CAN_ERR_CRTL_RX_OVERFLOW)
+      m->rxoverflow++;
+    if(frame->data[1] & CAN_ERR_CRTL_TX_OVERFLOW)
+      m->txoverflow++;
+    if(frame->data[1] & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+      newstate=CAN_STATE_PASSIVE;
+    else if(frame->data[1] & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+      newstate=CAN_STATE_WARNING;
+    else if(frame->data[1] & CAN_ERR_CRTL_ACTIVE)
+      newstate=CAN_STATE_ACTIVE;
+    }
+  if(cls & CAN_ERR_CNT)
+    {
+    m->txerr=frame->data[6];
+    m->rxerr=frame->data[7];
+    }
+  if(cls & CAN_ERR_BUSOFF)
+    {
+    m->busoff++;
+    newstate=CAN_STATE_BUSOFF;
+    }
+  if(cls & CAN_ERR_RESTARTED)
+    {
+    m->restarts++;
+    newstate=CAN_STATE_ACTIVE;
+    }
+
+  if(newstate!=m->state)
+    {
+    fprintf(stderr, "CAN controller state %s -> %s\n", can_state_names[m->state], can_state_names[newstate]);
+    m->state=newstate;
+    clock_gettime(CLOCK_MONOTONIC, &m->state_since);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void canmon_receive(struct canmon *m)
+  {
+  struct can_frame frame;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  while(recv(m->sock, &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame))
+    {
+    if(frame.can_id & CAN_ERR_FLAG)
+      {
+      canmon_error(m, &frame);
+      continue;
+      }
+    m->frames++;
+    canmon_window(m, &now);
+    m->window_bits+=can_frame_bits(frame.can_dlc);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void rtt_add(struct rtt_hist *h, long us)
+  {
+  loghist_add(h->bin, RTT_NBINS, RTT_BIN0_US, (us>0)? (unsigned long)us : 0);
+  if(h->n==0 || us<h->min_us)
+    h->min_us=us;
+  if(us>h->max_us)
+    h->max_us=us;
+  h->sum_us+=us;
+  h->n++;
+  }
+
+
+//-------------------------------------------------------------------
+
+// -1 if there are no samples
+
+long rtt_percentile(struct rtt_hist *h, double pct)
+  {
+  return loghist_percentile(h->bin, RTT_NBINS, RTT_BIN0_US, h->n, h->min_us, h->max_us, pct);
+  }
@@ -0,0 +1,86 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync CAN bus health monitor           ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// every CAN interface gets a monitor socket that sees all the traffic
+// on the bus (ours included, through the default loopback) plus the
+// error frames generated by the controller; from these we track the
+// controller state and estimate bus utilisation
+// round trip times of MECOS requests are kept per object as log2
+// histograms, see can_complete()
+
+#ifndef CANMON_H
+#define CANMON_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/can/error.h>
+#include "loghist.h"
+
+// log2 bins (loghist.h): bin 0 is < RTT_BIN0_US, bin k is
+// [RTT_BIN0_US<<(k-1), RTT_BIN0_US<<k)
+// and the last bin is open ended
+#define RTT_BIN0_US    128
+#define RTT_NBINS      14
+
+#define LOAD_WINDOW_MS 1000
+
+
+// controller state as reported by the error frames
+enum can_ctrl_state
+  {
+  CAN_STATE_ACTIVE,
+  CAN_STATE_WARNING,
+  CAN_STATE_PASSIVE,
+  CAN_STATE_BUSOFF,
+  CAN_NSTATES
+  };
+
+struct canmon
+  {
+  int                 sock;        // -1 if the monitor could not be opened
+  enum can_ctrl_state state;
+  struct timespec     state_since;
+  unsigned int        txerr, rxerr;
+  unsigned long       frames, errframes;
+  unsigned long       busoff, restarts, arblost, proterr, ackerr, txtimeout;
+  unsigned long       rxoverflow, txoverflow;
+  // bus load over the current and last complete window
+  unsigned long       window_bits;
+  struct timespec     window_start;
+  double              load, load_peak;
+  };
+
+struct rtt_hist
+  {
+  unsigned long n, timeouts, retries;
+  unsigned long bin[RTT_NBINS];
+  long          min_us, max_us;
+  double        sum_us;
+  };
+
+extern const char *can_state_names[CAN_NSTATES];
+
+
+/******* protos *******/
+
+void  canmon_reset(struct canmon *m);
+int   canmon_open(struct canmon *m, int ifindex);
+int   canmon_bind(struct canmon *m, int ifindex);
+void  canmon_close(struct canmon *m);
+void  canmon_window(struct canmon *m, struct timespec *now);
+void  canmon_error(struct canmon *m, struct can_frame *frame);
+void  canmon_receive(struct canmon *m);
+void  rtt_add(struct rtt_hist *h, long us);
+long  rtt_percentile(struct rtt_hist *h, double pct);
+
+#endif
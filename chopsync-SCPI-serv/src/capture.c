@@ -0,0 +1,430 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync triggered capture                ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+struct capturer capt[MAXDEV];
+struct cap_slot cap_slots[CAP_NSLOTS];
+// captures started so far; the sampler thread is the only writer
+unsigned long   cap_count;
+const char     *cap_edge_names[3] = { "FALL", "RISE", "ANY" };
+
+
+//-------------------------------------------------------------------
+
+// every device armed on the loss of phase lock
+
+void capture_open(void)
+  {
+  struct cap_trigger tr;
+  int i;
+
+  memset(&tr, 0, sizeof(tr));
+  tr.src=CAP_SRC_PHLOCK;
+  tr.flock=CAP_FALL;
+  tr.phlock=CAP_FALL;
+  tr.pre=CAP_DEFAULT_PRE;
+  tr.post=CAP_DEFAULT_POST;
+  for(i=0; i<ndevs; i++)
+    {
+    capt[i].slot=-1;
+    capture_arm(i, &tr);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// the sampler thread picks the new trigger up at its next sample; a
+// window being frozen is finished first
+
+void capture_arm(int dev, const struct cap_trigger *tr)
+  {
+  pthread_mutex_lock(&devs[dev].reglock);
+  capt[dev].next=*tr;
+  atomic_store(&capt[dev].rearm, true);
+  pthread_mutex_unlock(&devs[dev].reglock);
+  }
+
+
+//-------------------------------------------------------------------
+
+void capture_get(int dev, struct cap_trigger *tr)
+  {
+  pthread_mutex_lock(&devs[dev].reglock);
+  *tr=capt[dev].next;
+  pthread_mutex_unlock(&devs[dev].reglock);
+  }
+
+
+//-------------------------------------------------------------------
+
+void capture_force(int dev)
+  {
+  atomic_store(&capt[dev].force, true);
+  }
+
+
+//-------------------------------------------------------------------
+
+bool capture_edge(enum cap_edge edge, bool prev, bool now)
+  {
+  if(prev==now)
+    return false;
+  return edge==CAP_ANY || (edge==CAP_RISE)==now;
+  }
+
+
+//-------------------------------------------------------------------
+
+// trigger sources that fire on this sample; sampler thread
+
+unsigned int capture_check(struct capturer *c, struct chopdev *d, uint32_t status, uint32_t pherr)
+  {
+  const struct cap_trigger *tr;
+  unsigned long val;
+  unsigned int cause;
+  long age;
+  bool over, fault;
+  int n;
+
+  tr=&c->set;
+  n=(int)(pherr & PHERR_MASK);
+  n=(n ^ PHERR_SIGN)-PHERR_SIGN;
+  over=(tr->pherr_cnt>0 && (uint32_t)abs(n)>=tr->pherr_cnt);
+  fault=false;
+  if((tr->src & CAP_SRC_MECOS) && d->can.present &&
+     can_cache_read(&d->can, MECOS_OBJ_FAULT, &val, &age)==0)
+    fault=(val!=0);
+
+  cause=0;
+  if(c->have_prev)
+    {
+    if((tr->src & CAP_SRC_FLOCK) &&
+       capture_edge(tr->flock, (c->prev_status & FREQUENCY)!=0, (status & FREQUENCY)!=0))
+      cause|=CAP_SRC_FLOCK;
+    if((tr->src & CAP_SRC_PHLOCK) &&
+       capture_edge(tr->phlock, (c->prev_status & PHASE)!=0, (status & PHASE)!=0))
+      cause|=CAP_SRC_PHLOCK;
+    if((tr->src & CAP_SRC_PHERR) && over && !c->prev_over)
+      cause|=CAP_SRC_PHERR;
+    if((tr->src & CAP_SRC_MECOS) && fault && !c->prev_fault)
+      cause|=CAP_SRC_MECOS;
+    }
+  c->have_prev=true;
+  c->prev_status=status;
+  c->prev_over=over;
+  c->prev_fault=fault;
+  return cause;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the oldest slot no device is freezing into
+
+int capture_slot(void)
+  {
+  int best, k, i;
+
+  best=-1;
+  for(k=0; k<CAP_NSLOTS; k++)
+    {
+    for(i=0; i<ndevs && capt[i].slot!=k; i++)
+      ;
+    if(i<ndevs)
+      continue;
+    if(best<0 || cap_slots[k].info.id<cap_slots[best].info.id)
+      best=k;
+    }
+  return best;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the trigger fired on the newest sample, ring index head-1
+
+void capture_start(int dev, struct capturer *c, unsigned int cause, uint32_t status, uint64_t head, uint64_t t)
+  {
+  struct cap_slot *sl;
+  struct cap_info *in;
+  uint64_t trig;
+  uint32_t seq;
+
+  c->slot=capture_slot();
+  sl=&cap_slots[c->slot];
+  trig=head-1;
+  c->first=(trig>c->set.pre)? trig-c->set.pre : 0;
+  c->end=trig+c->set.post;
+  c->copied=c->first;
+  c->fired++;
+
+  seq=atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  atomic_store_explicit(&sl->seq, seq+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  in=&sl->info;
+  in->id=++cap_count;
+  in->dev=dev;
+  in->cause=cause;
+  in->status=status;
+  clock_gettime(CLOCK_REALTIME, &in->when);
+  in->t_trig=t;
+  in->rate_hz=smp.rate_hz;
+  in->pre=(unsigned int)(trig-c->first);
+  in->n=0;
+  in->total=(unsigned int)(c->end-c->first);
+  atomic_store_explicit(&sl->seq, seq+2, memory_order_release);
+  }
+
+
+//-------------------------------------------------------------------
+
+// copy what the ring has of the window, at most CAP_COPY_PER_TICK
+// samples; the window is at most half the ring and the copy outruns
+// the sampler, so nothing is overwritten before it is copied
+
+void capture_copy(int dev, struct capturer *c, uint64_t head)
+  {
+  struct cap_slot *sl;
+  struct smp_ring *r;
+  uint64_t last, i;
+  uint32_t seq;
+
+  sl=&cap_slots[c->slot];
+  r=&smp.ring[dev];
+  last=(head<c->end)? head : c->end;
+  if(last>c->copied+CAP_COPY_PER_TICK)
+    last=c->copied+CAP_COPY_PER_TICK;
+  if(last==c->copied)
+    return;
+
+  seq=atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  atomic_store_explicit(&sl->seq, seq+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for(i=c->copied; i<last; i++)
+    sl->s[i-c->first]=r->s[i&(SMP_RINGLEN-1)];
+  sl->info.n=(unsigned int)(last-c->first);
+  atomic_store_explicit(&sl->seq, seq+2, memory_order_release);
+
+  c->copied=last;
+  if(c->copied==c->end)
+    c->slot=-1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one step for a device, after the sample at time t; sampler thread
+
+void capture_step(int dev, uint64_t t)
+  {
+  struct capturer   *c;
+  struct chopdev    *d;
+  struct smp_sample *s;
+  unsigned int cause;
+  uint64_t head;
+
+  c=&capt[dev];
+  d=&devs[dev];
+  if(atomic_load_explicit(&c->rearm, memory_order_relaxed))
+    {
+    pthread_mutex_lock(&d->reglock);
+    c->set=c->next;
+    atomic_store(&c->rearm, false);
+    pthread_mutex_unlock(&d->reglock);
+    c->have_prev=false;
+    }
+
+  // this thread writes the ring: head is exact
+  head=atomic_load_explicit(&smp.ring[dev].head, memory_order_relaxed);
+  if(head==0)
+    return;
+  s=&smp.ring[dev].s[(head-1)&(SMP_RINGLEN-1)];
+
+  // edges keep being tracked while a window is frozen, so that they
+  // don't fire late
+  cause=capture_check(c, d, s->reg[SMP_IDX_STATUS], s->reg[SMP_IDX_PHERR]);
+  if(c->slot>=0)
+    {
+    capture_copy(dev, c, head);
+    return;
+    }
+  if(atomic_exchange(&c->force, false))
+    cause|=CAP_SRC_FORCE;
+  if(cause!=0)
+    {
+    capture_start(dev, c, cause, s->reg[SMP_IDX_STATUS], head, t);
+    capture_copy(dev, c, head);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// copy up to n samples of capture id from sample first on; returns
+// how many, -1 if there is no such capture, -2 if the sampler kept
+// writing it (try again)
+
+int capture_read(unsigned long id, struct cap_info *info, unsigned int first, struct smp_sample *out, unsigned int n)
+  {
+  struct cap_slot *sl;
+  unsigned int m;
+  uint32_t seq;
+  bool busy;
+  int k, try;
+
+  busy=false;
+  for(k=0; k<CAP_NSLOTS; k++)
+    {
+    sl=&cap_slots[k];
+    for(try=0; try<CAP_READ_TRIES; try++)
+      {
+      seq=atomic_load_explicit(&sl->seq, memory_order_acquire);
+      if(seq & 1)
+        continue;
+      *info=sl->info;
+      if(info->id!=id)
+        break;
+      m=(first>=info->n)? 0 : info->n-first;
+      if(m>n)
+        m=n;
+      if(m>0)
+        memcpy(out, &sl->s[first], m*sizeof(*out));
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&sl->seq, memory_order_relaxed)==seq)
+        return (int)m;
+      }
+    if(try==CAP_READ_TRIES)
+      busy=true;
+    }
+  return busy? -2 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the captures of a device, oldest first; returns how many
+// (a slot the sampler is writing at the moment may be missing)
+
+int capture_list(int dev, struct cap_info *info, int max)
+  {
+  struct cap_info in, t;
+  struct cap_slot *sl;
+  uint32_t seq;
+  int k, n, i, try;
+
+  n=0;
+  for(k=0; k<CAP_NSLOTS && n<max; k++)
+    {
+    sl=&cap_slots[k];
+    for(try=0; try<CAP_READ_TRIES; try++)
+      {
+      seq=atomic_load_explicit(&sl->seq, memory_order_acquire);
+      in=sl->info;
+      atomic_thread_fence(memory_order_acquire);
+      if(!(seq & 1) && atomic_load_explicit(&sl->seq, memory_order_relaxed)==seq)
+        break;
+      }
+    if(try==CAP_READ_TRIES || in.id==0 || in.dev!=dev)
+      continue;
+    // insertion by id
+    for(i=n; i>0 && info[i-1].id>in.id; i--)
+      {
+      t=info[i-1];
+      info[i]=t;
+      }
+    info[i]=in;
+    n++;
+    }
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+// in the syntax CAPTURE:TRIGGER takes, each source after a blank
+
+void capture_format_trigger(const struct cap_trigger *tr, struct out *o)
+  {
+  if(tr->src==0)
+    {
+    out_str(o, " OFF");
+    return;
+    }
+  if(tr->src & CAP_SRC_FLOCK)
+    {
+    out_str(o, " FLOCK ");
+    out_str(o, cap_edge_names[tr->flock]);
+    }
+  if(tr->src & CAP_SRC_PHLOCK)
+    {
+    out_str(o, " PHLOCK ");
+    out_str(o, cap_edge_names[tr->phlock]);
+    }
+  if(tr->src & CAP_SRC_PHERR)
+    {
+    // counts of 1/16 ns, exact in millionths of ns
+    out_str(o, " PHERR ");
+    out_fix(o, (int64_t)tr->pherr_cnt*62500, 6, false);
+    }
+  if(tr->src & CAP_SRC_MECOS)
+    out_str(o, " MECOS_FAULT");
+  }
+
+
+//-------------------------------------------------------------------
+
+void capture_format_cause(unsigned int cause, struct out *o)
+  {
+  static const char *const names[] = { "FLOCK", "PHLOCK", "PHERR", "MECOS_FAULT", "FORCE" };
+  bool first;
+  int i;
+
+  first=true;
+  for(i=0; i<5; i++)
+    if(cause & (1u<<i))
+      {
+      if(!first)
+        out_str(o, "+");
+      out_str(o, names[i]);
+      first=false;
+      }
+  }
+
+
+//-------------------------------------------------------------------
+
+// sample k of a capture, as one line:
+// <k-pre> <t-t_trig us> <FLOCK> <PHLOCK> <PHERR ns> <MECOS_CMD> <BUNCHFREQ> <CHOPFREQ>
+
+void capture_format_sample(const struct cap_info *info, unsigned int k, const struct smp_sample *s, struct out *o)
+  {
+  uint32_t st;
+  int n;
+
+  st=s->reg[SMP_IDX_STATUS];
+  out_int(o, (int64_t)k-(int64_t)info->pre, true);
+  out_str(o, " ");
+  out_fix(o, (int64_t)(s->t_ns-info->t_trig), 3, true);
+  out_str(o, (st & FREQUENCY)? " 1" : " 0");
+  out_str(o, (st & PHASE)? " 1 " : " 0 ");
+  n=(int)(s->reg[SMP_IDX_PHERR] & PHERR_MASK);
+  n=(n ^ PHERR_SIGN)-PHERR_SIGN;
+  out_fix(o, (int64_t)n*62500, 6, true);
+  out_str(o, " ");
+  n=(int)(s->reg[SMP_IDX_MECOSCMD] & MECOSCMD_MASK);
+  n=(n ^ MECOSCMD_SIGN)-MECOSCMD_SIGN;
+  out_int(o, n, true);
+  out_str(o, " ");
+  out_uint(o, s->reg[SMP_IDX_BUNCHFREQ]);
+  out_str(o, " ");
+  out_uint(o, s->reg[SMP_IDX_CHOPFREQ]);
+  out_str(o, "\n");
+  }
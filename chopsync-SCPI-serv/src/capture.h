@@ -0,0 +1,144 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync triggered capture                ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// oscilloscope-style capture of the loop signals around an event:
+// the sampler ring is the pre-trigger buffer (status, MECOS command,
+// phase error, bunch marker and chopper frequencies at the sampler
+// rate), and when the trigger of a device fires, the window
+//
+//   pre samples before the trigger, the trigger sample, post-1 after
+//
+// is frozen into a capture slot; the trigger re-arms once the window
+// is complete
+// trigger sources, any combination:
+//
+//   FLOCK  [FALL|RISE|ANY]   edge of the frequency lock bit
+//   PHLOCK [FALL|RISE|ANY]   edge of the phase lock bit
+//   PHERR  <ns>              |phase error| goes over the threshold
+//   MECOS_FAULT              MECOS fault goes active (from the CAN
+//                            cache, as fresh as the MECOS polling)
+//   FORCE                    CAPTURE:FORCE, by hand
+//
+// everything runs in the sampler thread, one step per sample: the
+// window is copied out of the ring CAP_COPY_PER_TICK samples at a time,
+// faster than the ring moves, so no sample period does a long copy
+// slots are shared by all devices and reused oldest first; each has a
+// sequence count, odd while the sampler writes it, so that readers in
+// the main thread see a capture whole or not at all
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "config.h"
+#include "device.h"
+#include "sampler.h"
+#include "scpi.h"
+
+#define CAP_NSLOTS        8
+#define CAP_MAXLEN        (SMP_RINGLEN/2)   // pre+post samples
+#define CAP_DEFAULT_PRE   1024
+#define CAP_DEFAULT_POST  1024
+#define CAP_COPY_PER_TICK 64
+#define CAP_PAGE          24                // samples per CAPTURE:DATA? answer (MAXANS)
+#define CAP_READ_TRIES    3
+
+// trigger sources
+#define CAP_SRC_FLOCK     0x01
+#define CAP_SRC_PHLOCK    0x02
+#define CAP_SRC_PHERR     0x04
+#define CAP_SRC_MECOS     0x08
+#define CAP_SRC_FORCE     0x10
+
+enum cap_edge
+  {
+  CAP_FALL,
+  CAP_RISE,
+  CAP_ANY
+  };
+
+struct cap_trigger
+  {
+  unsigned int  src;              // CAP_SRC_*, FORCE never set here
+  enum cap_edge flock, phlock;
+  uint32_t      pherr_cnt;        // threshold, sfix_24.7 counts
+  unsigned int  pre, post;
+  };
+
+// at most one window per device is being frozen, so there is always
+// a slot that is not
+#if CAP_NSLOTS < MAXDEV
+#error "CAP_NSLOTS must be at least MAXDEV"
+#endif
+
+struct cap_info
+  {
+  unsigned long   id;             // 0: never used
+  int             dev;
+  unsigned int    cause;          // CAP_SRC_* that fired
+  uint32_t        status;         // status register at the trigger
+  struct timespec when;           // CLOCK_REALTIME at the trigger
+  uint64_t        t_trig;         // CLOCK_MONOTONIC ns, as the samples
+  unsigned int    rate_hz;
+  unsigned int    pre;            // the trigger is sample pre
+  unsigned int    n, total;       // frozen so far, window length
+  };
+
+struct cap_slot
+  {
+  _Atomic uint32_t  seq;          // odd while being written
+  struct cap_info   info;
+  struct smp_sample s[CAP_MAXLEN];
+  };
+
+// per device; set/next are exchanged under the device's register lock
+struct capturer
+  {
+  atomic_bool        rearm;       // next is new
+  atomic_bool        force;
+  struct cap_trigger next;        // written by the main thread
+  struct cap_trigger set;         // in use by the sampler thread
+  bool               have_prev;
+  uint32_t           prev_status;
+  bool               prev_over, prev_fault;
+  // window being frozen; slot<0 if armed
+  int                slot;
+  uint64_t           first, end, copied;    // ring indexes
+  unsigned long      fired;
+  };
+
+extern struct capturer capt[MAXDEV];
+extern struct cap_slot cap_slots[CAP_NSLOTS];
+extern unsigned long   cap_count;
+extern const char     *cap_edge_names[3];
+
+
+/******* protos *******/
+
+void capture_open(void);
+void capture_arm(int dev, const struct cap_trigger *tr);
+void capture_get(int dev, struct cap_trigger *tr);
+void capture_force(int dev);
+bool capture_edge(enum cap_edge edge, bool prev, bool now);
+unsigned int capture_check(struct capturer *c, struct chopdev *d, uint32_t status, uint32_t pherr);
+void capture_start(int dev, struct capturer *c, unsigned int cause, uint32_t status, uint64_t head, uint64_t t);
+void capture_copy(int dev, struct capturer *c, uint64_t head);
+void capture_step(int dev, uint64_t t);
+int  capture_slot(void);
+int  capture_read(unsigned long id, struct cap_info *info, unsigned int first, struct smp_sample *out, unsigned int n);
+int  capture_list(int dev, struct cap_info *info, int max);
+void capture_format_trigger(const struct cap_trigger *tr, struct out *o);
+void capture_format_cause(unsigned int cause, struct out *o);
+void capture_format_sample(const struct cap_info *info, unsigned int k, const struct smp_sample *s, struct out *o);
+
+#endif
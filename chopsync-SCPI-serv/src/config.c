@@ -0,0 +1,636 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync server configuration file        ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+struct config cfg;
+
+
+//-------------------------------------------------------------------
+
+void config_defaults(void)
+  {
+  memset(&cfg, 0, sizeof(cfg));
+
+  cfg.port = PORT;
+
+  // a single device at the historical addresses
+  cfg.ndevs = 1;
+  cfg.dev[0].used = true;
+  cfg.dev[0].regbase = REGBANK_BASE;
+  strcpy(cfg.dev[0].canif, CAN_DEFAULT_IF);
+  cfg.dev[0].nodeoff = 0;
+
+  cfg.tm_port = 0;
+  cfg.tm_ttl = 1;
+  cfg.tm_ifaddr.s_addr = htonl(INADDR_ANY);
+
+  cfg.can_budget = CAN_DEFAULT_BUDGET;
+  cfg.mecos_poll = 0;
+
+  cfg.rt_rate = 0;
+  cfg.rt_cpu = SMP_DEFAULT_CPU;
+  cfg.rt_prio = SMP_DEFAULT_PRIO;
+  cfg.rt_maincpu = SMP_DEFAULT_MAINCPU;
+
+  cfg.sv_on = false;
+  cfg.sv_attempts = SV_DEFAULT_ATTEMPTS;
+  cfg.sv_timeout_ms = SV_DEFAULT_TIMEOUT_MS;
+  cfg.sv_settle_ms = SV_DEFAULT_SETTLE_MS;
+  cfg.sv_mecos_age_ms = SV_DEFAULT_MECOS_AGE_MS;
+
+  cfg.http_port = 0;
+  cfg.http_rate = HTTP_DEFAULT_RATE;
+  cfg.http_write = false;
+  cfg.http_norigins = 0;
+
+  cfg.maxclients = CONN_DEFAULT_CLIENTS;
+  cfg.lim_can_rate = SCHED_DEFAULT_CAN_RATE;
+  cfg.lim_can_burst = SCHED_DEFAULT_CAN_BURST;
+  cfg.lim_write_rate = 0;
+  cfg.lim_write_burst = 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// decimal or 0x-prefixed hex; the whole token must be a number
+
+int conf_number(const char *p, unsigned long *val)
+  {
+  char *end;
+
+  if(p==NULL || *p==0)
+    return -1;
+  errno=0;
+  *val=strtoul(p, &end, 0);
+  if(errno!=0 || *end!=0)
+    return -1;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_DEVICE(int lineno)
+  {
+  char *p;
+  unsigned long n, base, off;
+  struct devconf *d;
+  int i;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&n)!=0 || n>=MAXDEV)
+    {
+    fprintf(stderr,"config line %d: bad device number (max %d)\n", lineno, MAXDEV-1);
+    return -1;
+    }
+  d=&cfg.dev[n];
+  if(d->used)
+    {
+    fprintf(stderr,"config line %d: device %lu already defined\n", lineno, n);
+    return -1;
+    }
+
+  // mapped with mmap, so it has to sit on a page boundary
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&base)!=0)
+    {
+    fprintf(stderr,"config line %d: bad register bank base\n", lineno);
+    return -1;
+    }
+  if(base%(unsigned long)sysconf(_SC_PAGESIZE)!=0)
+    {
+    fprintf(stderr,"config line %d: register bank base 0x%lX not aligned to the %ld byte page\n", lineno, base, sysconf(_SC_PAGESIZE));
+    return -1;
+    }
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL || strlen(p)>=IFNAMSIZ)
+    {
+    fprintf(stderr,"config line %d: bad CAN interface name\n", lineno);
+    return -1;
+    }
+  strcpy(d->canif, p);
+
+  // node id offset is optional
+  off=0;
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL && conf_number(p,&off)!=0)
+    {
+    fprintf(stderr,"config line %d: bad node id offset\n", lineno);
+    return -1;
+    }
+
+  // the answers of two devices on one node can't be told apart (and
+  // their reads would be coalesced)
+  for(i=0; i<MAXDEV; i++)
+    if(cfg.dev[i].used && strcmp(cfg.dev[i].canif, d->canif)==0 && cfg.dev[i].nodeoff==off)
+      {
+      fprintf(stderr,"config line %d: %s node id offset 0x%02lX already used by device %d\n", lineno, d->canif, off, i);
+      return -1;
+      }
+
+  d->used=true;
+  d->regbase=base;
+  d->nodeoff=(unsigned int)off;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_TELEMETRY(int lineno)
+  {
+  char *p;
+  unsigned long n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL || inet_aton(p, &cfg.tm_group)==0 || !IN_MULTICAST(ntohl(cfg.tm_group.s_addr)))
+    {
+    fprintf(stderr,"config line %d: bad telemetry multicast group\n", lineno);
+    return -1;
+    }
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&n)!=0 || n==0 || n>65535)
+    {
+    fprintf(stderr,"config line %d: bad telemetry port\n", lineno);
+    return -1;
+    }
+  cfg.tm_port=(int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&n)!=0 || n>TELEMETRY_MAXRATE)
+    {
+    fprintf(stderr,"config line %d: telemetry rate must be 0..%d Hz\n", lineno, TELEMETRY_MAXRATE);
+    return -1;
+    }
+  cfg.tm_rate=(unsigned int)n;
+
+  // optional ttl and outgoing interface
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL)
+    {
+    if(conf_number(p,&n)!=0 || n>255)
+      {
+      fprintf(stderr,"config line %d: bad telemetry ttl\n", lineno);
+      return -1;
+      }
+    cfg.tm_ttl=(int)n;
+    p=strtok(NULL,CONF_DELIMS);
+    if(p!=NULL && inet_aton(p, &cfg.tm_ifaddr)==0)
+      {
+      fprintf(stderr,"config line %d: bad telemetry interface address\n", lineno);
+      return -1;
+      }
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_REALTIME(int lineno)
+  {
+  char *p;
+  unsigned long n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&n)!=0 || n>SMP_MAXRATE)
+    {
+    fprintf(stderr,"config line %d: sample rate must be 0..%d Hz\n", lineno, SMP_MAXRATE);
+    return -1;
+    }
+  cfg.rt_rate=(unsigned int)n;
+
+  // optional sampler cpu, priority and main thread cpu
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n>=SMP_MAXCPU)
+    {
+    fprintf(stderr,"config line %d: bad sampler cpu\n", lineno);
+    return -1;
+    }
+  cfg.rt_cpu=(int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n<1 || n>99)
+    {
+    fprintf(stderr,"config line %d: SCHED_FIFO priority must be 1..99\n", lineno);
+    return -1;
+    }
+  cfg.rt_prio=(int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n>=SMP_MAXCPU)
+    {
+    fprintf(stderr,"config line %d: bad main thread cpu\n", lineno);
+    return -1;
+    }
+  cfg.rt_maincpu=(int)n;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_SUPERVISOR(int lineno)
+  {
+  char *p;
+  unsigned long n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL && strcasecmp(p,"ON")==0)
+    cfg.sv_on=true;
+  else if(p!=NULL && strcasecmp(p,"OFF")==0)
+    cfg.sv_on=false;
+  else
+    {
+    fprintf(stderr,"config line %d: SUPERVISOR must be ON or OFF\n", lineno);
+    return -1;
+    }
+
+  // optional limits
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n<1 || n>100)
+    {
+    fprintf(stderr,"config line %d: supervisor attempts must be 1..100\n", lineno);
+    return -1;
+    }
+  cfg.sv_attempts=(unsigned int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n<1 || n>600000)
+    {
+    fprintf(stderr,"config line %d: bad supervisor lock timeout\n", lineno);
+    return -1;
+    }
+  cfg.sv_timeout_ms=(unsigned int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n>10000)
+    {
+    fprintf(stderr,"config line %d: bad supervisor settle time\n", lineno);
+    return -1;
+    }
+  cfg.sv_settle_ms=(unsigned int)n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL)
+    return 0;
+  if(conf_number(p,&n)!=0 || n>3600000)
+    {
+    fprintf(stderr,"config line %d: bad MECOS max age\n", lineno);
+    return -1;
+    }
+  cfg.sv_mecos_age_ms=(unsigned int)n;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_UNIX(int lineno)
+  {
+  struct unixconf *u;
+  char *p;
+  unsigned long n;
+  int i;
+
+  for(i=0; i<MAXUNIX && cfg.ux[i].used; i++)
+    ;
+  if(i==MAXUNIX)
+    {
+    fprintf(stderr,"config line %d: at most %d UNIX listeners\n", lineno, MAXUNIX);
+    return -1;
+    }
+  u=&cfg.ux[i];
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL || strlen(p)<2 || strlen(p)>=MAXUNIXPATH)
+    {
+    fprintf(stderr,"config line %d: bad UNIX socket name\n", lineno);
+    return -1;
+    }
+  strcpy(u->path, p);
+  u->type=SOCK_STREAM;
+  u->wuid=-1;
+  u->wgid=-1;
+
+  // optional socket type and writers
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL)
+    {
+    if(strcasecmp(p,"SEQPACKET")==0)
+      u->type=SOCK_SEQPACKET;
+    else if(strcasecmp(p,"STREAM")!=0)
+      {
+      fprintf(stderr,"config line %d: UNIX socket type must be STREAM or SEQPACKET\n", lineno);
+      return -1;
+      }
+    p=strtok(NULL,CONF_DELIMS);
+    }
+  if(p!=NULL)
+    {
+    if(conf_number(p,&n)!=0 || n>=(unsigned long)(uid_t)-1)
+      {
+      fprintf(stderr,"config line %d: bad writer uid\n", lineno);
+      return -1;
+      }
+    u->wuid=(long)n;
+    p=strtok(NULL,CONF_DELIMS);
+    }
+  if(p!=NULL)
+    {
+    if(conf_number(p,&n)!=0 || n>=(unsigned long)(gid_t)-1)
+      {
+      fprintf(stderr,"config line %d: bad writer gid\n", lineno);
+      return -1;
+      }
+    u->wgid=(long)n;
+    }
+
+  u->used=true;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int parse_HTTP(int lineno)
+  {
+  char *p;
+  unsigned long n;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&n)!=0 || n==0 || n>65535)
+    {
+    fprintf(stderr,"config line %d: bad HTTP port\n", lineno);
+    return -1;
+    }
+  cfg.http_port=(int)n;
+
+  // optional WebSocket push rate, and WRITE
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL && strcasecmp(p,"WRITE")!=0)
+    {
+    if(conf_number(p,&n)!=0 || n>HTTP_MAXRATE)
+      {
+      fprintf(stderr,"config line %d: WebSocket push rate must be 0..%d Hz\n", lineno, HTTP_MAXRATE);
+      return -1;
+      }
+    cfg.http_rate=(unsigned int)n;
+    p=strtok(NULL,CONF_DELIMS);
+    }
+  if(p!=NULL && strcasecmp(p,"WRITE")!=0)
+    {
+    fprintf(stderr,"config line %d: HTTP <port> [<push rate>] [WRITE]\n", lineno);
+    return -1;
+    }
+  cfg.http_write=(p!=NULL);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// as the browser sends it: scheme://host[:port], no path
+
+int parse_HTTP_ORIGIN(int lineno)
+  {
+  char *p;
+
+  if(cfg.http_norigins==HTTP_MAXORIGINS)
+    {
+    fprintf(stderr,"config line %d: at most %d HTTP origins\n", lineno, HTTP_MAXORIGINS);
+    return -1;
+    }
+  p=strtok(NULL,CONF_DELIMS);
+  if(p==NULL || strlen(p)>=HTTP_MAXORIGIN || strstr(p,"://")==NULL || strchr(strstr(p,"://")+3,'/')!=NULL)
+    {
+    fprintf(stderr,"config line %d: bad HTTP origin (scheme://host[:port])\n", lineno);
+    return -1;
+    }
+  strcpy(cfg.http_origins[cfg.http_norigins++], p);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the burst defaults to one second's worth
+
+int parse_LIMIT(int lineno)
+  {
+  char *p;
+  unsigned long rate, burst;
+  bool can;
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL && strcasecmp(p,"CAN")==0)
+    can=true;
+  else if(p!=NULL && strcasecmp(p,"WRITE")==0)
+    can=false;
+  else
+    {
+    fprintf(stderr,"config line %d: LIMIT CAN or LIMIT WRITE\n", lineno);
+    return -1;
+    }
+
+  p=strtok(NULL,CONF_DELIMS);
+  if(conf_number(p,&rate)!=0 || rate>SCHED_MAXRATE)
+    {
+    fprintf(stderr,"config line %d: limit must be 0..%d commands/s\n", lineno, SCHED_MAXRATE);
+    return -1;
+    }
+  burst=rate;
+  p=strtok(NULL,CONF_DELIMS);
+  if(p!=NULL && (conf_number(p,&burst)!=0 || burst==0 || burst>SCHED_MAXRATE))
+    {
+    fprintf(stderr,"config line %d: burst must be 1..%d commands\n", lineno, SCHED_MAXRATE);
+    return -1;
+    }
+
+  if(can)
+    {
+    cfg.lim_can_rate=(unsigned int)rate;
+    cfg.lim_can_burst=(unsigned int)burst;
+    }
+  else
+    {
+    cfg.lim_write_rate=(unsigned int)rate;
+    cfg.lim_write_burst=(unsigned int)burst;
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// returns 0 if the file was read, 1 if there is no file (defaults
+// are kept), -1 on syntax errors
+
+int read_config(const char *fname)
+  {
+  FILE *fd;
+  char line[MAXCONFLINE+1];
+  char *p;
+  int  lineno, ret, i;
+  unsigned long val;
+  bool devseen;
+
+  config_defaults();
+
+  fd = fopen(fname, "r");
+  if(fd==NULL)
+    return 1;
+
+  ret=0;
+  lineno=0;
+  devseen=false;
+  while(fgets(line, MAXCONFLINE, fd)!=NULL)
+    {
+    lineno++;
+    // strip comments
+    p=strchr(line,'#');
+    if(p!=NULL)
+      *p=0;
+
+    p=strtok(line,CONF_DELIMS);
+    if(p==NULL)
+      continue;
+
+    if(strcasecmp(p,"PORT")==0)
+      {
+      p=strtok(NULL,CONF_DELIMS);
+      if(conf_number(p,&val)!=0 || val==0 || val>65535)
+        {
+        fprintf(stderr,"config line %d: bad port\n", lineno);
+        ret=-1;
+        }
+      else
+        cfg.port=(int)val;
+      }
+    else if(strcasecmp(p,"DEVICE")==0)
+      {
+      // first DEVICE line replaces the default device table
+      if(!devseen)
+        {
+        memset(cfg.dev, 0, sizeof(cfg.dev));
+        devseen=true;
+        }
+      if(parse_DEVICE(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"CAN_BUDGET")==0)
+      {
+      p=strtok(NULL,CONF_DELIMS);
+      if(conf_number(p,&val)!=0 || val==0 || val>100)
+        {
+        fprintf(stderr,"config line %d: CAN budget must be 1..100 %%\n", lineno);
+        ret=-1;
+        }
+      else
+        cfg.can_budget=(unsigned int)val;
+      }
+    else if(strcasecmp(p,"MECOS_POLL")==0)
+      {
+      p=strtok(NULL,CONF_DELIMS);
+      if(conf_number(p,&val)!=0 || val>MECOS_POLL_MAXRATE)
+        {
+        fprintf(stderr,"config line %d: MECOS poll rate must be 0..%d Hz\n", lineno, MECOS_POLL_MAXRATE);
+        ret=-1;
+        }
+      else
+        cfg.mecos_poll=(unsigned int)val;
+      }
+    else if(strcasecmp(p,"TELEMETRY")==0)
+      {
+      if(parse_TELEMETRY(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"REALTIME")==0)
+      {
+      if(parse_REALTIME(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"SUPERVISOR")==0)
+      {
+      if(parse_SUPERVISOR(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"HTTP")==0)
+      {
+      if(parse_HTTP(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"HTTP_ORIGIN")==0)
+      {
+      if(parse_HTTP_ORIGIN(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"UNIX")==0)
+      {
+      if(parse_UNIX(lineno)!=0)
+        ret=-1;
+      }
+    else if(strcasecmp(p,"CLIENTS")==0)
+      {
+      p=strtok(NULL,CONF_DELIMS);
+      if(conf_number(p,&val)!=0 || val==0 || val>CONN_MAXCLIENTS)
+        {
+        fprintf(stderr,"config line %d: CLIENTS must be 1..%d\n", lineno, CONN_MAXCLIENTS);
+        ret=-1;
+        }
+      else
+        cfg.maxclients=(int)val;
+      }
+    else if(strcasecmp(p,"LIMIT")==0)
+      {
+      if(parse_LIMIT(lineno)!=0)
+        ret=-1;
+      }
+    else
+      {
+      fprintf(stderr,"config line %d: unknown keyword %s\n", lineno, p);
+      ret=-1;
+      }
+    }
+  fclose(fd);
+
+  // devices must be numbered contiguously from 0
+  cfg.ndevs=0;
+  for(i=0; i<MAXDEV && cfg.dev[i].used; i++)
+    cfg.ndevs++;
+  for(; i<MAXDEV; i++)
+    if(cfg.dev[i].used)
+      {
+      fprintf(stderr,"config: devices must be numbered 0..n-1 without gaps\n");
+      ret=-1;
+      }
+  if(cfg.ndevs==0)
+    {
+    fprintf(stderr,"config: no devices defined\n");
+    ret=-1;
+    }
+
+  return ret;
+  }
@@ -0,0 +1,126 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync server configuration file        ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// the configuration file is optional; without it the server runs
+// a single device with the historical hard-coded settings
+//
+// syntax: one "KEYWORD value [value...]" per line, '#' starts a comment
+//
+//   PORT      <tcp port>
+//   DEVICE    <n> <regbank base, page aligned> <can interface> <node id offset>   (once per device and per interface + offset)
+//   TELEMETRY <multicast group> <udp port> <rate Hz> [ttl] [local if address]
+//   CAN_BUDGET <percent of the bus our own traffic may use>
+//   MECOS_POLL <rate Hz of background MECOS cache refresh; 0 = off>
+//   REALTIME  <sample rate Hz> [sampler cpu] [SCHED_FIFO priority] [main cpu]
+//   SUPERVISOR {ON|OFF} [max attempts] [lock timeout ms] [settle ms] [MECOS max age ms; 0 = don't check, else needs MECOS_POLL]
+//   HTTP      <tcp port> [WebSocket push rate Hz] [WRITE: WebSocket clients may write]
+//   HTTP_ORIGIN <origin a browser may connect from, e.g. http://dashboard:3000>   (up to HTTP_MAXORIGINS lines)
+//   UNIX      <socket path | @abstract name> [STREAM|SEQPACKET] [writer uid] [writer gid]   (up to MAXUNIX lines)
+//   CLIENTS   <max TCP + AF_UNIX clients at once>
+//   LIMIT     {CAN|WRITE} <commands per second per client; 0 = no limit> [burst]
+//
+// example for two choppers:
+//
+//   DEVICE 0 0xA0000000 can0 0x00
+//   DEVICE 1 0xA0010000 can1 0x00
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CONFIG_FNAME "/etc/chopsync/chopsync.conf"
+#define MAXCONFLINE  256
+#define CONF_DELIMS  " \t\r\n"
+
+// max number of synchronizer+MECOS pairs served by one process
+#define MAXDEV 8
+
+// AF_UNIX listeners besides TCP
+#define MAXUNIX     4
+#define MAXUNIXPATH 108   // sizeof(sun_path)
+
+// web pages allowed to use the HTTP gateway
+#define HTTP_MAXORIGINS 4
+#define HTTP_MAXORIGIN  128
+
+
+struct devconf
+  {
+  bool          used;
+  unsigned long regbase;
+  char          canif[IFNAMSIZ];
+  unsigned int  nodeoff;
+  };
+
+struct unixconf
+  {
+  bool          used;
+  char          path[MAXUNIXPATH];
+  int           type;             // SOCK_STREAM or SOCK_SEQPACKET
+  long          wuid, wgid;       // may write besides root and us; -1 = none
+  };
+
+struct config
+  {
+  int            port;
+  int            ndevs;
+  struct devconf dev[MAXDEV];
+  // UDP multicast telemetry; off unless tm_port is set
+  struct in_addr tm_group;
+  struct in_addr tm_ifaddr;
+  int            tm_port;
+  unsigned int   tm_rate;
+  int            tm_ttl;
+  unsigned int   can_budget;     // %
+  unsigned int   mecos_poll;     // Hz
+  // real-time register sampler; off unless rt_rate is set
+  unsigned int   rt_rate;        // Hz
+  int            rt_cpu, rt_prio, rt_maincpu;
+  // loss-of-lock supervisor; needs the sampler
+  bool           sv_on;
+  unsigned int   sv_attempts;
+  unsigned int   sv_timeout_ms, sv_settle_ms, sv_mecos_age_ms;
+  struct unixconf ux[MAXUNIX];
+  // HTTP/WebSocket gateway; off unless http_port is set
+  int            http_port;
+  unsigned int   http_rate;      // Hz
+  bool           http_write;     // WebSocket clients may write
+  int            http_norigins;
+  char           http_origins[HTTP_MAXORIGINS][HTTP_MAXORIGIN];
+  int            maxclients;
+  // per-client token buckets for MECOS and write commands; rate 0 = off
+  unsigned int   lim_can_rate, lim_can_burst;
+  unsigned int   lim_write_rate, lim_write_burst;
+  };
+
+extern struct config cfg;
+
+
+/******* protos *******/
+
+void config_defaults(void);
+int  conf_number(const char *p, unsigned long *val);
+int  parse_DEVICE(int lineno);
+int  parse_TELEMETRY(int lineno);
+int  parse_REALTIME(int lineno);
+int  parse_SUPERVISOR(int lineno);
+int  parse_UNIX(int lineno);
+int  parse_HTTP(int lineno);
+int  parse_HTTP_ORIGIN(int lineno);
+int  parse_LIMIT(int lineno);
+int  read_config(const char *fname);
+
+#endif
@@ -0,0 +1,185 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync client connections               ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+struct connpool conns;
+
+
+//-------------------------------------------------------------------
+
+// the pool, then all the input buffers, then all the output buffers,
+// in one anonymous mapping; with the sampler running mlockall() keeps
+// it in RAM
+
+int conn_pool_open(int max)
+  {
+  char  *p;
+  size_t size;
+  int    i;
+
+  size=max*(sizeof(struct conn)+sizeof(struct linebuf)+CONN_OUTLEN);
+  p=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p==MAP_FAILED)
+    {
+    perror("connection pool");
+    return -1;
+    }
+  conns.arena=p;
+  conns.arena_size=size;
+  conns.max=max;
+  conns.used=0;
+  conns.c=(struct conn *)p;
+  p+=max*sizeof(struct conn);
+  for(i=0; i<max; i++)
+    {
+    conns.c[i].fd=-1;
+    conns.c[i].in=(struct linebuf *)p;
+    p+=sizeof(struct linebuf);
+    }
+  for(i=0; i<max; i++)
+    {
+    conns.c[i].out=p;
+    p+=CONN_OUTLEN;
+    }
+  for(i=0; i<FD_SETSIZE; i++)
+    conns.idx[i]=-1;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// a connection for a new client; NULL if there is none left, and then
+// the client has been told and closed
+
+struct conn *conn_open(int fd)
+  {
+  struct conn *c;
+  int i;
+
+  for(i=0; i<conns.max && conns.c[i].fd>=0; i++)
+    ;
+  if(i==conns.max || fd<0 || fd>=FD_SETSIZE)
+    {
+    fprintf(stderr, "Server: no room for another client, closing\n");
+    (void)send(fd, ERRS ": too many clients\n", strlen(ERRS ": too many clients\n"), MSG_NOSIGNAL|MSG_DONTWAIT);
+    close(fd);
+    conns.refused++;
+    return NULL;
+    }
+  c=&conns.c[i];
+  c->fd=fd;
+  memset(&c->peer, 0, sizeof(c->peer));
+  memset(&c->sched, 0, sizeof(c->sched));
+  c->in->lines=false;
+  c->in->len=0;
+  c->in->buf[0]=0;
+  c->outlen=0;
+  conns.idx[fd]=(short)i;
+  conns.used++;
+  return c;
+  }
+
+
+//-------------------------------------------------------------------
+
+struct conn *conn_by_fd(int fd)
+  {
+  if(fd<0 || fd>=FD_SETSIZE || conns.idx[fd]<0)
+    return NULL;
+  return &conns.c[conns.idx[fd]];
+  }
+
+
+//-------------------------------------------------------------------
+
+// what is still held back goes out first, the client may be reading
+
+void conn_close(struct conn *c)
+  {
+  conn_flush(c);
+  pend_orphan(c->fd);
+  close(c->fd);
+  FD_CLR(c->fd, &active_fd_set);
+  conns.idx[c->fd]=-1;
+  c->fd=-1;
+  c->in->len=0;
+  conns.used--;
+  }
+
+
+//-------------------------------------------------------------------
+
+void conn_send(struct conn *c, const char *s, size_t n)
+  {
+  ssize_t ret;
+
+  // one message per answer on SEQPACKET
+  if(c->peer.local && local_ls[c->peer.listener].type==SOCK_SEQPACKET)
+    {
+    (void)write(c->fd, s, n);
+    return;
+    }
+
+  if(c->outlen+n>CONN_OUTLEN)
+    conn_flush(c);
+  if(n<=CONN_OUTLEN)
+    {
+    memcpy(c->out+c->outlen, s, n);
+    c->outlen+=n;
+    return;
+    }
+  // bigger than the whole buffer: straight out
+  while(n>0)
+    {
+    ret=write(c->fd, s, n);
+    if(ret<0 && errno==EINTR)
+      continue;
+    if(ret<=0)
+      return;
+    s+=ret;
+    n-=ret;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// a client that went away loses what was held back for it
+
+void conn_flush(struct conn *c)
+  {
+  ssize_t ret;
+  size_t  off;
+
+  off=0;
+  while(off<c->outlen)
+    {
+    ret=write(c->fd, c->out+off, c->outlen-off);
+    if(ret<0 && errno==EINTR)
+      continue;
+    if(ret<=0)
+      break;
+    off+=ret;
+    }
+  c->outlen=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void conn_flush_all(void)
+  {
+  int i;
+
+  for(i=0; i<conns.max; i++)
+    if(conns.c[i].fd>=0 && conns.c[i].outlen>0)
+      conn_flush(&conns.c[i]);
+  }
@@ -0,0 +1,73 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync client connections               ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// every stream client (TCP or AF_UNIX) has a connection object from a
+// pool sized at startup (CLIENTS in the config file); the pool and the
+// input and output buffers of all its connections are carved out of
+// one arena mapped at startup, so nothing is allocated while serving
+// and the memory in use does not grow with the load or the uptime
+// a client that finds the pool full is told so and closed
+//
+// answers to a stream client are collected in its output buffer and
+// written once per pass of the main loop (conn_flush_all()), instead of
+// one write() per sendback(); SEQPACKET clients still get one message
+// per sendback(), that is what they read
+
+#ifndef CONN_H
+#define CONN_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "scpi.h"
+#include "local.h"
+#include "reqsched.h"
+
+#define CONN_DEFAULT_CLIENTS 32
+#define CONN_MAXCLIENTS      256
+#define CONN_OUTLEN          4096      // answers held back per client
+
+struct conn
+  {
+  int                 fd;              // -1 when free
+  struct peer         peer;
+  struct sched_client sched;
+  struct linebuf     *in;              // commands not run yet
+  char               *out;             // answers not written yet
+  size_t              outlen;
+  };
+
+struct connpool
+  {
+  int           max, used;
+  unsigned long refused;
+  void         *arena;
+  size_t        arena_size;
+  struct conn  *c;
+  short         idx[FD_SETSIZE];       // fd -> connection, -1 if none
+  };
+
+extern struct connpool conns;
+
+
+/******* protos *******/
+
+int          conn_pool_open(int max);
+struct conn *conn_open(int fd);
+struct conn *conn_by_fd(int fd);
+void         conn_close(struct conn *c);
+void         conn_send(struct conn *c, const char *s, size_t n);
+void         conn_flush(struct conn *c);
+void         conn_flush_all(void);
+
+#endif
@@ -0,0 +1,210 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync device table                     ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "device.h"
+
+/***  globals  ***/
+struct chopdev  devs[MAXDEV];
+int             ndevs;
+// device addressed by the command being served, and its register bank
+struct chopdev *curdev;
+uint32_t       *regbank;
+// timer of the background MECOS cache refresh; -1 if disabled
+int             mecos_poll_fd = -1;
+
+
+//-------------------------------------------------------------------
+
+int memorymap(int memfd, struct chopdev *d)
+  {
+#ifdef SIMULATED_REGBANK
+  (void)memfd;
+  d->regbank = (uint32_t *)mmap(NULL, REGBANK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+#else
+  d->regbank = (uint32_t *)mmap(NULL, REGBANK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, d->regbase);
+#endif
+  if(d->regbank==MAP_FAILED)
+    return -1;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// register access on a given device, regardless of the selected one
+
+unsigned int dev_readreg(struct chopdev *d, unsigned int reg)
+  {
+  return d->regbank[reg];
+  }
+
+
+//-------------------------------------------------------------------
+
+void dev_writereg(struct chopdev *d, unsigned int reg, unsigned int val)
+  {
+  pthread_mutex_lock(&d->reglock);
+  journal_reg(d->id, reg, d->regbank, val);
+  d->regbank[reg]=val;
+  pthread_mutex_unlock(&d->reglock);
+  }
+
+
+//-------------------------------------------------------------------
+
+// set and clear bits of a register atomically with respect to the
+// other writers (bits in both set and clr end up set)
+
+void dev_modreg(struct chopdev *d, unsigned int reg, unsigned int set, unsigned int clr)
+  {
+  uint32_t val;
+
+  pthread_mutex_lock(&d->reglock);
+  val=(d->regbank[reg] & ~clr) | set;
+  journal_reg(d->id, reg, d->regbank, val);
+  d->regbank[reg]=val;
+  pthread_mutex_unlock(&d->reglock);
+  }
+
+
+//-------------------------------------------------------------------
+
+// map the register bank of every configured device and open its
+// CAN interface; a failing register bank is fatal, a failing CAN
+// interface is not (the device just runs without MECOS support)
+// built with SIMULATED_REGBANK, every register bank is plain zeroed
+// memory and no CAN interface is opened: the server (or the bench)
+// runs on any host
+
+int init_devices(void)
+  {
+  pthread_mutexattr_t ma;
+  int fd, i;
+
+  // the sampler thread must not wait on a lock held by a preempted
+  // server thread
+  pthread_mutexattr_init(&ma);
+  pthread_mutexattr_setprotocol(&ma, PTHREAD_PRIO_INHERIT);
+
+  // /dev/mem is opened once for all devices
+#ifdef SIMULATED_REGBANK
+  fd=-1;
+#else
+  if((fd = open("/dev/mem", O_RDWR | O_SYNC)) == -1)
+    return -1;
+#endif
+
+  for(i=0; i<cfg.ndevs; i++)
+    {
+    devs[i].id=i;
+    devs[i].regbase=cfg.dev[i].regbase;
+    pthread_mutex_init(&devs[i].reglock, &ma);
+    if(memorymap(fd, &devs[i])!=0)
+      {
+      fprintf(stderr,"Can't map register bank of DEV%d at 0x%08lX\n", i, devs[i].regbase);
+      close(fd);
+      return -1;
+      }
+    strcpy(devs[i].can.ifname, cfg.dev[i].canif);
+    devs[i].can.nodeoff=cfg.dev[i].nodeoff;
+    devs[i].can.dev=i;
+    devs[i].can.sock=-1;
+    }
+  // file descriptor can be closed without invalidating the mappings
+  if(fd>=0)
+    close(fd);
+  ndevs=cfg.ndevs;
+
+  // open CAN interfaces to talk to MECOS
+  // if it fails, we proceed anyway, without CAN support
+#ifndef SIMULATED_REGBANK
+  for(i=0; i<ndevs; i++)
+    if(open_can(&devs[i].can)!=0)
+      fprintf(stderr,"DEV%d: CAN unavailable on %s; continuing anyway\n", i, devs[i].can.ifname);
+#endif
+
+  select_device(0);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void select_device(int n)
+  {
+  curdev=&devs[n];
+  regbank=curdev->regbank;
+  }
+
+
+//-------------------------------------------------------------------
+
+struct chopdev *device_by_canfd(int fd)
+  {
+  int i;
+
+  for(i=0; i<ndevs; i++)
+    if(devs[i].can.present && devs[i].can.sock==fd)
+      return &devs[i];
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// background refresh of the MECOS cache; requests go out in the lowest
+// priority class and coalesce with client reads of the same objects
+
+int mecos_poll_open(void)
+  {
+  struct itimerspec its;
+
+  if(cfg.mecos_poll==0)
+    return -1;
+
+  mecos_poll_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(mecos_poll_fd < 0)
+    {
+    perror("MECOS poll timerfd");
+    return -1;
+    }
+  memset(&its, 0, sizeof(its));
+  its.it_interval.tv_sec = (cfg.mecos_poll==1)? 1 : 0;
+  its.it_interval.tv_nsec = (cfg.mecos_poll==1)? 0 : 1000000000L/cfg.mecos_poll;
+  its.it_value = its.it_interval;
+  timerfd_settime(mecos_poll_fd, 0, &its, NULL);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void mecos_poll_done(void *ctx, int ret, unsigned long int val)
+  {
+  // nothing to do: the answer is already in the node cache
+  (void)ctx;
+  (void)ret;
+  (void)val;
+  }
+
+
+//-------------------------------------------------------------------
+
+void mecos_poll_tick(void)
+  {
+  uint64_t expirations;
+  int i, obj;
+
+  if(read(mecos_poll_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return;
+
+  for(i=0; i<ndevs; i++)
+    if(devs[i].can.present)
+      for(obj=0; obj<MECOS_NOBJ; obj++)
+        can_read_object_async(&devs[i].can, obj, CAN_PRIO_BACKGROUND, 0, mecos_poll_done, NULL);
+  }
@@ -0,0 +1,64 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync device table                     ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// a device is one synchronizer register bank plus the MECOS AMB
+// it drives; one server process serves all devices in the table
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include "config.h"
+#include "can.h"
+#include "journal.h"
+
+#define REGBANK_BASE 0xA0000000
+#define REGBANK_SIZE 256
+
+#define MECOS_POLL_MAXRATE 100
+
+
+struct chopdev
+  {
+  int             id;
+  unsigned long   regbase;
+  uint32_t       *regbank;
+  // serializes read-modify-write of the registers between the server
+  // and the sampler thread (priority inheritance)
+  pthread_mutex_t reglock;
+  struct can_node can;
+  };
+
+extern struct chopdev  devs[MAXDEV];
+extern int             ndevs;
+extern struct chopdev *curdev;
+extern uint32_t       *regbank;
+extern int             mecos_poll_fd;
+
+
+/******* protos *******/
+
+int          memorymap(int memfd, struct chopdev *d);
+unsigned int dev_readreg(struct chopdev *d, unsigned int reg);
+void         dev_writereg(struct chopdev *d, unsigned int reg, unsigned int val);
+void         dev_modreg(struct chopdev *d, unsigned int reg, unsigned int set, unsigned int clr);
+int          init_devices(void);
+void         select_device(int n);
+struct chopdev *device_by_canfd(int fd);
+int          mecos_poll_open(void);
+void         mecos_poll_done(void *ctx, int ret, unsigned long int val);
+void         mecos_poll_tick(void);
+
+#endif
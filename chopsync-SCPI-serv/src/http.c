@@ -0,0 +1,719 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync HTTP/WebSocket JSON gateway      ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#define _GNU_SOURCE
+#include "server.h"
+#include <sys/uio.h>
+
+/***  globals  ***/
+struct http http = { .sock = -1, .timerfd = -1 };
+
+
+//-------------------------------------------------------------------
+
+// one 64 byte block into the hash state
+
+void sha1_block(uint32_t h[5], const unsigned char *blk)
+  {
+  uint32_t w[80], a, b, c, d, e, f, k, t;
+  int i;
+
+  for(i=0; i<16; i++)
+    w[i]=(uint32_t)blk[4*i]<<24 | (uint32_t)blk[4*i+1]<<16 | (uint32_t)blk[4*i+2]<<8 | blk[4*i+3];
+  for(i=16; i<80; i++)
+    {
+    t=w[i-3]^w[i-8]^w[i-14]^w[i-16];
+    w[i]=(t<<1)|(t>>31);
+    }
+  a=h[0]; b=h[1]; c=h[2]; d=h[3]; e=h[4];
+  for(i=0; i<80; i++)
+    {
+    if(i<20)
+      {
+      f=(b&c)|(~b&d);
+      k=0x5A827999;
+      }
+    else if(i<40)
+      {
+      f=b^c^d;
+      k=0x6ED9EBA1;
+      }
+    else if(i<60)
+      {
+      f=(b&c)|(b&d)|(c&d);
+      k=0x8F1BBCDC;
+      }
+    else
+      {
+      f=b^c^d;
+      k=0xCA62C1D6;
+      }
+    t=((a<<5)|(a>>27))+f+e+k+w[i];
+    e=d;
+    d=c;
+    c=(b<<30)|(b>>2);
+    b=a;
+    a=t;
+    }
+  h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e;
+  }
+
+
+//-------------------------------------------------------------------
+
+// FIPS 180-1; only used for the WebSocket handshake
+
+void sha1(const unsigned char *data, size_t len, unsigned char out[20])
+  {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  unsigned char tail[128];
+  uint64_t bits;
+  size_t   off, n, tlen;
+  int      i;
+
+  for(off=0; off+64<=len; off+=64)
+    sha1_block(h, data+off);
+
+  // the rest, 0x80, zeros and the length in bits fill one or two blocks
+  n=len-off;
+  tlen=(n<56)? 64 : 128;
+  memset(tail, 0, sizeof(tail));
+  memcpy(tail, data+off, n);
+  tail[n]=0x80;
+  bits=(uint64_t)len*8;
+  for(i=0; i<8; i++)
+    tail[tlen-1-i]=(unsigned char)(bits>>(8*i));
+  sha1_block(h, tail);
+  if(tlen==128)
+    sha1_block(h, tail+64);
+
+  for(i=0; i<20; i++)
+    out[i]=(unsigned char)(h[i/4]>>(24-8*(i%4)));
+  }
+
+
+//-------------------------------------------------------------------
+
+// returns the length written to out (4 per 3 input bytes, plus 0)
+
+size_t base64(const unsigned char *in, size_t len, char *out)
+  {
+  static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t v;
+  size_t i, n;
+
+  n=0;
+  for(i=0; i+2<len; i+=3)
+    {
+    v=(uint32_t)in[i]<<16 | (uint32_t)in[i+1]<<8 | in[i+2];
+    out[n++]=tab[(v>>18)&63];
+    out[n++]=tab[(v>>12)&63];
+    out[n++]=tab[(v>>6)&63];
+    out[n++]=tab[v&63];
+    }
+  if(i<len)
+    {
+    v=(uint32_t)in[i]<<16 | ((i+1<len)? (uint32_t)in[i+1]<<8 : 0);
+    out[n++]=tab[(v>>18)&63];
+    out[n++]=tab[(v>>12)&63];
+    out[n++]=(i+1<len)? tab[(v>>6)&63] : '=';
+    out[n++]='=';
+    }
+  out[n]=0;
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+int http_open(void)
+  {
+  struct sockaddr_in name;
+  int i, opt = 1;
+
+  for(i=0; i<HTTP_MAXCONN; i++)
+    http.c[i].fd=-1;
+  if(cfg.http_port==0)
+    return -1;
+
+  // from the server we replace, or from systemd
+  http.sock = upgrade_take(UPG_HTTP_LISTEN, NULL, -1);
+  if(http.sock < 0)
+    {
+    http.sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(http.sock < 0)
+      {
+      perror("http socket");
+      return -1;
+      }
+    if(setsockopt(http.sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+      perror("http SO_REUSEADDR");
+
+    memset(&name, 0, sizeof(name));
+    name.sin_family = AF_INET;
+    name.sin_port = htons(cfg.http_port);
+    name.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(http.sock, (struct sockaddr *)&name, sizeof(name)) < 0 || listen(http.sock, HTTP_MAXCONN) < 0)
+      {
+      perror("http bind");
+      close(http.sock);
+      http.sock=-1;
+      return -1;
+      }
+    }
+
+  http.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(http.timerfd < 0)
+    {
+    perror("http timerfd");
+    close(http.sock);
+    http.sock=-1;
+    return -1;
+    }
+  if(http_set_rate(cfg.http_rate)!=0)
+    return -1;
+
+  fprintf(stderr,"HTTP on port %d, WebSocket push at %u Hz, %s, %d web origins allowed\n", cfg.http_port, http.rate_hz,
+          cfg.http_write? "WebSocket may write" : "WebSocket read-only", cfg.http_norigins);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int http_set_rate(unsigned int hz)
+  {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if(hz>0)
+    {
+    its.it_interval.tv_sec = (hz==1)? 1 : 0;
+    its.it_interval.tv_nsec = (hz==1)? 0 : 1000000000L/hz;
+    its.it_value = its.it_interval;
+    }
+  if(timerfd_settime(http.timerfd, 0, &its, NULL) < 0)
+    {
+    perror("http timerfd_settime");
+    return -1;
+    }
+  http.rate_hz=hz;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// returns the new connection's fd, for the caller to select on, or -1
+
+int http_accept(void)
+  {
+  struct sockaddr_in clientname;
+  socklen_t size;
+  int fd, i;
+
+  size=sizeof(clientname);
+  fd=accept4(http.sock, (struct sockaddr *)&clientname, &size, SOCK_CLOEXEC);
+  if(fd<0)
+    {
+    perror("http accept");
+    return -1;
+    }
+  for(i=0; i<HTTP_MAXCONN && http.c[i].fd>=0; i++)
+    ;
+  if(i==HTTP_MAXCONN || fd>=FD_SETSIZE)
+    {
+    (void)send(fd, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", 75, MSG_NOSIGNAL|MSG_DONTWAIT);
+    close(fd);
+    return -1;
+    }
+  http.c[i].fd=fd;
+  http.c[i].ws=false;
+  memset(&http.c[i].sched, 0, sizeof(http.c[i].sched));
+  http.c[i].len=0;
+  fprintf(stderr, "HTTP: new connection from host %s, port %hu\n",
+          inet_ntoa(clientname.sin_addr), ntohs(clientname.sin_port));
+  return fd;
+  }
+
+
+//-------------------------------------------------------------------
+
+struct httpconn *http_conn_by_fd(int fd)
+  {
+  int i;
+
+  if(fd<0)
+    return NULL;
+  for(i=0; i<HTTP_MAXCONN; i++)
+    if(http.c[i].fd==fd)
+      return &http.c[i];
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+void http_close(struct httpconn *c)
+  {
+  pend_orphan(c->fd);
+  FD_CLR(c->fd, &active_fd_set);
+  close(c->fd);
+  c->fd=-1;
+  c->ws=false;
+  c->len=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// state of every device; decoding as in read_syncstate() and the
+// query handlers, MECOS values from the cache with their age
+
+size_t http_state_json(char *buf, size_t maxlen)
+  {
+  struct syncstate st;
+  struct timespec  now;
+  struct chopdev  *d;
+  unsigned long    val;
+  long             age;
+  size_t           len;
+  int              i, n;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  len=snprintf(buf, maxlen, "{\"time\":%ld.%03ld,\"devices\":[", (long)now.tv_sec, now.tv_nsec/1000000L);
+  for(i=0; i<ndevs && len<maxlen; i++)
+    {
+    d=&devs[i];
+    read_syncstate(d, &st);
+    len+=snprintf(buf+len, maxlen-len,
+                  "%s{\"dev\":%d,\"status\":%u,\"flock\":%s,\"phlock\":%s,\"stickylol\":%s,"
+                  "\"synch\":%s,\"unwrap\":%s,\"unw_res\":%s,\"phsetpoint_ns\":%d,\"pherr_ns\":%.4f,"
+                  "\"mecos_cmd\":%d,\"bunchfreq_hz\":%u,\"chopfreq_hz\":%u,\"bunchmarker_prescaler\":%u,"
+                  "\"chopper_prescaler\":%u,\"trigout_ph\":%u,\"gain\":%f,\"unw_thr\":%u,"
+                  "\"siggen_df_hz\":%f,\"can\":%s,\"mecos\":{",
+                  (i>0)?",":"", i, st.status, st.flock?"true":"false", st.phlock?"true":"false",
+                  st.stickylol?"true":"false", st.synch?"true":"false", st.unwrap?"true":"false",
+                  st.unwres?"true":"false", st.phsetp_ns, st.pherr_raw/POW_2_7*8., st.mecos_cmd,
+                  st.bunchfreq, st.chopfreq, st.bunch_presc, st.chop_presc, st.trigout,
+                  st.gain_raw/POW_2_12, st.unwthr, st.siggen_dftw/2199., d->can.present?"true":"false");
+    for(n=0; n<MECOS_NOBJ && len<maxlen; n++)
+      {
+      if(d->can.present && can_cache_read(&d->can, n, &val, &age)==0)
+        len+=snprintf(buf+len, maxlen-len, "%s\"%s\":{\"value\":%lu,\"age_ms\":%ld}",
+                      (n>0)?",":"", mecos_objs[n].name, val, age);
+      else
+        len+=snprintf(buf+len, maxlen-len, "%s\"%s\":null", (n>0)?",":"", mecos_objs[n].name);
+      }
+    if(len<maxlen)
+      len+=snprintf(buf+len, maxlen-len, "}}");
+    }
+  if(len<maxlen)
+    len+=snprintf(buf+len, maxlen-len, "]}");
+  return (len<maxlen)? len : 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// all or nothing, never blocks the loop; -1 if the client can't take
+// it (the caller closes the connection)
+
+int http_send(struct httpconn *c, const char *data, size_t len)
+  {
+  ssize_t n;
+
+  n=send(c->fd, data, len, MSG_NOSIGNAL|MSG_DONTWAIT);
+  return (n==(ssize_t)len)? 0 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one unfragmented, unmasked server frame
+
+int http_ws_send(struct httpconn *c, int op, const char *data, size_t len)
+  {
+  unsigned char hdr[10];
+  struct iovec  iov[2];
+  struct msghdr msg;
+  size_t hlen;
+  ssize_t n;
+  int i;
+
+  hdr[0]=0x80|op;
+  if(len<126)
+    {
+    hdr[1]=(unsigned char)len;
+    hlen=2;
+    }
+  else if(len<65536)
+    {
+    hdr[1]=126;
+    hdr[2]=(unsigned char)(len>>8);
+    hdr[3]=(unsigned char)len;
+    hlen=4;
+    }
+  else
+    {
+    hdr[1]=127;
+    for(i=0; i<8; i++)
+      hdr[2+i]=(unsigned char)((uint64_t)len>>(56-8*i));
+    hlen=10;
+    }
+
+  iov[0].iov_base=hdr;
+  iov[0].iov_len=hlen;
+  iov[1].iov_base=(void *)data;
+  iov[1].iov_len=len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=iov;
+  msg.msg_iovlen=2;
+  n=sendmsg(c->fd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT);
+  return (n==(ssize_t)(hlen+len))? 0 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+void http_reply(struct httpconn *c, const char *status, const char *type, const char *body, bool keep)
+  {
+  char   head[256];
+  size_t blen;
+  int    hlen;
+
+  blen=strlen(body);
+  hlen=snprintf(head, sizeof(head),
+                "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                "Cache-Control: no-store\r\n%s%s%s"
+                "Connection: %s\r\n\r\n", status, type, blen,
+                (http.cors!=NULL)? "Access-Control-Allow-Origin: " : "", (http.cors!=NULL)? http.cors : "",
+                (http.cors!=NULL)? "\r\nVary: Origin\r\n" : "", keep?"keep-alive":"close");
+  if(http_send(c, head, hlen)==0 && blen>0)
+    (void)http_send(c, body, blen);
+  }
+
+
+//-------------------------------------------------------------------
+
+// value of a header of the request head, or NULL
+
+const char *http_header(const char *head, const char *name, char *val, size_t maxlen)
+  {
+  const char *p, *e;
+  size_t nlen, n;
+
+  nlen=strlen(name);
+  for(p=strstr(head, "\r\n"); p!=NULL; p=strstr(p, "\r\n"))
+    {
+    p+=2;
+    if(strncasecmp(p, name, nlen)==0 && p[nlen]==':')
+      {
+      p+=nlen+1;
+      while(*p==' ' || *p=='\t')
+        p++;
+      e=strstr(p, "\r\n");
+      n=(e!=NULL)? (size_t)(e-p) : strlen(p);
+      if(n>=maxlen)
+        n=maxlen-1;
+      memcpy(val, p, n);
+      val[n]=0;
+      return val;
+      }
+    }
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// may the request be served? no Origin: not from a browser; else the
+// origin must be configured, and is then the one CORS allows
+
+bool http_origin_ok(const char *head)
+  {
+  char val[HTTP_MAXORIGIN];
+  int  i;
+
+  http.cors=NULL;
+  if(http_header(head, "Origin", val, sizeof(val))==NULL)
+    return true;
+  for(i=0; i<cfg.http_norigins; i++)
+    if(strcasecmp(val, cfg.http_origins[i])==0)
+      {
+      http.cors=cfg.http_origins[i];
+      return true;
+      }
+  return false;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one request whose head is the first headlen bytes of the buffer;
+// returns -1 if the connection is to be closed
+
+int http_request(struct httpconn *c, size_t headlen)
+  {
+  static char body[HTTP_MAXJSON];
+  char method[8], path[256], version[16], val[128], key[176], resp[256];
+  unsigned char digest[20];
+  char  accept[32];
+  bool  keep;
+  char  saved;
+
+  http.requests++;
+  // the head alone, as a string
+  saved=c->buf[headlen];
+  c->buf[headlen]=0;
+
+  if(sscanf(c->buf, "%7s %255s %15s", method, path, version)!=3 || strncmp(version, "HTTP/1.", 7)!=0)
+    {
+    http_reply(c, "400 Bad Request", "text/plain", "bad request\n", false);
+    return -1;
+    }
+  if(strcmp(version, "HTTP/1.1")==0)
+    keep=(http_header(c->buf, "Connection", val, sizeof(val))==NULL || strcasestr(val, "close")==NULL);
+  else
+    keep=(http_header(c->buf, "Connection", val, sizeof(val))!=NULL && strcasestr(val, "keep-alive")!=NULL);
+  // no bodies are expected; a request with one is answered and closed
+  if(http_header(c->buf, "Content-Length", val, sizeof(val))!=NULL && atol(val)>0)
+    keep=false;
+
+  if(!http_origin_ok(c->buf))
+    {
+    fprintf(stderr, "HTTP: request from a web page of a foreign origin refused\n");
+    http_reply(c, "403 Forbidden", "text/plain", "origin not allowed\n", false);
+    return -1;
+    }
+  if(strcmp(method, "GET")!=0)
+    http_reply(c, "405 Method Not Allowed", "text/plain", "only GET is supported\n", false);
+  else if(strcmp(path, "/state")==0)
+    {
+    if(http_state_json(body, sizeof(body))==0)
+      http_reply(c, "500 Internal Server Error", "text/plain", "state too large\n", false);
+    else
+      http_reply(c, "200 OK", "application/json", body, keep);
+    }
+  else if(strcmp(path, "/ws")==0)
+    {
+    if(http_header(c->buf, "Upgrade", val, sizeof(val))==NULL || strcasecmp(val, "websocket")!=0 ||
+       http_header(c->buf, "Sec-WebSocket-Key", val, sizeof(val))==NULL)
+      {
+      http_reply(c, "400 Bad Request", "text/plain", "WebSocket upgrade expected\n", false);
+      return -1;
+      }
+    snprintf(key, sizeof(key), "%s" WS_GUID, val);
+    sha1((unsigned char *)key, strlen(key), digest);
+    base64(digest, sizeof(digest), accept);
+    snprintf(resp, sizeof(resp), "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+             "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    if(http_send(c, resp, strlen(resp))!=0)
+      return -1;
+    c->ws=true;
+    c->buf[headlen]=saved;
+    // first state right away, not at the next tick
+    if(http_state_json(body, sizeof(body))>0 && http_ws_send(c, WS_TEXT, body, strlen(body))!=0)
+      return -1;
+    return 0;
+    }
+  else
+    http_reply(c, "404 Not Found", "text/plain", "try /state or /ws\n", keep);
+
+  c->buf[headlen]=saved;
+  return keep? 0 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one client frame at the start of the buffer; returns its length, 0
+// if it is not complete yet, -1 if the connection is to be closed
+
+int http_ws_frame(struct httpconn *c)
+  {
+  unsigned char *b;
+  char   cmd[MAXMSG+1];
+  size_t hlen, plen, i;
+  int    op;
+
+  b=(unsigned char *)c->buf;
+  if(c->len<2)
+    return 0;
+  op=b[0]&0x0F;
+  // clients must mask, and we don't reassemble fragments
+  if((b[1]&0x80)==0 || (b[0]&0x80)==0 || op==0)
+    {
+    (void)http_ws_send(c, WS_CLOSE, "\x03\xEA", 2);    // 1002 protocol error
+    return -1;
+    }
+  plen=b[1]&0x7F;
+  hlen=2;
+  if(plen==126)
+    {
+    if(c->len<4)
+      return 0;
+    plen=(size_t)b[2]<<8 | b[3];
+    hlen=4;
+    }
+  else if(plen==127)
+    plen=HTTP_MAXREQ;
+  if(hlen+4+plen>HTTP_MAXREQ)
+    {
+    (void)http_ws_send(c, WS_CLOSE, "\x03\xF1", 2);    // 1009 too big
+    return -1;
+    }
+  if(c->len<hlen+4+plen)
+    return 0;
+
+  for(i=0; i<plen; i++)
+    b[hlen+4+i]^=b[hlen+i%4];
+  b+=hlen+4;
+
+  switch(op)
+    {
+    case WS_TEXT:
+      // a command, as if from a TCP client
+      if(plen>MAXMSG)
+        plen=MAXMSG;
+      memcpy(cmd, b, plen);
+      cmd[plen]=0;
+      run_command(c->fd, cmd);
+      break;
+    case WS_PING:
+      if(http_ws_send(c, WS_PONG, (char *)b, plen)!=0)
+        return -1;
+      break;
+    case WS_PONG:
+      break;
+    case WS_CLOSE:
+      (void)http_ws_send(c, WS_CLOSE, (char *)b, (plen>=2)? 2 : 0);
+      return -1;
+    default:
+      (void)http_ws_send(c, WS_CLOSE, "\x03\xEB", 2);    // 1003 unsupported data
+      return -1;
+    }
+  return (int)(hlen+4+plen);
+  }
+
+
+//-------------------------------------------------------------------
+
+// data from an HTTP or WebSocket client
+
+void http_receive(struct httpconn *c)
+  {
+  ssize_t n;
+
+  n=read(c->fd, c->buf+c->len, HTTP_MAXREQ-c->len);
+  if(n<=0)
+    {
+    http_close(c);
+    return;
+    }
+  c->len+=n;
+  c->buf[c->len]=0;
+  http_drain(c);
+  }
+
+
+//-------------------------------------------------------------------
+
+// every complete request or frame in the buffer; a command still
+// waiting for CAN holds the following ones back, as over TCP
+
+void http_drain(struct httpconn *c)
+  {
+  char *e;
+  int  used;
+
+  while(c->fd>=0 && c->len>0 && FD_ISSET(c->fd, &active_fd_set))
+    {
+    http.cors=NULL;
+    if(c->ws)
+      used=http_ws_frame(c);
+    else
+      {
+      e=strstr(c->buf, "\r\n\r\n");
+      if(e==NULL)
+        {
+        if(c->len>=HTTP_MAXREQ)
+          {
+          http_reply(c, "431 Request Header Fields Too Large", "text/plain", "request too large\n", false);
+          used=-1;
+          }
+        else
+          used=0;
+        }
+      else
+        {
+        used=(int)(e+4-c->buf);
+        if(http_request(c, used)<0)
+          used=-1;
+        }
+      }
+
+    if(used<0)
+      {
+      http_close(c);
+      return;
+      }
+    if(used==0)
+      break;
+    c->len-=used;
+    memmove(c->buf, c->buf+used, c->len);
+    c->buf[c->len]=0;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// the frames held back behind a command that waited for CAN, once
+// its answer is out; main loop, never from inside a command
+
+void http_drain_all(void)
+  {
+  int i;
+
+  for(i=0; i<HTTP_MAXCONN; i++)
+    if(http.c[i].fd>=0 && http.c[i].len>0 && FD_ISSET(http.c[i].fd, &active_fd_set))
+      http_drain(&http.c[i]);
+  }
+
+
+//-------------------------------------------------------------------
+
+// push the state to every WebSocket client; a client that can't keep
+// up is dropped rather than buffered for
+
+void http_tick(void)
+  {
+  static char body[HTTP_MAXJSON];
+  uint64_t expirations;
+  size_t   len;
+  int      i;
+
+  (void)read(http.timerfd, &expirations, sizeof(expirations));
+  for(i=0; i<HTTP_MAXCONN && !(http.c[i].fd>=0 && http.c[i].ws); i++)
+    ;
+  if(i==HTTP_MAXCONN)
+    return;
+
+  len=http_state_json(body, sizeof(body));
+  if(len==0)
+    return;
+  http.pushes++;
+  for(i=0; i<HTTP_MAXCONN; i++)
+    if(http.c[i].fd>=0 && http.c[i].ws && http_ws_send(&http.c[i], WS_TEXT, body, len)!=0)
+      {
+      http.dropped++;
+      fprintf(stderr, "HTTP: WebSocket client too slow, dropped\n");
+      http_close(&http.c[i]);
+      }
+  }
@@ -0,0 +1,105 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync HTTP/WebSocket JSON gateway      ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// optional (HTTP in the config file): a minimal HTTP/1.1 endpoint in
+// the main loop, for web dashboards
+//
+//   GET /state      decoded registers of every device and the MECOS
+//                   cache as one JSON object (keep-alive is honoured)
+//   GET /ws         WebSocket (RFC 6455); the server pushes the same
+//                   JSON object as a text frame at the configured rate,
+//                   and every text frame the client sends is run as a
+//                   command, exactly as over TCP, the answer coming
+//                   back as one text frame
+//
+// nothing here ever waits for the CAN bus: MECOS values come from the
+// cache (MECOS_POLL keeps it fresh), with their age in ms; commands
+// sent over the WebSocket go through parse() and may wait like any
+// other client
+//
+// any web page a browser shows may try to connect here, so a request
+// with an Origin header is refused (403) unless the origin is one of
+// the HTTP_ORIGIN lines, and only those get CORS headers; programs
+// that send no Origin are not browsers and are served; WebSocket
+// clients are read-only unless HTTP has WRITE
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "reqsched.h"
+
+#define HTTP_MAXCONN     8
+#define HTTP_MAXREQ      2048       // request head, or one WebSocket frame
+#define HTTP_MAXJSON     8192
+#define HTTP_DEFAULT_RATE 10
+#define HTTP_MAXRATE     100
+#define WS_GUID          "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// WebSocket opcodes
+#define WS_TEXT   0x1
+#define WS_CLOSE  0x8
+#define WS_PING   0x9
+#define WS_PONG   0xA
+
+
+struct httpconn
+  {
+  int    fd;                // -1 when free
+  bool   ws;                // upgraded to WebSocket
+  struct sched_client sched;  // limits of the commands it sends
+  size_t len;
+  char   buf[HTTP_MAXREQ+1];
+  };
+
+struct http
+  {
+  int             sock;     // -1 when not configured
+  int             timerfd;
+  unsigned int    rate_hz;
+  unsigned long   requests, pushes, dropped;
+  const char     *cors;     // allowed origin of the request being answered
+  struct httpconn c[HTTP_MAXCONN];
+  };
+
+extern struct http http;
+
+
+/******* protos *******/
+
+void   sha1_block(uint32_t h[5], const unsigned char *blk);
+void   sha1(const unsigned char *data, size_t len, unsigned char out[20]);
+size_t base64(const unsigned char *in, size_t len, char *out);
+int    http_open(void);
+int    http_set_rate(unsigned int hz);
+int    http_accept(void);
+struct httpconn *http_conn_by_fd(int fd);
+bool   http_origin_ok(const char *head);
+void   http_close(struct httpconn *c);
+size_t http_state_json(char *buf, size_t maxlen);
+int    http_send(struct httpconn *c, const char *data, size_t len);
+int    http_ws_send(struct httpconn *c, int op, const char *data, size_t len);
+void   http_reply(struct httpconn *c, const char *status, const char *type, const char *body, bool keep);
+const char *http_header(const char *head, const char *name, char *val, size_t maxlen);
+int    http_request(struct httpconn *c, size_t headlen);
+int    http_ws_frame(struct httpconn *c);
+void   http_receive(struct httpconn *c);
+void   http_drain(struct httpconn *c);
+void   http_drain_all(void);
+void   http_tick(void);
+
+#endif
@@ -0,0 +1,441 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync register write journal           ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+_Static_assert(sizeof(struct journal_ent)==64, "journal entries are 64 bytes");
+_Static_assert(sizeof(struct journal_hdr)==64, "journal header is 64 bytes");
+_Static_assert((JOURNAL_NENT & (JOURNAL_NENT-1))==0, "JOURNAL_NENT must be a power of 2");
+
+/***  globals  ***/
+struct journal               journal;
+_Thread_local struct journal_who journal_who = { .src=JOURNAL_SRC_SERVER, .known=true, .fd=-1 };
+const char                  *journal_src_names[JOURNAL_NSRC] = { "SERVER", "TCP", "UNIX", "HTTP", "SUPERVISOR", "RAMP", "TUNE", "AXIPROBE" };
+
+
+//-------------------------------------------------------------------
+
+// map JOURNAL_FILE, going on from what is in it if it is ours; if it
+// can't be had the journal is kept in memory only
+// returns 0 if it is on file
+
+int journal_open(void)
+  {
+  struct journal_hdr *h;
+  void  *p;
+  int    fd;
+
+  journal.size=sizeof(struct journal_hdr)+JOURNAL_NENT*sizeof(struct journal_ent);
+  journal.file=false;
+  p=MAP_FAILED;
+  fd=open(JOURNAL_FILE, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+  if(fd<0)
+    perror("journal " JOURNAL_FILE);
+  else
+    {
+    if(ftruncate(fd, (off_t)journal.size)<0)
+      perror("journal ftruncate");
+    else
+      p=mmap(NULL, journal.size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+    // the mapping stays without the fd
+    close(fd);
+    journal.file=(p!=MAP_FAILED);
+    }
+  if(p==MAP_FAILED)
+    {
+    p=mmap(NULL, journal.size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    if(p==MAP_FAILED)
+      {
+      perror("journal mmap");
+      return -1;
+      }
+    fprintf(stderr, "journal: in memory only\n");
+    }
+
+  h=p;
+  if(memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic))!=0 || h->version!=JOURNAL_VERSION ||
+     h->entsize!=sizeof(struct journal_ent) || h->nent!=JOURNAL_NENT)
+    {
+    memset(p, 0, journal.size);
+    h->version=JOURNAL_VERSION;
+    h->entsize=sizeof(struct journal_ent);
+    h->nent=JOURNAL_NENT;
+    // the magic last: a half written header is not taken for one
+    atomic_thread_fence(memory_order_release);
+    memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+    }
+  else
+    fprintf(stderr, "journal: %llu entries in " JOURNAL_FILE "\n", (unsigned long long)atomic_load(&h->head));
+  journal.ent=(struct journal_ent *)(h+1);
+  journal.hdr=h;
+
+  // where a run starts; the timestamps before it are of another clock
+  journal_who.id=(uint32_t)getpid();
+  journal_add(JOURNAL_START, 0, 0, 0, 0, 0, (uint32_t)time(NULL), journal_now());
+  journal_who.id=0;
+  return journal.file? 0 : -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+uint64_t journal_now(void)
+  {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+  }
+
+
+//-------------------------------------------------------------------
+
+// a command from the client on fd starts; who it is is only looked up
+// if the command writes something
+
+void journal_begin(int fd)
+  {
+  if(journal.hdr==NULL)
+    return;
+  journal_who.src=JOURNAL_SRC_SERVER;
+  journal_who.known=false;
+  journal_who.fd=fd;
+  journal_who.t0=journal_now();
+  journal_who.first=atomic_load_explicit(&journal.hdr->head, memory_order_relaxed);
+  journal_who.last=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the command is answered: its entries get the time the handler took
+
+void journal_end(void)
+  {
+  struct journal_ent *e;
+  uint64_t head, seq, s;
+  uint32_t lat;
+
+  if(journal.hdr==NULL || journal_who.fd<0)
+    return;
+  if(journal_who.last!=0)
+    {
+    lat=(uint32_t)(journal_now()-journal_who.t0);
+    head=atomic_load(&journal.hdr->head);
+    if(head-journal_who.first>JOURNAL_NENT)
+      journal_who.first=head-JOURNAL_NENT;
+    for(seq=journal_who.first; seq<head; seq++)
+      {
+      e=&journal.ent[seq & (JOURNAL_NENT-1)];
+      s=atomic_load_explicit(&e->seq, memory_order_acquire);
+      if(s!=seq+1 || e->src!=journal_who.src || e->fd!=journal_who.fd)
+        continue;
+      // ours since journal_begin(): nobody else writes it
+      atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      e->lat_ns=lat;
+      journal_publish(e, seq);
+      }
+    }
+  journal_who.src=JOURNAL_SRC_SERVER;
+  journal_who.known=true;
+  journal_who.fd=-1;
+  journal_who.t0=0;
+  journal_who.last=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// a thread of the server's own, about to run part src; for the
+// sampler, of the sample taken at t
+
+void journal_thread(enum journal_src src, uint64_t t)
+  {
+  journal_who.src=src;
+  journal_who.known=true;
+  journal_who.fd=-1;
+  journal_who.t0=t;
+  }
+
+
+//-------------------------------------------------------------------
+
+void journal_whois(struct journal_who *w)
+  {
+  struct sockaddr_in sa;
+  struct conn *c;
+  socklen_t len;
+
+  w->known=true;
+  w->src=JOURNAL_SRC_SERVER;
+  w->ip=0;
+  w->id=0;
+  w->uid=0;
+  if((c=conn_by_fd(w->fd))!=NULL && c->peer.local)
+    {
+    w->src=JOURNAL_SRC_UNIX;
+    w->id=(uint32_t)c->peer.pid;
+    w->uid=(uint32_t)c->peer.uid;
+    return;
+    }
+  if(c!=NULL)
+    w->src=JOURNAL_SRC_TCP;
+  else if(http_conn_by_fd(w->fd)!=NULL)
+    w->src=JOURNAL_SRC_HTTP;
+  else
+    return;
+  len=sizeof(sa);
+  if(getpeername(w->fd, (struct sockaddr *)&sa, &len)==0 && sa.sin_family==AF_INET)
+    {
+    w->ip=sa.sin_addr.s_addr;
+    w->id=ntohs(sa.sin_port);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// the next slot, marked as being written
+
+struct journal_ent *journal_claim(uint64_t *seq)
+  {
+  struct journal_ent *e;
+
+  *seq=atomic_fetch_add_explicit(&journal.hdr->head, 1, memory_order_relaxed);
+  e=&journal.ent[*seq & (JOURNAL_NENT-1)];
+  atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  return e;
+  }
+
+
+//-------------------------------------------------------------------
+
+void journal_publish(struct journal_ent *e, uint64_t seq)
+  {
+  atomic_store_explicit(&e->seq, seq+1, memory_order_release);
+  }
+
+
+//-------------------------------------------------------------------
+
+// into our last entry, if it is the same register and still the last
+// one of the journal; returns false if it needs an entry of its own
+
+bool journal_fold(uint8_t kind, uint8_t dev, uint16_t addr, uint8_t sub, uint32_t val, uint64_t now)
+  {
+  struct journal_ent *e;
+  uint64_t seq, span;
+
+  if(journal_who.last==0 || atomic_load_explicit(&journal.hdr->head, memory_order_relaxed)!=journal_who.last)
+    return false;
+  seq=journal_who.last-1;
+  e=&journal.ent[seq & (JOURNAL_NENT-1)];
+  if(e->kind!=kind || e->dev!=dev || e->addr!=addr || e->sub!=sub || e->src!=journal_who.src ||
+     (e->flags & JOURNAL_F_FAILED))
+    return false;
+  span=(now-e->t_ns)/1000;
+  if(span>UINT32_MAX || span-e->span_us>JOURNAL_FOLD_GAP_MS*1000ULL)
+    return false;
+
+  atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  e->lastold=e->newv;
+  e->flags|=JOURNAL_F_LAST;
+  e->newv=val;
+  e->count++;
+  e->span_us=(uint32_t)span;
+  journal_publish(e, seq);
+  return true;
+  }
+
+
+//-------------------------------------------------------------------
+
+void journal_add(uint8_t kind, uint8_t dev, uint16_t addr, uint8_t sub, uint8_t flags, uint32_t oldv, uint32_t val, uint64_t now)
+  {
+  struct journal_ent *e;
+  uint64_t seq;
+
+  if(!journal_who.known)
+    journal_whois(&journal_who);
+  e=journal_claim(&seq);
+  e->t_ns=now;
+  e->oldv=oldv;
+  e->newv=val;
+  // a command's is filled in by journal_end()
+  e->lat_ns=(journal_who.fd<0 && journal_who.t0!=0 && now>journal_who.t0)? (uint32_t)(now-journal_who.t0) : 0;
+  e->count=1;
+  e->span_us=0;
+  e->addr=addr;
+  e->kind=kind;
+  e->dev=dev;
+  e->src=journal_who.src;
+  e->sub=sub;
+  e->flags=flags;
+  e->pad=0;
+  e->fd=journal_who.fd;
+  e->ip=journal_who.ip;
+  e->id=journal_who.id;
+  e->uid=journal_who.uid;
+  e->lastold=0;
+  journal_publish(e, seq);
+  journal_who.last=seq+1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// register reg of device dev is about to get val; the old value is
+// read from bank only for a new entry
+
+void journal_reg(int dev, unsigned int reg, const volatile uint32_t *bank, uint32_t val)
+  {
+  uint64_t now;
+
+  if(journal.hdr==NULL)
+    return;
+  now=journal_now();
+  if(!journal_fold(JOURNAL_REG, (uint8_t)dev, (uint16_t)reg, 0, val, now))
+    journal_add(JOURNAL_REG, (uint8_t)dev, (uint16_t)reg, 0, JOURNAL_F_OLD, bank[reg], val, now);
+  }
+
+
+//-------------------------------------------------------------------
+
+void journal_can(int dev, uint16_t addr, uint8_t sub, bool have_old, uint32_t oldv, uint32_t val, bool failed)
+  {
+  uint64_t now;
+
+  if(journal.hdr==NULL)
+    return;
+  now=journal_now();
+  if(failed || !journal_fold(JOURNAL_CAN, (uint8_t)dev, addr, sub, val, now))
+    journal_add(JOURNAL_CAN, (uint8_t)dev, addr, sub, (have_old? JOURNAL_F_OLD : 0) | (failed? JOURNAL_F_FAILED : 0),
+                oldv, val, now);
+  }
+
+
+//-------------------------------------------------------------------
+
+// a consistent copy of entry seq; false if it is gone, not written
+// yet or being written
+
+bool journal_get(uint64_t seq, struct journal_ent *out)
+  {
+  struct journal_ent *e;
+  uint64_t s;
+
+  e=&journal.ent[seq & (JOURNAL_NENT-1)];
+  s=atomic_load_explicit(&e->seq, memory_order_acquire);
+  if(s!=seq+1)
+    return false;
+  memcpy(out, e, sizeof(*out));
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&e->seq, memory_order_relaxed)==s;
+  }
+
+
+//-------------------------------------------------------------------
+
+// 41 1234.567890 DEV0 REG 1 0x00000000 -> 0x00000004 TCP 10.0.0.5:40312 fd 7 lat 35.2 us
+// 42 1240.000000 DEV0 REG 3 0x00000010 -> 0x000000A0 x1200 in 120000 us last 0x0000009F RAMP lat 3.1 us
+
+void journal_format(const struct journal_ent *e, struct out *o)
+  {
+  char  buf[32];
+  struct tm tm;
+  struct in_addr a;
+  time_t t;
+
+  out_uint(o, atomic_load_explicit(&e->seq, memory_order_relaxed)-1);
+  out_str(o, " ");
+  out_fix(o, (int64_t)(e->t_ns/1000), 6, false);
+  if(e->kind==JOURNAL_START)
+    {
+    t=(time_t)e->newv;
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    out_str(o, " START pid ");
+    out_uint(o, e->id);
+    out_str(o, " at ");
+    out_str(o, buf);
+    out_str(o, "\n");
+    return;
+    }
+
+  out_str(o, " DEV");
+  out_uint(o, e->dev);
+  if(e->kind==JOURNAL_REG)
+    {
+    out_str(o, " REG ");
+    out_uint(o, e->addr);
+    }
+  else
+    {
+    out_str(o, " CAN 0x");
+    out_hex(o, e->addr, 4);
+    out_str(o, ".");
+    out_hex(o, e->sub, 2);
+    }
+  if(e->flags & JOURNAL_F_OLD)
+    {
+    out_str(o, " 0x");
+    out_hex(o, e->oldv, 8);
+    }
+  else
+    out_str(o, " ?");
+  out_str(o, " -> 0x");
+  out_hex(o, e->newv, 8);
+  if(e->count>1)
+    {
+    out_str(o, " x");
+    out_uint(o, e->count);
+    out_str(o, " in ");
+    out_uint(o, e->span_us);
+    out_str(o, " us");
+    if(e->flags & JOURNAL_F_LAST)
+      {
+      out_str(o, " last 0x");
+      out_hex(o, e->lastold, 8);
+      }
+    }
+  if(e->flags & JOURNAL_F_FAILED)
+    out_str(o, " failed");
+
+  out_str(o, " ");
+  out_str(o, (e->src<JOURNAL_NSRC)? journal_src_names[e->src] : "?");
+  if(e->src==JOURNAL_SRC_TCP || e->src==JOURNAL_SRC_HTTP)
+    {
+    a.s_addr=e->ip;
+    out_str(o, " ");
+    out_str(o, inet_ntop(AF_INET, &a, buf, sizeof(buf))!=NULL? buf : "?");
+    out_str(o, ":");
+    out_uint(o, e->id);
+    }
+  else if(e->src==JOURNAL_SRC_UNIX)
+    {
+    out_str(o, " uid ");
+    out_uint(o, e->uid);
+    out_str(o, " pid ");
+    out_uint(o, e->id);
+    }
+  if(e->fd>=0)
+    {
+    out_str(o, " fd ");
+    out_uint(o, (uint64_t)e->fd);
+    }
+  if(e->lat_ns!=0)
+    {
+    out_str(o, " lat ");
+    out_fix(o, e->lat_ns/100, 1, false);
+    out_str(o, " us");
+    }
+  out_str(o, "\n");
+  }
@@ -0,0 +1,153 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync register write journal           ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// every write to a synchronizer register and every MECOS write on the
+// CAN bus goes into the journal, with who did it:
+//
+//   time (CLOCK_MONOTONIC), device, register, old and new value,
+//   source: the client (TCP/HTTP address and port, UNIX uid and pid,
+//   fd), the sampler thread part (SUPERVISOR, RAMP, TUNE) or the
+//   register access probe (AXIPROBE)
+//   latency: for a command the time its handler took, start to
+//   answer; in the sampler thread the time from the sampling instant
+//   to the write
+//
+// the journal is a ring of JOURNAL_NENT fixed size entries in a file
+// mapped MAP_SHARED, so it survives a crash of the server and is read
+// back at the next start (and a hot upgrade goes on writing the same
+// one); the kernel writes it out, the writers never make a system call
+// writers take a slot with one atomic add on the head, and publish it
+// with a per-entry sequence number (0 while it is being written), so
+// the sampler thread and the main thread never wait for each other
+// the same source writing the same register again, with nothing else
+// journaled in between, is folded into the last entry (a phase ramp is
+// one entry, not one per sample); only the count, the last value, the
+// value before it and the time since the first write change: the
+// first and the last step are kept, the ones in between are not
+//
+// the old value of a MECOS write is what the cache last read from the
+// AMB, when there is one
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "scpi.h"
+
+#define JOURNAL_FILE     "/var/lib/chopsync/journal"
+#define JOURNAL_NENT     65536    // power of 2; 4 MB
+#define JOURNAL_PAGE     12       // entries per JOURNAL? answer (MAXANS)
+#define JOURNAL_FOLD_GAP_MS 100   // longer apart: entries of their own
+#define JOURNAL_MAGIC    "CHOPJRNL"
+#define JOURNAL_VERSION  1
+
+enum journal_kind
+  {
+  JOURNAL_START,          // a server started; newv is the wall clock (s)
+  JOURNAL_REG,
+  JOURNAL_CAN,
+  JOURNAL_NKINDS
+  };
+
+enum journal_src
+  {
+  JOURNAL_SRC_SERVER,     // the server itself, outside of any command
+  JOURNAL_SRC_TCP,
+  JOURNAL_SRC_UNIX,
+  JOURNAL_SRC_HTTP,
+  JOURNAL_SRC_SUPERVISOR,
+  JOURNAL_SRC_RAMP,
+  JOURNAL_SRC_TUNE,
+  JOURNAL_SRC_AXIPROBE,
+  JOURNAL_NSRC
+  };
+
+#define JOURNAL_F_OLD     0x01    // oldv is known
+#define JOURNAL_F_FAILED  0x02    // the CAN frame could not be sent
+#define JOURNAL_F_LAST    0x04    // lastold is set (count>1)
+
+struct journal_ent
+  {
+  _Atomic uint64_t seq;           // sequence number + 1; 0 while written
+  uint64_t         t_ns;          // of the first write
+  uint32_t         oldv, newv;
+  uint32_t         lat_ns;
+  uint32_t         count;         // writes folded into the entry
+  uint32_t         span_us;       // from the first of them to the last
+  uint16_t         addr;          // register; MECOS address
+  uint8_t          kind, dev, src, sub, flags, pad;
+  int32_t          fd;
+  uint32_t         ip;            // TCP, HTTP; network order
+  uint32_t         id;            // port (TCP, HTTP), pid (UNIX, START)
+  uint32_t         uid;           // UNIX
+  uint32_t         lastold;       // before the last folded write
+  };
+
+struct journal_hdr
+  {
+  char             magic[8];
+  uint32_t         version, entsize, nent, pad;
+  _Atomic uint64_t head;          // entries ever written
+  uint64_t         pad2[4];
+  };
+
+struct journal
+  {
+  struct journal_hdr *hdr;        // NULL: not journaling
+  struct journal_ent *ent;
+  size_t              size;
+  bool                file;       // false: in memory only
+  };
+
+// who is writing, per thread; set around every command by the main
+// thread, by sampler part in the sampler thread, once by the probe
+struct journal_who
+  {
+  uint8_t   src;
+  bool      known;                // identity below looked up
+  int       fd;
+  uint32_t  ip, id, uid;
+  uint64_t  t0;                   // start of the command, or the sample
+  uint64_t  first;                // first seq of the command
+  uint64_t  last;                 // seq + 1 of our last entry, 0 if none
+  };
+
+extern struct journal               journal;
+extern _Thread_local struct journal_who journal_who;
+extern const char                  *journal_src_names[JOURNAL_NSRC];
+
+
+/******* protos *******/
+
+int      journal_open(void);
+uint64_t journal_now(void);
+void     journal_begin(int fd);
+void     journal_end(void);
+void     journal_thread(enum journal_src src, uint64_t t);
+void     journal_whois(struct journal_who *w);
+struct journal_ent *journal_claim(uint64_t *seq);
+void     journal_publish(struct journal_ent *e, uint64_t seq);
+bool     journal_fold(uint8_t kind, uint8_t dev, uint16_t addr, uint8_t sub, uint32_t val, uint64_t now);
+void     journal_add(uint8_t kind, uint8_t dev, uint16_t addr, uint8_t sub, uint8_t flags, uint32_t oldv, uint32_t val, uint64_t now);
+void     journal_reg(int dev, unsigned int reg, const volatile uint32_t *bank, uint32_t val);
+void     journal_can(int dev, uint16_t addr, uint8_t sub, bool have_old, uint32_t oldv, uint32_t val, bool failed);
+bool     journal_get(uint64_t seq, struct journal_ent *out);
+void     journal_format(const struct journal_ent *e, struct out *o);
+
+#endif
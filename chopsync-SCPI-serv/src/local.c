@@ -0,0 +1,166 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync local (AF_UNIX) listeners        ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#define _GNU_SOURCE
+#include "server.h"
+
+/***  globals  ***/
+struct local_listener local_ls[MAXUNIX];
+
+
+//-------------------------------------------------------------------
+
+// open the configured listeners; a listener that fails is left out,
+// TCP keeps working; returns the number of open listeners
+
+int local_open(void)
+  {
+  struct sockaddr_un name;
+  struct unixconf *u;
+  socklen_t len;
+  int i, n;
+
+  n=0;
+  for(i=0; i<MAXUNIX; i++)
+    {
+    local_ls[i].sock=-1;
+    u=&cfg.ux[i];
+    if(!u->used)
+      continue;
+
+    // from the server we replace, or from systemd
+    local_ls[i].sock=upgrade_take(UPG_UNIX_LISTEN, u->path, -1);
+    if(local_ls[i].sock>=0)
+      {
+      local_ls[i].type=u->type;
+      fprintf(stderr, "listening on %s (%s, inherited)\n", u->path, (u->type==SOCK_SEQPACKET)?"SEQPACKET":"STREAM");
+      n++;
+      continue;
+      }
+
+    memset(&name, 0, sizeof(name));
+    name.sun_family=AF_UNIX;
+    if(u->path[0]=='@')
+      {
+      // abstract: leading NUL, length counts the name only
+      memcpy(name.sun_path+1, u->path+1, strlen(u->path)-1);
+      len=offsetof(struct sockaddr_un, sun_path)+strlen(u->path);
+      }
+    else
+      {
+      strcpy(name.sun_path, u->path);
+      len=sizeof(name);
+      // left over from a previous run
+      unlink(u->path);
+      }
+
+    local_ls[i].sock=socket(AF_UNIX, u->type|SOCK_CLOEXEC, 0);
+    if(local_ls[i].sock<0)
+      {
+      perror("local socket");
+      continue;
+      }
+    if(bind(local_ls[i].sock, (struct sockaddr *)&name, len)<0 || listen(local_ls[i].sock, 8)<0)
+      {
+      fprintf(stderr, "local listener %s: %s\n", u->path, strerror(errno));
+      close(local_ls[i].sock);
+      local_ls[i].sock=-1;
+      continue;
+      }
+    // anybody may connect; credentials decide who may write
+    if(u->path[0]!='@')
+      chmod(u->path, 0666);
+    local_ls[i].type=u->type;
+    fprintf(stderr, "listening on %s (%s)\n", u->path, (u->type==SOCK_SEQPACKET)?"SEQPACKET":"STREAM");
+    n++;
+    }
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+int local_listener_by_fd(int fd)
+  {
+  int i;
+
+  if(fd<0)
+    return -1;
+  for(i=0; i<MAXUNIX; i++)
+    if(local_ls[i].sock==fd)
+      return i;
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// accept a client on listener k and look at its credentials; returns
+// the new fd, or -1
+
+int local_accept(int k)
+  {
+  struct unixconf *u;
+  struct ucred cred;
+  struct conn *c;
+  struct peer *p;
+  socklen_t len;
+  int fd;
+
+  fd=accept(local_ls[k].sock, NULL, NULL);
+  if(fd<0)
+    {
+    perror("local accept");
+    return -1;
+    }
+  if((c=conn_open(fd))==NULL)
+    return -1;
+
+  u=&cfg.ux[k];
+  p=&c->peer;
+  p->local=true;
+  p->listener=k;
+  len=sizeof(cred);
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)<0)
+    {
+    // nobody we know: read-only
+    perror("SO_PEERCRED");
+    p->pid=0;
+    p->uid=(uid_t)-1;
+    p->gid=(gid_t)-1;
+    }
+  else
+    {
+    p->pid=cred.pid;
+    p->uid=cred.uid;
+    p->gid=cred.gid;
+    }
+  p->readonly=!(p->uid==0 || p->uid==geteuid() ||
+               (u->wuid>=0 && p->uid==(uid_t)u->wuid) ||
+               (u->wgid>=0 && p->gid==(gid_t)u->wgid));
+
+  fprintf(stderr, "Server: new connection on %s from pid %d uid %d gid %d%s\n",
+          u->path, (int)p->pid, (int)p->uid, (int)p->gid, p->readonly?" (read-only)":"");
+  return fd;
+  }
+
+
+//-------------------------------------------------------------------
+
+// TCP clients are not restricted, WebSocket clients only if the HTTP
+// line says WRITE
+
+bool local_may_write(int fd)
+  {
+  struct conn *c;
+
+  if(http_conn_by_fd(fd)!=NULL)
+    return cfg.http_write;
+  c=conn_by_fd(fd);
+  return (c==NULL || !c->peer.readonly);
+  }
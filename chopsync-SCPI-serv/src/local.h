@@ -0,0 +1,61 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync local (AF_UNIX) listeners        ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// besides TCP the server can listen on AF_UNIX sockets (UNIX in the
+// config file) for clients on the board itself: no TCP stack and no
+// Nagle on the way, and with SOCK_SEQPACKET one read is exactly one
+// command
+// names starting with '@' are in the abstract namespace: nothing in
+// the filesystem, gone when the server exits
+// the kernel tells who is connecting (SO_PEERCRED); only root, the
+// server's own user and the configured writer uid/gid may send write
+// commands, everybody else is read-only; TCP clients are not affected
+
+#ifndef LOCAL_H
+#define LOCAL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include "config.h"
+
+// what we know about the client on a connected fd
+struct peer
+  {
+  bool  local;
+  bool  readonly;
+  int   listener;
+  pid_t pid;
+  uid_t uid;
+  gid_t gid;
+  };
+
+struct local_listener
+  {
+  int sock;
+  int type;
+  };
+
+extern struct local_listener local_ls[MAXUNIX];
+
+
+/******* protos *******/
+
+int  local_open(void);
+int  local_listener_by_fd(int fd);
+int  local_accept(int k);
+bool local_may_write(int fd);
+
+#endif
@@ -0,0 +1,55 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync log2 latency histograms          ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+
+//-------------------------------------------------------------------
+
+void loghist_add(unsigned long *bin, int nbins, unsigned long bin0, unsigned long v)
+  {
+  int k;
+
+  for(k=0; k<nbins-1 && v>=(bin0<<k); k++)
+    ;
+  bin[k]++;
+  }
+
+
+//-------------------------------------------------------------------
+
+// estimate a percentile of n samples between min and max, interpolating
+// linearly inside the bin; -1 if there are no samples
+
+long loghist_percentile(const unsigned long *bin, int nbins, unsigned long bin0,
+                        unsigned long n, double min, double max, double pct)
+  {
+  double target, lo, hi;
+  unsigned long cum;
+  int k;
+
+  if(n==0)
+    return -1;
+  target=n*pct/100.;
+  cum=0;
+  for(k=0; k<nbins; k++)
+    {
+    if(cum+bin[k]>=target && bin[k]>0)
+      {
+      lo=(k==0)? 0 : (double)(bin0<<(k-1));
+      hi=(k==nbins-1)? max : (double)(bin0<<k);
+      if(hi>max)
+        hi=max;
+      if(lo<min)
+        lo=min;
+      return (long)(lo+(hi-lo)*(target-cum)/bin[k]);
+      }
+    cum+=bin[k];
+    }
+  return (long)max;
+  }
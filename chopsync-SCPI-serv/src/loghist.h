@@ -0,0 +1,26 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync log2 latency histograms          ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// the bins of the CAN round trip (canmon.h) and register access
+// (axiprobe.h) histograms: bin 0 is < bin0, bin k is
+// [bin0<<(k-1), bin0<<k) and the last bin is open ended
+// the callers keep count, min, max and sum in their own units and
+// hand them in; only the bin array is shared
+
+#ifndef LOGHIST_H
+#define LOGHIST_H
+
+#include <stdio.h>
+
+
+/***  protos  ***/
+
+void  loghist_add(unsigned long *bin, int nbins, unsigned long bin0, unsigned long v);
+long  loghist_percentile(const unsigned long *bin, int nbins, unsigned long bin0,
+                         unsigned long n, double min, double max, double pct);
+
+#endif
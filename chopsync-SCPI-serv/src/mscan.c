@@ -0,0 +1,326 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync MECOS object dictionary scan     ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "mscan.h"
+
+/***  globals  ***/
+struct mscan mscan;
+const char  *mscan_state_names[MSCAN_NSTATES] = { "IDLE", "RUNNING", "DONE", "STOPPED" };
+
+
+//-------------------------------------------------------------------
+
+// <lo>-<hi> or a single <n>, both ends in 0..max; NUM_* code
+
+int mscan_range(struct span s, int64_t max, unsigned int *lo, unsigned int *hi)
+  {
+  struct span a, b;
+  const char *dash;
+  int64_t vlo, vhi;
+  int ret;
+
+  dash=(s.len>1)? memchr(s.p+1, '-', s.len-1) : NULL;
+  a.p=s.p;
+  a.len=(dash!=NULL)? (size_t)(dash-s.p) : s.len;
+  ret=num_int(a, 0, max, &vlo);
+  if(ret!=NUM_OK)
+    return ret;
+  vhi=vlo;
+  if(dash!=NULL)
+    {
+    b.p=dash+1;
+    b.len=s.len-a.len-1;
+    ret=num_int(b, 0, max, &vhi);
+    if(ret!=NUM_OK)
+      return ret;
+    if(vhi<vlo)
+      return NUM_RANGE;
+    }
+  *lo=(unsigned int)vlo;
+  *hi=(unsigned int)vhi;
+  return NUM_OK;
+  }
+
+
+//-------------------------------------------------------------------
+
+// addresses outer, subindices inner: the dump comes out sorted
+// returns -1 if a scan is running or the range is too big
+
+int mscan_start(int dev, struct can_node *node, unsigned int addr_lo, unsigned int addr_hi, unsigned int sub_lo, unsigned int sub_hi)
+  {
+  unsigned int a, s;
+  int n;
+
+  if(mscan.state==MSCAN_RUNNING)
+    return -1;
+  if((addr_hi-addr_lo+1)*(sub_hi-sub_lo+1)>MSCAN_MAX)
+    return -1;
+
+  // reads of the last scan still out are not ours any more
+  mscan.gen++;
+  mscan.dev=dev;
+  mscan.node=node;
+  mscan.addr_lo=addr_lo;
+  mscan.addr_hi=addr_hi;
+  mscan.sub_lo=sub_lo;
+  mscan.sub_hi=sub_hi;
+  n=0;
+  for(a=addr_lo; a<=addr_hi; a++)
+    for(s=sub_lo; s<=sub_hi; s++)
+      {
+      mscan.ent[n].addr=(uint16_t)a;
+      mscan.ent[n].sub=(uint8_t)s;
+      mscan.ent[n].res=MSCAN_PENDING;
+      mscan.ent[n].val=0;
+      n++;
+      }
+  mscan.n=n;
+  mscan.next=0;
+  mscan.inflight=0;
+  mscan.found=0;
+  mscan.noanswer=0;
+  mscan.failed=0;
+  mscan.why[0]=0;
+  clock_gettime(CLOCK_MONOTONIC, &mscan.start);
+  mscan.state=MSCAN_RUNNING;
+  fprintf(stderr, "MECOS scan: %s+0x%02X 0x%04X-0x%04X subindex %u-%u, %d registers\n",
+          node->ifname, node->nodeoff, addr_lo, addr_hi, sub_lo, sub_hi, n);
+  mscan_pump();
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void mscan_stop(const char *why)
+  {
+  if(mscan.state!=MSCAN_RUNNING)
+    return;
+  mscan.state=MSCAN_STOPPED;
+  clock_gettime(CLOCK_MONOTONIC, &mscan.end);
+  snprintf(mscan.why, sizeof(mscan.why), "%s", why);
+  fprintf(stderr, "MECOS scan: stopped (%s) after %d of %d registers\n", why, mscan.next-mscan.inflight, mscan.n);
+  }
+
+
+//-------------------------------------------------------------------
+
+// keep the window full; called when the scan starts, whenever one of
+// its reads is over, and by mscan_service() when it had to wait for
+// room with none of its own reads out
+
+void mscan_pump(void)
+  {
+  struct mscan_ent *e;
+  int ret;
+
+  while(mscan.state==MSCAN_RUNNING && mscan.inflight<MSCAN_WINDOW && mscan.next<mscan.n)
+    {
+    e=&mscan.ent[mscan.next];
+    ret=can_read_async(mscan.node, (unsigned char)(e->addr>>8), (unsigned char)(e->addr&0xFF), e->sub,
+                       CAN_PRIO_BACKGROUND, MSCAN_DEADLINE_MS, mscan_done,
+                       (void *)(((uintptr_t)mscan.gen<<16) | (uintptr_t)mscan.next));
+    if(ret==0)
+      {
+      mscan.next++;
+      mscan.inflight++;
+      continue;
+      }
+    if(ret==CAN_ELINK)
+      {
+      mscan_stop("CAN link down");
+      return;
+      }
+    // no room in the in-flight table or the queue (taken by other
+    // reads): the same register again later
+    if(ret==CAN_EBUSY)
+      break;
+    e->res=MSCAN_FAILED;
+    mscan.failed++;
+    mscan.next++;
+    }
+
+  if(mscan.state==MSCAN_RUNNING && mscan.next==mscan.n && mscan.inflight==0)
+    {
+    mscan.state=MSCAN_DONE;
+    clock_gettime(CLOCK_MONOTONIC, &mscan.end);
+    fprintf(stderr, "MECOS scan: done, %d of %d registers found in %.1f s\n", mscan.found, mscan.n, mscan_elapsed());
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// once per pass of the main loop: a scan that found no room for its
+// next read and has none out has nothing else to wake it up
+
+void mscan_service(void)
+  {
+  if(mscan.state==MSCAN_RUNNING && mscan.inflight==0 && mscan.next<mscan.n)
+    mscan_pump();
+  }
+
+
+//-------------------------------------------------------------------
+
+// completion of one read; ctx is the scan generation and the index
+
+void mscan_done(void *ctx, int ret, unsigned long int val)
+  {
+  struct mscan_ent *e;
+  unsigned int gen;
+  int k;
+
+  gen=(unsigned int)((uintptr_t)ctx>>16);
+  k=(int)((uintptr_t)ctx & 0xFFFF);
+  if(gen!=(mscan.gen & ((unsigned int)(UINTPTR_MAX>>16))) || k>=mscan.n)
+    return;
+
+  mscan.inflight--;
+  e=&mscan.ent[k];
+  if(ret==CAN_OK)
+    {
+    e->res=MSCAN_FOUND;
+    e->val=(uint32_t)val;
+    mscan.found++;
+    }
+  else if(ret==CAN_ETIMEOUT)
+    {
+    e->res=MSCAN_NOANSWER;
+    mscan.noanswer++;
+    }
+  else
+    {
+    e->res=MSCAN_FAILED;
+    mscan.failed++;
+    if(ret==CAN_ELINK)
+      mscan_stop("CAN link down");
+    }
+  mscan_pump();
+  }
+
+
+//-------------------------------------------------------------------
+
+// seconds since the start, up to the end if it is over
+
+double mscan_elapsed(void)
+  {
+  struct timespec now;
+
+  if(mscan.state==MSCAN_IDLE)
+    return 0.;
+  if(mscan.state==MSCAN_RUNNING)
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  else
+    now=mscan.end;
+  return can_ts_diff_us(&now, &mscan.start)/1.e6;
+  }
+
+
+//-------------------------------------------------------------------
+
+// index of the k-th register that answered, -1 if there are fewer
+
+int mscan_nth_found(int k)
+  {
+  int i;
+
+  for(i=0; i<mscan.n; i++)
+    if(mscan.ent[i].res==MSCAN_FOUND && k--==0)
+      return i;
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// 0x2000.00 0x000001F4 500
+
+void mscan_format(const struct mscan_ent *e, struct out *o)
+  {
+  out_str(o, "0x");
+  out_hex(o, e->addr, 4);
+  out_str(o, ".");
+  out_hex(o, e->sub, 2);
+  out_str(o, " 0x");
+  out_hex(o, e->val, 8);
+  out_str(o, " ");
+  out_int(o, e->val, false);
+  out_str(o, "\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+// the registers found, as MSCAN_DIR/<name>.scan; the name comes upper
+// case from the command line, files are lower case
+// on success err holds the file name
+
+int mscan_save(const char *name, size_t len, char *err, size_t maxlen)
+  {
+  FILE  *fd;
+  char   fname[sizeof(MSCAN_DIR)+MSCAN_MAXNAME+sizeof(MSCAN_EXT)+1];
+  char   lname[MSCAN_MAXNAME+1];
+  char   line[64];
+  struct out o;
+  time_t t;
+  size_t i;
+  int    k;
+
+  if(mscan.state==MSCAN_IDLE || mscan.state==MSCAN_RUNNING)
+    {
+    snprintf(err, maxlen, "%s", (mscan.state==MSCAN_IDLE)? "no scan to save" : "scan still running");
+    return -1;
+    }
+  if(len==0 || len>MSCAN_MAXNAME)
+    {
+    snprintf(err, maxlen, "scan names are 1..%d characters", MSCAN_MAXNAME);
+    return -1;
+    }
+  // no way out of MSCAN_DIR
+  for(i=0; i<len; i++)
+    {
+    if(!isalnum((unsigned char)name[i]) && name[i]!='_' && name[i]!='-')
+      {
+      snprintf(err, maxlen, "scan names are letters, digits, _ and -");
+      return -1;
+      }
+    lname[i]=tolower((unsigned char)name[i]);
+    }
+  lname[len]=0;
+  snprintf(fname, sizeof(fname), "%s/%s%s", MSCAN_DIR, lname, MSCAN_EXT);
+
+  fd=fopen(fname, "w");
+  if(fd==NULL)
+    {
+    snprintf(err, maxlen, "can't write %s (%s)", fname, strerror(errno));
+    return -1;
+    }
+  t=time(NULL);
+  fprintf(fd, "# chopsync MECOS scan of DEV%d %s+0x%02X, %s", mscan.dev, mscan.node->ifname, mscan.node->nodeoff, ctime(&t));
+  fprintf(fd, "# addresses 0x%04X-0x%04X subindex %u-%u: %d registers, %d found, %d no answer, %d failed%s%s\n",
+          mscan.addr_lo, mscan.addr_hi, mscan.sub_lo, mscan.sub_hi, mscan.n, mscan.found, mscan.noanswer,
+          mscan.failed, (mscan.state==MSCAN_STOPPED)? ", stopped: " : "", mscan.why);
+  fprintf(fd, "# address.subindex value (hex, decimal)\n");
+  for(k=0; k<mscan.n; k++)
+    if(mscan.ent[k].res==MSCAN_FOUND)
+      {
+      out_init(&o, line, sizeof(line));
+      mscan_format(&mscan.ent[k], &o);
+      fputs(line, fd);
+      }
+  if(fclose(fd)!=0)
+    {
+    snprintf(err, maxlen, "can't write %s (%s)", fname, strerror(errno));
+    return -1;
+    }
+  snprintf(err, maxlen, "%s", fname);
+  return 0;
+  }
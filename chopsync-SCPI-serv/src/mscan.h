@@ -0,0 +1,109 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync MECOS object dictionary scan     ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// MECOS:SCAN reads a range of registers of a device's AMB in the
+// background, to find out what the object dictionary holds (and where
+// the registers we don't know the address of are) or to snapshot its
+// configuration
+//
+//   MECOS:SCAN 0x2000-0x20FF [0-3]    addresses, then subindices
+//
+// up to MSCAN_WINDOW requests are on the bus at a time, at background
+// priority so that interactive commands and the safety traffic go
+// first; answers are collected in whatever order they come, and each
+// finished read starts the next one from the main loop, so a scan
+// costs the server nothing while it waits
+// a register that does not answer within MSCAN_DEADLINE_MS is taken
+// as not there; the deadline is short on purpose, MECOS answers in a
+// few ms and a dictionary is mostly holes
+//
+// one scan at a time; the results stay until the next scan starts and
+// can be read page by page (MECOS:SCAN:DATA?) or written out as a
+// text file in MSCAN_DIR (MECOS:SCAN:SAVE)
+
+#ifndef MSCAN_H
+#define MSCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "can.h"
+#include "scpi.h"
+
+#define MSCAN_MAX          4096     // registers in one scan
+#define MSCAN_WINDOW       16       // reads in flight
+#define MSCAN_DEADLINE_MS  200
+#define MSCAN_PAGE         32       // registers per MECOS:SCAN:DATA? answer (MAXANS)
+#define MSCAN_DIR          "/var/lib/chopsync"
+#define MSCAN_EXT          ".scan"
+#define MSCAN_MAXNAME      32
+
+#if MSCAN_WINDOW > CAN_MAXINFLIGHT/2
+#error "MSCAN_WINDOW must leave room in can_inflight[] for the other reads"
+#endif
+
+enum mscan_state
+  {
+  MSCAN_IDLE,
+  MSCAN_RUNNING,
+  MSCAN_DONE,
+  MSCAN_STOPPED,        // by hand, or the link went down
+  MSCAN_NSTATES
+  };
+
+// what became of one register
+enum mscan_res
+  {
+  MSCAN_PENDING,
+  MSCAN_FOUND,
+  MSCAN_NOANSWER,
+  MSCAN_FAILED
+  };
+
+struct mscan_ent
+  {
+  uint16_t addr;
+  uint8_t  sub;
+  uint8_t  res;         // enum mscan_res
+  uint32_t val;
+  };
+
+struct mscan
+  {
+  enum mscan_state state;
+  int              dev;
+  struct can_node *node;
+  unsigned int     gen;            // answers to an older scan are ignored
+  unsigned int     addr_lo, addr_hi, sub_lo, sub_hi;
+  int              n, next, inflight;
+  int              found, noanswer, failed;
+  struct timespec  start, end;
+  char             why[32];        // why it stopped
+  struct mscan_ent ent[MSCAN_MAX];
+  };
+
+extern struct mscan mscan;
+extern const char  *mscan_state_names[MSCAN_NSTATES];
+
+
+/******* protos *******/
+
+int    mscan_range(struct span s, int64_t max, unsigned int *lo, unsigned int *hi);
+int    mscan_start(int dev, struct can_node *node, unsigned int addr_lo, unsigned int addr_hi, unsigned int sub_lo, unsigned int sub_hi);
+void   mscan_stop(const char *why);
+void   mscan_pump(void);
+void   mscan_service(void);
+void   mscan_done(void *ctx, int ret, unsigned long int val);
+double mscan_elapsed(void);
+int    mscan_nth_found(int k);
+void   mscan_format(const struct mscan_ent *e, struct out *o);
+int    mscan_save(const char *name, size_t len, char *err, size_t maxlen);
+
+#endif
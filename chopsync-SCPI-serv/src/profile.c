@@ -0,0 +1,558 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync run setup (CONFIGURE)            ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+// registers as they were before the last CONFIGURE of each device
+struct setupundo setupundo[MAXDEV];
+
+// keywords, in the order CONFIGURE? lists them
+static const struct
+  {
+  const char   *name, *alias;
+  unsigned int  bit;
+  } setup_keys[] =
+  {
+  { "SYNCHRONIZER",          "SYNCH",     SU_SYNCH },
+  { "BUNCHMARKER_PRESCALER", NULL,        SU_BUNCH_PRESC },
+  { "CHOPPER_PRESCALER",     NULL,        SU_CHOP_PRESC },
+  { "TRIGOUT_PH",            NULL,        SU_TRIGOUT },
+  { "GAIN",                  "G",         SU_GAIN },
+  { "UNW_THR",               NULL,        SU_UNWTHR },
+  { "UNWRAP",                "UNWRAPPER", SU_UNWRAP },
+  { "UNW_RES",               NULL,        SU_UNWRES },
+  { "PHSETPOINT_NS",         NULL,        SU_PHSETP },
+  };
+#define NSETUPKEYS (sizeof(setup_keys)/sizeof(setup_keys[0]))
+
+
+//-------------------------------------------------------------------
+
+// gain register (ufix_16.12) in millionths, rounded half to even
+// like %f
+
+uint32_t setup_gain_micro(unsigned int raw)
+  {
+  uint32_t q, r;
+
+  q=(uint32_t)raw*15625U/64U;
+  r=(uint32_t)raw*15625U%64U;
+  if(r>32 || (r==32 && (q&1)!=0))
+    q++;
+  return q;
+  }
+
+
+//-------------------------------------------------------------------
+
+static int setup_onoff(struct toker *tk, bool *on)
+  {
+  struct span p;
+
+  if(!tok_next(tk, &p))
+    return NUM_MISSING;
+  if(span_eq(p, "ON"))
+    *on=true;
+  else if(span_eq(p, "OFF"))
+    *on=false;
+  else
+    return NUM_SYNTAX;
+  return NUM_OK;
+  }
+
+
+//-------------------------------------------------------------------
+
+// keyword/value pairs into s, which may already hold some (a profile
+// is parsed line by line); the values are checked one by one here,
+// their combination by setup_validate()
+
+int setup_parse(struct toker *tk, struct setup *s, char *err, size_t maxlen)
+  {
+  struct span k;
+  int64_t v;
+  double  g;
+  size_t  i;
+  int     ret;
+
+  while(tok_next(tk, &k))
+    {
+    for(i=0; i<NSETUPKEYS; i++)
+      if(span_eq(k, setup_keys[i].name) || (setup_keys[i].alias!=NULL && span_eq(k, setup_keys[i].alias)))
+        break;
+    if(i==NSETUPKEYS)
+      {
+      snprintf(err, maxlen, "unknown parameter %.*s", (int)k.len, k.p);
+      return -1;
+      }
+    if(s->have & setup_keys[i].bit)
+      {
+      snprintf(err, maxlen, "%s given twice", setup_keys[i].name);
+      return -1;
+      }
+
+    switch(setup_keys[i].bit)
+      {
+      case SU_BUNCH_PRESC:
+      case SU_CHOP_PRESC:
+        // what the register field holds; no clamping here
+        ret=tok_int(tk, 1, PRESCALER_MASK, &v);
+        if(setup_keys[i].bit==SU_BUNCH_PRESC)
+          s->bunch_presc=(unsigned int)v;
+        else
+          s->chop_presc=(unsigned int)v;
+        break;
+      case SU_TRIGOUT:
+        // against the prescaler in setup_validate()
+        ret=tok_int(tk, 1, TRIGOUT_MASK, &v);
+        s->trigout=(unsigned int)v;
+        break;
+      case SU_GAIN:
+        ret=tok_fix(tk, UNIT_NONE, 0, 6, 0, INT64_MAX, &v);
+        if(ret==NUM_OK)
+          {
+          g=round(v/1e6*POW_2_12);
+          if(g<1 || g>MAX_G)
+            ret=NUM_RANGE;
+          else
+            s->gain_raw=(unsigned int)g;
+          }
+        break;
+      case SU_UNWTHR:
+        ret=tok_int(tk, 0, MAX_UNWTHR_CNTS, &v);
+        s->unwthr=(unsigned int)v;
+        break;
+      case SU_PHSETP:
+        ret=tok_fix(tk, UNIT_TIME, 0, 0, INT32_MIN, INT32_MAX, &v);
+        if(ret==NUM_OK)
+          {
+          s->phsetp_cnt=(int)round(v/8.);
+          if(s->phsetp_cnt>MAX_SETPOINT_CNTS || s->phsetp_cnt<-MAX_SETPOINT_CNTS)
+            ret=NUM_RANGE;
+          }
+        break;
+      case SU_UNWRAP:
+        ret=setup_onoff(tk, &s->unwrap);
+        break;
+      case SU_UNWRES:
+        ret=setup_onoff(tk, &s->unwres);
+        break;
+      default:
+        ret=setup_onoff(tk, &s->synch);
+        break;
+      }
+    if(ret!=NUM_OK)
+      {
+      snprintf(err, maxlen, "invalid %s (%s)", setup_keys[i].name, num_strerror(ret));
+      return -1;
+      }
+    s->have|=setup_keys[i].bit;
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// everything CONFIGURE sets, as the device has it now
+
+void setup_read(struct chopdev *d, struct setup *s)
+  {
+  unsigned int r1;
+  int n;
+
+  r1=dev_readreg(d, 1);
+  s->have=SU_ALL;
+  s->bunch_presc=dev_readreg(d, BUNCHMARKER_PSCALER_REG) & PRESCALER_MASK;
+  s->chop_presc=dev_readreg(d, CHOPPER_PSCALER_REG) & PRESCALER_MASK;
+  s->trigout=dev_readreg(d, 12) & TRIGOUT_MASK;
+  s->gain_raw=dev_readreg(d, 11) & GAIN_MASK;
+  s->unwthr=dev_readreg(d, 2) & UNWTHR_MASK;
+  n=(int)(dev_readreg(d, 3) & PHSETPOINT_MASK);
+  s->phsetp_cnt=(n ^ PHSETPOINT_SIGN)-PHSETPOINT_SIGN;
+  s->unwrap=((r1 & UNWRAPPER_MASK)!=0);
+  s->unwres=((r1 & UNWRESET_MASK)!=0);
+  s->synch=((r1 & SYNCH_RESET_MASK)==0);
+  }
+
+
+//-------------------------------------------------------------------
+
+// NULL if the device may be configured now
+
+static const char *setup_busy(struct chopdev *d, const struct setup *s)
+  {
+  enum sv_state st;
+
+  if((s->have & SU_PHSETP) && ramp_running(d->id))
+    return "phase ramp running, PHSETPOINT_NS:ABORT first";
+  st=sv[d->id].state;
+  if(atomic_load(&sv[d->id].enable) && (st==SV_WAITMECOS || st==SV_RESET || st==SV_RELOCK))
+    return "lock recovery running";
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+int setup_validate(struct chopdev *d, const struct setup *s, char *err, size_t maxlen)
+  {
+  const char *why;
+  unsigned int presc, trig;
+
+  why=setup_busy(d, s);
+  if(why!=NULL)
+    {
+    snprintf(err, maxlen, "%s", why);
+    return -1;
+    }
+
+  // TRIGOUT phase must be in range [1..bunchmarker_prescaler], and
+  // stay there if only one of the two changes
+  if(s->have & (SU_BUNCH_PRESC|SU_TRIGOUT))
+    {
+    presc=(s->have & SU_BUNCH_PRESC)? s->bunch_presc : (dev_readreg(d, BUNCHMARKER_PSCALER_REG) & PRESCALER_MASK);
+    trig=(s->have & SU_TRIGOUT)? s->trigout : (dev_readreg(d, 12) & TRIGOUT_MASK);
+    if(trig>presc)
+      {
+      if(s->have & SU_TRIGOUT)
+        snprintf(err, maxlen, "TRIGOUT_PH %u beyond BUNCHMARKER_PRESCALER %u", trig, presc);
+      else
+        snprintf(err, maxlen, "TRIGOUT_PH is %u, beyond BUNCHMARKER_PRESCALER %u; set it too", trig, presc);
+      return -1;
+      }
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one register of the burst, caller holding the register lock
+
+void setup_store(struct chopdev *d, unsigned int reg, uint32_t val)
+  {
+  journal_reg(d->id, reg, d->regbank, val);
+  d->regbank[reg]=val;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one burst under the register lock, in an order that never puts the
+// synchronizer in an invalid state
+
+void setup_write(struct chopdev *d, const struct setup *s)
+  {
+  uint32_t *rb;
+  unsigned int r1;
+  bool presc_first;
+
+  rb=d->regbank;
+  pthread_mutex_lock(&d->reglock);
+
+  r1=rb[1];
+  if((s->have & SU_SYNCH) && !s->synch)
+    {
+    r1|=SYNCH_RESET_MASK;
+    setup_store(d, 1, r1);
+    }
+
+  // a larger prescaler first makes room for the new TRIGOUT phase; a
+  // smaller one last, once TRIGOUT fits in it
+  presc_first=!(s->have & SU_TRIGOUT) || s->bunch_presc>=(rb[BUNCHMARKER_PSCALER_REG] & PRESCALER_MASK);
+  if((s->have & SU_BUNCH_PRESC) && presc_first)
+    setup_store(d, BUNCHMARKER_PSCALER_REG, s->bunch_presc);
+  if(s->have & SU_TRIGOUT)
+    setup_store(d, 12, s->trigout & TRIGOUT_MASK);
+  if((s->have & SU_BUNCH_PRESC) && !presc_first)
+    setup_store(d, BUNCHMARKER_PSCALER_REG, s->bunch_presc);
+  if(s->have & SU_CHOP_PRESC)
+    setup_store(d, CHOPPER_PSCALER_REG, s->chop_presc);
+  if(s->have & SU_UNWTHR)
+    setup_store(d, 2, s->unwthr & UNWTHR_MASK);
+  if(s->have & SU_GAIN)
+    setup_store(d, 11, s->gain_raw & GAIN_MASK);
+  if(s->have & SU_PHSETP)
+    setup_store(d, 3, ((unsigned int)s->phsetp_cnt) & PHSETPOINT_MASK);
+
+  if(s->have & (SU_UNWRAP|SU_UNWRES))
+    {
+    if(s->have & SU_UNWRAP)
+      r1=s->unwrap? (r1 | UNWRAPPER_MASK) : (r1 & ~UNWRAPPER_MASK);
+    if(s->have & SU_UNWRES)
+      r1=s->unwres? (r1 | UNWRESET_MASK) : (r1 & ~UNWRESET_MASK);
+    setup_store(d, 1, r1);
+    }
+  if((s->have & SU_SYNCH) && s->synch)
+    setup_store(d, 1, r1 & ~SYNCH_RESET_MASK);
+
+  pthread_mutex_unlock(&d->reglock);
+  }
+
+
+//-------------------------------------------------------------------
+
+// read back what setup_write() wrote
+
+int setup_verify(struct chopdev *d, const struct setup *s, char *err, size_t maxlen)
+  {
+  struct setup now;
+  const char *bad;
+
+  setup_read(d, &now);
+  bad=NULL;
+  if((s->have & SU_SYNCH) && now.synch!=s->synch)
+    bad="SYNCHRONIZER";
+  else if((s->have & SU_BUNCH_PRESC) && now.bunch_presc!=s->bunch_presc)
+    bad="BUNCHMARKER_PRESCALER";
+  else if((s->have & SU_CHOP_PRESC) && now.chop_presc!=s->chop_presc)
+    bad="CHOPPER_PRESCALER";
+  else if((s->have & SU_TRIGOUT) && now.trigout!=s->trigout)
+    bad="TRIGOUT_PH";
+  else if((s->have & SU_GAIN) && now.gain_raw!=s->gain_raw)
+    bad="GAIN";
+  else if((s->have & SU_UNWTHR) && now.unwthr!=s->unwthr)
+    bad="UNW_THR";
+  else if((s->have & SU_PHSETP) && now.phsetp_cnt!=s->phsetp_cnt)
+    bad="PHSETPOINT_NS";
+  else if((s->have & SU_UNWRAP) && now.unwrap!=s->unwrap)
+    bad="UNWRAP";
+  else if((s->have & SU_UNWRES) && now.unwres!=s->unwres)
+    bad="UNW_RES";
+  if(bad==NULL)
+    return 0;
+  snprintf(err, maxlen, "%s did not read back as written", bad);
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+// validate, write and check s; on failure the device is left as it
+// was; on success the previous values become the undo set
+
+int setup_apply(struct chopdev *d, const struct setup *s, char *err, size_t maxlen)
+  {
+  struct setup before;
+  size_t len;
+
+  if(setup_validate(d, s, err, maxlen)!=0)
+    return -1;
+  setup_read(d, &before);
+  before.have=s->have;
+  setup_write(d, s);
+  if(setup_verify(d, s, err, maxlen)!=0)
+    {
+    setup_write(d, &before);
+    len=strlen(err);
+    snprintf(err+len, maxlen-len, "; rolled back");
+    return -1;
+    }
+  setupundo[d->id].set=before;
+  setupundo[d->id].valid=true;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+int setup_count(const struct setup *s)
+  {
+  return __builtin_popcount(s->have);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the parameters of s as CONFIGURE takes them
+
+void setup_format(const struct setup *s, struct out *o)
+  {
+  size_t i;
+  bool first;
+
+  first=true;
+  for(i=0; i<NSETUPKEYS; i++)
+    {
+    if(!(s->have & setup_keys[i].bit))
+      continue;
+    if(!first)
+      out_str(o, " ");
+    first=false;
+    out_str(o, setup_keys[i].name);
+    out_str(o, " ");
+    switch(setup_keys[i].bit)
+      {
+      case SU_BUNCH_PRESC: out_uint(o, s->bunch_presc);                   break;
+      case SU_CHOP_PRESC:  out_uint(o, s->chop_presc);                    break;
+      case SU_TRIGOUT:     out_uint(o, s->trigout);                       break;
+      case SU_GAIN:        out_fix(o, setup_gain_micro(s->gain_raw), 6, false); break;
+      case SU_UNWTHR:      out_uint(o, s->unwthr);                        break;
+      case SU_PHSETP:      out_int(o, s->phsetp_cnt*8, false);            break;
+      case SU_UNWRAP:      out_str(o, s->unwrap? "ON" : "OFF");           break;
+      case SU_UNWRES:      out_str(o, s->unwres? "ON" : "OFF");           break;
+      default:             out_str(o, s->synch? "ON" : "OFF");            break;
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// put back the registers the last CONFIGURE changed; what they were
+// becomes the undo set, so a second undo redoes
+
+int setup_undo(struct chopdev *d, char *err, size_t maxlen)
+  {
+  struct setupundo *u;
+  struct setup before;
+  const char *why;
+
+  u=&setupundo[d->id];
+  if(!u->valid)
+    {
+    snprintf(err, maxlen, "nothing to undo");
+    return -1;
+    }
+  why=setup_busy(d, &u->set);
+  if(why!=NULL)
+    {
+    snprintf(err, maxlen, "%s", why);
+    return -1;
+    }
+  // the old values were valid together when they were replaced; no
+  // range checks, they must go back exactly
+  setup_read(d, &before);
+  before.have=u->set.have;
+  setup_write(d, &u->set);
+  if(setup_verify(d, &u->set, err, maxlen)!=0)
+    {
+    setup_write(d, &before);
+    return -1;
+    }
+  u->set=before;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// PROFILE_DIR/<name>.profile into s; the name comes upper case from
+// the command line, files are lower case
+
+int profile_load(const char *name, size_t len, struct setup *s, char *err, size_t maxlen)
+  {
+  FILE *fd;
+  char  fname[sizeof(PROFILE_DIR)+MAXPROFILENAME+sizeof(PROFILE_EXT)+1];
+  char  lname[MAXPROFILENAME+1];
+  char  line[MAXCONFLINE+1];
+  char  why[MAXMSG];
+  char *p;
+  struct toker tk;
+  size_t i;
+  int   lineno;
+
+  if(len==0 || len>MAXPROFILENAME)
+    {
+    snprintf(err, maxlen, "profile names are 1..%d characters", MAXPROFILENAME);
+    return -1;
+    }
+  // no way out of PROFILE_DIR
+  for(i=0; i<len; i++)
+    {
+    if(!isalnum((unsigned char)name[i]) && name[i]!='_' && name[i]!='-')
+      {
+      snprintf(err, maxlen, "profile names are letters, digits, _ and -");
+      return -1;
+      }
+    lname[i]=tolower((unsigned char)name[i]);
+    }
+  lname[len]=0;
+  snprintf(fname, sizeof(fname), "%s/%s%s", PROFILE_DIR, lname, PROFILE_EXT);
+
+  fd=fopen(fname, "r");
+  if(fd==NULL)
+    {
+    snprintf(err, maxlen, "no profile %.*s", (int)len, name);
+    return -1;
+    }
+  memset(s, 0, sizeof(*s));
+  lineno=0;
+  while(fgets(line, MAXCONFLINE, fd)!=NULL)
+    {
+    lineno++;
+    // strip comments
+    p=strchr(line,'#');
+    if(p!=NULL)
+      *p=0;
+    for(p=line; *p; p++)
+      {
+      if(*p=='\r' || *p=='\n')
+        *p=' ';
+      *p=toupper((unsigned char)*p);
+      }
+    tok_init(&tk, line);
+    if(setup_parse(&tk, s, why, sizeof(why))!=0)
+      {
+      fclose(fd);
+      snprintf(err, maxlen, "profile %s line %d: %s", lname, lineno, why);
+      return -1;
+      }
+    }
+  fclose(fd);
+  if(s->have==0)
+    {
+    snprintf(err, maxlen, "profile %s sets nothing", lname);
+    return -1;
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+static int profile_cmp(const void *a, const void *b)
+  {
+  return strcmp((const char *)a, (const char *)b);
+  }
+
+
+//-------------------------------------------------------------------
+
+// names of the profiles in PROFILE_DIR, sorted, at most max
+
+int profile_list(char names[][MAXPROFILENAME+1], int max)
+  {
+  DIR *dir;
+  struct dirent *e;
+  size_t len, i;
+  int n;
+
+  dir=opendir(PROFILE_DIR);
+  if(dir==NULL)
+    return 0;
+  n=0;
+  while(n<max && (e=readdir(dir))!=NULL)
+    {
+    len=strlen(e->d_name);
+    if(len<=strlen(PROFILE_EXT) || strcmp(e->d_name+len-strlen(PROFILE_EXT), PROFILE_EXT)!=0)
+      continue;
+    len-=strlen(PROFILE_EXT);
+    if(len>MAXPROFILENAME)
+      continue;
+    for(i=0; i<len; i++)
+      names[n][i]=toupper((unsigned char)e->d_name[i]);
+    names[n][len]=0;
+    n++;
+    }
+  closedir(dir);
+  qsort(names, n, sizeof(names[0]), profile_cmp);
+  return n;
+  }
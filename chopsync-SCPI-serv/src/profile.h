@@ -0,0 +1,99 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync run setup (CONFIGURE)            ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// CONFIGURE sets several synchronizer parameters of a device at once:
+//
+//   CONFIGURE BUNCHMARKER_PRESCALER 10 TRIGOUT_PH 3 GAIN 1.5 ...
+//
+// keywords are the names of the single commands; the set is validated
+// as a whole before anything is written (TRIGOUT_PH against the new
+// BUNCHMARKER_PRESCALER, or against the current one if that is not
+// part of the set), and out of range values are refused instead of
+// clamped
+// the writes go out in one burst under the register lock, ordered so
+// that the hardware never sees an invalid combination:
+//
+//   SYNCHRONIZER OFF first, SYNCHRONIZER ON last
+//   TRIGOUT_PH before a smaller BUNCHMARKER_PRESCALER, after a larger
+//   one
+//
+// and are read back; on a mismatch the previous values are restored
+// the registers as they were before the last CONFIGURE are kept, and
+// CONFIGURE:UNDO puts them back (a second UNDO redoes)
+// CONFIGURE? answers the current setup in the same syntax, so that it
+// can be sent back or saved as a profile: a file
+//
+//   PROFILE_DIR/<name>.profile
+//
+// with the same keyword/value pairs, any number per line, # comments;
+// CONFIGURE:PROFILE <name> applies it as a single CONFIGURE
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include "config.h"
+#include "device.h"
+#include "scpi.h"
+
+#define PROFILE_DIR      "/etc/chopsync/profiles"
+#define PROFILE_EXT      ".profile"
+#define MAXPROFILENAME   32
+#define MAXPROFILES      32      // listed by CONFIGURE:PROFILE?
+
+// what a set contains
+#define SU_BUNCH_PRESC   0x0001
+#define SU_CHOP_PRESC    0x0002
+#define SU_TRIGOUT       0x0004
+#define SU_GAIN          0x0008
+#define SU_UNWTHR        0x0010
+#define SU_PHSETP        0x0020
+#define SU_UNWRAP        0x0040
+#define SU_UNWRES        0x0080
+#define SU_SYNCH         0x0100
+#define SU_ALL           0x01FF
+
+// parameters in register units
+struct setup
+  {
+  unsigned int have;
+  unsigned int bunch_presc, chop_presc, trigout;
+  unsigned int gain_raw, unwthr;
+  int          phsetp_cnt;        // 8 ns counts
+  bool         unwrap, unwres, synch;
+  };
+
+struct setupundo
+  {
+  bool          valid;
+  struct setup  set;
+  };
+
+extern struct setupundo setupundo[MAXDEV];
+
+
+/******* protos *******/
+
+int   setup_parse(struct toker *tk, struct setup *s, char *err, size_t maxlen);
+void  setup_read(struct chopdev *d, struct setup *s);
+int   setup_validate(struct chopdev *d, const struct setup *s, char *err, size_t maxlen);
+void  setup_store(struct chopdev *d, unsigned int reg, uint32_t val);
+void  setup_write(struct chopdev *d, const struct setup *s);
+int   setup_verify(struct chopdev *d, const struct setup *s, char *err, size_t maxlen);
+int   setup_apply(struct chopdev *d, const struct setup *s, char *err, size_t maxlen);
+int   setup_count(const struct setup *s);
+void  setup_format(const struct setup *s, struct out *o);
+int   setup_undo(struct chopdev *d, char *err, size_t maxlen);
+uint32_t setup_gain_micro(unsigned int raw);
+int   profile_load(const char *name, size_t len, struct setup *s, char *err, size_t maxlen);
+int   profile_list(char names[][MAXPROFILENAME+1], int max);
+
+#endif
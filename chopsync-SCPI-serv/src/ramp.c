@@ -0,0 +1,191 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync phase setpoint ramps             ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+const char  *ramp_state_names[RAMP_NSTATES] = { "IDLE", "RUNNING", "DONE", "ABORTED" };
+struct ramp  ramps[MAXDEV];
+
+
+//-------------------------------------------------------------------
+
+// post a ramp to target_ns at most vmax ns/s, accelerating at amax
+// ns/s^2; returns -1 without the sampler, 1 if a ramp is still running
+// or a request not yet taken by the sampler thread
+
+int ramp_start(int dev, double target_ns, double vmax, double amax)
+  {
+  struct ramp *r;
+
+  if(!smp.running)
+    return -1;
+  r=&ramps[dev];
+  if(atomic_load(&r->state)==RAMP_RUNNING || atomic_load(&r->cmd)!=RAMP_CMD_NONE)
+    return 1;
+  if(target_ns>MAX_SETPOINT_CNTS*8.)
+    target_ns=MAX_SETPOINT_CNTS*8.;
+  if(target_ns<-MAX_SETPOINT_CNTS*8.)
+    target_ns=-MAX_SETPOINT_CNTS*8.;
+  r->req_target=target_ns;
+  r->req_vmax=vmax;
+  r->req_amax=amax;
+  // publishes the request fields to the sampler thread
+  atomic_store(&r->cmd, RAMP_CMD_START);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// running, or started and not picked up by the sampler thread yet:
+// either way the setpoint is the ramp's
+
+bool ramp_running(int dev)
+  {
+  return (atomic_load(&ramps[dev].state)==RAMP_RUNNING || atomic_load(&ramps[dev].cmd)!=RAMP_CMD_NONE);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the setpoint stays where the ramp was at the next sample; returns 1
+// if no ramp is running
+
+int ramp_abort(int dev)
+  {
+  struct ramp *r;
+
+  r=&ramps[dev];
+  if(atomic_load(&r->state)!=RAMP_RUNNING && atomic_load(&r->cmd)!=RAMP_CMD_START)
+    return 1;
+  atomic_store(&r->cmd, RAMP_CMD_ABORT);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// profile from start to r->target with the requested limits
+
+void ramp_plan(struct ramp *r, double start)
+  {
+  double dist;
+
+  r->start=start;
+  dist=fabs(r->target-start);
+  r->dir=(r->target<start)? -1. : 1.;
+  r->amax=r->req_amax;
+  r->vpeak=r->req_vmax;
+  // too short to reach the slew rate: accelerate half way, then brake
+  if(r->vpeak*r->vpeak/r->amax > dist)
+    r->vpeak=sqrt(dist*r->amax);
+  if(dist==0)
+    {
+    r->t_acc=0;
+    r->t_cruise=0;
+    }
+  else
+    {
+    r->t_acc=r->vpeak/r->amax;
+    r->t_cruise=(dist-r->vpeak*r->t_acc)/r->vpeak;
+    }
+  r->t_total=2*r->t_acc+r->t_cruise;
+  }
+
+
+//-------------------------------------------------------------------
+
+// setpoint in ns t seconds into the ramp; velocity in ns/s to *vel
+
+double ramp_eval(struct ramp *r, double t, double *vel)
+  {
+  double s, v, td;
+
+  if(t<0)
+    t=0;
+  if(t>r->t_total)
+    t=r->t_total;
+  if(t<r->t_acc)
+    {
+    s=0.5*r->amax*t*t;
+    v=r->amax*t;
+    }
+  else if(t<r->t_acc+r->t_cruise)
+    {
+    s=0.5*r->vpeak*r->t_acc + r->vpeak*(t-r->t_acc);
+    v=r->vpeak;
+    }
+  else
+    {
+    td=r->t_total-t;
+    s=fabs(r->target-r->start)-0.5*r->amax*td*td;
+    v=r->amax*td;
+    }
+  *vel=r->dir*v;
+  return r->start+r->dir*s;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one sample of the ramp of a device at time t; runs in the sampler
+// thread
+
+void ramp_step(int dev, uint64_t t)
+  {
+  struct ramp    *r;
+  struct chopdev *d;
+  int cmd, n;
+
+  r=&ramps[dev];
+  d=&devs[dev];
+  cmd=atomic_exchange(&r->cmd, RAMP_CMD_NONE);
+  if(cmd==RAMP_CMD_START)
+    {
+    n=(int)(dev_readreg(d, 3) & PHSETPOINT_MASK);
+    n=(n ^ PHSETPOINT_SIGN)-PHSETPOINT_SIGN;
+    r->target=r->req_target;
+    ramp_plan(r, n*8.);
+    r->t0=t;
+    r->lastcnt=n;
+    r->pos=n*8.;
+    r->vel=0;
+    r->elapsed=0;
+    r->writes=0;
+    atomic_store(&r->state, RAMP_RUNNING);
+    }
+  else if(cmd==RAMP_CMD_ABORT && atomic_load(&r->state)==RAMP_RUNNING)
+    {
+    r->vel=0;
+    atomic_store(&r->state, RAMP_ABORTED);
+    }
+  if(atomic_load_explicit(&r->state, memory_order_relaxed)!=RAMP_RUNNING)
+    return;
+
+  r->elapsed=(t-r->t0)/1e9;
+  r->pos=ramp_eval(r, r->elapsed, &r->vel);
+  if(r->elapsed>=r->t_total)
+    {
+    r->pos=r->target;
+    r->vel=0;
+    }
+  n=(int)lround(r->pos/8.);
+  if(n>MAX_SETPOINT_CNTS)
+    n=MAX_SETPOINT_CNTS;
+  if(n<-MAX_SETPOINT_CNTS)
+    n=-MAX_SETPOINT_CNTS;
+  if(n!=r->lastcnt)
+    {
+    dev_writereg(d, 3, ((unsigned int)n) & PHSETPOINT_MASK);
+    r->lastcnt=n;
+    r->writes++;
+    }
+  if(r->elapsed>=r->t_total)
+    atomic_store(&r->state, RAMP_DONE);
+  }
@@ -0,0 +1,76 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync phase setpoint ramps             ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// moves the phase setpoint (register 3) to a target along a
+// trapezoidal velocity profile: constant acceleration up to the
+// maximum slew rate, cruise, constant deceleration to rest on the
+// target (a triangle if the move is too short to reach the slew rate)
+// the profile is computed once at the start and evaluated at every
+// sample of the sampler thread, so the setpoints written do not
+// depend on the network and do not accumulate rounding; the register
+// is only written when its 8 ns count changes
+// the main thread only posts START/ABORT requests; the sampler thread
+// owns the profile
+
+#ifndef RAMP_H
+#define RAMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include "config.h"
+#include "device.h"
+
+enum ramp_state
+  {
+  RAMP_IDLE,
+  RAMP_RUNNING,
+  RAMP_DONE,
+  RAMP_ABORTED,
+  RAMP_NSTATES
+  };
+
+enum ramp_cmd
+  {
+  RAMP_CMD_NONE,
+  RAMP_CMD_START,
+  RAMP_CMD_ABORT
+  };
+
+struct ramp
+  {
+  atomic_int    cmd;
+  atomic_int    state;
+  // request, valid while cmd is RAMP_CMD_START
+  double        req_target, req_vmax, req_amax;
+  // profile, sampler thread only
+  uint64_t      t0;                   // CLOCK_MONOTONIC ns
+  double        start, dir, vpeak, amax;
+  double        t_acc, t_cruise, t_total;   // s
+  int           lastcnt;
+  // progress, written by the sampler thread; readers may see values
+  // a sample old
+  double        target, pos, vel, elapsed;
+  unsigned long writes;
+  };
+
+extern const char  *ramp_state_names[RAMP_NSTATES];
+extern struct ramp  ramps[MAXDEV];
+
+
+/******* protos *******/
+
+int    ramp_start(int dev, double target_ns, double vmax, double amax);
+int    ramp_abort(int dev);
+bool   ramp_running(int dev);
+void   ramp_plan(struct ramp *r, double start);
+double ramp_eval(struct ramp *r, double t, double *vel);
+void   ramp_step(int dev, uint64_t t);
+
+#endif
@@ -0,0 +1,266 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync per-client fair scheduling       ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+struct scheduler    sched;
+const char         *sched_limit_names[SL_NLIMITS] = { "CAN", "WRITE" };
+
+
+//-------------------------------------------------------------------
+
+// cost and limits of a command line, before parse() has touched it:
+// the device prefix, then the header as dispatch() sees it
+
+void sched_classify(const char *line, struct sched_cmd *sc)
+  {
+  struct toker tk;
+  struct span  p;
+  const char  *q;
+  bool  rd;
+  int   n;
+
+  sc->dev=0;
+  sc->ndev=1;
+  sc->can=false;
+  sc->write=false;
+
+  while(*line==' ' || *line=='\t')
+    line++;
+  if(strncasecmp(line,"ALL:",4)==0)
+    {
+    sc->dev=-1;
+    sc->ndev=ndevs;
+    line+=4;
+    }
+  else if(strncasecmp(line,"DEV",3)==0 && isdigit((unsigned char)line[3]))
+    {
+    n=0;
+    for(q=line+3; isdigit((unsigned char)*q); q++)
+      if(n<MAXDEV)
+        n=n*10+(*q-'0');
+    if(*q==':')
+      {
+      sc->dev=n;
+      line=q+1;
+      }
+    }
+
+  tok_init(&tk, line);
+  rd=tok_command(&tk, &p);
+  if(p.len==4 && strncasecmp(p.p,"HELP",4)==0)
+    sc->cost=SCHED_COST_HELP;
+  // scan results are in memory, only starting a scan uses the bus
+  else if(rd && p.len>=10 && strncasecmp(p.p,"MECOS:SCAN",10)==0)
+    sc->cost=SCHED_COST_READ;
+  else if(p.len>6 && strncasecmp(p.p,"MECOS:",6)==0)
+    {
+    sc->can=true;
+    sc->write=!rd;
+    sc->cost=SCHED_COST_CAN;
+    }
+  else if(!rd)
+    {
+    sc->write=true;
+    sc->cost=SCHED_COST_WRITE;
+    }
+  else
+    sc->cost=SCHED_COST_READ;
+  sc->cost*=sc->ndev;
+  }
+
+
+//-------------------------------------------------------------------
+
+// take n tokens if there are; rate 0 is no limit
+// a command costing more than the whole burst gets through when the
+// bucket is full, otherwise it could never run
+
+bool tbucket_take(struct tbucket *b, double rate, double burst, double n)
+  {
+  struct timespec now;
+  double dt;
+
+  if(rate<=0)
+    return true;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(!b->init)
+    {
+    b->tokens=burst;
+    b->init=true;
+    }
+  else
+    {
+    dt=(now.tv_sec-b->refill.tv_sec) + (now.tv_nsec-b->refill.tv_nsec)/1e9;
+    b->tokens+=dt*rate;
+    if(b->tokens>burst)
+      b->tokens=burst;
+    }
+  b->refill=now;
+
+  if(n>burst)
+    n=burst;
+  if(b->tokens<n)
+    return false;
+  b->tokens-=n;
+  return true;
+  }
+
+
+//-------------------------------------------------------------------
+
+// stream clients and WebSocket clients; NULL for anything else
+
+struct sched_client *sched_client_by_fd(int fd)
+  {
+  struct conn     *c;
+  struct httpconn *hc;
+
+  if((c=conn_by_fd(fd))!=NULL)
+    return &c->sched;
+  if((hc=http_conn_by_fd(fd))!=NULL && hc->ws)
+    return &hc->sched;
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// may a client run this command now? false: it is over its limits, or
+// the CAN queue of a device it addresses is filling up; the caller
+// answers OVERLOAD
+
+bool sched_admit(int fd, const char *line)
+  {
+  struct sched_client *c;
+  struct sched_cmd     sc;
+  struct can_link     *l;
+  bool ok;
+  int  i;
+
+  c=sched_client_by_fd(fd);
+  if(c==NULL)
+    return true;
+  sched_classify(line, &sc);
+
+  ok=true;
+  if(sc.can)
+    {
+    // waiting behind a long queue would only pile up timeouts
+    for(i=0; i<ndevs; i++)
+      {
+      l=devs[i].can.link;
+      if((sc.dev<0 || sc.dev==i) && devs[i].can.present && l!=NULL &&
+         l->txq[CAN_PRIO_INTERACTIVE].count>=CAN_TXQ_LEN/2)
+        ok=false;
+      }
+    if(ok)
+      ok=tbucket_take(&c->tb[SL_CAN], cfg.lim_can_rate, cfg.lim_can_burst, sc.ndev);
+    }
+  if(ok && sc.write)
+    ok=tbucket_take(&c->tb[SL_WRITE], cfg.lim_write_rate, cfg.lim_write_burst, sc.ndev);
+
+  if(ok)
+    c->served++;
+  else
+    c->overload++;
+  return ok;
+  }
+
+
+//-------------------------------------------------------------------
+
+// copy the first command a client has queued into buf, without the
+// line end; returns the length of the line in the buffer, -1 if there
+// is no whole line yet
+
+int sched_head(struct conn *c, char *buf, size_t maxlen)
+  {
+  struct linebuf *lb;
+  char   *e;
+  size_t n;
+
+  lb=c->in;
+  e=memchr(lb->buf, '\n', lb->len);
+  if(e==NULL)
+    return -1;
+  n=(size_t)(e-lb->buf);
+  if(n>=maxlen)
+    n=maxlen-1;
+  memcpy(buf, lb->buf, n);
+  buf[n]=0;
+  if(n>0 && buf[n-1]=='\r')
+    buf[n-1]=0;
+  return (int)(e-lb->buf);
+  }
+
+
+//-------------------------------------------------------------------
+
+// a command is queued and the previous answer is out
+
+bool sched_runnable(struct conn *c)
+  {
+  struct linebuf *lb;
+
+  lb=c->in;
+  return (c->fd>=0 && lb->len>0 && FD_ISSET(c->fd, &active_fd_set) &&
+          memchr(lb->buf, '\n', lb->len)!=NULL);
+  }
+
+
+//-------------------------------------------------------------------
+
+// one round over the connections, starting one further each time;
+// returns true if commands are left, so that select() must not block
+
+bool sched_round(void)
+  {
+  struct conn      *c;
+  struct sched_cmd  sc;
+  struct linebuf   *lb;
+  char  cmd[MAXMSG+1];
+  bool  more;
+  int   k, n;
+
+  if(conns.max==0)
+    return false;
+  more=false;
+  for(k=0; k<conns.max; k++)
+    {
+    c=&conns.c[(sched.next+k)%conns.max];
+    if(!sched_runnable(c))
+      {
+      // no credit saved up while there is nothing to run
+      c->sched.deficit=0;
+      continue;
+      }
+
+    c->sched.deficit+=SCHED_QUANTUM;
+    while(sched_runnable(c) && (n=sched_head(c, cmd, sizeof(cmd)))>=0)
+      {
+      sched_classify(cmd, &sc);
+      if(sc.cost>c->sched.deficit)
+        break;
+      c->sched.deficit-=sc.cost;
+      lb=c->in;
+      lb->len-=n+1;
+      memmove(lb->buf, lb->buf+n+1, lb->len);
+      lb->buf[lb->len]=0;
+      run_command(c->fd, cmd);
+      }
+    if(sched_runnable(c))
+      more=true;
+    else
+      c->sched.deficit=0;
+    }
+  sched.next=(sched.next+1)%conns.max;
+  sched.rounds++;
+  return more;
+  }
@@ -0,0 +1,101 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync per-client fair scheduling       ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// the commands a stream client has sent wait in its line buffer; the
+// main loop runs them by deficit round robin: each round, every client
+// with a command waiting (and no answer outstanding) earns SCHED_QUANTUM
+// credits and runs commands as long as it has credit for the next one
+//
+//   READ 1   WRITE 2   MECOS:* 4   HELP 16   (times ndevs with ALL:)
+//
+// so a client hammering MECOS queries or HELP gets its share of the
+// loop and no more, and one round per pass of the main loop leaves
+// room for CAN answers and new connections in between
+// on top of that, CAN-backed commands (MECOS:*) and write commands are
+// limited per connection by token buckets (LIMIT in the config file);
+// over the limit, or with the device's interactive CAN queue half
+// full, the answer is "ERR: OVERLOAD" at once instead of a queue that
+// makes everybody wait
+
+#ifndef REQSCHED_H
+#define REQSCHED_H
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/select.h>
+#include "config.h"
+
+#define SCHED_QUANTUM     4
+#define SCHED_COST_READ   1
+#define SCHED_COST_WRITE  2
+#define SCHED_COST_CAN    4
+#define SCHED_COST_HELP   16
+
+// per connection, in commands per second and commands
+#define SCHED_DEFAULT_CAN_RATE   20
+#define SCHED_DEFAULT_CAN_BURST  10
+#define SCHED_MAXRATE            100000
+
+// rate limited command classes
+enum sched_limit
+  {
+  SL_CAN,
+  SL_WRITE,
+  SL_NLIMITS
+  };
+
+// what running a command costs
+struct sched_cmd
+  {
+  int  cost;
+  int  dev;                    // -1: ALL:
+  int  ndev;                   // devices it addresses
+  bool can, write;
+  };
+
+// token bucket, in commands
+struct tbucket
+  {
+  bool            init;
+  double          tokens;
+  struct timespec refill;
+  };
+
+struct sched_client
+  {
+  int             deficit;
+  struct tbucket  tb[SL_NLIMITS];
+  unsigned long   served, overload;
+  };
+
+struct scheduler
+  {
+  int             next;        // first connection of the next round
+  unsigned long   rounds;
+  };
+
+struct conn;
+
+extern struct scheduler    sched;
+extern const char         *sched_limit_names[SL_NLIMITS];
+
+
+/******* protos *******/
+
+void sched_classify(const char *line, struct sched_cmd *sc);
+bool tbucket_take(struct tbucket *b, double rate, double burst, double n);
+struct sched_client *sched_client_by_fd(int fd);
+bool sched_admit(int fd, const char *line);
+int  sched_head(struct conn *c, char *buf, size_t maxlen);
+bool sched_runnable(struct conn *c);
+bool sched_round(void);
+
+#endif
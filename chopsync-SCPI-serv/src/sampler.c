@@ -0,0 +1,317 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync real-time register sampler       ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#define _GNU_SOURCE
+#include "sampler.h"
+#include "supervisor.h"
+#include "ramp.h"
+#include "tune.h"
+#include "journal.h"
+#include "capture.h"
+
+/***  globals  ***/
+const unsigned int smp_regs[SMP_NREGS] = { 0, 5, 6, 7, 8 };
+struct sampler     smp;
+
+
+//-------------------------------------------------------------------
+
+void sampler_stats_reset(void)
+  {
+  smp.cycles=0;
+  smp.overruns=0;
+  smp.lat_min_ns=0;
+  smp.lat_max_ns=0;
+  smp.lat_sum_ns=0;
+  memset(smp.lat_hist, 0, sizeof(smp.lat_hist));
+  }
+
+
+//-------------------------------------------------------------------
+
+// account one wakeup, lat_ns late
+
+void sampler_record(long lat_ns)
+  {
+  long us;
+
+  if(smp.cycles==0 || lat_ns<smp.lat_min_ns)
+    smp.lat_min_ns=lat_ns;
+  if(lat_ns>smp.lat_max_ns)
+    smp.lat_max_ns=lat_ns;
+  smp.lat_sum_ns+=lat_ns;
+  us=lat_ns/1000;
+  smp.lat_hist[(us<SMP_HIST_US)? us : SMP_HIST_US]++;
+  smp.cycles++;
+  }
+
+
+//-------------------------------------------------------------------
+
+// wakeup latency percentile in us, from the histogram; -1 if no data
+
+long sampler_lat_percentile(double pct)
+  {
+  unsigned long cum;
+  double target;
+  long us;
+
+  if(smp.cycles==0)
+    return -1;
+  target=smp.cycles*pct/100.;
+  cum=0;
+  for(us=0; us<=SMP_HIST_US; us++)
+    {
+    cum+=smp.lat_hist[us];
+    if(cum>=target)
+      return us;
+    }
+  return SMP_HIST_US;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one sample of every device
+
+void sampler_take(uint64_t t_ns)
+  {
+  volatile uint32_t *bank;
+  struct smp_ring   *r;
+  struct smp_sample *s;
+  uint64_t head;
+  int i, k;
+
+  for(i=0; i<ndevs; i++)
+    {
+    r=&smp.ring[i];
+    head=atomic_load_explicit(&r->head, memory_order_relaxed);
+    s=&r->s[head&(SMP_RINGLEN-1)];
+    // the bank is hardware: every sample must really read it
+    bank=devs[i].regbank;
+    s->t_ns=t_ns;
+    for(k=0; k<SMP_NREGS; k++)
+      s->reg[k]=bank[smp_regs[k]];
+    // publish: readers see the sample complete or not at all
+    atomic_store_explicit(&r->head, head+1, memory_order_release);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void *sampler_main(void *arg)
+  {
+  struct timespec next, now;
+  uint64_t t;
+  long lat;
+  int i;
+
+  (void)arg;
+  sampler_prefault();
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(!atomic_load(&smp.stop))
+    {
+    next.tv_nsec+=smp.period_ns;
+    while(next.tv_nsec>=1000000000L)
+      {
+      next.tv_nsec-=1000000000L;
+      next.tv_sec++;
+      }
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)==EINTR)
+      ;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(atomic_exchange(&smp.reset, false))
+      sampler_stats_reset();
+
+    lat=(now.tv_sec-next.tv_sec)*1000000000L + (now.tv_nsec-next.tv_nsec);
+    sampler_record(lat);
+    t=(uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+    sampler_take(t);
+    for(i=0; i<ndevs; i++)
+      {
+      // whoever writes a register is in the journal
+      journal_thread(JOURNAL_SRC_SUPERVISOR, t);
+      supervisor_step(i, t);
+      journal_thread(JOURNAL_SRC_RAMP, t);
+      ramp_step(i, t);
+      journal_thread(JOURNAL_SRC_TUNE, t);
+      tune_step(i, t);
+      capture_step(i, t);
+      }
+
+    // woke up later than a whole period: skip the missed instants
+    // instead of sampling in a burst to catch up
+    if(lat>=smp.period_ns)
+      {
+      smp.overruns+=lat/smp.period_ns;
+      next=now;
+      }
+    }
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// touch the stack the thread will use and the sample rings, so that
+// with memory locked no page fault happens in the sampling loop
+
+void sampler_prefault(void)
+  {
+  char stack[SMP_PREFAULT_STACK];
+  int i;
+
+  memset(stack, 0, sizeof(stack));
+  // keep the compiler from dropping the memset
+  __asm__ __volatile__("" : : "r"(stack) : "memory");
+  for(i=0; i<ndevs; i++)
+    memset(smp.ring[i].s, 0, sizeof(smp.ring[i].s));
+  }
+
+
+//-------------------------------------------------------------------
+
+int sampler_pin(pthread_attr_t *attr, int cpu)
+  {
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(attr!=NULL)
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+  }
+
+
+//-------------------------------------------------------------------
+
+// start the sampler if configured; returns 1 if not configured, -1 if
+// the thread could not be started at all
+// missing privileges only cost the real-time guarantees: the sampler
+// then runs as a normal thread and REALTIME? says so
+
+int sampler_start(void)
+  {
+  pthread_attr_t attr;
+  struct sched_param sp;
+  long ncpu;
+  int ret;
+
+  if(cfg.rt_rate==0)
+    return 1;
+
+  smp.rate_hz=cfg.rt_rate;
+  smp.period_ns=1000000000L/smp.rate_hz;
+  smp.cpu=cfg.rt_cpu;
+  smp.prio=cfg.rt_prio;
+  smp.maincpu=cfg.rt_maincpu;
+  sampler_stats_reset();
+
+  // everything mapped now and later stays in RAM
+  smp.locked=(mlockall(MCL_CURRENT|MCL_FUTURE)==0);
+  if(!smp.locked)
+    perror("mlockall");
+
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  sp.sched_priority=smp.prio;
+  pthread_attr_setschedparam(&attr, &sp);
+  ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+  smp.pinned=(smp.cpu<ncpu && smp.maincpu<ncpu && smp.cpu!=smp.maincpu);
+  if(!smp.pinned)
+    fprintf(stderr, "sampler: CPUs %d and %d not usable with %ld online; not pinning\n", smp.cpu, smp.maincpu, ncpu);
+  else if(sampler_pin(&attr, smp.cpu)!=0)
+    smp.pinned=false;
+
+  ret=pthread_create(&smp.thread, &attr, sampler_main, NULL);
+  smp.fifo=(ret==0);
+  if(ret==EPERM)
+    {
+    fprintf(stderr, "sampler: no permission for SCHED_FIFO; running as a normal thread\n");
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    ret=pthread_create(&smp.thread, &attr, sampler_main, NULL);
+    }
+  pthread_attr_destroy(&attr);
+  if(ret!=0)
+    {
+    errno=ret;
+    perror("sampler thread");
+    return -1;
+    }
+
+  // network and CAN handling keep off the sampler's CPU
+  if(smp.pinned && sampler_pin(NULL, smp.maincpu)!=0)
+    {
+    perror("sampler: pinning main thread");
+    smp.pinned=false;
+    }
+
+  smp.running=true;
+  fprintf(stderr, "sampler: %u Hz, %s prio %d, %s CPU %d, memory %slocked\n", smp.rate_hz,
+          smp.fifo?"SCHED_FIFO":"SCHED_OTHER", smp.prio, smp.pinned?"on":"NOT pinned to",
+          smp.cpu, smp.locked?"":"NOT ");
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// copy the last n samples of a device, oldest first; returns how many
+// were copied (fewer than n early on, or if the ring has overtaken
+// the copy)
+
+int sampler_snapshot(int dev, struct smp_sample *out, int n)
+  {
+  struct smp_ring *r;
+  uint64_t head, first, now, i;
+  int k;
+
+  if(!smp.running || dev<0 || dev>=ndevs || n<=0)
+    return 0;
+  if(n>SMP_RINGLEN)
+    n=SMP_RINGLEN;
+  r=&smp.ring[dev];
+
+  head=atomic_load_explicit(&r->head, memory_order_acquire);
+  first=(head>(uint64_t)n)? head-n : 0;
+  for(i=first; i<head; i++)
+    out[i-first]=r->s[i&(SMP_RINGLEN-1)];
+
+  // samples the writer may have overwritten while we copied; the one
+  // at index now may be half written
+  atomic_thread_fence(memory_order_acquire);
+  now=atomic_load_explicit(&r->head, memory_order_relaxed);
+  if(now+1>first+SMP_RINGLEN)
+    {
+    k=(int)(now+1-SMP_RINGLEN-first);
+    if(k>=(int)(head-first))
+      return 0;
+    memmove(out, out+k, (head-first-k)*sizeof(*out));
+    return (int)(head-first-k);
+    }
+  return (int)(head-first);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the thread finishes the sample it is on and exits; the registers
+// are left as they are
+
+void sampler_stop(void)
+  {
+  if(!smp.running)
+    return;
+  atomic_store(&smp.stop, true);
+  pthread_join(smp.thread, NULL);
+  smp.running=false;
+  }
@@ -0,0 +1,103 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync real-time register sampler       ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// optional (REALTIME in the config file): a thread that samples the
+// PLL registers of every device at a fixed rate, scheduled SCHED_FIFO
+// on its own CPU with all memory locked, while the network and CAN
+// loop stays on another CPU
+// every wakeup is timed against its ideal instant, cyclictest-style,
+// so that REALTIME? tells how much the samples can be trusted
+// samples go to one ring per device; the sampler thread is the only
+// writer, readers take consistent snapshots with sampler_snapshot()
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "device.h"
+
+#define SMP_MAXRATE    100000
+#define SMP_DEFAULT_CPU  1
+#define SMP_DEFAULT_PRIO 80
+#define SMP_DEFAULT_MAINCPU 0
+#define SMP_MAXCPU     1024
+
+// registers in every sample: status, MECOS command, phase error,
+// bunch marker and chopper frequencies
+#define SMP_NREGS      5
+#define SMP_IDX_STATUS 0
+#define SMP_IDX_MECOSCMD 1
+#define SMP_IDX_PHERR  2
+#define SMP_IDX_BUNCHFREQ 3
+#define SMP_IDX_CHOPFREQ 4
+#define SMP_RINGLEN    8192       // power of 2
+#define SMP_HIST_US    1000       // latency histogram: 1 us bins + overflow
+#define SMP_PREFAULT_STACK (64*1024)
+
+struct smp_sample
+  {
+  uint64_t t_ns;                  // CLOCK_MONOTONIC
+  uint32_t reg[SMP_NREGS];
+  };
+
+struct smp_ring
+  {
+  _Atomic uint64_t  head;         // samples written since start
+  struct smp_sample s[SMP_RINGLEN];
+  };
+
+struct sampler
+  {
+  bool          running;
+  bool          fifo;             // SCHED_FIFO was granted
+  bool          locked;           // mlockall() succeeded
+  bool          pinned;           // both threads are on their CPUs
+  int           cpu, prio, maincpu;
+  unsigned int  rate_hz;
+  long          period_ns;
+  pthread_t     thread;
+  atomic_bool   reset;            // ask the thread to clear its statistics
+  atomic_bool   stop;             // ask the thread to exit (hot upgrade)
+  // wakeup latency, written by the sampler thread only; readers may
+  // see a statistic a sample old, which is fine for reporting
+  unsigned long cycles, overruns;
+  long          lat_min_ns, lat_max_ns;
+  double        lat_sum_ns;
+  unsigned long lat_hist[SMP_HIST_US+1];
+  struct smp_ring ring[MAXDEV];
+  };
+
+extern const unsigned int smp_regs[SMP_NREGS];
+extern struct sampler     smp;
+
+
+/******* protos *******/
+
+void     sampler_stats_reset(void);
+void     sampler_record(long lat_ns);
+long     sampler_lat_percentile(double pct);
+void     sampler_take(uint64_t t_ns);
+void    *sampler_main(void *arg);
+void     sampler_prefault(void);
+int      sampler_pin(pthread_attr_t *attr, int cpu);
+int      sampler_start(void);
+int      sampler_snapshot(int dev, struct smp_sample *out, int n);
+void     sampler_stop(void);
+
+#endif
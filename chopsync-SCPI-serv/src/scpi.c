@@ -0,0 +1,487 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync command tokenizer and numbers    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include <string.h>
+#include "scpi.h"
+
+/***  globals  ***/
+const uint64_t pow10_tab[19] =
+  {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+  10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL
+  };
+
+
+//-------------------------------------------------------------------
+
+void tok_init(struct toker *t, const char *s)
+  {
+  t->p=s;
+  }
+
+
+//-------------------------------------------------------------------
+
+// next blank separated token; false at the end of the line
+
+bool tok_next(struct toker *t, struct span *s)
+  {
+  const char *p;
+
+  p=t->p;
+  while(*p==' ' || *p=='\t')
+    p++;
+  if(*p==0)
+    {
+    t->p=p;
+    return false;
+    }
+  s->p=p;
+  while(*p!=0 && *p!=' ' && *p!='\t')
+    p++;
+  s->len=(size_t)(p-s->p);
+  t->p=p;
+  return true;
+  }
+
+
+//-------------------------------------------------------------------
+
+// the command header: up to a blank or a '?'; true if it is a query
+
+bool tok_command(struct toker *t, struct span *cmd)
+  {
+  const char *p;
+
+  p=t->p;
+  while(*p==' ' || *p=='\t')
+    p++;
+  cmd->p=p;
+  while(*p!=0 && *p!=' ' && *p!='\t' && *p!='?')
+    p++;
+  cmd->len=(size_t)(p-cmd->p);
+  t->p=p;
+  if(*p=='?')
+    {
+    t->p=p+1;
+    return true;
+    }
+  return false;
+  }
+
+
+//-------------------------------------------------------------------
+
+bool tok_end(struct toker *t)
+  {
+  while(*t->p==' ' || *t->p=='\t')
+    t->p++;
+  return (*t->p==0);
+  }
+
+
+//-------------------------------------------------------------------
+
+bool span_eq(struct span s, const char *word)
+  {
+  return (strlen(word)==s.len && memcmp(s.p, word, s.len)==0);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the whole span must be the number
+
+int num_int(struct span s, int64_t min, int64_t max, int64_t *val)
+  {
+  const char *p, *e;
+  uint64_t mag;
+  unsigned int d, base;
+  bool neg;
+  int64_t v;
+
+  p=s.p;
+  e=s.p+s.len;
+  if(p==e)
+    return NUM_MISSING;
+  neg=false;
+  if(*p=='+' || *p=='-')
+    neg=(*p++=='-');
+  base=10;
+  if(e-p>2 && p[0]=='0' && (p[1]=='X' || p[1]=='x'))
+    {
+    base=16;
+    p+=2;
+    }
+  if(p==e)
+    return NUM_SYNTAX;
+
+  mag=0;
+  for(; p<e; p++)
+    {
+    if(*p>='0' && *p<='9')
+      d=*p-'0';
+    else if(base==16 && *p>='A' && *p<='F')
+      d=*p-'A'+10;
+    else if(base==16 && *p>='a' && *p<='f')
+      d=*p-'a'+10;
+    else
+      return NUM_SYNTAX;
+    if(mag>(UINT64_MAX-d)/base)
+      return NUM_RANGE;
+    mag=mag*base+d;
+    }
+
+  if(neg)
+    {
+    if(mag>(uint64_t)INT64_MAX+1)
+      return NUM_RANGE;
+    v=(mag==(uint64_t)INT64_MAX+1)? INT64_MIN : -(int64_t)mag;
+    }
+  else
+    {
+    if(mag>(uint64_t)INT64_MAX)
+      return NUM_RANGE;
+    v=(int64_t)mag;
+    }
+  if(v<min || v>max)
+    return NUM_RANGE;
+  *val=v;
+  return NUM_OK;
+  }
+
+
+//-------------------------------------------------------------------
+
+// power of ten of a unit suffix relative to the base unit
+
+int num_unit_exp(struct span s, enum num_unit unit, int *exp)
+  {
+  if(unit==UNIT_TIME)
+    {
+    if(span_eq(s, "NS"))
+      *exp=0;
+    else if(span_eq(s, "US"))
+      *exp=3;
+    else if(span_eq(s, "MS"))
+      *exp=6;
+    else if(span_eq(s, "S"))
+      *exp=9;
+    else
+      return NUM_UNIT;
+    return NUM_OK;
+    }
+  if(unit==UNIT_FREQ)
+    {
+    if(span_eq(s, "HZ"))
+      *exp=0;
+    else if(span_eq(s, "KHZ"))
+      *exp=3;
+    else if(span_eq(s, "MHZ"))
+      *exp=6;
+    else if(span_eq(s, "GHZ"))
+      *exp=9;
+    else
+      return NUM_UNIT;
+    return NUM_OK;
+    }
+  return NUM_UNIT;
+  }
+
+
+//-------------------------------------------------------------------
+
+// value in the base unit of the kind, times 10^decimals, rounded half
+// away from zero; bare_exp is the power of ten of a number without
+// suffix (e.g. 6 for a time in ms)
+
+int num_fix(struct span s, enum num_unit unit, int bare_exp, int decimals, int64_t min, int64_t max, int64_t *val)
+  {
+  const char *p, *e;
+  struct span suffix;
+  uint64_t mant, q, r;
+  int exp10, ndig, x, uexp, total, ret;
+  bool neg, seen, xneg;
+  int64_t v;
+
+  p=s.p;
+  e=s.p+s.len;
+  if(p==e)
+    return NUM_MISSING;
+  neg=false;
+  if(*p=='+' || *p=='-')
+    neg=(*p++=='-');
+
+  // mantissa; digits beyond NUM_MAXDIGITS only count for the exponent
+  mant=0;
+  exp10=0;
+  ndig=0;
+  seen=false;
+  for(; p<e && *p>='0' && *p<='9'; p++)
+    {
+    seen=true;
+    if(mant==0 && *p=='0')
+      continue;
+    if(ndig<NUM_MAXDIGITS)
+      {
+      mant=mant*10+(*p-'0');
+      ndig++;
+      }
+    else
+      exp10++;
+    }
+  if(p<e && *p=='.')
+    for(p++; p<e && *p>='0' && *p<='9'; p++)
+      {
+      seen=true;
+      if(ndig<NUM_MAXDIGITS && !(mant==0 && *p=='0'))
+        {
+        mant=mant*10+(*p-'0');
+        ndig++;
+        exp10--;
+        }
+      else if(mant==0)
+        exp10--;
+      }
+  if(!seen)
+    return NUM_SYNTAX;
+
+  // exponent
+  if(p<e && (*p=='E' || *p=='e'))
+    {
+    p++;
+    xneg=false;
+    if(p<e && (*p=='+' || *p=='-'))
+      xneg=(*p++=='-');
+    if(p==e || *p<'0' || *p>'9')
+      return NUM_SYNTAX;
+    for(x=0; p<e && *p>='0' && *p<='9'; p++)
+      if(x<1000)
+        x=x*10+(*p-'0');
+    exp10+=xneg? -x : x;
+    }
+
+  // unit
+  uexp=bare_exp;
+  if(p<e)
+    {
+    suffix.p=p;
+    suffix.len=(size_t)(e-p);
+    ret=num_unit_exp(suffix, unit, &uexp);
+    if(ret!=NUM_OK)
+      return (unit==UNIT_NONE)? NUM_SYNTAX : ret;
+    }
+
+  total=exp10+uexp+decimals;
+  if(mant==0)
+    ;
+  else if(total>=0)
+    {
+    for(; total>0; total--)
+      {
+      if(mant>UINT64_MAX/10)
+        return NUM_RANGE;
+      mant*=10;
+      }
+    }
+  else if(-total>18)
+    mant=0;
+  else
+    {
+    q=mant/pow10_tab[-total];
+    r=mant%pow10_tab[-total];
+    mant=(2*r>=pow10_tab[-total])? q+1 : q;
+    }
+
+  if(mant>(uint64_t)INT64_MAX)
+    return NUM_RANGE;
+  v=neg? -(int64_t)mant : (int64_t)mant;
+  if(v<min || v>max)
+    return NUM_RANGE;
+  *val=v;
+  return NUM_OK;
+  }
+
+
+//-------------------------------------------------------------------
+
+int tok_int(struct toker *t, int64_t min, int64_t max, int64_t *val)
+  {
+  struct span s;
+
+  if(!tok_next(t, &s))
+    return NUM_MISSING;
+  return num_int(s, min, max, val);
+  }
+
+
+//-------------------------------------------------------------------
+
+int tok_fix(struct toker *t, enum num_unit unit, int bare_exp, int decimals, int64_t min, int64_t max, int64_t *val)
+  {
+  struct span s;
+
+  if(!tok_next(t, &s))
+    return NUM_MISSING;
+  return num_fix(s, unit, bare_exp, decimals, min, max, val);
+  }
+
+
+//-------------------------------------------------------------------
+
+const char *num_strerror(int err)
+  {
+  switch(err)
+    {
+    case NUM_OK:      return "no error";
+    case NUM_MISSING: return "missing value";
+    case NUM_SYNTAX:  return "invalid number";
+    case NUM_RANGE:   return "value out of range";
+    case NUM_UNIT:    return "unknown unit";
+    default:          return "bad value";
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void out_init(struct out *o, char *buf, size_t maxlen)
+  {
+  o->p=buf;
+  o->end=buf+maxlen-1;
+  *buf=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void out_str(struct out *o, const char *s)
+  {
+  while(*s!=0 && o->p<o->end)
+    *o->p++=*s++;
+  *o->p=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void out_span(struct out *o, struct span s)
+  {
+  size_t i;
+
+  for(i=0; i<s.len && o->p<o->end; i++)
+    *o->p++=s.p[i];
+  *o->p=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void out_uint(struct out *o, uint64_t v)
+  {
+  char tmp[20];
+  int  n;
+
+  n=0;
+  do
+    {
+    tmp[n++]=(char)('0'+v%10);
+    v/=10;
+    }
+  while(v!=0);
+  while(n>0 && o->p<o->end)
+    *o->p++=tmp[--n];
+  *o->p=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void out_int(struct out *o, int64_t v, bool plus)
+  {
+  if(v<0)
+    {
+    out_str(o, "-");
+    out_uint(o, (uint64_t)(-(v+1))+1);
+    }
+  else
+    {
+    if(plus)
+      out_str(o, "+");
+    out_uint(o, (uint64_t)v);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// v is the value times 10^decimals; printed as printf's %f would with
+// that precision
+
+void out_fix(struct out *o, int64_t v, int decimals, bool plus)
+  {
+  uint64_t mag, frac;
+  char tmp[20];
+  int  i;
+
+  if(decimals<0)
+    decimals=0;
+  if(decimals>18)
+    decimals=18;
+  if(v<0)
+    {
+    out_str(o, "-");
+    mag=(uint64_t)(-(v+1))+1;
+    }
+  else
+    {
+    if(plus)
+      out_str(o, "+");
+    mag=(uint64_t)v;
+    }
+  out_uint(o, mag/pow10_tab[decimals]);
+  if(decimals==0)
+    return;
+  frac=mag%pow10_tab[decimals];
+  for(i=decimals-1; i>=0; i--)
+    {
+    tmp[i]=(char)('0'+frac%10);
+    frac/=10;
+    }
+  out_str(o, ".");
+  for(i=0; i<decimals && o->p<o->end; i++)
+    *o->p++=tmp[i];
+  *o->p=0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// upper case, zero padded to width digits
+
+void out_hex(struct out *o, uint32_t v, int width)
+  {
+  static const char digits[] = "0123456789ABCDEF";
+  char tmp[8];
+  int  n;
+
+  n=0;
+  do
+    {
+    tmp[n++]=digits[v&0xF];
+    v>>=4;
+    }
+  while(v!=0);
+  for(; width>n && o->p<o->end; width--)
+    *o->p++='0';
+  while(n>0 && o->p<o->end)
+    *o->p++=tmp[--n];
+  *o->p=0;
+  }
@@ -0,0 +1,107 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync command tokenizer and numbers    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// the command path reads its arguments through a toker: a cursor on
+// the command line that hands out tokens as spans (pointer + length)
+// into the line, so nothing is copied, nothing is modified and there
+// is no hidden state; two commands can be parsed at the same time
+//
+// numbers are parsed and formatted by hand, without locale or heap:
+//
+//   num_int   decimal, or hex with 0X, optionally signed
+//   num_fix   decimal with fraction and exponent (1.5, -2E3), returned
+//             as a fixed point integer with the requested decimals;
+//             time and frequency arguments take SCPI suffixes
+//
+//               time  NS US MS S       (base unit ns)
+//               freq  HZ KHZ MHZ GHZ   (base unit Hz; MHZ is mega)
+//
+//             a bare number is in the command's own unit
+//
+// both return a NUM_* code that num_strerror() turns into the text
+// for the ERR answer
+// answers are built with an out cursor; it never writes past the
+// buffer and keeps it 0-terminated
+//
+// on a stream a command is what one read() returns, unless the client
+// ends its commands with '\n': from its first newline on the stream is
+// cut into lines, so that a client can pipeline commands; the answers
+// come back one per line, in order
+
+#ifndef SCPI_H
+#define SCPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NUM_OK        0
+#define NUM_MISSING  -1
+#define NUM_SYNTAX   -2
+#define NUM_RANGE    -3
+#define NUM_UNIT     -4
+
+#define NUM_MAXDIGITS 18        // significant digits kept in a mantissa
+#define SCPI_MAXLINE  512       // longest command (MAXMSG)
+
+enum num_unit
+  {
+  UNIT_NONE,
+  UNIT_TIME,
+  UNIT_FREQ
+  };
+
+struct span
+  {
+  const char *p;
+  size_t      len;
+  };
+
+struct toker
+  {
+  const char *p;          // rest of the line
+  };
+
+struct out
+  {
+  char *p, *end;          // end: last byte, kept for the 0
+  };
+
+// input of a stream client, not run yet
+struct linebuf
+  {
+  bool   lines;           // the client ends its commands with '\n'
+  size_t len;
+  char   buf[SCPI_MAXLINE+1];
+  };
+
+
+extern const uint64_t pow10_tab[19];
+
+
+/******* protos *******/
+
+void        tok_init(struct toker *t, const char *s);
+bool        tok_next(struct toker *t, struct span *s);
+bool        tok_command(struct toker *t, struct span *cmd);
+bool        tok_end(struct toker *t);
+bool        span_eq(struct span s, const char *word);
+int         num_int(struct span s, int64_t min, int64_t max, int64_t *val);
+int         num_unit_exp(struct span s, enum num_unit unit, int *exp);
+int         num_fix(struct span s, enum num_unit unit, int bare_exp, int decimals, int64_t min, int64_t max, int64_t *val);
+int         tok_int(struct toker *t, int64_t min, int64_t max, int64_t *val);
+int         tok_fix(struct toker *t, enum num_unit unit, int bare_exp, int decimals, int64_t min, int64_t max, int64_t *val);
+const char *num_strerror(int err);
+void        out_init(struct out *o, char *buf, size_t maxlen);
+void        out_str(struct out *o, const char *s);
+void        out_span(struct out *o, struct span s);
+void        out_uint(struct out *o, uint64_t v);
+void        out_int(struct out *o, int64_t v, bool plus);
+void        out_fix(struct out *o, int64_t v, int decimals, bool plus);
+void        out_hex(struct out *o, uint32_t v, int width);
+
+#endif
@@ -2,41 +2,35 @@
  ***                                            ***
  ***  chopsync TCP server (kinda SCPI)          ***
  ***                                            ***
- ***  latest rev: aug  8 2024                   ***
+ ***  latest rev: oct 18 2026                   ***
  ***                                            ***
  **************************************************/ 
 
 #include "server.h"
 
 /***  globals  ***/
-uint32_t *regbank;
-int      can_present;
+fd_set          active_fd_set;
+struct pending  pendings[MAXPENDING];
+struct pendpart pendparts[MAXPENDPARTS];
+// reply being built by the command in dispatch, and device part of it
+struct pending *curpend;
+int             curpart;
+// optional "DEADLINE <ms>" of the command being dispatched; 0 = default
+long            curdeadline;
 
 /***  implementation  ***/
 
-int memorymap(void)
+void writereg(unsigned int reg, unsigned int val)
   {
-  int fd;
-  
-  if((fd = open("/dev/mem", O_RDWR | O_SYNC)) != -1)
-    {
-    regbank = (uint32_t *)mmap(NULL, REGBANK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, REGBANK_BASE);
-    if(regbank==MAP_FAILED)
-      return -1;
-    // file descriptor can be closed without invalidating the mapping
-    close(fd);
-    return 0;
-    }
-  else
-    return -1;
+  dev_writereg(curdev, reg, val);
   }
 
 
 //-------------------------------------------------------------------
 
-void writereg(unsigned int reg, unsigned int val)
+void modreg(unsigned int reg, unsigned int set, unsigned int clr)
   {
-  regbank[reg]=val;
+  dev_modreg(curdev, reg, set, clr);
   }
 
 
@@ -48,6 +42,44 @@ unsigned int readreg(unsigned int reg)
   }
 
 
+//-------------------------------------------------------------------
+
+// decode the whole register bank of a device at once; field by field
+// this is the same decoding done by the individual query handlers
+
+void read_syncstate(struct chopdev *d, struct syncstate *st)
+  {
+  unsigned int r0, r1;
+  int n;
+
+  r0=dev_readreg(d, 0);
+  r1=dev_readreg(d, 1);
+  st->status=((r1&0x00FF)<<8 | (r0&0x00FF));
+  st->flock=((r0 & FREQUENCY)!=0);
+  st->phlock=((r0 & PHASE)!=0);
+  st->stickylol=((r0 & STICKYLOL_MASK)!=0);
+  st->synch=((r1 & SYNCH_RESET_MASK)==0);
+  st->unwrap=((r1 & UNWRAPPER_MASK)!=0);
+  st->unwres=((r1 & UNWRESET_MASK)!=0);
+
+  n=(int)(dev_readreg(d, 3) & PHSETPOINT_MASK);
+  st->phsetp_ns=((n ^ PHSETPOINT_SIGN)-PHSETPOINT_SIGN)*8;
+  n=(int)(dev_readreg(d, 6) & PHERR_MASK);
+  st->pherr_raw=(n ^ PHERR_SIGN)-PHERR_SIGN;
+  n=(int)(dev_readreg(d, 5) & MECOSCMD_MASK);
+  st->mecos_cmd=(n ^ MECOSCMD_SIGN)-MECOSCMD_SIGN;
+
+  st->bunchfreq=dev_readreg(d, BUNCHMARKER_FREQ_REG);
+  st->chopfreq=dev_readreg(d, CHOPPER_FREQ_REG);
+  st->bunch_presc=dev_readreg(d, BUNCHMARKER_PSCALER_REG) & PRESCALER_MASK;
+  st->chop_presc=dev_readreg(d, CHOPPER_PSCALER_REG) & PRESCALER_MASK;
+  st->trigout=dev_readreg(d, 12) & TRIGOUT_MASK;
+  st->gain_raw=dev_readreg(d, 11) & GAIN_MASK;
+  st->unwthr=dev_readreg(d, 2) & UNWTHR_MASK;
+  st->siggen_dftw=(int)dev_readreg(d, 4);
+  }
+
+
 //-------------------------------------------------------------------
 
 void upstring(char *s)
@@ -86,65 +118,60 @@ void trimstring(char* s)
 
 //-------------------------------------------------------------------
 
-void parseREG(char *ans, size_t maxlen, int rw)
+// the plain ON/OFF answer of the flag queries
+
+void ans_onoff(char *ans, size_t maxlen, bool on)
   {
-  char *p;
-  int n;
-  unsigned int reg, val;
-  
-  // next in line is register address [0..MAXREG]
-  p=strtok(NULL," ");
-  if(p!=NULL)
+  struct out o;
+
+  out_init(&o, ans, maxlen);
+  out_str(&o, on? OKS ": ON\n" : OKS ": OFF\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseREG(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct out o;
+  int64_t reg, val;
+  int ret;
+
+  // next in line is register address [0..MAXREG], decimal or 0X hex
+  ret=tok_int(tk, 0, INT64_MAX, &reg);
+  if(ret==NUM_MISSING)
+    snprintf(ans, maxlen, "%s: missing register number\n", ERRS);
+  else if(ret!=NUM_OK || reg>MAXREG)
+    snprintf(ans, maxlen, "%s: no such register\n", ERRS);
+  else if(rw==WRITE)
     {
-    // try to read a hex value; remember the string is uppercase
-    n=sscanf(p,"0X%x",&reg);
-    // if failed, try to read a decimal value
-    if(n==0)
-      n=sscanf(p,"%u",&reg);
-    
-    if(n==0 || reg>MAXREG)
-      {
-      snprintf(ans, maxlen, "%s: no such register\n", ERRS);    
-      }
+    // next in line is the value to write into the register
+    ret=tok_int(tk, INT32_MIN, UINT32_MAX, &val);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing value to write into register\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid value to write into register 0x%X (%s)\n", ERRS, (unsigned int)reg, num_strerror(ret));
     else
       {
-      // we have a valid register address
-      if(rw==WRITE)
-        {
-        // next in line is the value to write into the register
-        p=strtok(NULL," ");
-        if(p!=NULL)
-          {
-          // try to read a hex value; remember the string is uppercase
-          n=sscanf(p,"0X%x",&val);
-          // if failed, try to read a decimal value
-          if(n==0)
-            n=sscanf(p,"%u",&val);
-          
-          if(n==0)
-            {
-            snprintf(ans, maxlen, "%s: invalid value to write into register 0x%X\n", ERRS, reg);
-            }
-          else
-            {
-            // WRITE REGISTER
-            writereg(reg,val);
-            snprintf(ans, maxlen, "%s: write 0x%08X into register 0x%X\n", OKS, val, reg);
-            }
-          }
-        else
-          snprintf(ans, maxlen, "%s: missing value to write into register\n", ERRS);
-        }
-      else
-        {
-        // READ REGISTER
-        snprintf(ans, maxlen, "%s: 0x%08X in register 0x%X\n", OKS, readreg(reg), reg);
-        }
+      // WRITE REGISTER
+      writereg((unsigned int)reg, (unsigned int)val);
+      out_init(&o, ans, maxlen);
+      out_str(&o, OKS ": write 0x");
+      out_hex(&o, (uint32_t)val, 8);
+      out_str(&o, " into register 0x");
+      out_hex(&o, (uint32_t)reg, 1);
+      out_str(&o, "\n");
       }
     }
   else
     {
-    snprintf(ans, maxlen, "%s: missing register number\n", ERRS);
+    // READ REGISTER
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": 0x");
+    out_hex(&o, readreg((unsigned int)reg), 8);
+    out_str(&o, " in register 0x");
+    out_hex(&o, (uint32_t)reg, 1);
+    out_str(&o, "\n");
     }
   }
 
@@ -191,40 +218,42 @@ void parseIDN(char *ans, size_t maxlen)
 
 void parseSTB(char *ans, size_t maxlen)
   {
-   snprintf(ans, maxlen, 
-            "%s: 0x%03X is the combined status word\n", OKS, 
-            ((readreg(1)&0x00FF)<<8 | (readreg(0)&0x00FF))
-           );
+  struct out o;
+
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": 0x");
+  out_hex(&o, ((readreg(1)&0x00FF)<<8 | (readreg(0)&0x00FF)), 3);
+  out_str(&o, " is the combined status word\n");
   }
 
 
 //-------------------------------------------------------------------
 
-void parseSYNCHRONIZER(char *ans, size_t maxlen, int rw)
+void parseSYNCHRONIZER(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
+  struct span p;
   
   if(rw==READ)
     {
     // read synchronizer on/off state
-    snprintf(ans, maxlen, "%s: %s\n", OKS, ((readreg(1) & SYNCH_RESET_MASK) == 0)?"ON":"OFF");
+    ans_onoff(ans, maxlen, (readreg(1) & SYNCH_RESET_MASK) == 0);
     }
   else
     {
     // turn synchronizer on/off
     
     // next in line is ON or OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    if(tok_next(tk, &p))
       {
-      if(strcmp(p,"ON")==0)
+      if(span_eq(p,"ON"))
         {
-        writereg(1,readreg(1) & ~SYNCH_RESET_MASK);
+        modreg(1, 0, SYNCH_RESET_MASK);
         snprintf(ans, maxlen, "%s: SYNCHRONIZER is now ON\n", OKS);
         }
-      else if(strcmp(p,"OFF")==0)
+      else if(span_eq(p,"OFF"))
         {
-        writereg(1,readreg(1) | SYNCH_RESET_MASK);
+        supervisor_synch_off(curdev->id);
+        modreg(1, SYNCH_RESET_MASK, 0);
         snprintf(ans, maxlen, "%s: SYNCHRONIZER is now OFF\n", OKS);
         }
       else
@@ -241,17 +270,19 @@ void parseSYNCHRONIZER(char *ans, size_t maxlen, int rw)
 
 void parseRST(char *ans, size_t maxlen)
   {
-  writereg(1,readreg(1) | SYNCH_RESET_MASK);
+  supervisor_synch_off(curdev->id);
+  modreg(1, SYNCH_RESET_MASK, 0);
   snprintf(ans, maxlen, "%s: SYNCHRONIZER is now OFF\n", OKS);        
   }
 
 
 //-------------------------------------------------------------------
 
-void parsePHSETP(char *ans, size_t maxlen, int rw)
+void parsePHSETP(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
-  int n;
+  struct out o;
+  int64_t v;
+  int n, ret;
   
   if(rw==READ)
     {
@@ -259,34 +290,111 @@ void parsePHSETP(char *ans, size_t maxlen, int rw)
     n=(int)(readreg(3) & PHSETPOINT_MASK);
     // sign extension
     n=(n ^ PHSETPOINT_SIGN)-PHSETPOINT_SIGN;
-    snprintf(ans, maxlen, "%s: %d ns\n", OKS, n*8);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n*8, false);
+    out_str(&o, " ns\n");
     }
   else
     {
     // set new phase setpoint
     
-    // next in line is the desired setpoint in ns
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    // next in line is the desired setpoint, in ns unless it has a unit;
+    // taken in 8 ns counts, rounded
+    ret=tok_fix(tk, UNIT_TIME, 0, 0, INT32_MIN, INT32_MAX, &v);
+    if(ramp_running(curdev->id))
+      snprintf(ans, maxlen, "%s: phase ramp running, PHSETPOINT_NS:ABORT first\n", ERRS);
+    else if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing setpoint specification\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid setpoint value (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      n=(int)strtol(p, NULL, 10);
-      if(errno!=0 && n==0)
-        snprintf(ans, maxlen, "%s: invalid setpoint value\n", ERRS);
-      else
-        {
-        n=round(n/8.);
-        if(n>MAX_SETPOINT_CNTS)
-          n=MAX_SETPOINT_CNTS;
-        if(n<-MAX_SETPOINT_CNTS)
-          n=-MAX_SETPOINT_CNTS;
-        writereg(3,((unsigned int)n) & PHSETPOINT_MASK);
-        snprintf(ans, maxlen, "%s: new setpoint is %d ns\n", OKS, n*8);
-        }
+      n=round(v/8.);
+      if(n>MAX_SETPOINT_CNTS)
+        n=MAX_SETPOINT_CNTS;
+      if(n<-MAX_SETPOINT_CNTS)
+        n=-MAX_SETPOINT_CNTS;
+      writereg(3,((unsigned int)n) & PHSETPOINT_MASK);
+      out_init(&o, ans, maxlen);
+      out_str(&o, OKS ": new setpoint is ");
+      out_int(&o, n*8, false);
+      out_str(&o, " ns\n");
       }
+    }
+
+  }
+
+
+//-------------------------------------------------------------------
+
+// write: ramp to <target ns> at most <slew ns/s>, accelerating at
+// <accel ns/s2>, driven by the sampler thread
+// read: progress of the last ramp
+
+void parsePHSETP_RAMP(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct ramp *r;
+  int64_t val[3];
+  int i, ret;
+
+  r=&ramps[curdev->id];
+  if(rw==READ)
+    {
+    ret=atomic_load(&r->state);
+    if(ret==RAMP_IDLE)
+      snprintf(ans, maxlen, "%s: IDLE\n", OKS);
     else
-      snprintf(ans, maxlen, "%s: missing setpoint specification\n", ERRS);
+      snprintf(ans, maxlen, "%s: %s at %.0f ns target %.0f ns from %.0f ns speed %.0f ns/s time %.3f/%.3f s writes %lu\n",
+               OKS, ramp_state_names[ret], r->pos, r->target, r->start, r->vel,
+               (ret==RAMP_RUNNING)? r->elapsed : fmin(r->elapsed, r->t_total), r->t_total, r->writes);
+    return;
+    }
+
+  // target in ns (or with a time unit), slew and acceleration in ns/s
+  // and ns/s2; all in thousandths
+  for(i=0; i<3; i++)
+    {
+    if(i==0)
+      ret=tok_fix(tk, UNIT_TIME, 0, 3, INT64_MIN, INT64_MAX, &val[i]);
+    else
+      ret=tok_fix(tk, UNIT_NONE, 0, 3, 1, INT64_MAX, &val[i]);
+    if(ret==NUM_MISSING)
+      {
+      snprintf(ans, maxlen, "%s: use PHSETPOINT_NS:RAMP <target ns> <slew ns/s> <accel ns/s2>\n", ERRS);
+      return;
+      }
+    if(ret!=NUM_OK)
+      {
+      snprintf(ans, maxlen, "%s: invalid ramp parameter %d (%s)\n", ERRS, i+1, num_strerror(ret));
+      return;
+      }
     }
+  if(tune_running(curdev->id))
+    {
+    snprintf(ans, maxlen, "%s: auto-tuning running, AUTOTUNE OFF first\n", ERRS);
+    return;
+    }
+  ret=ramp_start(curdev->id, val[0]/1000., val[1]/1000., val[2]/1000.);
+  if(ret<0)
+    snprintf(ans, maxlen, "%s: phase ramps need the real-time sampler (REALTIME)\n", ERRS);
+  else if(ret>0)
+    snprintf(ans, maxlen, "%s: phase ramp running, PHSETPOINT_NS:ABORT first\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: ramping to %.0f ns\n", OKS, ramps[curdev->id].req_target);
+  }
+
+
+//-------------------------------------------------------------------
 
+void parsePHSETP_ABORT(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(ramp_abort(curdev->id)!=0)
+    snprintf(ans, maxlen, "%s: no phase ramp running\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: phase ramp aborted\n", OKS);
   }
 
 
@@ -295,40 +403,41 @@ void parsePHSETP(char *ans, size_t maxlen, int rw)
 // choosing regnum in the parameters lets you choose to change 
 // the bunchmarker or the chopper prescaler
 
-void parsePRESCALER(char *ans, size_t maxlen, int rw, int regnum)
+void parsePRESCALER(char *ans, size_t maxlen, int rw, int regnum, struct toker *tk)
   {
-  char *p;
-  int n;
+  struct out o;
+  int64_t v;
+  int n, ret;
   
   if(rw==READ)
     {
     // read prescaler
     n=(int)(readreg(regnum) & PRESCALER_MASK);
-    snprintf(ans, maxlen, "%s: %d\n", OKS, n);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n, false);
+    out_str(&o, "\n");
     }
   else
     {
     // set new prescaler value
     
     // next in line is the desired scaler value
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    ret=tok_int(tk, INT32_MIN, INT32_MAX, &v);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing prescaler value\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid prescaler value (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      n=(int)strtol(p, NULL, 10);
-      if(errno!=0 && n==0)
-        snprintf(ans, maxlen, "%s: invalid prescaler value\n", ERRS);
-      else
-        {
-        if(n>MAX_PRESCALER)
-          n=MAX_PRESCALER;
-        if(n<1)
-          n=1;
-        writereg(regnum,(unsigned int)n);
-        snprintf(ans, maxlen, "%s: new prescaler is %d\n", OKS, n);
-        }
+      n=(int)v;
+      if(n>MAX_PRESCALER)
+        n=MAX_PRESCALER;
+      if(n<1)
+        n=1;
+      writereg(regnum,(unsigned int)n);
+      snprintf(ans, maxlen, "%s: new prescaler is %d\n", OKS, n);
       }
-    else
-      snprintf(ans, maxlen, "%s: missing prescaler value\n", ERRS);
     }
 
   }
@@ -341,13 +450,15 @@ void parsePRESCALER(char *ans, size_t maxlen, int rw, int regnum)
 
 void parseFREQ(char *ans, size_t maxlen, int rw, int regnum)
   {
-  int n;
+  struct out o;
   
   if(rw==READ)
     {
     // read frequency
-    n=(int)readreg(regnum);
-    snprintf(ans, maxlen, "%s: %d Hz\n", OKS, n);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, (int)readreg(regnum), false);
+    out_str(&o, " Hz\n");
     }
   else
     snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
@@ -357,42 +468,43 @@ void parseFREQ(char *ans, size_t maxlen, int rw, int regnum)
 
 //-------------------------------------------------------------------
 
-void parseTRIGOUTPH(char *ans, size_t maxlen, int rw)
+void parseTRIGOUTPH(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
-  int n, presc;
+  struct out o;
+  int64_t v;
+  int n, presc, ret;
   
   if(rw==READ)
     {
     // read TRIGOUT phase value
     n=(int)(readreg(12) & TRIGOUT_MASK);
-    snprintf(ans, maxlen, "%s: %d\n", OKS, n);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n, false);
+    out_str(&o, "\n");
     }
   else
     {
     // set new TRIGOUT phase
     
     // next in line is the desired value
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    ret=tok_int(tk, INT32_MIN, INT32_MAX, &v);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing TRIGOUT phase value\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid value (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      n=(int)strtol(p, NULL, 10);
-      if(errno!=0 && n==0)
-        snprintf(ans, maxlen, "%s: invalid value\n", ERRS);
-      else
-        {
-        // TRIGOUT phase must be in range [1..bunchmarker_prescaler]
-        presc=(int)(readreg(BUNCHMARKER_PSCALER_REG) & PRESCALER_MASK);
-        if(n>presc)
-          n=presc;
-        if(n<1)
-          n=1;
-        writereg(12,((unsigned int)n) & TRIGOUT_MASK);
-        snprintf(ans, maxlen, "%s: new TRIGOUT phase is %d\n", OKS, n);
-        }
+      // TRIGOUT phase must be in range [1..bunchmarker_prescaler]
+      n=(int)v;
+      presc=(int)(readreg(BUNCHMARKER_PSCALER_REG) & PRESCALER_MASK);
+      if(n>presc)
+        n=presc;
+      if(n<1)
+        n=1;
+      writereg(12,((unsigned int)n) & TRIGOUT_MASK);
+      snprintf(ans, maxlen, "%s: new TRIGOUT phase is %d\n", OKS, n);
       }
-    else
-      snprintf(ans, maxlen, "%s: missing TRIGOUT phase value\n", ERRS);
     }
 
   }
@@ -400,31 +512,30 @@ void parseTRIGOUTPH(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseUNWRAP(char *ans, size_t maxlen, int rw)
+void parseUNWRAP(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
+  struct span p;
   
   if(rw==READ)
     {
     // read unwrapper on/off state
-    snprintf(ans, maxlen, "%s: %s\n", OKS, ((readreg(1) & UNWRAPPER_MASK) != 0)?"ON":"OFF");
+    ans_onoff(ans, maxlen, (readreg(1) & UNWRAPPER_MASK) != 0);
     }
   else
     {
     // turn unwrapper on/off
     
     // next in line is ON or OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    if(tok_next(tk, &p))
       {
-      if(strcmp(p,"ON")==0)
+      if(span_eq(p,"ON"))
         {
-        writereg(1,readreg(1) | UNWRAPPER_MASK);
+        modreg(1, UNWRAPPER_MASK, 0);
         snprintf(ans, maxlen, "%s: Unwrapper is now ON\n", OKS);
         }
-      else if(strcmp(p,"OFF")==0)
+      else if(span_eq(p,"OFF"))
         {
-        writereg(1,readreg(1) & ~UNWRAPPER_MASK);
+        modreg(1, 0, UNWRAPPER_MASK);
         snprintf(ans, maxlen, "%s: Unwrapper is now OFF\n", OKS);
         }
       else
@@ -439,31 +550,30 @@ void parseUNWRAP(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseUNWRES(char *ans, size_t maxlen, int rw)
+void parseUNWRES(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
+  struct span p;
   
   if(rw==READ)
     {
     // read unwrapper reset option on/off state
-    snprintf(ans, maxlen, "%s: %s\n", OKS, ((readreg(1) & UNWRESET_MASK) != 0)?"ON":"OFF");
+    ans_onoff(ans, maxlen, (readreg(1) & UNWRESET_MASK) != 0);
     }
   else
     {
     // turn unwrapper reset option on/off
     
     // next in line is ON or OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    if(tok_next(tk, &p))
       {
-      if(strcmp(p,"ON")==0)
+      if(span_eq(p,"ON"))
         {
-        writereg(1,readreg(1) | UNWRESET_MASK);
+        modreg(1, UNWRESET_MASK, 0);
         snprintf(ans, maxlen, "%s: Unwrapper reset option is now ON\n", OKS);
         }
-      else if(strcmp(p,"OFF")==0)
+      else if(span_eq(p,"OFF"))
         {
-        writereg(1,readreg(1) & ~UNWRESET_MASK);
+        modreg(1, 0, UNWRESET_MASK);
         snprintf(ans, maxlen, "%s: Unwrapper reset option is now OFF\n", OKS);
         }
       else
@@ -478,40 +588,41 @@ void parseUNWRES(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseUNWTHR(char *ans, size_t maxlen, int rw)
+void parseUNWTHR(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
-  int n;
+  struct out o;
+  int64_t v;
+  int n, ret;
   
   if(rw==READ)
     {
     // read unwrapper threshold
     n=(int)(readreg(2) & UNWTHR_MASK);
-    snprintf(ans, maxlen, "%s: %d\n", OKS, n);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n, false);
+    out_str(&o, "\n");
     }
   else
     {
     // set new unwrapper threshold
     
     // next in line is the desired value
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    ret=tok_int(tk, INT32_MIN, INT32_MAX, &v);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing threshold value\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid value (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      n=(int)strtol(p, NULL, 10);
-      if(errno!=0 && n==0)
-        snprintf(ans, maxlen, "%s: invalid value\n", ERRS);
-      else
-        {
-        if(n>MAX_UNWTHR_CNTS)
-          n=MAX_UNWTHR_CNTS;
-        if(n<0)
-          n=0;
-        writereg(2,((unsigned int)n) & UNWTHR_MASK);
-        snprintf(ans, maxlen, "%s: new unwrapper reset threshold is %d\n", OKS, n);
-        }
+      n=(int)v;
+      if(n>MAX_UNWTHR_CNTS)
+        n=MAX_UNWTHR_CNTS;
+      if(n<0)
+        n=0;
+      writereg(2,((unsigned int)n) & UNWTHR_MASK);
+      snprintf(ans, maxlen, "%s: new unwrapper reset threshold is %d\n", OKS, n);
       }
-    else
-      snprintf(ans, maxlen, "%s: missing threshold value\n", ERRS);
     }
 
   }
@@ -519,10 +630,10 @@ void parseUNWTHR(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseSIGGENDFTW(char *ans, size_t maxlen, int rw)
+void parseSIGGENDFTW(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
-  int n;
+  int64_t v;
+  int n, ret;
   float df;
   
   if(rw==READ)
@@ -537,26 +648,23 @@ void parseSIGGENDFTW(char *ans, size_t maxlen, int rw)
     {
     // set new deltaFTW
     
-    // next in line is the desired value
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    // next in line is the desired value, in Hz unless it has a unit,
+    // taken to the uHz
+    ret=tok_fix(tk, UNIT_FREQ, 0, 6, INT64_MIN, INT64_MAX, &v);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing frequency specification\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid frequency (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      errno=0;  // to distinguish success/failure after call
-      df=strtof(p, NULL);
-      if(errno!=0)
-        snprintf(ans, maxlen, "%s: invalid frequency\n", ERRS);
-      else
-        {
-        // convert to sfix_32.0
-        // scale is 1 Hz = 2199 counts
-        n=round(df*2119.);
-        // no coercing; we use 32 bit
-        writereg(4,(unsigned int)n);
-        snprintf(ans, maxlen, "%s: new frequency is 3'123'437.5 %+f Hz\n", OKS, n/(2199.));
-        }
+      df=v/1e6;
+      // convert to sfix_32.0
+      // scale is 1 Hz = 2199 counts
+      n=round(df*2119.);
+      // no coercing; we use 32 bit
+      writereg(4,(unsigned int)n);
+      snprintf(ans, maxlen, "%s: new frequency is 3'123'437.5 %+f Hz\n", OKS, n/(2199.));
       }
-    else
-      snprintf(ans, maxlen, "%s: missing frequency specification\n", ERRS);
     }
 
   }
@@ -564,47 +672,174 @@ void parseSIGGENDFTW(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseGAIN(char *ans, size_t maxlen, int rw)
+void parseGAIN(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
-  int n;
-  float g;
+  struct out o;
+  int64_t v;
+  int n, ret;
+  double g;
   
   if(rw==READ)
     {
-    // read gain and convert it from ufix_16.12
+    // read gain and convert it from ufix_16.12; in millionths that is
+    // n*10^6/2^12 = n*15625/64, rounded half to even like %f
     n=(int)(readreg(11) & GAIN_MASK);
-    g=n/POW_2_12;
-    snprintf(ans, maxlen, "%s: %f\n", OKS, g);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_fix(&o, setup_gain_micro(n), 6, false);
+    out_str(&o, "\n");
     }
   else
     {
     // set new gain
     
-    // next in line is the desired value
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    // next in line is the desired value, taken to the millionth
+    ret=tok_fix(tk, UNIT_NONE, 0, 6, INT64_MIN, INT64_MAX, &v);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing gain specification\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid gain (%s)\n", ERRS, num_strerror(ret));
+    else
+      {
+      // convert to ufix_16.12
+      g=round(v/1e6*POW_2_12);
+      if(g>MAX_G)
+        g=MAX_G;
+      if(g<1)
+        g=1;
+      n=(int)g;
+      writereg(11,((unsigned int)n) & GAIN_MASK);
+      snprintf(ans, maxlen, "%s: new gain is %f\n", OKS, n/POW_2_12);
+      }
+    }
+
+  }
+
+
+//-------------------------------------------------------------------
+
+// AUTOTUNE [<step ns>] [APPLY] measures every gain of tune_gains[]
+// from the sampler thread; with APPLY the best gain and unwrapper
+// threshold are written at the end, AUTOTUNE OFF stops the run
+// the query gives the progress, then the recommendation
+
+void parseAUTOTUNE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct tune *u;
+  struct span  p;
+  int64_t v;
+  bool apply;
+  int st, ret;
+
+  u=&tunes[curdev->id];
+  if(rw==READ)
+    {
+    st=atomic_load(&u->state);
+    if(tune_running(curdev->id))
+      snprintf(ans, maxlen, "%s: %s gain %d of %d (%.3f) step %d ns\n", OKS,
+               (st>=TUNE_SETTLE && st<=TUNE_STEP_DOWN)? tune_state_names[st] : "STARTING",
+               u->cur+1, u->ncand, (u->cur>=0)? u->cand[u->cur].gain_raw/POW_2_12 : 0., u->stepcnt*8);
+    else if(u->best>=0 && st==TUNE_DONE)
+      snprintf(ans, maxlen, "%s: %s best gain %.3f rms %.2f ns overshoot %.0f %% settling %.0f ms UNW_THR %u%s\n", OKS,
+               tune_state_names[st], u->cand[u->best].gain_raw/POW_2_12, u->cand[u->best].rms_ns,
+               u->cand[u->best].overshoot_pct, u->cand[u->best].settle_ms, u->unwthr, u->apply? " applied" : "");
+    else
+      snprintf(ans, maxlen, "%s: %s%s%s\n", OKS, tune_state_names[st],
+               (u->why!=NULL)? " why " : "", (u->why!=NULL)? u->why : "");
+    return;
+    }
+
+  v=TUNE_DEFAULT_STEP_NS;
+  apply=false;
+  ret=NUM_OK;
+  while(ret==NUM_OK && tok_next(tk, &p))
+    {
+    if(span_eq(p,"OFF"))
       {
-      errno=0;  // to distinguish success/failure after call
-      g=strtof(p, NULL);
-      if(errno!=0)
-        snprintf(ans, maxlen, "%s: invalid gain\n", ERRS);
+      if(tune_abort(curdev->id)!=0)
+        snprintf(ans, maxlen, "%s: no auto-tuning running\n", ERRS);
       else
-        {
-        // convert to ufix_16.12
-        n=round(g*POW_2_12);
-        if(n>MAX_G)
-          n=MAX_G;
-        if(n<1)
-          n=1;
-        writereg(11,((unsigned int)n) & GAIN_MASK);
-        snprintf(ans, maxlen, "%s: new gain is %f\n", OKS, n/POW_2_12);
-        }
+        snprintf(ans, maxlen, "%s: auto-tuning stopped\n", OKS);
+      return;
       }
+    if(span_eq(p,"APPLY"))
+      apply=true;
     else
-      snprintf(ans, maxlen, "%s: missing gain specification\n", ERRS);
+      ret=num_fix(p, UNIT_TIME, 0, 0, 8, TUNE_MAX_STEP_NS, &v);
+    }
+  if(ret!=NUM_OK)
+    {
+    snprintf(ans, maxlen, "%s: use AUTOTUNE [<step> 8..%d ns] [APPLY] (%s)\n", ERRS, TUNE_MAX_STEP_NS, num_strerror(ret));
+    return;
     }
+  if(ramp_running(curdev->id))
+    {
+    snprintf(ans, maxlen, "%s: phase ramp running, PHSETPOINT_NS:ABORT first\n", ERRS);
+    return;
+    }
+  ret=tune_start(curdev->id, (double)v, apply);
+  if(ret<0)
+    snprintf(ans, maxlen, "%s: auto-tuning needs the real-time sampler (REALTIME)\n", ERRS);
+  else if(ret>0)
+    snprintf(ans, maxlen, "%s: auto-tuning running, AUTOTUNE OFF first\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: tuning %d gains with %d ns steps, about %.0f s\n", OKS, TUNE_NGAINS,
+             8*(int)fmax(1., round(v/8.)), (TUNE_SETTLE_MS+TUNE_NOISE_MS+2*TUNE_STEP_MS)*TUNE_NGAINS/1000.);
+  }
+
+
+//-------------------------------------------------------------------
+
+// AUTOTUNE:RESULTS?: one line per gain of the last run
+//   <gain> <result> noise <ns> overshoot <%> settling <ms> rms <ns> peak <ns>
+
+void parseAUTOTUNE_RESULTS(char *ans, size_t maxlen, int rw)
+  {
+  struct tune_cand *c;
+  struct tune *u;
+  size_t len;
+  int i, st;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  u=&tunes[curdev->id];
+  st=atomic_load(&u->state);
+  if(tune_running(curdev->id) || st==TUNE_IDLE || u->cur<0)
+    {
+    snprintf(ans, maxlen, "%s: %s\n", ERRS, (st==TUNE_IDLE || u->cur<0)? "no auto-tuning results" : "auto-tuning running");
+    return;
+    }
+
+  len=snprintf(ans, maxlen, "%s: %d lines\n", OKS, u->ncand);
+  for(i=0; i<u->ncand && len<maxlen; i++)
+    {
+    c=&u->cand[i];
+    len+=snprintf(ans+len, maxlen-len, "%.3f %s noise %.2f overshoot %.0f settling %.0f rms %.2f peak %.1f%s\n",
+                  c->gain_raw/POW_2_12, tune_res_names[c->res], c->noise_ns, c->overshoot_pct,
+                  c->settle_ms, c->rms_ns, c->peak_ns, (i==u->best)? " best" : "");
+    }
+  }
 
+
+//-------------------------------------------------------------------
+
+// write the gain and unwrapper threshold the last run recommends
+
+void parseAUTOTUNE_APPLY(char *ans, size_t maxlen, int rw)
+  {
+  struct tune *u;
+
+  u=&tunes[curdev->id];
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(tune_apply(curdev->id)!=0)
+    snprintf(ans, maxlen, "%s: no auto-tuning result to apply\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: new gain is %f, unwrapper reset threshold %u\n", OKS,
+             u->cand[u->best].gain_raw/POW_2_12, u->unwthr);
   }
 
 
@@ -612,6 +847,7 @@ void parseGAIN(char *ans, size_t maxlen, int rw)
 
 void parseMECOSCMD(char *ans, size_t maxlen, int rw)
   {
+  struct out o;
   int n;
   
   if(rw==READ)
@@ -620,7 +856,10 @@ void parseMECOSCMD(char *ans, size_t maxlen, int rw)
     n=(int)(readreg(5) & MECOSCMD_MASK);
     // sign extension
     n=(n ^ MECOSCMD_SIGN)-MECOSCMD_SIGN;
-    snprintf(ans, maxlen, "%s: %+d pulses\n", OKS, n);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n, true);
+    out_str(&o, " pulses\n");
     }
   else
     snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
@@ -632,8 +871,8 @@ void parseMECOSCMD(char *ans, size_t maxlen, int rw)
 
 void parsePHERR(char *ans, size_t maxlen, int rw)
   {
+  struct out o;
   int n;
-  float x;
   
   if(rw==READ)
     {
@@ -644,8 +883,11 @@ void parsePHERR(char *ans, size_t maxlen, int rw)
     // convert the value to ns
     // 1 count = 8 ns
     // count value is fractional because filtered and decimated -> precision increases
-    x=n/POW_2_7*8.;
-    snprintf(ans, maxlen, "%s: %+f ns\n", OKS, x);
+    // n/2^7*8 ns = n/16 ns, exact in millionths of ns: n*62500
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_fix(&o, (int64_t)n*62500, 6, true);
+    out_str(&o, " ns\n");
     }
   else
     snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
@@ -660,7 +902,7 @@ void parseLOCK(char *ans, size_t maxlen, int rw, unsigned int mask)
   if(rw==READ)
     {
     // read lock status
-    snprintf(ans, maxlen, "%s: %s\n", OKS, ((readreg(0) & mask) != 0)?"ON":"OFF");
+    ans_onoff(ans, maxlen, (readreg(0) & mask) != 0);
     }
   else
     snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
@@ -670,26 +912,25 @@ void parseLOCK(char *ans, size_t maxlen, int rw, unsigned int mask)
 
 //-------------------------------------------------------------------
 
-void parseLOL(char *ans, size_t maxlen, int rw)
+void parseLOL(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
+  struct span p;
   
   if(rw==READ)
     {
     // read sticky lock-of-loss alarm
-    snprintf(ans, maxlen, "%s: %s\n", OKS, ((readreg(0) & STICKYLOL_MASK) != 0)?"ON":"OFF");
+    ans_onoff(ans, maxlen, (readreg(0) & STICKYLOL_MASK) != 0);
     }
   else
     {
     // reset sticky lock-of-loss alarm
     
     // next in line must be OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    if(tok_next(tk, &p))
       {
-      if(strcmp(p,"OFF")==0)
+      if(span_eq(p,"OFF"))
         {
-        writereg(1,readreg(1) | LOL_RESET_MASK);
+        modreg(1, LOL_RESET_MASK, 0);
         snprintf(ans, maxlen, "%s: Sticky loss-of-lock alarm has been reset\n", OKS);
         }
       else
@@ -704,369 +945,2349 @@ void parseLOL(char *ans, size_t maxlen, int rw)
 
 //-------------------------------------------------------------------
 
-void parseMECOS_HZ_SETP(char *ans, size_t maxlen, int rw)
+// MECOS queries don't block the server: the request goes out on the bus
+// and the answer is formatted by an ans* function when MECOS replies
+// (or the request times out); meanwhile other clients are served
+
+void mecos_query(enum mecos_obj obj, ansfn fmt, char *ans, size_t maxlen)
   {
-  char *p;
+  struct pendpart *pp;
+  unsigned long val;
   int ret;
-  long vsetpoint;
-  
-  if(rw==READ)
-    {
-    // read speed setpoint from MECOS AMB
-    ret=can_hz_setpoint_read((unsigned long *)&vsetpoint);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %ld Hz\n", OKS, vsetpoint);
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading Hz Setpoint\n", ERRS);
-    }
-  else
-    {
-    // write speed setpoint to MECOS AMB
 
-    // next in line is the desired speed setpoint
-    p=strtok(NULL," ");
-    if(p!=NULL)
+  *ans=0;
+  if(curpend!=NULL)
+    {
+    ret=CAN_EFAIL;
+    pp=pendpart_alloc(fmt);
+    if(pp!=NULL)
       {
-      errno=0;  // to distinguish success/failure after call
-      vsetpoint=strtol(p, NULL, 10);
-      if(errno!=0)
-        snprintf(ans, maxlen, "%s: invalid MECOS Hz setpoint value\n", ERRS);
-      else
+      if((ret=can_read_object_async(&curdev->can, obj, CAN_PRIO_INTERACTIVE, curdeadline, reply_done, pp))==0)
         {
-        vsetpoint=(vsetpoint<=MECOS_MAX_SPEED)? vsetpoint : MECOS_MAX_SPEED;
-        ret=can_hz_setpoint_write((unsigned long)vsetpoint);
-      if(ret==0)
-        snprintf(ans, maxlen, "%s: new MECOS Hz setpoint is %ld Hz\n", OKS, vsetpoint);
-      else
-        snprintf(ans, maxlen, "%s: CAN error writing Hz Setpoint\n", ERRS);
+        curpend->outstanding++;
+        return;
         }
+      pp->used=false;
       }
-    else
-      snprintf(ans, maxlen, "%s: missing MECOS Hz setpoint specification\n", ERRS);
+    // a link that is down is reported as such, not as a CAN error
+    mecos_answer(fmt, ans, maxlen, (ret==CAN_ELINK)? CAN_ELINK : CAN_EFAIL, 0);
+    return;
     }
+
+  // no reply context: plain blocking read
+  ret=can_read_object(&curdev->can, obj, &val);
+  mecos_answer(fmt, ans, maxlen, ret, val);
   }
 
 
 //-------------------------------------------------------------------
 
-void parseMECOS_HZ_ACT(char *ans, size_t maxlen, int rw)
+// a timeout, or the link being down, gets the same answer whatever the
+// query, so that clients can tell it from other CAN errors
+
+void mecos_answer(ansfn fmt, char *ans, size_t maxlen, int ret, unsigned long val)
   {
-  int ret;
-  long vact;
-  
-  if(rw==READ)
+  if(ret==CAN_ETIMEOUT)
+    snprintf(ans, maxlen, "%s: TIMEOUT\n", ERRS);
+  else if(ret==CAN_ELINK)
+    snprintf(ans, maxlen, "%s: CAN LINK DOWN\n", ERRS);
+  else
+    fmt(ans, maxlen, ret, val);
+  }
+
+
+//-------------------------------------------------------------------
+
+void mecos_write_error(char *ans, size_t maxlen, int ret, const char *what)
+  {
+  if(ret==CAN_ELINK)
+    snprintf(ans, maxlen, "%s: CAN LINK DOWN\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: CAN error writing %s\n", ERRS, what);
+  }
+
+
+//-------------------------------------------------------------------
+
+// reply context of a MECOS write: a frame that has to wait in the
+// transmit queue is answered by fmt once it is on the bus, or with an
+// error if it is dropped; NULL without one
+
+struct pendpart *mecos_write_begin(ansfn fmt)
+  {
+  return (curpend!=NULL)? pendpart_alloc(fmt) : NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// ret of the write started with pp (val: the value written); a queued
+// frame nobody can wait for is answered as such
+
+void mecos_write_end(struct pendpart *pp, ansfn fmt, char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  *ans=0;
+  if(ret==CAN_QUEUED && pp!=NULL)
     {
-    // read actual speed from MECOS AMB
-    ret=can_hz_actual_read((unsigned long *)&vact);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %ld Hz\n", OKS, vact);
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading actual speed\n", ERRS);
+    curpend->outstanding++;
+    return;
     }
+  if(pp!=NULL)
+    pp->used=false;
+  if(ret==CAN_QUEUED)
+    snprintf(ans, maxlen, "%s: queued\n", OKS);
   else
-    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    mecos_answer(fmt, ans, maxlen, ret, val);
   }
 
 
 //-------------------------------------------------------------------
 
-void parseMECOS_LIFTUP(char *ans, size_t maxlen, int rw)
+void parseMECOS_HZ_SETP(char *ans, size_t maxlen, int rw, struct toker *tk)
   {
-  char *p;
+  struct pendpart *pp;
   int ret;
-  bool lifted;
-  long vact;
+  int64_t vsetpoint;
   
   if(rw==READ)
     {
-    // read whether MECOS AMB is lifted or not 
-    ret=can_liftup_state_read(&lifted);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %s\n", OKS, lifted?"ON":"OFF");
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading liftup state\n", ERRS);
+    // read speed setpoint from MECOS AMB
+    mecos_query(MECOS_OBJ_HZ_SETP, ansMECOS_HZ_SETP, ans, maxlen);
     }
   else
     {
-    // next in line is ON or OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    // write speed setpoint to MECOS AMB
+
+    // next in line is the desired speed setpoint, in Hz unless it has
+    // a unit
+    ret=tok_fix(tk, UNIT_FREQ, 0, 0, 0, INT64_MAX, &vsetpoint);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing MECOS Hz setpoint specification\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: invalid MECOS Hz setpoint value (%s)\n", ERRS, num_strerror(ret));
+    else
       {
-      if(strcmp(p,"ON")==0)
-        {
-        ret=can_liftup_state_write(true);
-        if(ret==0)
-          snprintf(ans, maxlen, "%s: MECOS AMB lifted UP\n", OKS);
-        else
-          snprintf(ans, maxlen, "%s: CAN error writing liftup state\n", ERRS);
-        }
-      else if(strcmp(p,"OFF")==0)
-        {
-        // I won't lift down unless I can read that MECOS speed is zero
-        vact=1L;
-        ret=can_hz_actual_read((unsigned long *)&vact);
-        if((ret!=0)||(vact|=0L))
-          {
-          snprintf(ans, maxlen, "%s: won't lift down when MECOS speed is not zero\n", ERRS);
+      vsetpoint=(vsetpoint<=MECOS_MAX_SPEED)? vsetpoint : MECOS_MAX_SPEED;
+      pp=mecos_write_begin(ansMECOS_HZ_SETP_SET);
+      ret=can_hz_setpoint_write(&curdev->can, (unsigned long)vsetpoint, (pp!=NULL)? reply_done : NULL, pp);
+      mecos_write_end(pp, ansMECOS_HZ_SETP_SET, ans, maxlen, ret, (unsigned long)vsetpoint);
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_HZ_SETP_SET(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: new MECOS Hz setpoint is %ld Hz\n", OKS, (long)val);
+  else
+    mecos_write_error(ans, maxlen, ret, "Hz Setpoint");
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_HZ_SETP(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: %ld Hz\n", OKS, (long)val);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading Hz Setpoint\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_HZ_ACT(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    {
+    // read actual speed from MECOS AMB
+    mecos_query(MECOS_OBJ_HZ_ACT, ansMECOS_HZ_ACT, ans, maxlen);
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_HZ_ACT(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: %ld Hz\n", OKS, (long)val);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading actual speed\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_LIFTUP(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct pendpart *pp;
+  struct span p;
+  int ret;
+  
+  if(rw==READ)
+    {
+    // read whether MECOS AMB is lifted or not 
+    mecos_query(MECOS_OBJ_LIFTED, ansMECOS_LIFTUP, ans, maxlen);
+    }
+  else
+    {
+    // next in line is ON or OFF
+    if(tok_next(tk, &p))
+      {
+      if(span_eq(p,"ON"))
+        {
+        pp=mecos_write_begin(ansMECOS_LIFTED_UP);
+        ret=can_liftup_state_write(&curdev->can, true, (pp!=NULL)? reply_done : NULL, pp);
+        mecos_write_end(pp, ansMECOS_LIFTED_UP, ans, maxlen, ret, 1);
+        }
+      else if(span_eq(p,"OFF"))
+        {
+        // I won't lift down unless I can read that MECOS speed is zero;
+        // the lift down itself is done by ansMECOS_LIFTDOWN
+        mecos_query(MECOS_OBJ_HZ_ACT, ansMECOS_LIFTDOWN, ans, maxlen);
+        }
+      else
+        snprintf(ans, maxlen, "%s: use ON/OFF with MECOS:LIFTUP command\n", ERRS);
+      }
+    else
+      snprintf(ans, maxlen, "%s: missing ON/OFF option\n", ERRS);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_LIFTUP(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    ans_onoff(ans, maxlen, val!=0);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading liftup state\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_LIFTED_UP(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  (void)val;
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: MECOS AMB lifted UP\n", OKS);
+  else
+    mecos_write_error(ans, maxlen, ret, "liftup state");
+  }
+
+
+//-------------------------------------------------------------------
+
+// val is the actual MECOS speed; the answer to the speed read is being
+// made, so a queued lift down can only be answered as queued
+
+void ansMECOS_LIFTDOWN(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if((ret!=0)||(val!=0UL))
+    {
+    snprintf(ans, maxlen, "%s: won't lift down when MECOS speed is not zero\n", ERRS);
+    }
+  else
+    {
+    ret=can_liftup_state_write(&curdev->can, false, NULL, NULL);
+    mecos_write_end(NULL, ansMECOS_LIFTED_DOWN, ans, maxlen, ret, 1);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_LIFTED_DOWN(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  (void)val;
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: MECOS AMB lifted DOWN\n", OKS);
+  else
+    mecos_write_error(ans, maxlen, ret, "liftup state");
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_ROTATION(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct pendpart *pp;
+  struct span p;
+  int ret;
+  
+  if(rw==READ)
+    {
+    // read whether MECOS AMB is rotating or not 
+    mecos_query(MECOS_OBJ_ROTATING, ansMECOS_ROTATION, ans, maxlen);
+    }
+  else
+    {
+    // next in line is ON or OFF
+    if(tok_next(tk, &p))
+      {
+      if(span_eq(p,"ON"))
+        {
+        pp=mecos_write_begin(ansMECOS_ROTATION_ON);
+        ret=can_rotation_state_write(&curdev->can, true, (pp!=NULL)? reply_done : NULL, pp);
+        mecos_write_end(pp, ansMECOS_ROTATION_ON, ans, maxlen, ret, 1);
+        }
+      else if(span_eq(p,"OFF"))
+        {
+        pp=mecos_write_begin(ansMECOS_ROTATION_OFF);
+        ret=can_rotation_state_write(&curdev->can, false, (pp!=NULL)? reply_done : NULL, pp);
+        mecos_write_end(pp, ansMECOS_ROTATION_OFF, ans, maxlen, ret, 1);
+        }
+      else
+        snprintf(ans, maxlen, "%s: use ON/OFF with MECOS:ROTATION command\n", ERRS);
+      }
+    else
+      snprintf(ans, maxlen, "%s: missing ON/OFF option\n", ERRS);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_ROTATION(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    ans_onoff(ans, maxlen, val!=0);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading rotating state\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_ROTATION_ON(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  (void)val;
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: MECOS AMB rotation ON\n", OKS);
+  else
+    mecos_write_error(ans, maxlen, ret, "rotation state");
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_ROTATION_OFF(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  (void)val;
+  if(ret==0)
+    snprintf(ans, maxlen, "%s: MECOS AMB rotation OFF\n", OKS);
+  else
+    mecos_write_error(ans, maxlen, ret, "rotation state");
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_FAULT(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    {
+    // read general fault register from MECOS
+    mecos_query(MECOS_OBJ_FAULT, ansMECOS_FAULT, ans, maxlen);
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_FAULT(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    ans_onoff(ans, maxlen, val!=0UL);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading MECOS fault register\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_STABLE(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    {
+    // ask MECOS whether external control is enabled
+    mecos_query(MECOS_OBJ_EXTCTL, ansMECOS_STABLE, ans, maxlen);
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void ansMECOS_STABLE(char *ans, size_t maxlen, int ret, unsigned long val)
+  {
+  if(ret==0)
+    ans_onoff(ans, maxlen, val!=0);
+  else
+    snprintf(ans, maxlen, "%s: CAN error reading MECOS stable state (=ext control enable)\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+// MECOS:SCAN <addr>[-<addr>] [<sub>[-<sub>]] starts a scan of the
+// device's AMB, MECOS:SCAN OFF stops it; the query gives the progress
+
+void parseMECOS_SCAN(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct span  p;
+  unsigned int alo, ahi, slo, shi;
+  int ret;
+
+  if(rw==READ)
+    {
+    if(mscan.state==MSCAN_IDLE)
+      {
+      snprintf(ans, maxlen, "%s: IDLE\n", OKS);
+      return;
+      }
+    snprintf(ans, maxlen, "%s: %s DEV%d %s+0x%02X 0x%04X-0x%04X subindex %u-%u done %d of %d found %d noanswer %d failed %d in %.1f s%s%s\n", OKS,
+             mscan_state_names[mscan.state], mscan.dev, mscan.node->ifname, mscan.node->nodeoff,
+             mscan.addr_lo, mscan.addr_hi, mscan.sub_lo, mscan.sub_hi, mscan.next-mscan.inflight, mscan.n,
+             mscan.found, mscan.noanswer, mscan.failed, mscan_elapsed(),
+             (mscan.why[0]!=0)? " why " : "", mscan.why);
+    return;
+    }
+
+  if(!tok_next(tk, &p))
+    {
+    snprintf(ans, maxlen, "%s: missing address range\n", ERRS);
+    return;
+    }
+  if(span_eq(p,"OFF"))
+    {
+    if(mscan.state!=MSCAN_RUNNING)
+      snprintf(ans, maxlen, "%s: no scan running\n", ERRS);
+    else
+      {
+      mscan_stop("by hand");
+      snprintf(ans, maxlen, "%s: scan stopped\n", OKS);
+      }
+    return;
+    }
+
+  ret=mscan_range(p, 0xFFFF, &alo, &ahi);
+  slo=0;
+  shi=0;
+  if(ret==NUM_OK && tok_next(tk, &p))
+    ret=mscan_range(p, 0xFF, &slo, &shi);
+  if(ret!=NUM_OK)
+    snprintf(ans, maxlen, "%s: use <addr>[-<addr>] [<subindex>[-<subindex>]] (%s)\n", ERRS, num_strerror(ret));
+  else if(!curdev->can.present || curdev->can.link==NULL)
+    snprintf(ans, maxlen, "%s: CAN not available\n", ERRS);
+  else if(curdev->can.link->state!=CAN_LINK_UP)
+    snprintf(ans, maxlen, "%s: CAN LINK DOWN\n", ERRS);
+  else if(mscan.state==MSCAN_RUNNING)
+    snprintf(ans, maxlen, "%s: a scan is running already\n", ERRS);
+  else if((ahi-alo+1)*(shi-slo+1)>MSCAN_MAX)
+    snprintf(ans, maxlen, "%s: at most %d registers in one scan\n", ERRS, MSCAN_MAX);
+  else if(mscan_start(curdev->id, &curdev->can, alo, ahi, slo, shi)!=0)
+    snprintf(ans, maxlen, "%s: can't start the scan\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: scanning %d registers\n", OKS, mscan.n);
+  }
+
+
+//-------------------------------------------------------------------
+
+// MECOS:SCAN:DATA? [<first> [<count>]]: the registers that answered,
+// from the first-th on
+
+void parseMECOS_SCAN_DATA(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct out o;
+  int64_t first, count;
+  int ret, i, n;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(mscan.state==MSCAN_IDLE)
+    {
+    snprintf(ans, maxlen, "%s: no scan\n", ERRS);
+    return;
+    }
+
+  first=0;
+  count=MSCAN_PAGE;
+  ret=tok_int(tk, 0, MSCAN_MAX, &first);
+  if(ret==NUM_OK)
+    ret=tok_int(tk, 1, MSCAN_PAGE, &count);
+  if(ret!=NUM_OK && ret!=NUM_MISSING)
+    {
+    snprintf(ans, maxlen, "%s: use [<first> [<count> up to %d]]\n", ERRS, MSCAN_PAGE);
+    return;
+    }
+
+  // count the lines first, the header comes before them
+  i=mscan_nth_found((int)first);
+  for(n=0; i>=0 && i<mscan.n && n<count; i++)
+    if(mscan.ent[i].res==MSCAN_FOUND)
+      n++;
+
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_int(&o, n, false);
+  out_str(&o, " lines\n");
+  i=mscan_nth_found((int)first);
+  for(; i>=0 && i<mscan.n && n>0; i++)
+    if(mscan.ent[i].res==MSCAN_FOUND)
+      {
+      mscan_format(&mscan.ent[i], &o);
+      n--;
+      }
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseMECOS_SCAN_SAVE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct span p;
+  char   msg[MAXMSG];
+
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(!tok_next(tk, &p))
+    snprintf(ans, maxlen, "%s: missing scan name\n", ERRS);
+  else if(mscan_save(p.p, p.len, msg, sizeof(msg))!=0)
+    snprintf(ans, maxlen, "%s: %s\n", ERRS, msg);
+  else
+    snprintf(ans, maxlen, "%s: %d registers saved in %s\n", OKS, mscan.found, msg);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseDEVICES(char *ans, size_t maxlen, int rw)
+  {
+  int    i;
+  size_t len;
+
+  if(rw==READ)
+    {
+    // list device table: register bank, CAN interface, node id offset
+    len=snprintf(ans, maxlen, "%s: %d device%s", OKS, ndevs, (ndevs>1)?"s":"");
+    for(i=0; i<ndevs && len<maxlen; i++)
+      len+=snprintf(ans+len, maxlen-len, "; DEV%d 0x%08lX %s+0x%02X CAN %s",
+                    i, devs[i].regbase, devs[i].can.ifname, devs[i].can.nodeoff,
+                    !devs[i].can.present? "OFF" : (devs[i].can.link->state!=CAN_LINK_UP)? "DOWN" : "ON");
+    if(len<maxlen)
+      snprintf(ans+len, maxlen-len, "\n");
+    else
+      ans[maxlen-2]='\n';
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseTELEMETRY(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    {
+    if(telem.sock<0)
+      snprintf(ans, maxlen, "%s: OFF (not configured)\n", OKS);
+    else
+      snprintf(ans, maxlen, "%s: %s %s:%u %u Hz seq %u sent %lu errors %lu\n", OKS,
+               (telem.rate_hz>0)?"ON":"OFF", inet_ntoa(telem.dest.sin_addr), ntohs(telem.dest.sin_port),
+               telem.rate_hz, telem.seq, telem.sent, telem.errors);
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseTELEMETRY_RATE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  int64_t n;
+  int ret;
+
+  if(rw==READ)
+    {
+    snprintf(ans, maxlen, "%s: %u Hz\n", OKS, telem.rate_hz);
+    }
+  else
+    {
+    // next in line is the publishing rate; 0 stops publishing
+    ret=tok_fix(tk, UNIT_FREQ, 0, 0, 0, TELEMETRY_MAXRATE, &n);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing telemetry rate\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: rate must be 0..%d Hz (%s)\n", ERRS, TELEMETRY_MAXRATE, num_strerror(ret));
+    else if(telem.sock<0)
+      snprintf(ans, maxlen, "%s: telemetry not configured\n", ERRS);
+    else if(telemetry_set_rate((unsigned int)n)!=0)
+      snprintf(ans, maxlen, "%s: can't set telemetry rate\n", ERRS);
+    else
+      snprintf(ans, maxlen, "%s: telemetry rate is now %u Hz\n", OKS, telem.rate_hz);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseHTTP(char *ans, size_t maxlen, int rw)
+  {
+  int i, nconn, nws;
+
+  if(rw==READ)
+    {
+    nconn=0;
+    nws=0;
+    for(i=0; i<HTTP_MAXCONN; i++)
+      if(http.c[i].fd>=0)
+        {
+        nconn++;
+        nws+=http.c[i].ws;
+        }
+    if(http.sock<0)
+      snprintf(ans, maxlen, "%s: OFF (not configured)\n", OKS);
+    else
+      snprintf(ans, maxlen, "%s: port %d push %u Hz connections %d websockets %d requests %lu pushes %lu dropped %lu\n", OKS,
+               cfg.http_port, http.rate_hz, nconn, nws, http.requests, http.pushes, http.dropped);
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseHTTP_RATE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  int64_t n;
+  int ret;
+
+  if(rw==READ)
+    {
+    snprintf(ans, maxlen, "%s: %u Hz\n", OKS, http.rate_hz);
+    }
+  else
+    {
+    // next in line is the WebSocket push rate; 0 stops pushing
+    ret=tok_fix(tk, UNIT_FREQ, 0, 0, 0, HTTP_MAXRATE, &n);
+    if(ret==NUM_MISSING)
+      snprintf(ans, maxlen, "%s: missing push rate\n", ERRS);
+    else if(ret!=NUM_OK)
+      snprintf(ans, maxlen, "%s: rate must be 0..%d Hz (%s)\n", ERRS, HTTP_MAXRATE, num_strerror(ret));
+    else if(http.sock<0)
+      snprintf(ans, maxlen, "%s: HTTP not configured\n", ERRS);
+    else if(http_set_rate((unsigned int)n)!=0)
+      snprintf(ans, maxlen, "%s: can't set push rate\n", ERRS);
+    else
+      snprintf(ans, maxlen, "%s: WebSocket push rate is now %u Hz\n", OKS, http.rate_hz);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// transmit scheduler state of the bus the device is on:
+// per class depth/max depth, frames sent, deferred and dropped, max wait
+
+void parseCAN_TXQ(char *ans, size_t maxlen, int rw)
+  {
+  struct can_link *l;
+  size_t len;
+  int    p;
+
+  if(rw==READ)
+    {
+    l=curdev->can.link;
+    if(!curdev->can.present || l==NULL)
+      {
+      snprintf(ans, maxlen, "%s: CAN not available\n", ERRS);
+      return;
+      }
+    can_refill(l);
+    len=snprintf(ans, maxlen, "%s: %s budget %u%% of %d bit/s, %.0f bits available", OKS,
+                 l->ifname, cfg.can_budget, CAN_BITRATE, l->tokens);
+    for(p=0; p<CAN_NPRIO && len<maxlen; p++)
+      len+=snprintf(ans+len, maxlen-len, "; %s depth %d max %d sent %lu deferred %lu dropped %lu maxwait %ld us",
+                    can_prio_names[p], l->txq[p].count, l->txq[p].maxdepth, l->txq[p].sent,
+                    l->txq[p].deferred, l->txq[p].dropped, l->txq[p].maxwait_us);
+    if(len<maxlen)
+      snprintf(ans+len, maxlen-len, "\n");
+    else
+      ans[maxlen-2]='\n';
+    }
+  else
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  }
+
+
+//-------------------------------------------------------------------
+
+// bus health of the device's CAN interface and round trip statistics
+// of its MECOS reads; multi-line answer "OK: <n> lines" + n lines
+
+void parseCAN_STATS(char *ans, size_t maxlen, int rw)
+  {
+  struct can_node *node;
+  struct canmon   *m;
+  struct rtt_hist *h;
+  struct timespec  now;
+  char   body[MAXANS];
+  size_t len;
+  int    nlines, obj, k;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  node=&curdev->can;
+  if(!node->present || node->link==NULL)
+    {
+    snprintf(ans, maxlen, "%s: CAN not available\n", ERRS);
+    return;
+    }
+
+  m=&node->link->mon;
+  len=0;
+  if(m->sock<0)
+    len+=snprintf(body+len, sizeof(body)-len, "%s monitor not available\n", node->ifname);
+  else
+    {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    canmon_window(m, &now);
+    len+=snprintf(body+len, sizeof(body)-len, "%s state %s for %ld s txerr %u rxerr %u\n",
+                  node->ifname, can_state_names[m->state], (long)(now.tv_sec-m->state_since.tv_sec),
+                  m->txerr, m->rxerr);
+    len+=snprintf(body+len, sizeof(body)-len, "%s load %.1f%% peak %.1f%% frames %lu errframes %lu\n",
+                  node->ifname, m->load, m->load_peak, m->frames, m->errframes);
+    len+=snprintf(body+len, sizeof(body)-len, "%s busoff %lu restarts %lu arblost %lu proterr %lu ackerr %lu txtimeout %lu rxoverflow %lu txoverflow %lu\n",
+                  node->ifname, m->busoff, m->restarts, m->arblost, m->proterr, m->ackerr,
+                  m->txtimeout, m->rxoverflow, m->txoverflow);
+    }
+  len+=snprintf(body+len, sizeof(body)-len, "requests %lu coalesced %lu retries %lu (all devices)\n",
+                can_requests, can_coalesced, can_retries);
+
+  // per object: count, timeouts, min/avg/p50/p99/max in us, then the
+  // log2 histogram starting at RTT_BIN0_US
+  for(obj=0; obj<=MECOS_NOBJ && len<sizeof(body); obj++)
+    {
+    h=&node->rtt[obj];
+    if(h->n==0 && h->timeouts==0)
+      continue;
+    len+=snprintf(body+len, sizeof(body)-len, "RTT %s n %lu timeouts %lu retries %lu rto %ld min %ld avg %.0f p50 %ld p99 %ld max %ld us hist",
+                  (obj<MECOS_NOBJ)? mecos_objs[obj].name : "OTHER", h->n, h->timeouts, h->retries,
+                  can_rto_us(node, obj), h->min_us, (h->n>0)? h->sum_us/h->n : 0.,
+                  rtt_percentile(h, 50.), rtt_percentile(h, 99.), h->max_us);
+    for(k=0; k<RTT_NBINS && len<sizeof(body); k++)
+      len+=snprintf(body+len, sizeof(body)-len, " %lu", h->bin[k]);
+    if(len<sizeof(body))
+      len+=snprintf(body+len, sizeof(body)-len, "\n");
+    }
+
+  if(len>=sizeof(body))
+    {
+    snprintf(ans, maxlen, "%s: answer too long\n", ERRS);
+    return;
+    }
+  for(nlines=0, k=0; body[k]!=0; k++)
+    if(body[k]=='\n')
+      nlines++;
+  snprintf(ans, maxlen, "%s: %d lines\n%s", OKS, nlines, body);
+  }
+
+
+//-------------------------------------------------------------------
+
+// JOURNAL? [<n> [<first>]]: the last n register and MECOS writes, or n
+// of them from sequence number first on; oldest first
+
+void parseJOURNAL(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct journal_ent ent[JOURNAL_PAGE];
+  struct out o;
+  int64_t  n, first;
+  uint64_t head, lo, seq;
+  int ret, i, k;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(journal.hdr==NULL)
+    {
+    snprintf(ans, maxlen, "%s: no journal\n", ERRS);
+    return;
+    }
+
+  n=JOURNAL_PAGE;
+  first=-1;
+  ret=tok_int(tk, 1, JOURNAL_PAGE, &n);
+  if(ret==NUM_OK)
+    ret=tok_int(tk, 0, INT64_MAX, &first);
+  if(ret!=NUM_OK && ret!=NUM_MISSING)
+    {
+    snprintf(ans, maxlen, "%s: use JOURNAL? [<n> up to %d [<first>]]\n", ERRS, JOURNAL_PAGE);
+    return;
+    }
+
+  // the ring only holds the last JOURNAL_NENT
+  head=atomic_load(&journal.hdr->head);
+  lo=(head>JOURNAL_NENT)? head-JOURNAL_NENT : 0;
+  if(first<0)
+    seq=(head-lo>(uint64_t)n)? head-(uint64_t)n : lo;
+  else
+    seq=((uint64_t)first>lo)? (uint64_t)first : lo;
+  for(k=0; seq<head && k<n; seq++)
+    if(journal_get(seq, &ent[k]))
+      k++;
+
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_int(&o, k, false);
+  out_str(&o, " lines\n");
+  for(i=0; i<k; i++)
+    journal_format(&ent[i], &o);
+  }
+
+
+//-------------------------------------------------------------------
+
+// AXIPROBE [<reg>[-<reg>]] [<rounds>] [WRITE] times the accesses to the
+// device's registers, AXIPROBE OFF stops it; the query gives the
+// progress, then the summary: reads of all the registers together,
+// writes, and the sample rate the bursts allow
+
+void parseAXIPROBE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct axi_hist rd, wr;
+  struct span  p;
+  unsigned int lo, hi, r;
+  int64_t n;
+  bool   write, range, more;
+  long   p99;
+  int    ret, state;
+  struct out o;
+
+  state=atomic_load(&axi.state);
+  if(rw==READ)
+    {
+    if(state==AXI_IDLE)
+      {
+      snprintf(ans, maxlen, "%s: IDLE\n", OKS);
+      return;
+      }
+    if(state==AXI_RUNNING)
+      {
+      snprintf(ans, maxlen, "%s: RUNNING DEV%d registers %u-%u round %ld of %ld\n", OKS,
+               axi.dev, axi.lo, axi.hi, atomic_load(&axi.progress), axi.n);
+      return;
+      }
+
+    // DONE DEV0 registers 0-12 rounds 100000 in 0.52 s tick 41.7 ns
+    // READ p50 120 p99 250 max 3400 outliers 12 WRITE ... BLOCK p99
+    // 1600 ns max 625000 Hz SAMPLER p99 400 ns max 2500000 Hz at 10000 Hz
+    memset(&rd, 0, sizeof(rd));
+    memset(&wr, 0, sizeof(wr));
+    for(r=axi.lo; r<=axi.hi; r++)
+      {
+      axi_sum(&rd, &axi.rd[r]);
+      axi_sum(&wr, &axi.wr[r]);
+      }
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_str(&o, axi_state_names[state]);
+    out_str(&o, " DEV");
+    out_int(&o, axi.dev, false);
+    out_str(&o, " registers ");
+    out_uint(&o, axi.lo);
+    out_str(&o, "-");
+    out_uint(&o, axi.hi);
+    out_str(&o, " rounds ");
+    out_int(&o, atomic_load(&axi.progress), false);
+    out_str(&o, " in ");
+    out_fix(&o, (int64_t)(axi.elapsed*100), 2, false);
+    out_str(&o, " s tick ");
+    out_fix(&o, (int64_t)(1e10/axi.hz), 1, false);
+    out_str(&o, " ns READ p50 ");
+    out_int(&o, axi_percentile(&rd, 50.), false);
+    out_str(&o, " p99 ");
+    out_int(&o, axi_percentile(&rd, 99.), false);
+    out_str(&o, " max ");
+    out_uint(&o, rd.max_ns);
+    out_str(&o, " outliers ");
+    out_uint(&o, rd.outliers);
+    if(wr.n>0)
+      {
+      out_str(&o, " WRITE p50 ");
+      out_int(&o, axi_percentile(&wr, 50.), false);
+      out_str(&o, " p99 ");
+      out_int(&o, axi_percentile(&wr, 99.), false);
+      out_str(&o, " max ");
+      out_uint(&o, wr.max_ns);
+      out_str(&o, " outliers ");
+      out_uint(&o, wr.outliers);
+      }
+    // the rates are from the p99 of a burst, what the bus gives nearly always
+    p99=axi_percentile(&axi.blk, 99.);
+    if(p99>0)
+      {
+      out_str(&o, " BLOCK p99 ");
+      out_int(&o, p99, false);
+      out_str(&o, " ns max ");
+      out_uint(&o, (uint64_t)(1e9/p99));
+      out_str(&o, " Hz");
+      }
+    p99=axi_percentile(&axi.smp, 99.);
+    if(p99>0)
+      {
+      out_str(&o, " SAMPLER p99 ");
+      out_int(&o, p99, false);
+      out_str(&o, " ns max ");
+      out_uint(&o, (uint64_t)(1e9/p99));
+      out_str(&o, " Hz");
+      if(smp.running)
+        {
+        out_str(&o, " at ");
+        out_uint(&o, smp.rate_hz);
+        out_str(&o, " Hz");
+        }
+      }
+    out_str(&o, "\n");
+    return;
+    }
+
+  lo=0;
+  hi=12;
+  n=AXI_DEFAULT_N;
+  write=false;
+  range=false;
+  ret=NUM_OK;
+  more=tok_next(tk, &p);
+  if(more && span_eq(p,"OFF"))
+    {
+    if(state!=AXI_RUNNING)
+      snprintf(ans, maxlen, "%s: no probe running\n", ERRS);
+    else
+      {
+      atomic_store(&axi.stop, true);
+      snprintf(ans, maxlen, "%s: probe stopped\n", OKS);
+      }
+    return;
+    }
+  for(; more && ret==NUM_OK; more=tok_next(tk, &p))
+    {
+    if(span_eq(p,"WRITE"))
+      write=true;
+    else if(!range)
+      {
+      ret=mscan_range(p, MAXREG, &lo, &hi);
+      range=true;
+      }
+    else
+      ret=num_int(p, 1, AXI_MAX_N, &n);
+    }
+  if(ret!=NUM_OK)
+    snprintf(ans, maxlen, "%s: use AXIPROBE [<reg>[-<reg>]] [<rounds> up to %d] [WRITE] (%s)\n", ERRS, AXI_MAX_N, num_strerror(ret));
+  else if(state==AXI_RUNNING)
+    snprintf(ans, maxlen, "%s: a probe is running already\n", ERRS);
+  else if(axi_start(curdev->id, lo, hi, (long)n, write)!=0)
+    snprintf(ans, maxlen, "%s: can't start the probe\n", ERRS);
+  else
+    snprintf(ans, maxlen, "%s: probing registers %u-%u, %ld rounds\n", OKS, lo, hi, (long)n);
+  }
+
+
+//-------------------------------------------------------------------
+
+// AXIPROBE:DATA? [<first>]: per register read and write statistics,
+// the bursts and the slowest accesses, from line first on
+
+void parseAXIPROBE_DATA(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct out o;
+  char   line[MAXANS];
+  int64_t first;
+  int ret, state, n, k;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  state=atomic_load(&axi.state);
+  if(state==AXI_RUNNING)
+    {
+    snprintf(ans, maxlen, "%s: probe running\n", ERRS);
+    return;
+    }
+  if(state==AXI_IDLE)
+    {
+    snprintf(ans, maxlen, "%s: no probe results\n", ERRS);
+    return;
+    }
+
+  first=0;
+  ret=tok_int(tk, 0, INT32_MAX, &first);
+  if(ret!=NUM_OK && ret!=NUM_MISSING)
+    {
+    snprintf(ans, maxlen, "%s: use AXIPROBE:DATA? [<first>]\n", ERRS);
+    return;
+    }
+
+  // count the lines first, the header comes before them
+  for(n=0; n<AXI_PAGE; n++)
+    {
+    out_init(&o, line, sizeof(line));
+    if(!axi_line((int)first+n, &o))
+      break;
+    }
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_int(&o, n, false);
+  out_str(&o, " lines\n");
+  for(k=0; k<n; k++)
+    axi_line((int)first+k, &o);
+  }
+
+
+//-------------------------------------------------------------------
+
+// link manager state of the device's CAN interface: state and for how
+// long, what took it down last, downs, reopens and failed reopens, and
+// when the next reopen is due
+
+void parseCAN_LINK(char *ans, size_t maxlen, int rw)
+  {
+  struct can_link *l;
+  struct timespec  now;
+  size_t len;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  l=curdev->can.link;
+  if(!curdev->can.present || l==NULL)
+    {
+    snprintf(ans, maxlen, "%s: CAN not available\n", ERRS);
+    return;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  len=snprintf(ans, maxlen, "%s: %s %s for %ld s last %s downs %lu reopens %lu failures %lu", OKS,
+               l->ifname, canlink_state_names[l->state], can_ts_diff_us(&now, &l->since)/1000000L,
+               (l->why[0]!=0)? l->why : "-", l->downs, l->reopens, l->reopen_fails);
+  if(l->state!=CAN_LINK_UP && len<maxlen)
+    len+=snprintf(ans+len, maxlen-len, " tries %d next in %.1f s", l->tries,
+                  (can_ts_diff_us(&l->next_try, &now)>0)? can_ts_diff_us(&l->next_try, &now)/1.e6 : 0.);
+  if(len<maxlen)
+    snprintf(ans+len, maxlen-len, "\n");
+  else
+    ans[maxlen-2]='\n';
+  }
+
+
+//-------------------------------------------------------------------
+
+// real-time sampler mode and wakeup latency, cyclictest-style;
+// multi-line answer
+
+void parseREALTIME(char *ans, size_t maxlen, int rw)
+  {
+  char   body[MAXANS];
+  size_t len;
+  int    i, nlines;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: OFF (not configured)\n", OKS);
+    return;
+    }
+
+  len=snprintf(body, sizeof(body), "mode %s prio %d cpu %d main cpu %d%s, memory %slocked\n",
+               smp.fifo?"SCHED_FIFO":"SCHED_OTHER", smp.prio, smp.cpu, smp.maincpu,
+               smp.pinned?"":" (not pinned)", smp.locked?"":"NOT ");
+  len+=snprintf(body+len, sizeof(body)-len, "rate %u Hz period %ld ns cycles %lu overruns %lu\n",
+                smp.rate_hz, smp.period_ns, smp.cycles, smp.overruns);
+  len+=snprintf(body+len, sizeof(body)-len, "latency min %.1f avg %.1f p99 %ld p99.9 %ld max %.1f us\n",
+                smp.lat_min_ns/1000., (smp.cycles>0)? smp.lat_sum_ns/smp.cycles/1000. : 0.,
+                sampler_lat_percentile(99.), sampler_lat_percentile(99.9), smp.lat_max_ns/1000.);
+  nlines=3;
+  for(i=0; i<ndevs && len<sizeof(body); i++, nlines++)
+    len+=snprintf(body+len, sizeof(body)-len, "DEV%d samples %llu\n", i,
+                  (unsigned long long)atomic_load(&smp.ring[i].head));
+  snprintf(ans, maxlen, "%s: %d lines\n%s", OKS, nlines, body);
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseREALTIME_RESET(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(!smp.running)
+    snprintf(ans, maxlen, "%s: real-time sampler not configured\n", ERRS);
+  else
+    {
+    // the sampler thread clears its own statistics at the next wakeup
+    atomic_store(&smp.reset, true);
+    snprintf(ans, maxlen, "%s: sampler statistics cleared\n", OKS);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseSUPERVISOR(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct supervisor *s;
+  struct span p;
+
+  s=&sv[curdev->id];
+  if(rw==READ)
+    {
+    if(sv_eventfd<0)
+      snprintf(ans, maxlen, "%s: OFF (needs REALTIME)\n", OKS);
+    else
+      snprintf(ans, maxlen, "%s: %s state %s attempt %d losses %lu recovered %lu failed %lu gaveup %lu overridden %lu\n", OKS,
+               atomic_load(&s->enable)?"ON":"OFF", sv_state_names[s->state], s->attempt,
+               s->losses, s->recovered, s->failed, s->gaveup, s->overridden);
+    }
+  else
+    {
+    // next in line is ON or OFF; ON also rearms after a give up
+    if(!tok_next(tk, &p))
+      snprintf(ans, maxlen, "%s: missing ON/OFF option\n", ERRS);
+    else if(sv_eventfd<0)
+      snprintf(ans, maxlen, "%s: supervisor needs the real-time sampler\n", ERRS);
+    else if(span_eq(p,"ON") && !supervisor_mecos_polled(curdev))
+      snprintf(ans, maxlen, "%s: supervisor checks MECOS, but MECOS_POLL is off\n", ERRS);
+    else if(span_eq(p,"ON"))
+      {
+      supervisor_enable(curdev->id, true);
+      snprintf(ans, maxlen, "%s: SUPERVISOR is now ON\n", OKS);
+      }
+    else if(span_eq(p,"OFF"))
+      {
+      supervisor_enable(curdev->id, false);
+      snprintf(ans, maxlen, "%s: SUPERVISOR is now OFF\n", OKS);
+      }
+    else
+      snprintf(ans, maxlen, "%s: use ON/OFF with SUPERVISOR command\n", ERRS);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// recovery attempts of the device, oldest first; multi-line answer
+
+void parseSUPERVISOR_LOG(char *ans, size_t maxlen, int rw)
+  {
+  struct supervisor *s;
+  struct sv_attempt *a;
+  struct tm tm;
+  uint64_t head, i;
+  char   body[MAXANS], tstr[32];
+  size_t len;
+  int    nlines;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  s=&sv[curdev->id];
+  head=atomic_load_explicit(&s->loghead, memory_order_acquire);
+  len=0;
+  body[0]=0;
+  nlines=0;
+  for(i=(head>SV_LOGLEN)? head-SV_LOGLEN : 0; i<head && len<sizeof(body); i++, nlines++)
+    {
+    a=&s->log[i&(SV_LOGLEN-1)];
+    localtime_r(&a->when.tv_sec, &tm);
+    strftime(tstr, sizeof(tstr), "%Y-%m-%dT%H:%M:%S", &tm);
+    len+=snprintf(body+len, sizeof(body)-len, "%s.%03ld attempt %d %s %.3f ms reg0 0x%08X\n",
+                  tstr, a->when.tv_nsec/1000000L, a->n, sv_result_names[a->result],
+                  a->dur_us/1000., a->reg0);
+    }
+  snprintf(ans, maxlen, "%s: %d lines\n%s", OKS, nlines, body);
+  }
+
+
+//-------------------------------------------------------------------
+
+// phase error spectrum from the sampler ring; optional arguments are
+// the bands to integrate, as <f1>-<f2> in Hz (default: decades)
+// multi-line answer: analysis parameters, total and band RMS jitter,
+// spurs, then the PSD averaged over 1/8 decade bins
+
+void parsePHERR_SPECTRUM(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  static struct spectrum sp;
+  struct spec_band band[SPEC_MAXBANDS];
+  struct span p, f1, f2;
+  char   body[MAXANS];
+  size_t len, j;
+  int64_t v1, v2;
+  int    nbands, nlines, i, k, k1, k2;
+  double f, sum;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: spectrum needs the real-time sampler (REALTIME)\n", ERRS);
+    return;
+    }
+
+  nbands=0;
+  while(tok_next(tk, &p))
+    {
+    if(nbands>=SPEC_MAXBANDS)
+      {
+      snprintf(ans, maxlen, "%s: at most %d bands\n", ERRS, SPEC_MAXBANDS);
+      return;
+      }
+    // split at the '-' that is not the sign of an exponent
+    for(j=1; j<p.len && !(p.p[j]=='-' && p.p[j-1]!='E'); j++)
+      ;
+    f1.p=p.p;
+    f1.len=j;
+    f2.p=p.p+j+1;
+    f2.len=(j<p.len)? p.len-j-1 : 0;
+    // in mHz
+    if(j>=p.len || num_fix(f1, UNIT_FREQ, 0, 3, 0, INT64_MAX, &v1)!=NUM_OK ||
+       num_fix(f2, UNIT_FREQ, 0, 3, 0, INT64_MAX, &v2)!=NUM_OK || v2<=v1)
+      {
+      snprintf(ans, maxlen, "%s: bands are <f1>-<f2> in Hz\n", ERRS);
+      return;
+      }
+    band[nbands].f1=v1/1000.;
+    band[nbands].f2=v2/1000.;
+    nbands++;
+    }
+
+  if(spec_compute(curdev->id, &sp)!=0)
+    {
+    snprintf(ans, maxlen, "%s: need %d samples, sampler still filling\n", ERRS, SPEC_N);
+    return;
+    }
+
+  if(nbands==0)
+    for(f=1.; f<sp.fs/2. && nbands<SPEC_MAXBANDS; f*=10.)
+      {
+      band[nbands].f1=f;
+      band[nbands].f2=(f*10.<sp.fs/2.)? f*10. : sp.fs/2.;
+      nbands++;
+      }
+
+  len=snprintf(body, sizeof(body), "fs %.0f Hz N %d segments %d df %.4g Hz window HANN fft %s\n",
+               sp.fs, SPEC_N, sp.nseg, sp.df, SPEC_PATH);
+  len+=snprintf(body+len, sizeof(body)-len, "RMS %.4g ns %.4g..%.4g Hz\n", sp.rms_total, sp.df, sp.fs/2.);
+  for(i=0; i<nbands && len<sizeof(body); i++)
+    len+=snprintf(body+len, sizeof(body)-len, "BAND %.4g..%.4g Hz RMS %.4g ns\n",
+                  band[i].f1, band[i].f2, spec_band_rms(&sp, band[i].f1, band[i].f2));
+  for(i=0; i<sp.nspurs && len<sizeof(body); i++)
+    len+=snprintf(body+len, sizeof(body)-len, "SPUR %.4g Hz %.4g ns rms %+.1f dB\n",
+                  sp.spur[i].f, sp.spur[i].rms, sp.spur[i].db);
+
+  // log-binned PSD: bin edges at 10^(j/SPEC_PSD_PER_DECADE) Hz
+  for(f=pow(10., floor(log10(sp.df)*SPEC_PSD_PER_DECADE)/SPEC_PSD_PER_DECADE);
+      f<sp.fs/2. && len<sizeof(body); f*=pow(10., 1./SPEC_PSD_PER_DECADE))
+    {
+    k1=(int)ceil(f/sp.df);
+    k2=(int)ceil(f*pow(10., 1./SPEC_PSD_PER_DECADE)/sp.df)-1;
+    if(k1<1)
+      k1=1;
+    if(k2>SPEC_M)
+      k2=SPEC_M;
+    if(k2<k1)
+      continue;
+    for(sum=0, k=k1; k<=k2; k++)
+      sum+=sp.psd[k];
+    len+=snprintf(body+len, sizeof(body)-len, "PSD %.4g Hz %.4g ns2/Hz\n",
+                  sqrt(k1*sp.df*k2*sp.df), sum/(k2-k1+1));
+    }
+
+  if(len>=sizeof(body))
+    {
+    snprintf(ans, maxlen, "%s: answer too long\n", ERRS);
+    return;
+    }
+  for(nlines=0, i=0; body[i]!=0; i++)
+    if(body[i]=='\n')
+      nlines++;
+  snprintf(ans, maxlen, "%s: %d lines\n%s", OKS, nlines, body);
+  }
+
+
+//-------------------------------------------------------------------
+
+// state, trigger and window of the device
+
+void parseCAPTURE(char *ans, size_t maxlen, int rw)
+  {
+  struct cap_trigger tr;
+  struct out o;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: OFF (needs REALTIME)\n", OKS);
+    return;
+    }
+  capture_get(curdev->id, &tr);
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_str(&o, (capt[curdev->id].slot>=0)? "RECORDING" : (tr.src!=0)? "ARMED" : "OFF");
+  out_str(&o, " trigger");
+  capture_format_trigger(&tr, &o);
+  out_str(&o, " window ");
+  out_uint(&o, tr.pre);
+  out_str(&o, " ");
+  out_uint(&o, tr.post);
+  out_str(&o, " fired ");
+  out_uint(&o, capt[curdev->id].fired);
+  out_str(&o, "\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+// write: OFF, or any of FLOCK [edge], PHLOCK [edge], PHERR <ns>,
+// MECOS_FAULT; replaces the trigger, keeps the window
+
+void parseCAPTURE_TRIGGER(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct cap_trigger tr;
+  struct toker save;
+  struct span p, q;
+  struct out o;
+  enum cap_edge *edge;
+  int64_t v;
+  int ret;
+
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: capture needs the real-time sampler (REALTIME)\n", ERRS);
+    return;
+    }
+  capture_get(curdev->id, &tr);
+  if(rw==READ)
+    {
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ":");
+    capture_format_trigger(&tr, &o);
+    out_str(&o, "\n");
+    return;
+    }
+
+  if(!tok_next(tk, &p))
+    {
+    snprintf(ans, maxlen, "%s: missing trigger sources or OFF\n", ERRS);
+    return;
+    }
+  tr.src=0;
+  if(!span_eq(p,"OFF"))
+    do
+      {
+      if(span_eq(p,"FLOCK") || span_eq(p,"PHLOCK"))
+        {
+        if(span_eq(p,"FLOCK"))
+          {
+          tr.src|=CAP_SRC_FLOCK;
+          edge=&tr.flock;
           }
         else
           {
-          ret=can_liftup_state_write(false);
-          if(ret==0)
-            snprintf(ans, maxlen, "%s: MECOS AMB lifted DOWN\n", OKS);
-          else
-            snprintf(ans, maxlen, "%s: CAN error writing liftup state\n", ERRS);
+          tr.src|=CAP_SRC_PHLOCK;
+          edge=&tr.phlock;
+          }
+        // optional edge, FALL if not given
+        *edge=CAP_FALL;
+        save=*tk;
+        if(tok_next(tk, &q))
+          {
+          if(span_eq(q,"RISE"))
+            *edge=CAP_RISE;
+          else if(span_eq(q,"ANY"))
+            *edge=CAP_ANY;
+          else if(!span_eq(q,"FALL"))
+            *tk=save;
           }
         }
+      else if(span_eq(p,"PHERR"))
+        {
+        // in millionths of ns; the register counts 1/16 ns
+        ret=tok_fix(tk, UNIT_TIME, 0, 6, 1, (int64_t)(PHERR_SIGN/16)*1000000, &v);
+        if(ret!=NUM_OK)
+          {
+          snprintf(ans, maxlen, "%s: PHERR needs a threshold in ns, up to %d (%s)\n", ERRS, PHERR_SIGN/16, num_strerror(ret));
+          return;
+          }
+        tr.src|=CAP_SRC_PHERR;
+        tr.pherr_cnt=(uint32_t)((v*16+500000)/1000000);
+        if(tr.pherr_cnt==0)
+          tr.pherr_cnt=1;
+        }
+      else if(span_eq(p,"MECOS_FAULT"))
+        tr.src|=CAP_SRC_MECOS;
       else
-        snprintf(ans, maxlen, "%s: use ON/OFF with MECOS:LIFTUP command\n", ERRS);
+        {
+        out_init(&o, ans, maxlen);
+        out_str(&o, ERRS ": unknown trigger source ");
+        out_span(&o, p);
+        out_str(&o, "; use FLOCK, PHLOCK, PHERR, MECOS_FAULT or OFF\n");
+        return;
+        }
       }
+    while(tok_next(tk, &p));
+
+  capture_arm(curdev->id, &tr);
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": trigger is now");
+  capture_format_trigger(&tr, &o);
+  out_str(&o, "\n");
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseCAPTURE_WINDOW(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct cap_trigger tr;
+  int64_t pre, post;
+  int ret;
+
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: capture needs the real-time sampler (REALTIME)\n", ERRS);
+    return;
+    }
+  capture_get(curdev->id, &tr);
+  if(rw==READ)
+    {
+    snprintf(ans, maxlen, "%s: %u %u\n", OKS, tr.pre, tr.post);
+    return;
+    }
+
+  // next in line are the samples before and after the trigger
+  ret=tok_int(tk, 0, CAP_MAXLEN-1, &pre);
+  if(ret==NUM_OK)
+    ret=tok_int(tk, 1, CAP_MAXLEN, &post);
+  if(ret==NUM_MISSING)
+    snprintf(ans, maxlen, "%s: missing <pre> <post> samples\n", ERRS);
+  else if(ret!=NUM_OK || pre+post>CAP_MAXLEN)
+    snprintf(ans, maxlen, "%s: window is <pre> <post> samples, at most %d in all, post at least 1\n", ERRS, CAP_MAXLEN);
+  else
+    {
+    tr.pre=(unsigned int)pre;
+    tr.post=(unsigned int)post;
+    capture_arm(curdev->id, &tr);
+    snprintf(ans, maxlen, "%s: window is now %u samples before and %u from the trigger (%.1f ms)\n", OKS,
+             tr.pre, tr.post, (tr.pre+tr.post)*1000./smp.rate_hz);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseCAPTURE_FORCE(char *ans, size_t maxlen, int rw)
+  {
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(!smp.running)
+    snprintf(ans, maxlen, "%s: capture needs the real-time sampler (REALTIME)\n", ERRS);
+  else if(capt[curdev->id].slot>=0)
+    snprintf(ans, maxlen, "%s: a capture is being recorded\n", ERRS);
+  else
+    {
+    capture_force(curdev->id);
+    snprintf(ans, maxlen, "%s: capture forced\n", OKS);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseCAPTURE_LIST(char *ans, size_t maxlen, int rw)
+  {
+  struct cap_info info[CAP_NSLOTS];
+  struct out o;
+  struct tm tm;
+  char   tstr[32];
+  size_t len;
+  int    n, i;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: capture needs the real-time sampler (REALTIME)\n", ERRS);
+    return;
+    }
+
+  n=capture_list(curdev->id, info, CAP_NSLOTS);
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_int(&o, n, false);
+  out_str(&o, " lines\n");
+  for(i=0; i<n; i++)
+    {
+    // <id> <time> <cause> status <reg0> pre <n> post <n> <rate> Hz <state>
+    localtime_r(&info[i].when.tv_sec, &tm);
+    len=strftime(tstr, sizeof(tstr), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(tstr+len, sizeof(tstr)-len, ".%03ld ", info[i].when.tv_nsec/1000000L);
+    out_uint(&o, info[i].id);
+    out_str(&o, " ");
+    out_str(&o, tstr);
+    capture_format_cause(info[i].cause, &o);
+    out_str(&o, " status 0x");
+    out_hex(&o, info[i].status, 8);
+    out_str(&o, " pre ");
+    out_uint(&o, info[i].pre);
+    out_str(&o, " post ");
+    out_uint(&o, info[i].total-info[i].pre);
+    out_str(&o, " ");
+    out_uint(&o, info[i].rate_hz);
+    out_str(&o, " Hz ");
+    if(info[i].n==info[i].total)
+      out_str(&o, "COMPLETE\n");
     else
-      snprintf(ans, maxlen, "%s: missing ON/OFF option\n", ERRS);
+      {
+      out_str(&o, "RECORDING ");
+      out_uint(&o, info[i].n);
+      out_str(&o, "\n");
+      }
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// <id> [<first> [<count>]]: samples first.. of a capture, one per line
+
+void parseCAPTURE_DATA(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct smp_sample s[CAP_PAGE];
+  struct cap_info info;
+  struct out o;
+  int64_t id, first, count;
+  int ret, n, i;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  if(!smp.running)
+    {
+    snprintf(ans, maxlen, "%s: capture needs the real-time sampler (REALTIME)\n", ERRS);
+    return;
+    }
+
+  first=0;
+  count=CAP_PAGE;
+  ret=tok_int(tk, 1, INT64_MAX, &id);
+  if(ret==NUM_MISSING)
+    {
+    snprintf(ans, maxlen, "%s: missing capture id\n", ERRS);
+    return;
+    }
+  if(ret==NUM_OK)
+    ret=tok_int(tk, 0, CAP_MAXLEN, &first);
+  if(ret==NUM_OK)
+    ret=tok_int(tk, 1, CAP_PAGE, &count);
+  if(ret!=NUM_OK && ret!=NUM_MISSING)
+    {
+    snprintf(ans, maxlen, "%s: use <id> [<first> [<count> up to %d]]\n", ERRS, CAP_PAGE);
+    return;
+    }
+
+  n=capture_read((unsigned long)id, &info, (unsigned int)first, s, (unsigned int)count);
+  if(n==-1)
+    {
+    snprintf(ans, maxlen, "%s: no such capture\n", ERRS);
+    return;
+    }
+  if(n<0)
+    {
+    snprintf(ans, maxlen, "%s: capture being written, try again\n", ERRS);
+    return;
+    }
+
+  out_init(&o, ans, maxlen);
+  out_str(&o, OKS ": ");
+  out_int(&o, n, false);
+  out_str(&o, " lines\n");
+  for(i=0; i<n; i++)
+    capture_format_sample(&info, (unsigned int)first+i, &s[i], &o);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the connection pool and the per-client limits, then one line per
+// client: commands run, OVERLOAD answers, bytes queued, credit left
+
+void parseSCHED(char *ans, size_t maxlen, int rw)
+  {
+  struct conn     *c;
+  struct httpconn *hc;
+  char   body[MAXANS];
+  size_t len;
+  int    i, nlines;
+
+  if(rw!=READ)
+    {
+    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+    return;
+    }
+  len=snprintf(body, sizeof(body), "CLIENTS %d of %d, refused %lu, arena %zu bytes\n"
+               "LIMIT CAN %u/s burst %u, WRITE %u/s burst %u, quantum %d\n",
+               conns.used, conns.max, conns.refused, conns.arena_size,
+               cfg.lim_can_rate, cfg.lim_can_burst, cfg.lim_write_rate, cfg.lim_write_burst,
+               SCHED_QUANTUM);
+  nlines=2;
+  for(i=0; i<conns.max && len<sizeof(body); i++)
+    {
+    c=&conns.c[i];
+    if(c->fd<0)
+      continue;
+    len+=snprintf(body+len, sizeof(body)-len, "fd %d %s served %lu overload %lu queued %zu deficit %d\n",
+                  c->fd, c->peer.local? "UNIX" : "TCP", c->sched.served, c->sched.overload,
+                  c->in->len, c->sched.deficit);
+    nlines++;
+    }
+  for(i=0; i<HTTP_MAXCONN && len<sizeof(body); i++)
+    {
+    hc=&http.c[i];
+    if(hc->fd<0 || !hc->ws)
+      continue;
+    len+=snprintf(body+len, sizeof(body)-len, "fd %d WS served %lu overload %lu\n",
+                  hc->fd, hc->sched.served, hc->sched.overload);
+    nlines++;
+    }
+  snprintf(ans, maxlen, "%s: %d lines\n%s", OKS, nlines, body);
+  }
+
+
+//-------------------------------------------------------------------
+
+// write: several synchronizer parameters at once, validated together
+// and written in one ordered burst
+// read: the current setup, as CONFIGURE takes it
+
+void parseCONFIGURE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  struct setup s;
+  struct out o;
+  char err[MAXMSG];
+
+  if(rw==READ)
+    {
+    setup_read(curdev, &s);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    setup_format(&s, &o);
+    out_str(&o, "\n");
+    return;
+    }
+
+  memset(&s, 0, sizeof(s));
+  if(setup_parse(tk, &s, err, sizeof(err))!=0)
+    snprintf(ans, maxlen, "%s: %s; nothing changed\n", ERRS, err);
+  else if(s.have==0)
+    snprintf(ans, maxlen, "%s: use CONFIGURE <parameter> <value> [<parameter> <value> ...]\n", ERRS);
+  else if(setup_apply(curdev, &s, err, sizeof(err))!=0)
+    snprintf(ans, maxlen, "%s: %s; nothing changed\n", ERRS, err);
+  else
+    snprintf(ans, maxlen, "%s: %d parameters configured\n", OKS, setup_count(&s));
+  }
+
+
+//-------------------------------------------------------------------
+
+void parseCONFIGURE_UNDO(char *ans, size_t maxlen, int rw)
+  {
+  char err[MAXMSG];
+
+  if(rw==READ)
+    snprintf(ans, maxlen, "%s: read operation not supported\n", ERRS);
+  else if(setup_undo(curdev, err, sizeof(err))!=0)
+    snprintf(ans, maxlen, "%s: %s\n", ERRS, err);
+  else
+    snprintf(ans, maxlen, "%s: %d parameters restored\n", OKS, setup_count(&setupundo[curdev->id].set));
+  }
+
+
+//-------------------------------------------------------------------
+
+// write: apply a profile file as one CONFIGURE
+// read: multi-line list of the profiles
+
+void parseCONFIGURE_PROFILE(char *ans, size_t maxlen, int rw, struct toker *tk)
+  {
+  static char names[MAXPROFILES][MAXPROFILENAME+1];
+  struct setup s;
+  struct span  p;
+  struct out   o;
+  char err[MAXMSG];
+  int  i, n;
+
+  if(rw==READ)
+    {
+    n=profile_list(names, MAXPROFILES);
+    out_init(&o, ans, maxlen);
+    out_str(&o, OKS ": ");
+    out_int(&o, n, false);
+    out_str(&o, " lines\n");
+    for(i=0; i<n; i++)
+      {
+      out_str(&o, names[i]);
+      out_str(&o, "\n");
+      }
+    return;
+    }
+
+  if(!tok_next(tk, &p))
+    snprintf(ans, maxlen, "%s: missing profile name\n", ERRS);
+  else if(profile_load(p.p, p.len, &s, err, sizeof(err))!=0)
+    snprintf(ans, maxlen, "%s: %s; nothing changed\n", ERRS, err);
+  else if(setup_apply(curdev, &s, err, sizeof(err))!=0)
+    snprintf(ans, maxlen, "%s: %s; nothing changed\n", ERRS, err);
+  else
+    snprintf(ans, maxlen, "%s: profile %.*s applied, %d parameters configured\n", OKS, (int)p.len, p.p, setup_count(&s));
+  }
+
+
+//-------------------------------------------------------------------
+
+// run one command on every device; every device answers into its own
+// part of the pending reply, and reply_finish() joins them on a single
+// line as "DEV0 <answer>; DEV1 <answer>; ..."
+
+void parseALL(const char *cmd, char *ans, size_t maxlen, int filedes)
+  {
+  struct toker tk;
+  struct span  c;
+  int  i;
+
+  tok_init(&tk, cmd);
+  tok_command(&tk, &c);
+  if(span_eq(c,"HELP"))
+    {
+    snprintf(ans, maxlen, "%s: HELP is not a device command\n", ERRS);
+    return;
+    }
+  if(curpend==NULL)
+    {
+    snprintf(ans, maxlen, "%s: ALL: not available here\n", ERRS);
+    return;
+    }
+
+  for(i=0; i<ndevs; i++)
+    {
+    // dispatch() leaves the command alone, every device reads it again
+    select_device(i);
+    curpart=i;
+    dispatch(cmd, curpend->part[i], MAXANS, filedes);
+    }
+  curpend->nparts=ndevs;
+  curpart=0;
+  select_device(0);
+  }
+
+
+//-------------------------------------------------------------------
+
+void printHelp(int filedes)
+  {
+  static char body[MAXHELP], help[MAXHELP+32];
+  struct out o;
+  const char *s;
+  int nlines;
+
+  out_init(&o, body, sizeof(body));
+  out_str(&o,"Chopsync SCPI server commands\n\n");
+  out_str(&o,"Server support multiple concurrent clients\n");
+  out_str(&o,"Server is case insensitive\n");
+  out_str(&o,"Numbers can be decimal or hex, with the 0x prefix\n");
+  out_str(&o,"Times and frequencies take a unit suffix (NS, US, MS, S; HZ, KHZ, MHZ, GHZ), e.g. PHSETPOINT_NS 1.5US\n");
+  out_str(&o,"Any command can end with DEADLINE <ms>: MECOS queries not answered in time give ERR: TIMEOUT\n");
+  out_str(&o,"Server answers with OK or ERR, a colon and a descriptive message\n");
+  out_str(&o,"Multi-line answers start with OK: <n> lines and are followed by <n> lines\n");
+  out_str(&o,"Send CTRL-D to close the connection\n");
+  out_str(&o,"Commands go to device 0 unless prefixed with DEV<n>: (one device) or ALL: (every device)\n");
+  out_str(&o,"e.g. DEV1:PHLOCK? or ALL:PHLOCK?; ALL: answers are joined as DEV0 <answer>; DEV1 <answer>\n");
+  out_str(&o,"ALL: on a multi-line command gives one multi-line answer, each line prefixed with DEV<n>\n\n");
+  out_str(&o,"Command list:\n\n");
+  out_str(&o,"REGister <reg> <value>        : write <value> into register <reg>\n");
+  out_str(&o,"REGister? <reg>               : read content of register <reg>\n");
+  out_str(&o,"*IDN?                         : print firmware name and version\n");
+  out_str(&o,"*STB?                         : combined status word = lower 8 LSBs of reg#1 (<<8) + lower 8 LSBs of reg#0\n");
+  out_str(&o,"SYNCHronizer {ON|OFF}         : turn synchronizer on or off\n");
+  out_str(&o,"SYNCHronizer?                 : query synchronizer state; answer is either ON or OFF\n");
+  out_str(&o,"*RST                          : turn off synchronizer; equivalent to SYNCH OFF\n");
+  out_str(&o,"PHSETPOINT_NS <value>         : set phase setpoint to <value> ns\n");
+  out_str(&o,"PHSETPOINT_NS?                : query current phase setpoint, expressed in ns\n");
+  out_str(&o,"PHSETPOINT_NS:RAMP <target> <slew> <accel>\n");
+  out_str(&o,"                              : move the phase setpoint to <target> ns at most <slew> ns/s with\n");
+  out_str(&o,"                                <accel> ns/s2 acceleration, one step per sample (needs REALTIME)\n");
+  out_str(&o,"PHSETPOINT_NS:RAMP?           : query state, position, speed and time of the last ramp\n");
+  out_str(&o,"PHSETPOINT_NS:ABORT           : stop a running ramp where it is\n");
+  out_str(&o,"BUNCHMARKER_PRESCALER <value> : set prescaler for bunchmarker\n");
+  out_str(&o,"BUNCHMARKER_PRESCALER?        : query the value of the bunchmarker prescaler\n");
+  out_str(&o,"CHOPPER_PRESCALER <value>     : set prescaler for chopper photodiode\n");
+  out_str(&o,"CHOPPER_PRESCALER?            : query the value of the chopper photodiode prescaler\n");
+  out_str(&o,"TRIGOUT_PH <value>            : set phase for TRIGOUT signal; range [1 to BUNCHMARKER_PRESCALE]\n");
+  out_str(&o,"TRIGOUT_PH?                   : query the value of the TRIGOUT signal phase\n");
+  out_str(&o,"CONFIGURE <param> <value> ... : set any of SYNCHRONIZER, BUNCHMARKER_PRESCALER, CHOPPER_PRESCALER,\n");
+  out_str(&o,"                                TRIGOUT_PH, GAIN, UNW_THR, UNWRAP, UNW_RES, PHSETPOINT_NS at once;\n");
+  out_str(&o,"                                all are checked first (out of range is refused, not clamped), then\n");
+  out_str(&o,"                                written in one burst in a safe order and read back; ERR changes nothing\n");
+  out_str(&o,"CONFIGURE?                    : query all of them, in the syntax CONFIGURE takes\n");
+  out_str(&o,"CONFIGURE:UNDO                : restore what the last CONFIGURE changed; again to redo\n");
+  out_str(&o,"CONFIGURE:PROFILE <name>      : apply " PROFILE_DIR "/<name>" PROFILE_EXT " as one CONFIGURE\n");
+  out_str(&o,"CONFIGURE:PROFILE?            : multi-line list of the profiles\n");
+  out_str(&o,"UNWRAPper {ON|OFF}            : [advanced - be careful] turn unwrapper on or off\n");
+  out_str(&o,"UNWRAPper?                    : query unwrapper state; answer is either ON or OFF\n");
+  out_str(&o,"UNW_RES {ON|OFF}              : [advanced - be careful] turn unwrapper reset option on or off\n");
+  out_str(&o,"UNW_RES?                      : query unwrapper reset option; answer is either ON or OFF\n");
+  out_str(&o,"UNW_THR <value>               : [advanced - be careful] set threshold for unwrapper reset\n");
+  out_str(&o,"UNW_THR?                      : query the threshold for unwrapper reset\n");
+  out_str(&o,"SIGGEN_DF_HZ <value>          : [advanced - be careful] delta frequency for diagnostic bunch marker generator\n");
+  out_str(&o,"                                Frequency will be 3'123'437.5 + <value> Hz; <value> can be negative\n");
+  out_str(&o,"SIGGEN_DF_HZ?                 : query the diagnostic bunch marker generator delta frequency\n");
+  out_str(&o,"FLOCK?                        : query frequency lock; answer is either ON or OFF; read only\n");
+  out_str(&o,"PHLOCK?                       : query phase lock; answer is either ON or OFF; read only\n");
+  out_str(&o,"PHERR?                        : query current phase error in ns; read only\n");
+  out_str(&o,"MECOS_CMD?                    : query current inc/dec speed command from chopsync to MECOS; read only\n");
+  out_str(&o,"                                answer is number of commanded speed steps; a positive number means accelerate\n");
+  out_str(&o,"BUNCHFREQ?                    : query current bunch marker frequency in Hz; read only\n");
+  out_str(&o,"CHOPFREQ?                     : query current chopper photodiode frequency in Hz; read only\n");
+  out_str(&o,"STICKYLOL OFF                 : reset sticky loss-of-lock alarm; it can be set by hardware only\n");
+  out_str(&o,"STICKYLOL?                    : query sticky loss-of-lock alarm; answer is either ON or OFF\n");
+  out_str(&o,"Gain <value>                  : [advanced - be careful] set loop gain (conservative=4; high performance=default=6)\n");
+  out_str(&o,"Gain?                         : query loop gain\n");
+  out_str(&o,"AUTOTUNE [<step>] [APPLY]     : [advanced - be careful] try gains 2..8 with phase setpoint steps of <step>\n");
+  out_str(&o,"                                (default 40 ns) and measure noise, overshoot, settling and RMS error;\n");
+  out_str(&o,"                                recommends the gain and UNW_THR, writes them with APPLY; OFF stops it\n");
+  out_str(&o,"AUTOTUNE?                     : query auto-tuning progress, then the recommendation\n");
+  out_str(&o,"AUTOTUNE:RESULTS?             : multi-line, one line per gain of the last run\n");
+  out_str(&o,"AUTOTUNE:APPLY                : write the recommended gain and UNW_THR\n");
+  out_str(&o,"MECOS:HZ_SETPoint <value>     : command <value> Hz as chopper rotation frequency to MECOS AMB; must be <= 1000 Hz\n");
+  out_str(&o,"MECOS:HZ_SETPoint?            : read current commanded rotation frequency of MECOS AMB (Hz)\n");
+  out_str(&o,"MECOS:HZ_ACTual?              : read actual rotation frequency of MECOS AMB (Hz)\n");
+  out_str(&o,"MECOS:LIFTUP {ON|OFF}         : lift up or down chopper active magnetic bearing (AMB);\n");
+  out_str(&o,"                                CAUTION! NEVER lift down if the chopper is ROTATING!\n");
+  out_str(&o,"MECOS:LIFTUP?                 : query chopper active magnetic bearing (AMB) lift state;\n");
+  out_str(&o,"                                returns ON (=lifted up) or OFF (=lifted down)\n");
+  out_str(&o,"MECOS:ROTation {ON|OFF}       : starts/stops chopper rotation\n");
+  out_str(&o,"MECOS:ROTation?               : query chopper rotation state\n");
+  out_str(&o,"MECOS:FAULT?                  : returns ON in case of any faults in MECOS AMB; OFF for no faults \n");
+  out_str(&o,"MECOS:STABLE?                 : returns ON if MECOS AMB rotation is stable and external control\n");
+  out_str(&o,"                                by the chopper synchronizer is possible; OFF means that AMB speed is not stable yet,\n");
+  out_str(&o,"                                so it is not possible to engage the chopper synchronizer\n");
+  out_str(&o,"MECOS:SCAN <addr>[-<addr>] [<sub>[-<sub>]]\n");
+  out_str(&o,"                              : read a range of MECOS registers in the background, up to 16 at a\n");
+  out_str(&o,"                                time (e.g. MECOS:SCAN 0x2000-0x20FF 0-3); OFF stops the scan\n");
+  out_str(&o,"MECOS:SCAN?                   : query scan state (IDLE, RUNNING, DONE, STOPPED) and progress\n");
+  out_str(&o,"MECOS:SCAN:DATA? [<first> [<n>]]\n");
+  out_str(&o,"                              : multi-line registers that answered, from the first-th, at most 32:\n");
+  out_str(&o,"                                address.subindex, value in hex and decimal\n");
+  out_str(&o,"MECOS:SCAN:SAVE <name>        : write the registers that answered to " MSCAN_DIR "/<name>" MSCAN_EXT "\n");
+  out_str(&o,"DEVices?                      : list devices: register bank, CAN interface+node id offset, CAN state\n");
+  out_str(&o,"TELEMETRY?                    : query UDP multicast telemetry state: group, rate, sequence number, counters\n");
+  out_str(&o,"TELEMETRY:RATE <value>        : set telemetry publishing rate in Hz; 0 stops publishing\n");
+  out_str(&o,"TELEMETRY:RATE?               : query telemetry publishing rate in Hz\n");
+  out_str(&o,"HTTP?                         : query HTTP/WebSocket gateway state and counters\n");
+  out_str(&o,"HTTP:RATE <value>             : set WebSocket state push rate in Hz; 0 stops pushing\n");
+  out_str(&o,"HTTP:RATE?                    : query WebSocket state push rate in Hz\n");
+  out_str(&o,"CAN:TXQ?                      : query CAN transmit scheduler: bus budget and, per priority class\n");
+  out_str(&o,"                                (SAFETY, SETPOINT, INTERACTIVE, BACKGROUND), queue depth and counters\n");
+  out_str(&o,"CAN:STATS?                    : multi-line CAN bus health: controller state, error counters, bus load,\n");
+  out_str(&o,"                                and per MECOS object read retries, attempt timeout (rto) and\n");
+  out_str(&o,"                                round trip times (min/avg/p50/p99/max us,\n");
+  out_str(&o,"                                log2 histogram from 128 us up) and timeouts\n");
+  out_str(&o,"CAN:LINK?                     : query CAN link state (UP, BUS-OFF, DOWN, GONE) and for how long, last\n");
+  out_str(&o,"                                cause, downs, reopens, failed reopens; while not UP MECOS commands\n");
+  out_str(&o,"                                answer ERR: CAN LINK DOWN and the link is reopened automatically\n");
+  out_str(&o,"REALTIME?                     : multi-line real-time sampler state: scheduling, CPUs, memory lock,\n");
+  out_str(&o,"                                wakeup latency (min/avg/p99/p99.9/max us), overruns, samples per device\n");
+  out_str(&o,"REALTIME:RESET                : clear the sampler latency statistics\n");
+  out_str(&o,"SUPERVISOR {ON|OFF}           : automatic loss-of-lock recovery (needs REALTIME); ON also rearms it\n");
+  out_str(&o,"                                after it gave up\n");
+  out_str(&o,"SUPERVISOR?                   : query supervisor state and counters\n");
+  out_str(&o,"SUPERVISOR:LOG?               : multi-line log of the last recovery attempts\n");
+  out_str(&o,"PHERR:SPECTRUM? [f1-f2 ...]   : multi-line phase error spectrum from the sampler (needs REALTIME):\n");
+  out_str(&o,"                                RMS jitter in total and over the given bands in Hz (default decades),\n");
+  out_str(&o,"                                strongest spurs, PSD in ns2/Hz averaged over 1/8 decade bins\n");
+  out_str(&o,"CAPTURE?                      : query capture state (ARMED, RECORDING, OFF), trigger, window, captures\n");
+  out_str(&o,"CAPTURE:TRIGGER <source> ...  : freeze the sampler signals around an event (needs REALTIME); sources:\n");
+  out_str(&o,"                                FLOCK [FALL|RISE|ANY], PHLOCK [FALL|RISE|ANY], PHERR <ns> (|PHERR|\n");
+  out_str(&o,"                                over <ns>), MECOS_FAULT; OFF for none; default PHLOCK FALL\n");
+  out_str(&o,"CAPTURE:TRIGGER?              : query the trigger sources\n");
+  out_str(&o,"CAPTURE:WINDOW <pre> <post>   : samples kept before and from the trigger; default 1024 1024\n");
+  out_str(&o,"CAPTURE:WINDOW?               : query the window\n");
+  out_str(&o,"CAPTURE:FORCE                 : trigger a capture now\n");
+  out_str(&o,"CAPTURE:LIST?                 : multi-line list of the captures: id, time, cause, status register,\n");
+  out_str(&o,"                                samples before/after the trigger, sample rate, state\n");
+  out_str(&o,"CAPTURE:DATA? <id> [<first> [<n>]]\n");
+  out_str(&o,"                              : multi-line samples first.. of a capture, at most 24: sample from the\n");
+  out_str(&o,"                                trigger, time from the trigger in us, FLOCK, PHLOCK, PHERR ns,\n");
+  out_str(&o,"                                MECOS_CMD, BUNCHFREQ Hz, CHOPFREQ Hz\n");
+  out_str(&o,"SCHED?                        : multi-line client connections (CLIENTS in the config file), rate\n");
+  out_str(&o,"                                limits (LIMIT) and per-client commands served, OVERLOAD answers,\n");
+  out_str(&o,"                                bytes queued, credit\n");
+  out_str(&o,"JOURNAL? [<n> [<first>]]      : multi-line last n (at most 12) register and MECOS writes, or n from\n");
+  out_str(&o,"                                sequence number first on: time, device, register, old -> new value,\n");
+  out_str(&o,"                                who (client address, UNIX uid/pid, fd, or sampler part), latency\n");
+  out_str(&o,"AXIPROBE [<reg>[-<reg>]] [<rounds>] [WRITE]\n");
+  out_str(&o,"                              : time the register accesses in ns, to the timer tick (default 0-12,\n");
+  out_str(&o,"                                100000 rounds); WRITE also writes back the registers 2, 3, 11, 12;\n");
+  out_str(&o,"                                then bursts of the block and of the sampled registers; OFF stops it\n");
+  out_str(&o,"AXIPROBE?                     : query probe state and progress, then read and write latency, and the\n");
+  out_str(&o,"                                sample rate the bursts allow\n");
+  out_str(&o,"AXIPROBE:DATA? [<first>]      : multi-line at most 16 per register READ and WRITE latency (n, min,\n");
+  out_str(&o,"                                p50, p99, max, mean ns, outliers), BLOCK and SAMPLER bursts, and the\n");
+  out_str(&o,"                                slowest accesses with their time\n");
+
+  // framed like every other multi-line answer, one piece
+  nlines=0;
+  for(s=body; (s=strchr(s,'\n'))!=NULL; s++)
+    nlines++;
+  snprintf(help, sizeof(help), "%s: %d lines\n%s", OKS, nlines, body);
+  sendback(filedes, help);
+  }
+
+
+//-------------------------------------------------------------------
+
+void dispatch(const char *buf, char *ans, size_t maxlen, int filedes)
+  {
+  struct toker tk;
+  struct span  p;
+  int rw;
+
+  // is this a READ or WRITE operation? a '?' ends the command header;
+  // the arguments follow, and buf is never modified
+  tok_init(&tk, buf);
+  rw=tok_command(&tk, &p)? READ : WRITE;
+
+  // serve the right command
+  if(p.len==0)
+    snprintf(ans, maxlen, "%s: no such command\n", ERRS);
+  else if(rw==WRITE && !local_may_write(filedes) && !span_eq(p,"HELP"))
+    snprintf(ans, maxlen, "%s: write commands not allowed for this client\n", ERRS);
+  else if(span_eq(p,"REG") || span_eq(p,"REGISTER"))
+    parseREG(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"*IDN"))
+    parseIDN(ans, maxlen);
+  else if(span_eq(p,"*STB"))
+    parseSTB(ans, maxlen);
+  else if(span_eq(p,"SYNCH") || span_eq(p,"SYNCHRONIZER"))
+    parseSYNCHRONIZER(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"*RST"))
+    parseRST(ans, maxlen);
+  else if(span_eq(p,"DEV") || span_eq(p,"DEVICES"))
+    parseDEVICES(ans, maxlen, rw);
+  else if(span_eq(p,"TELEMETRY"))
+    parseTELEMETRY(ans, maxlen, rw);
+  else if(span_eq(p,"CAN:TXQ"))
+    parseCAN_TXQ(ans, maxlen, rw);
+  else if(span_eq(p,"CAN:STATS"))
+    parseCAN_STATS(ans, maxlen, rw);
+  else if(span_eq(p,"CAN:LINK"))
+    parseCAN_LINK(ans, maxlen, rw);
+  else if(span_eq(p,"REALTIME"))
+    parseREALTIME(ans, maxlen, rw);
+  else if(span_eq(p,"REALTIME:RESET"))
+    parseREALTIME_RESET(ans, maxlen, rw);
+  else if(span_eq(p,"SUPERVISOR"))
+    parseSUPERVISOR(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"SUPERVISOR:LOG"))
+    parseSUPERVISOR_LOG(ans, maxlen, rw);
+  else if(span_eq(p,"PHERR:SPECTRUM"))
+    parsePHERR_SPECTRUM(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"TELEMETRY:RATE"))
+    parseTELEMETRY_RATE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"HTTP"))
+    parseHTTP(ans, maxlen, rw);
+  else if(span_eq(p,"HTTP:RATE"))
+    parseHTTP_RATE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"PHSETPOINT_NS"))
+    parsePHSETP(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"PHSETPOINT_NS:RAMP"))
+    parsePHSETP_RAMP(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"PHSETPOINT_NS:ABORT"))
+    parsePHSETP_ABORT(ans, maxlen, rw);
+  else if(span_eq(p,"CAPTURE"))
+    parseCAPTURE(ans, maxlen, rw);
+  else if(span_eq(p,"CAPTURE:TRIGGER"))
+    parseCAPTURE_TRIGGER(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"CAPTURE:WINDOW"))
+    parseCAPTURE_WINDOW(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"CAPTURE:FORCE"))
+    parseCAPTURE_FORCE(ans, maxlen, rw);
+  else if(span_eq(p,"CAPTURE:LIST"))
+    parseCAPTURE_LIST(ans, maxlen, rw);
+  else if(span_eq(p,"CAPTURE:DATA"))
+    parseCAPTURE_DATA(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"SCHED"))
+    parseSCHED(ans, maxlen, rw);
+  else if(span_eq(p,"JOURNAL"))
+    parseJOURNAL(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"AXIPROBE"))
+    parseAXIPROBE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"AXIPROBE:DATA"))
+    parseAXIPROBE_DATA(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"CONFIGURE"))
+    parseCONFIGURE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"CONFIGURE:UNDO"))
+    parseCONFIGURE_UNDO(ans, maxlen, rw);
+  else if(span_eq(p,"CONFIGURE:PROFILE"))
+    parseCONFIGURE_PROFILE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"BUNCHMARKER_PRESCALER"))
+    parsePRESCALER(ans, maxlen, rw, BUNCHMARKER_PSCALER_REG, &tk);
+  else if(span_eq(p,"CHOPPER_PRESCALER"))
+    parsePRESCALER(ans, maxlen, rw, CHOPPER_PSCALER_REG, &tk);
+  else if(span_eq(p,"TRIGOUT_PH"))
+    parseTRIGOUTPH(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"UNWRAP") || span_eq(p,"UNWRAPPER"))
+    parseUNWRAP(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"UNW_RES"))
+    parseUNWRES(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"UNW_THR"))
+    parseUNWTHR(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"SIGGEN_DF_HZ"))
+    parseSIGGENDFTW(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"G") || span_eq(p,"GAIN"))
+    parseGAIN(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"AUTOTUNE"))
+    parseAUTOTUNE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"AUTOTUNE:RESULTS"))
+    parseAUTOTUNE_RESULTS(ans, maxlen, rw);
+  else if(span_eq(p,"AUTOTUNE:APPLY"))
+    parseAUTOTUNE_APPLY(ans, maxlen, rw);
+  else if(span_eq(p,"FLOCK"))
+    parseLOCK(ans, maxlen, rw, FREQUENCY);
+  else if(span_eq(p,"PHLOCK"))
+    parseLOCK(ans, maxlen, rw, PHASE);
+  else if(span_eq(p,"MECOS_CMD"))
+    parseMECOSCMD(ans, maxlen, rw);
+  else if(span_eq(p,"PHERR"))
+    parsePHERR(ans, maxlen, rw);
+  else if(span_eq(p,"BUNCHFREQ"))
+    parseFREQ(ans, maxlen, rw, BUNCHMARKER_FREQ_REG);
+  else if(span_eq(p,"CHOPFREQ"))
+    parseFREQ(ans, maxlen, rw, CHOPPER_FREQ_REG);
+  else if(span_eq(p,"STICKYLOL"))
+    parseLOL(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:HZ_SETP") || span_eq(p,"MECOS:HZ_SETPOINT"))
+    parseMECOS_HZ_SETP(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:HZ_ACT") || span_eq(p,"MECOS:HZ_ACTUAL"))
+    parseMECOS_HZ_ACT(ans, maxlen, rw);
+  else if(span_eq(p,"MECOS:LIFTUP"))
+    parseMECOS_LIFTUP(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:ROT") || span_eq(p,"MECOS:ROTATION"))
+    parseMECOS_ROTATION(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:FAULT"))
+    parseMECOS_FAULT(ans, maxlen, rw);
+  else if(span_eq(p,"MECOS:SCAN"))
+    parseMECOS_SCAN(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:SCAN:DATA"))
+    parseMECOS_SCAN_DATA(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:SCAN:SAVE"))
+    parseMECOS_SCAN_SAVE(ans, maxlen, rw, &tk);
+  else if(span_eq(p,"MECOS:STABLE"))
+    parseMECOS_STABLE(ans, maxlen, rw);
+  else if(span_eq(p,"HELP"))
+    {
+    printHelp(filedes);
+    *ans=0;
+    }
+  else
+    {
+    snprintf(ans, maxlen, "%s: no such command\n", ERRS);
     }
   }
 
 
 //-------------------------------------------------------------------
 
-void parseMECOS_ROTATION(char *ans, size_t maxlen, int rw)
+void parse(char *buf, char *ans, size_t maxlen, int filedes)
   {
-  char *p;
-  int ret;
-  bool rotating;
-  
-  if(rw==READ)
+  struct span s;
+  char   *p, *q;
+  int64_t n;
+  int     ret;
+
+  trimstring(buf);
+  upstring(buf);
+
+  // optional trailing "DEADLINE <time>": how long the client is willing
+  // to wait for MECOS; ms unless it has a unit
+  curdeadline=0;
+  p=NULL;
+  for(q=strstr(buf," DEADLINE "); q!=NULL; q=strstr(q+1," DEADLINE "))
+    p=q;
+  if(p!=NULL)
     {
-    // read whether MECOS AMB is rotating or not 
-    ret=can_rotation_state_read(&rotating);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %s\n", OKS, rotating?"ON":"OFF");
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading rotating state\n", ERRS);
+    s.p=p+10;
+    s.len=strlen(s.p);
+    ret=num_fix(s, UNIT_TIME, 6, 0, 1000000, (int64_t)CAN_DEADLINE_MAX_MS*1000000, &n);
+    if(ret!=NUM_OK)
+      {
+      snprintf(ans, maxlen, "%s: DEADLINE must be 1..%d ms (%s)\n", ERRS, CAN_DEADLINE_MAX_MS, num_strerror(ret));
+      return;
+      }
+    curdeadline=(long)(n/1000000);
+    *p=0;
     }
-  else
+
+  // optional device prefix; no prefix means device 0
+  if(strncmp(buf,"ALL:",4)==0)
     {
-    // next in line is ON or OFF
-    p=strtok(NULL," ");
-    if(p!=NULL)
+    parseALL(buf+4, ans, maxlen, filedes);
+    return;
+    }
+
+  n=0;
+  if(strncmp(buf,"DEV",3)==0 && isdigit((unsigned char)buf[3]))
+    {
+    p=strchr(buf,':');
+    if(p==NULL)
       {
-      if(strcmp(p,"ON")==0)
-        {
-        ret=can_rotation_state_write(true);
-        if(ret==0)
-          snprintf(ans, maxlen, "%s: MECOS AMB rotation ON\n", OKS);
-        else
-          snprintf(ans, maxlen, "%s: CAN error writing rotation state\n", ERRS);
-        }
-      else if(strcmp(p,"OFF")==0)
-        {
-        ret=can_rotation_state_write(false);
-        if(ret==0)
-          snprintf(ans, maxlen, "%s: MECOS AMB rotation OFF\n", OKS);
-        else
-          snprintf(ans, maxlen, "%s: CAN error writing rotation state\n", ERRS);
-        }
-      else
-        snprintf(ans, maxlen, "%s: use ON/OFF with MECOS:ROTATION command\n", ERRS);
+      snprintf(ans, maxlen, "%s: no such command\n", ERRS);
+      return;
       }
-    else
-      snprintf(ans, maxlen, "%s: missing ON/OFF option\n", ERRS);
+    s.p=buf+3;
+    s.len=(size_t)(p-s.p);
+    ret=num_int(s, 0, INT64_MAX, &n);
+    if(ret==NUM_SYNTAX)
+      {
+      snprintf(ans, maxlen, "%s: no such command\n", ERRS);
+      return;
+      }
+    if(ret!=NUM_OK || n>=ndevs)
+      {
+      snprintf(ans, maxlen, "%s: no such device\n", ERRS);
+      return;
+      }
+    buf=p+1;
     }
+
+  select_device((int)n);
+  dispatch(buf, ans, maxlen, filedes);
+  select_device(0);
   }
 
 
 //-------------------------------------------------------------------
 
-void parseMECOS_FAULT(char *ans, size_t maxlen, int rw)
+struct pending *pend_alloc(int filedes)
   {
-  int ret;
-  unsigned long errcode;
-  
-  if(rw==READ)
-    {
-    // read general fault register from MECOS
-    ret=can_general_fault_read(&errcode);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %s\n", OKS, (errcode!=0UL)?"ON":"OFF");
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading MECOS fault register\n", ERRS);
-    }
-  else
-    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  int i;
+
+  for(i=0; i<MAXPENDING; i++)
+    if(!pendings[i].used)
+      {
+      pendings[i].used=true;
+      pendings[i].fd=filedes;
+      pendings[i].outstanding=0;
+      pendings[i].nparts=1;
+      pendings[i].part[0][0]=0;
+      return &pendings[i];
+      }
+  return NULL;
   }
 
 
 //-------------------------------------------------------------------
 
-void parseMECOS_STABLE(char *ans, size_t maxlen, int rw)
+// the client on filedes is gone: answers still waiting for CAN are
+// formatted as usual, then dropped (the fd may be somebody else's by
+// then)
+
+void pend_orphan(int filedes)
   {
-  int ret;
-  bool enabled;
-  
-  if(rw==READ)
-    {
-    // ask MECOS whether external control is enabled
-    ret=can_ext_ctl_enabled_read(&enabled);
-    if(ret==0)
-      snprintf(ans, maxlen, "%s: %s\n", OKS, enabled?"ON":"OFF");
-    else
-      snprintf(ans, maxlen, "%s: CAN error reading MECOS stable state (=ext control enable)\n", ERRS);
-    }
-  else
-    snprintf(ans, maxlen, "%s: write operation not supported\n", ERRS);
+  int i;
+
+  for(i=0; i<MAXPENDING; i++)
+    if(pendings[i].used && pendings[i].fd==filedes)
+      pendings[i].fd=-1;
   }
 
 
 //-------------------------------------------------------------------
 
-void printHelp(int filedes)
+// context for one deferred answer of the command being dispatched
+
+struct pendpart *pendpart_alloc(ansfn fmt)
   {
-  sendback(filedes,"Chopsync SCPI server commands\n\n");
-  sendback(filedes,"Server support multiple concurrent clients\n");
-  sendback(filedes,"Server is case insensitive\n");
-  sendback(filedes,"Numbers can be decimal or hex, with the 0x prefix\n");
-  sendback(filedes,"Server answers with OK or ERR, a colon and a descriptive message\n");
-  sendback(filedes,"Send CTRL-D to close the connection\n\n");
-  sendback(filedes,"Command list:\n\n");
-  sendback(filedes,"REGister <reg> <value>        : write <value> into register <reg>\n");
-  sendback(filedes,"REGister? <reg>               : read content of register <reg>\n");
-  sendback(filedes,"*IDN?                         : print firmware name and version\n");
-  sendback(filedes,"*STB?                         : combined status word = lower 8 LSBs of reg#1 (<<8) + lower 8 LSBs of reg#0\n");
-  sendback(filedes,"SYNCHronizer {ON|OFF}         : turn synchronizer on or off\n");
-  sendback(filedes,"SYNCHronizer?                 : query synchronizer state; answer is either ON or OFF\n");
-  sendback(filedes,"*RST                          : turn off synchronizer; equivalent to SYNCH OFF\n");
-  sendback(filedes,"PHSETPOINT_NS <value>         : set phase setpoint to <value> ns\n");
-  sendback(filedes,"PHSETPOINT_NS?                : query current phase setpoint, expressed in ns\n");
-  sendback(filedes,"BUNCHMARKER_PRESCALER <value> : set prescaler for bunchmarker\n");
-  sendback(filedes,"BUNCHMARKER_PRESCALER?        : query the value of the bunchmarker prescaler\n");
-  sendback(filedes,"CHOPPER_PRESCALER <value>     : set prescaler for chopper photodiode\n");
-  sendback(filedes,"CHOPPER_PRESCALER?            : query the value of the chopper photodiode prescaler\n");
-  sendback(filedes,"TRIGOUT_PH <value>            : set phase for TRIGOUT signal; range [1 to BUNCHMARKER_PRESCALE]\n");
-  sendback(filedes,"TRIGOUT_PH?                   : query the value of the TRIGOUT signal phase\n");
-  sendback(filedes,"UNWRAPper {ON|OFF}            : [advanced - be careful] turn unwrapper on or off\n");
-  sendback(filedes,"UNWRAPper?                    : query unwrapper state; answer is either ON or OFF\n");
-  sendback(filedes,"UNW_RES {ON|OFF}              : [advanced - be careful] turn unwrapper reset option on or off\n");
-  sendback(filedes,"UNW_RES?                      : query unwrapper reset option; answer is either ON or OFF\n");
-  sendback(filedes,"UNW_THR <value>               : [advanced - be careful] set threshold for unwrapper reset\n");
-  sendback(filedes,"UNW_THR?                      : query the threshold for unwrapper reset\n");
-  sendback(filedes,"SIGGEN_DF_HZ <value>          : [advanced - be careful] delta frequency for diagnostic bunch marker generator\n");
-  sendback(filedes,"                                Frequency will be 3'123'437.5 + <value> Hz; <value> can be negative\n");
-  sendback(filedes,"SIGGEN_DF_HZ?                 : query the diagnostic bunch marker generator delta frequency\n");
-  sendback(filedes,"FLOCK?                        : query frequency lock; answer is either ON or OFF; read only\n");
-  sendback(filedes,"PHLOCK?                       : query phase lock; answer is either ON or OFF; read only\n");
-  sendback(filedes,"PHERR?                        : query current phase error in ns; read only\n");
-  sendback(filedes,"MECOS_CMD?                    : query current inc/dec speed command from chopsync to MECOS; read only\n");
-  sendback(filedes,"                                answer is number of commanded speed steps; a positive number means accelerate\n");
-  sendback(filedes,"BUNCHFREQ?                    : query current bunch marker frequency in Hz; read only\n");
-  sendback(filedes,"CHOPFREQ?                     : query current chopper photodiode frequency in Hz; read only\n");
-  sendback(filedes,"STICKYLOL OFF                 : reset sticky loss-of-lock alarm; it can be set by hardware only\n");
-  sendback(filedes,"STICKYLOL?                    : query sticky loss-of-lock alarm; answer is either ON or OFF\n");
-  sendback(filedes,"Gain <value>                  : [advanced - be careful] set loop gain (conservative=4; high performance=default=6)\n");
-  sendback(filedes,"Gain?                         : query loop gain\n");
-  sendback(filedes,"MECOS:HZ_SETPoint <value>     : command <value> Hz as chopper rotation frequency to MECOS AMB; must be <= 1000 Hz\n");
-  sendback(filedes,"MECOS:HZ_SETPoint?            : read current commanded rotation frequency of MECOS AMB (Hz)\n");
-  sendback(filedes,"MECOS:HZ_ACTual?              : read actual rotation frequency of MECOS AMB (Hz)\n");
-  sendback(filedes,"MECOS:LIFTUP {ON|OFF}         : lift up or down chopper active magnetic bearing (AMB);\n");
-  sendback(filedes,"                                CAUTION! NEVER lift down if the chopper is ROTATING!\n");
-  sendback(filedes,"MECOS:LIFTUP?                 : query chopper active magnetic bearing (AMB) lift state;\n");
-  sendback(filedes,"                                returns ON (=lifted up) or OFF (=lifted down)\n");
-  sendback(filedes,"MECOS:ROTation {ON|OFF}       : starts/stops chopper rotation\n");
-  sendback(filedes,"MECOS:ROTation?               : query chopper rotation state\n");
-  sendback(filedes,"MECOS:FAULT?                  : returns ON in case of any faults in MECOS AMB; OFF for no faults \n");
-  sendback(filedes,"MECOS:STABLE?                 : returns ON if MECOS AMB rotation is stable and external control\n");
-  sendback(filedes,"                                by the chopper synchronizer is possible; OFF means that AMB speed is not stable yet,\n");
-  sendback(filedes,"                                so it is not possible to engage the chopper synchronizer\n");
+  int i;
+
+  for(i=0; i<MAXPENDPARTS; i++)
+    if(!pendparts[i].used)
+      {
+      pendparts[i].used=true;
+      pendparts[i].pend=curpend;
+      pendparts[i].part=curpart;
+      pendparts[i].dev=curdev->id;
+      pendparts[i].fmt=fmt;
+      return &pendparts[i];
+      }
+  return NULL;
   }
 
 
 //-------------------------------------------------------------------
 
-void parse(char *buf, char *ans, size_t maxlen, int filedes)
+// CAN completion callback of a deferred answer
+
+void reply_done(void *ctx, int ret, unsigned long int val)
   {
-  char *p;
-  int rw;
+  struct pendpart *pp = ctx;
+  struct pending  *pend;
+  int olddev;
+
+  pend=pp->pend;
+  olddev=curdev->id;
+  select_device(pp->dev);
+  mecos_answer(pp->fmt, pend->part[pp->part], MAXANS, ret, val);
+  select_device(olddev);
+  pp->used=false;
+
+  if(--pend->outstanding==0)
+    reply_finish(pend);
+  }
 
-  trimstring(buf);
-  upstring(buf);
 
-  // is this a READ or WRITE operation?
-  // note: cannot use strtok because it modifies the input string
-  p=strchr(buf,'?');
-  if(p!=NULL)
-    {
-    rw=READ;
-    p=strtok(buf,"?");
-    }
-  else
-    {
-    rw=WRITE;
-    p=strtok(buf," ");
-    }
+//-------------------------------------------------------------------
 
-  // serve the right command
-  if( (strcmp(p,"REG")==0) || (strcmp(p,"REGISTER")==0))
-    parseREG(ans, maxlen, rw);
-  else if(strcmp(p,"*IDN")==0)
-    parseIDN(ans, maxlen);
-  else if(strcmp(p,"*STB")==0)
-    parseSTB(ans, maxlen);
-  else if( (strcmp(p,"SYNCH")==0) || (strcmp(p,"SYNCHRONIZER")==0))
-    parseSYNCHRONIZER(ans, maxlen, rw);
-  else if(strcmp(p,"*RST")==0)
-    parseRST(ans, maxlen);
-  else if(strcmp(p,"PHSETPOINT_NS")==0)
-    parsePHSETP(ans, maxlen, rw);
-  else if(strcmp(p,"BUNCHMARKER_PRESCALER")==0)
-    parsePRESCALER(ans, maxlen, rw, BUNCHMARKER_PSCALER_REG);
-  else if(strcmp(p,"CHOPPER_PRESCALER")==0)
-    parsePRESCALER(ans, maxlen, rw, CHOPPER_PSCALER_REG);
-  else if(strcmp(p,"TRIGOUT_PH")==0)
-    parseTRIGOUTPH(ans, maxlen, rw);
-  else if( (strcmp(p,"UNWRAP")==0) || (strcmp(p,"UNWRAPPER")==0))
-    parseUNWRAP(ans, maxlen, rw);
-  else if(strcmp(p,"UNW_RES")==0)
-    parseUNWRES(ans, maxlen, rw);
-  else if(strcmp(p,"UNW_THR")==0)
-    parseUNWTHR(ans, maxlen, rw);
-  else if(strcmp(p,"SIGGEN_DF_HZ")==0)
-    parseSIGGENDFTW(ans, maxlen, rw);
-  else if( (strcmp(p,"G")==0) || (strcmp(p,"GAIN")==0))
-    parseGAIN(ans, maxlen, rw);
-  else if(strcmp(p,"FLOCK")==0)
-    parseLOCK(ans, maxlen, rw, FREQUENCY);
-  else if(strcmp(p,"PHLOCK")==0)
-    parseLOCK(ans, maxlen, rw, PHASE);
-  else if(strcmp(p,"MECOS_CMD")==0)
-    parseMECOSCMD(ans, maxlen, rw);
-  else if(strcmp(p,"PHERR")==0)
-    parsePHERR(ans, maxlen, rw);
-  else if(strcmp(p,"BUNCHFREQ")==0)
-    parseFREQ(ans, maxlen, rw, BUNCHMARKER_FREQ_REG);
-  else if(strcmp(p,"CHOPFREQ")==0)
-    parseFREQ(ans, maxlen, rw, CHOPPER_FREQ_REG);
-  else if(strcmp(p,"STICKYLOL")==0)
-    parseLOL(ans, maxlen, rw);
-  else if( (strcmp(p,"MECOS:HZ_SETP")==0) || (strcmp(p,"MECOS:HZ_SETPOINT")==0))
-    parseMECOS_HZ_SETP(ans, maxlen, rw);
-  else if( (strcmp(p,"MECOS:HZ_ACT")==0) || (strcmp(p,"MECOS:HZ_ACTUAL")==0))
-    parseMECOS_HZ_ACT(ans, maxlen, rw);
-  else if(strcmp(p,"MECOS:LIFTUP")==0)
-    parseMECOS_LIFTUP(ans, maxlen, rw);
-  else if( (strcmp(p,"MECOS:ROT")==0) || (strcmp(p,"MECOS:ROTATION")==0))
-    parseMECOS_ROTATION(ans, maxlen, rw);
-  else if(strcmp(p,"MECOS:FAULT")==0)
-    parseMECOS_FAULT(ans, maxlen, rw);
-  else if(strcmp(p,"MECOS:STABLE")==0)
-    parseMECOS_STABLE(ans, maxlen, rw);
-  else if(strcmp(p,"HELP")==0)
+// number of lines after the header of a multi-line answer;
+// 0 for a single line answer
+
+int ans_lines(const char *ans)
+  {
+  int  n;
+  char c;
+
+  if(sscanf(ans, OKS ": %d lines%c", &n, &c)==2 && c=='\n' && n>0)
+    return n;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// all answers are in: send the reply and listen to the client again
+// ALL: answers are joined on one line, unless some device answered on
+// several lines: then the reply is multi-line and every line is tagged
+// with its device
+
+void reply_finish(struct pending *pend)
+  {
+  char   ans[MAXDEV*(MAXANS+64)];
+  char  *p, *e;
+  size_t len, n;
+  int    i, total;
+  bool   multi;
+
+  // the client went away meanwhile
+  if(pend->fd<0)
     {
-    printHelp(filedes);
-    *ans=0;
+    pend->used=false;
+    return;
     }
+
+  if(pend->nparts==1)
+    sendback(pend->fd, pend->part[0]);
   else
     {
-    snprintf(ans, maxlen, "%s: no such command\n", ERRS);
+    total=0;
+    multi=false;
+    for(i=0; i<pend->nparts; i++)
+      {
+      n=ans_lines(pend->part[i]);
+      multi|=(n>0);
+      total+=(n>0)? n : 1;
+      }
+
+    len=0;
+    if(!multi)
+      {
+      for(i=0; i<pend->nparts; i++)
+        {
+        n=strlen(pend->part[i]);
+        if(n>0 && pend->part[i][n-1]=='\n')
+          pend->part[i][--n]=0;
+        len+=snprintf(ans+len, sizeof(ans)-len, "%sDEV%d %s", (i>0)?"; ":"", i, pend->part[i]);
+        }
+      snprintf(ans+len, sizeof(ans)-len, "\n");
+      }
+    else
+      {
+      len=snprintf(ans, sizeof(ans), "%s: %d lines\n", OKS, total);
+      for(i=0; i<pend->nparts; i++)
+        {
+        p=pend->part[i];
+        if(ans_lines(p)>0)
+          p=strchr(p,'\n')+1;
+        while(*p!=0 && len<sizeof(ans))
+          {
+          e=strchr(p,'\n');
+          n=(e!=NULL)? (size_t)(e-p) : strlen(p);
+          len+=snprintf(ans+len, sizeof(ans)-len, "DEV%d %.*s\n", i, (int)n, p);
+          p+=n+((e!=NULL)? 1 : 0);
+          }
+        }
+      }
+    sendback(pend->fd, ans);
     }
+
+  FD_SET(pend->fd, &active_fd_set);
+  pend->used=false;
   }
 
 
@@ -1074,6 +3295,24 @@ void parse(char *buf, char *ans, size_t maxlen, int filedes)
 
 void sendback(int filedes, char *s)
   {
+  struct httpconn *c;
+  struct conn     *cn;
+
+  // WebSocket clients get every answer as one text frame
+  c=http_conn_by_fd(filedes);
+  if(c!=NULL && c->ws)
+    {
+    if(http_ws_send(c, WS_TEXT, s, strlen(s))!=0)
+      perror("WebSocket answer");
+    return;
+    }
+  // stream clients: held back until the end of the loop pass
+  cn=conn_by_fd(filedes);
+  if(cn!=NULL)
+    {
+    conn_send(cn, s, strlen(s));
+    return;
+    }
   (void)write(filedes, s, strlen(s));
   }
 
@@ -1082,16 +3321,30 @@ void sendback(int filedes, char *s)
 
 int read_from_client(int filedes)
   {
-  char buffer[MAXMSG+1];    // "+1" to add zero-terminator
-  char answer[MAXMSG+1];
+  struct linebuf *lb;
+  struct conn    *c;
   int  nbytes;
-  
-  nbytes = read(filedes, buffer, MAXMSG);
+
+  c=conn_by_fd(filedes);
+  if(c==NULL)
+    return -1;
+  // a command is queued already: the scheduler runs it first, more
+  // input waits in the socket
+  lb=c->in;
+  if(memchr(lb->buf, '\n', lb->len)!=NULL)
+    return 0;
+
+  // one byte is kept for the '\n' of a command without one
+  do
+    nbytes = read(filedes, lb->buf+lb->len, SCPI_MAXLINE-1-lb->len);
+  while(nbytes < 0 && errno==EINTR);
   if(nbytes < 0)
     {
-    // read error
+    // nothing there after all; anything else ends this client only
+    if(errno==EAGAIN || errno==EWOULDBLOCK)
+      return 0;
     perror("read");
-    exit(EXIT_FAILURE);
+    return -1;
     }
   else if(nbytes == 0)
     {
@@ -1101,10 +3354,22 @@ int read_from_client(int filedes)
   else
     {
     // data read
-    buffer[nbytes]=0;    // add string zero terminator
-    //fprintf(stderr, "Incoming msg: '%s'\n", buffer);
-    parse(buffer, answer, MAXMSG, filedes);
-    sendback(filedes, answer);
+    if(memchr(lb->buf+lb->len, '\n', nbytes)!=NULL)
+      lb->lines=true;
+    lb->len+=nbytes;
+    lb->buf[lb->len]=0;    // add string zero terminator
+    //fprintf(stderr, "Incoming msg: '%s'\n", lb->buf);
+    if(!lb->lines)
+      {
+      // one read, one command: queued as a line
+      lb->buf[lb->len++]='\n';
+      lb->buf[lb->len]=0;
+      }
+    else if(memchr(lb->buf, '\n', lb->len)==NULL && lb->len==SCPI_MAXLINE-1)
+      {
+      lb->len=0;
+      sendback(filedes, ERRS ": command too long\n");
+      }
     return 0;
     }
   }
@@ -1112,50 +3377,141 @@ int read_from_client(int filedes)
 
 //-------------------------------------------------------------------
 
+// one command from a client, whatever it came through; the answer
+// goes back now or once CAN has answered
+
+void run_command(int filedes, char *buffer)
+  {
+  struct pending *pend;
+
+  // over its limits: say so now rather than queue
+  if(!sched_admit(filedes, buffer))
+    {
+    sendback(filedes, ERRS ": OVERLOAD\n");
+    return;
+    }
+
+  curpend=pend_alloc(filedes);
+  if(curpend==NULL)
+    {
+    sendback(filedes, ERRS ": server busy\n");
+    return;
+    }
+  curpart=0;
+  journal_begin(filedes);
+  parse(buffer, curpend->part[0], MAXANS, filedes);
+  journal_end();
+  pend=curpend;
+  curpend=NULL;
+
+  // stop listening to this client until its answer is complete,
+  // so that answers keep the order of the commands
+  FD_CLR(filedes, &active_fd_set);
+  if(pend->outstanding==0)
+    reply_finish(pend);
+  }
+
+
+//-------------------------------------------------------------------
+
+// SERVER_NO_MAIN leaves main() out, to link the command handlers into
+// another program (bench/)
+#ifndef SERVER_NO_MAIN
+
 //int main(int argc, char *const argv[])
 int main(void)
   {
-  int sock, maxfd, opt = 1, i, nready;
-  fd_set active_fd_set, read_fd_set;
+  int sock, maxfd, opt = 1, i, k, nready;
+  fd_set read_fd_set;
+  struct timeval tv, *tvp;
+  bool more;
+  struct chopdev *d;
+  struct can_link *l;
+  struct httpconn *hc;
+  struct conn *cn;
   struct sockaddr_in clientname;
   size_t size;
   struct sockaddr_in name;
 
-  // map register bank into user space
-  if(memorymap()!=0)
+  if(read_config(CONFIG_FNAME)<0)
     {
-    fprintf(stderr,"Can't map Register Bank - aborted\n");
+    fprintf(stderr,"Errors in %s - aborted\n", CONFIG_FNAME);
     return -1;
     }
 
-  fprintf(stderr,"Starting server\n");
+  // state and buffers of the clients, for the whole run
+  if(conn_pool_open(cfg.maxclients)<0)
+    {
+    fprintf(stderr,"Can't map the connection pool - aborted\n");
+    return -1;
+    }
 
-  sock = socket(PF_INET, SOCK_STREAM, 0);
-  if(sock < 0)
+  // hot upgrade: before any thread, so all of them block SIGUSR2; when
+  // we are the new binary, everything the old server hands over
+  if(upgrade_open()<0)
     {
-    perror("socket");
-    exit(EXIT_FAILURE);
+    fprintf(stderr,"Can't take over from the running server - aborted\n");
+    return -1;
     }
 
-  if( setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(int)) )
+  // from here on every register write is journaled; not having the
+  // file is no reason to stop
+  journal_open();
+
+  // map register banks into user space and open CAN interfaces
+  if(init_devices()!=0)
     {
-    perror("setsockopt()");
-    exit(EXIT_FAILURE);
+    fprintf(stderr,"Can't map Register Bank - aborted\n");
+    return -1;
     }
 
-  name.sin_family = AF_INET;
-  name.sin_port = htons(PORT);
-  name.sin_addr.s_addr = htonl(INADDR_ANY);
-  if( bind( sock, (struct sockaddr *) &name, sizeof(name)) < 0)
+  // the old server stops its sampler before we start ours
+  upgrade_commit();
+
+  // optional real-time sampling thread; from here on the main
+  // thread keeps off its CPU
+  capture_open();
+  if(sampler_start()<0)
     {
-    perror("bind");
-    exit(EXIT_FAILURE);
+    fprintf(stderr,"Can't start real-time sampler - aborted\n");
+    return -1;
     }
 
-  if(listen(sock, 1) < 0)
+  supervisor_open();
+
+  fprintf(stderr,"Starting server\n");
+
+  // from the server we replace, or from systemd
+  sock = upgrade_take(UPG_TCP_LISTEN, NULL, -1);
+  if(sock < 0)
     {
-    perror("listen");
-    exit(EXIT_FAILURE);
+    sock = socket(PF_INET, SOCK_STREAM, 0);
+    if(sock < 0)
+      {
+      perror("socket");
+      exit(EXIT_FAILURE);
+      }
+
+    if( setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(int)) )
+      {
+      perror("setsockopt()");
+      exit(EXIT_FAILURE);
+      }
+
+    name.sin_family = AF_INET;
+    name.sin_port = htons(cfg.port);
+    name.sin_addr.s_addr = htonl(INADDR_ANY);
+    if( bind( sock, (struct sockaddr *) &name, sizeof(name)) < 0)
+      {
+      perror("bind");
+      exit(EXIT_FAILURE);
+      }
+
+    if(listen(sock, 1) < 0)
+      {
+      perror("listen");
+      exit(EXIT_FAILURE);
+      }
     }
   
   // initialize the set of active sockets; 
@@ -1165,19 +3521,121 @@ int main(void)
 
   maxfd = sock;
 
-  // open CAN interface to talk to MECOS
-  // register success into global "can_present"
-  // if it fails, we proceed anyway, without CAN support
-  can_present=open_can();
-  if(can_present!=0)
-    perror("CAN unavailable; continuing anyway");
+  // local clients on AF_UNIX sockets
+  local_open();
+  for(i=0; i<MAXUNIX; i++)
+    if(local_ls[i].sock>=0)
+      {
+      FD_SET(local_ls[i].sock, &active_fd_set);
+      if(local_ls[i].sock>maxfd)
+        maxfd=local_ls[i].sock;
+      }
+
+  // optional multicast telemetry, paced by a timer fd in the same select
+  if(telemetry_open()==0 && telem.timerfd>=0)
+    {
+    FD_SET(telem.timerfd, &active_fd_set);
+    if(telem.timerfd>maxfd)
+      maxfd=telem.timerfd;
+    }
+
+  // MECOS answers are collected by the same loop
+  for(i=0; i<ndevs; i++)
+    if(devs[i].can.present)
+      {
+      FD_SET(devs[i].can.sock, &active_fd_set);
+      if(devs[i].can.sock>maxfd)
+        maxfd=devs[i].can.sock;
+      }
+
+  // CAN link events, for links to be lost and found
+  if(canlink_open()>=0)
+    {
+    FD_SET(canlink_nlsock, &active_fd_set);
+    if(canlink_nlsock>maxfd)
+      maxfd=canlink_nlsock;
+    }
+
+  // CAN bus health monitors, one per interface
+  for(i=0; i<CAN_MAXLINKS; i++)
+    if(can_links[i].users>0 && can_links[i].mon.sock>=0)
+      {
+      FD_SET(can_links[i].mon.sock, &active_fd_set);
+      if(can_links[i].mon.sock>maxfd)
+        maxfd=can_links[i].mon.sock;
+      }
+
+  // dashboards over HTTP/WebSocket
+  if(http_open()==0)
+    {
+    FD_SET(http.sock, &active_fd_set);
+    FD_SET(http.timerfd, &active_fd_set);
+    if(http.sock>maxfd)
+      maxfd=http.sock;
+    if(http.timerfd>maxfd)
+      maxfd=http.timerfd;
+    }
+
+  // recovery attempts logged by the supervisor
+  if(sv_eventfd>=0)
+    {
+    FD_SET(sv_eventfd, &active_fd_set);
+    if(sv_eventfd>maxfd)
+      maxfd=sv_eventfd;
+    }
+
+  if(mecos_poll_open()==0)
+    {
+    FD_SET(mecos_poll_fd, &active_fd_set);
+    if(mecos_poll_fd>maxfd)
+      maxfd=mecos_poll_fd;
+    }
+
+  // kill -USR2 hands everything over to a new binary
+  if(upg.sigfd>=0)
+    {
+    FD_SET(upg.sigfd, &active_fd_set);
+    if(upg.sigfd>maxfd)
+      maxfd=upg.sigfd;
+    }
+
+  // clients of the server we replace
+  upgrade_finish(&maxfd);
+
+  // a client closing before its deferred answer is sent must not kill us
+  signal(SIGPIPE, SIG_IGN);
+  upgrade_notify("READY=1");
 
   while(1)
     {
+    // queued commands first, a fair share per client, and WebSocket
+    // frames that waited for an answer from CAN; not while handing
+    // over, they go along
+    more=false;
+    if(!upg.requested)
+      {
+      more=sched_round();
+      http_drain_all();
+      }
+    // everything answered so far goes out before we may block
+    conn_flush_all();
+
     // block until input arrives on one or more active sockets
     //fprintf(stderr,"Listening\n");
     read_fd_set = active_fd_set;
-    nready=select(maxfd+1, &read_fd_set, NULL, NULL, NULL);
+    // wake up in time to expire CAN requests nobody answers
+    tvp=(can_next_timeout(&tv)==0)? &tv : NULL;
+    // commands left for the next round: only poll for new input
+    if(more)
+      {
+      tv.tv_sec=0;
+      tv.tv_usec=0;
+      tvp=&tv;
+      }
+    // waiting to hand over: clients wait in the kernel for the new server
+    if(upg.requested)
+      tvp=upgrade_quiesce(&read_fd_set, sock, &tv, tvp);
+    nready=select(maxfd+1, &read_fd_set, NULL, NULL, tvp);
     if(nready<0)
       {
       perror("select");
@@ -1207,12 +3665,86 @@ int main(void)
                  "Server: new connection from host %s, port %hd\n",
                  inet_ntoa(clientname.sin_addr),
                  ntohs(clientname.sin_port));
-          FD_SET(newfd, &active_fd_set);
-          if(newfd>maxfd)
+          // answers to pipelined commands must not wait for the ACK of
+          // the previous one
+          if(conn_open(newfd)!=NULL)
             {
-            maxfd=newfd;
+            if(setsockopt(newfd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(int)))
+              perror("setsockopt(TCP_NODELAY)");
+            FD_SET(newfd, &active_fd_set);
+            if(newfd>maxfd)
+              {
+              maxfd=newfd;
+              }
             }
           }    // if new connection
+          else if((k=local_listener_by_fd(i))>=0)
+          {
+          // new local client
+          int newfd;
+          newfd=local_accept(k);
+          if(newfd>=0)
+            {
+            FD_SET(newfd, &active_fd_set);
+            if(newfd>maxfd)
+              maxfd=newfd;
+            }
+          }
+          else if(i == http.sock)
+          {
+          // new HTTP client
+          int newfd;
+          newfd=http_accept();
+          if(newfd>=0)
+            {
+            FD_SET(newfd, &active_fd_set);
+            if(newfd>maxfd)
+              maxfd=newfd;
+            }
+          }
+          else if(i == http.timerfd)
+          {
+          // time to push the state to WebSocket clients
+          http_tick();
+          }
+          else if((hc=http_conn_by_fd(i))!=NULL)
+          {
+          http_receive(hc);
+          }
+          else if(i == telem.timerfd)
+          {
+          // time to publish a telemetry datagram
+          telemetry_tick();
+          }
+          else if(i == sv_eventfd)
+          {
+          supervisor_report();
+          }
+          else if(i == upg.sigfd)
+          {
+          upgrade_signal();
+          }
+          else if(i == mecos_poll_fd)
+          {
+          // refresh the MECOS cache in the background
+          mecos_poll_tick();
+          }
+          else if((d=device_by_canfd(i))!=NULL)
+          {
+          // answers from MECOS
+          can_receive(&d->can);
+          }
+          else if((l=can_link_by_monfd(i))!=NULL)
+          {
+          // bus traffic and error frames
+          canmon_receive(&l->mon);
+          canlink_check(l);
+          }
+          else if(i == canlink_nlsock)
+          {
+          // CAN interfaces removed, down or back
+          canlink_event();
+          }
           else
           {
           // data arriving on an already-connected socket
@@ -1220,12 +3752,28 @@ int main(void)
           if(read_from_client(i) < 0)
             {
             fprintf(stderr,"Closing connection\n");
-            close(i);
-            FD_CLR(i, &active_fd_set);
+            if((cn=conn_by_fd(i))!=NULL)
+              conn_close(cn);
+            else
+              {
+              pend_orphan(i);
+              close(i);
+              FD_CLR(i, &active_fd_set);
+              }
             // I don't update maxfd; I should loop on the fd set to find the new maximum: not worth
             }
           }    // if data from already-connected client
         }    // if input pending
       }    // loop on FD set
+
+    // release frames held back by the CAN budget, then time out requests
+    can_tx_service();
+    can_expire();
+    canlink_service();
+    mscan_service();
+    conn_flush_all();
+    upgrade_poll(sock);
     }
   }
+
+#endif
@@ -2,7 +2,7 @@
  ***                                            ***
  ***  chopsync TCP server (kinda SCPI)          ***
  ***                                            ***
- ***  latest rev: aug  8 2024                   ***
+ ***  latest rev: oct 18 2026                   ***
  ***                                            ***
  **************************************************/ 
 
@@ -19,6 +19,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdbool.h>
@@ -26,11 +27,36 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <math.h>
+#include <signal.h>
+#include <sys/select.h>
 #include "can.h"
+#include "canlink.h"
+#include "config.h"
+#include "device.h"
+#include "telemetry.h"
+#include "sampler.h"
+#include "supervisor.h"
+#include "spectrum.h"
+#include "ramp.h"
+#include "local.h"
+#include "http.h"
+#include "scpi.h"
+#include "upgrade.h"
+#include "profile.h"
+#include "capture.h"
+#include "reqsched.h"
+#include "conn.h"
+#include "mscan.h"
+#include "tune.h"
+#include "journal.h"
+#include "axiprobe.h"
+#include "loghist.h"
 
 
 #define PORT    8888
 #define MAXMSG  512
+#define MAXANS  2048    // one device's answer; multi-line answers can be long
+#define MAXHELP 16384   // HELP, sent on its own; less than the clients' CS_MAXANS
 
 #define READ  1
 #define WRITE 0
@@ -38,9 +64,6 @@
 #define OKS  "OK"
 #define MAXREG 12
 
-#define REGBANK_BASE 0xA0000000
-#define REGBANK_SIZE 256
-
 #define PRODUCT_FNAME "/etc/petalinux/product"
 #define VERSION_FNAME "/etc/petalinux/version"
 
@@ -81,43 +104,158 @@
 
 #define MECOS_MAX_SPEED    1000
 
+// replies waiting for MECOS; one at most per client
+#define MAXPENDING   32
+#define MAXPENDPARTS (MAXPENDING*MAXDEV)
+
+
+// synchronizer state decoded from the register bank
+struct syncstate
+  {
+  unsigned int status;        // *STB? combined status word
+  bool         flock, phlock, stickylol;
+  bool         synch, unwrap, unwres;
+  int          phsetp_ns;
+  int          pherr_raw;     // sfix_24.7 in 8 ns counts; ns = pherr_raw/16
+  int          mecos_cmd;
+  unsigned int bunchfreq, chopfreq;
+  unsigned int bunch_presc, chop_presc, trigout;
+  unsigned int gain_raw;      // ufix_16.12
+  unsigned int unwthr;
+  int          siggen_dftw;
+  };
+
+
+// formats the answer to a MECOS query once CAN returns (ret!=0: failure)
+typedef void (*ansfn)(char *ans, size_t maxlen, int ret, unsigned long val);
+
+// reply to one client command; an ALL: command has one part per device
+struct pending
+  {
+  bool  used;
+  int   fd;
+  int   outstanding;       // answers still waiting for CAN
+  int   nparts;
+  char  part[MAXDEV][MAXANS+1];
+  };
+
+// one deferred answer: where it goes and how to format it
+struct pendpart
+  {
+  bool            used;
+  struct pending *pend;
+  int             part;
+  int             dev;
+  ansfn           fmt;
+  };
+
+extern fd_set          active_fd_set;
+extern struct pending  pendings[MAXPENDING];
+extern struct pending *curpend;
+extern int             curpart;
+extern long            curdeadline;
+
 
 /***  protos  ***/
 
-int          memorymap(void);
 void         writereg(unsigned int reg, unsigned int val);
+void         modreg(unsigned int reg, unsigned int set, unsigned int clr);
 unsigned int readreg(unsigned int reg);
+void         read_syncstate(struct chopdev *d, struct syncstate *st);
 void         upstring(char *s);
 void         trimstring(char* s);
-void         parseREG(char *ans, size_t maxlen, int rw);
+void         ans_onoff(char *ans, size_t maxlen, bool on);
+void         parseREG(char *ans, size_t maxlen, int rw, struct toker *tk);
 void         parseIDN(char *ans, size_t maxlen);
 void         parseSTB(char *ans, size_t maxlen);
-void         parseSYNCHRONIZER(char *ans, size_t maxlen, int rw);
+void         parseSYNCHRONIZER(char *ans, size_t maxlen, int rw, struct toker *tk);
 void         parseRST(char *ans, size_t maxlen);
-void         parsePHSETP(char *ans, size_t maxlen, int rw);
-void         parsePRESCALER(char *ans, size_t maxlen, int rw, int regnum);
-void         parseUNWRAP(char *ans, size_t maxlen, int rw);
-void         parseUNWRES(char *ans, size_t maxlen, int rw);
-void         parseTRIGOUTPH(char *ans, size_t maxlen, int rw);
-void         parseUNWTHR(char *ans, size_t maxlen, int rw);
-void         parseSIGGENDFTW(char *ans, size_t maxlen, int rw);
-void         parseGAIN(char *ans, size_t maxlen, int rw);
+void         parsePHSETP(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parsePHSETP_RAMP(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parsePHSETP_ABORT(char *ans, size_t maxlen, int rw);
+void         parsePRESCALER(char *ans, size_t maxlen, int rw, int regnum, struct toker *tk);
+void         parseUNWRAP(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseUNWRES(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseTRIGOUTPH(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseUNWTHR(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseSIGGENDFTW(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseGAIN(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseAUTOTUNE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseAUTOTUNE_RESULTS(char *ans, size_t maxlen, int rw);
+void         parseAUTOTUNE_APPLY(char *ans, size_t maxlen, int rw);
 void         parseLOCK(char *ans, size_t maxlen, int rw, unsigned int mask);
 void         parsePHERR(char *ans, size_t maxlen, int rw);
 void         parseMECOSCMD(char *ans, size_t maxlen, int rw);
 void         parseFREQ(char *ans, size_t maxlen, int rw, int regnum);
-void         parseLOL(char *ans, size_t maxlen, int rw);
-void         parseMECOS_HZ_SETP(char *ans, size_t maxlen, int rw);
+void         parseLOL(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         mecos_query(enum mecos_obj obj, ansfn fmt, char *ans, size_t maxlen);
+void         mecos_answer(ansfn fmt, char *ans, size_t maxlen, int ret, unsigned long val);
+void         mecos_write_error(char *ans, size_t maxlen, int ret, const char *what);
+struct pendpart *mecos_write_begin(ansfn fmt);
+void         mecos_write_end(struct pendpart *pp, ansfn fmt, char *ans, size_t maxlen, int ret, unsigned long val);
+void         parseMECOS_HZ_SETP(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         ansMECOS_HZ_SETP_SET(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_HZ_SETP(char *ans, size_t maxlen, int ret, unsigned long val);
 void         parseMECOS_HZ_ACT(char *ans, size_t maxlen, int rw);
-void         parseMECOS_LIFTUP(char *ans, size_t maxlen, int rw);
-void         parseMECOS_ROTATION(char *ans, size_t maxlen, int rw);
+void         ansMECOS_HZ_ACT(char *ans, size_t maxlen, int ret, unsigned long val);
+void         parseMECOS_LIFTUP(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         ansMECOS_LIFTUP(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_LIFTED_UP(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_LIFTDOWN(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_LIFTED_DOWN(char *ans, size_t maxlen, int ret, unsigned long val);
+void         parseMECOS_ROTATION(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         ansMECOS_ROTATION(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_ROTATION_ON(char *ans, size_t maxlen, int ret, unsigned long val);
+void         ansMECOS_ROTATION_OFF(char *ans, size_t maxlen, int ret, unsigned long val);
 void         parseMECOS_FAULT(char *ans, size_t maxlen, int rw);
+void         ansMECOS_FAULT(char *ans, size_t maxlen, int ret, unsigned long val);
 void         parseMECOS_STABLE(char *ans, size_t maxlen, int rw);
+void         ansMECOS_STABLE(char *ans, size_t maxlen, int ret, unsigned long val);
+void         parseMECOS_SCAN(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseMECOS_SCAN_DATA(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseMECOS_SCAN_SAVE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseDEVICES(char *ans, size_t maxlen, int rw);
+void         parseTELEMETRY(char *ans, size_t maxlen, int rw);
+void         parseTELEMETRY_RATE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseHTTP(char *ans, size_t maxlen, int rw);
+void         parseHTTP_RATE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCAN_TXQ(char *ans, size_t maxlen, int rw);
+void         parseCAN_STATS(char *ans, size_t maxlen, int rw);
+void         parseCAN_LINK(char *ans, size_t maxlen, int rw);
+void         parseREALTIME(char *ans, size_t maxlen, int rw);
+void         parseREALTIME_RESET(char *ans, size_t maxlen, int rw);
+void         parseSUPERVISOR(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseSUPERVISOR_LOG(char *ans, size_t maxlen, int rw);
+void         parsePHERR_SPECTRUM(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCAPTURE(char *ans, size_t maxlen, int rw);
+void         parseCAPTURE_TRIGGER(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCAPTURE_WINDOW(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCAPTURE_FORCE(char *ans, size_t maxlen, int rw);
+void         parseCAPTURE_LIST(char *ans, size_t maxlen, int rw);
+void         parseCAPTURE_DATA(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseSCHED(char *ans, size_t maxlen, int rw);
+void         parseJOURNAL(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseAXIPROBE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseAXIPROBE_DATA(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCONFIGURE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseCONFIGURE_UNDO(char *ans, size_t maxlen, int rw);
+void         parseCONFIGURE_PROFILE(char *ans, size_t maxlen, int rw, struct toker *tk);
+void         parseALL(const char *cmd, char *ans, size_t maxlen, int filedes);
 void         printHelp(int filedes);
+void         dispatch(const char *buf, char *ans, size_t maxlen, int filedes);
 void         parse(char *buf, char *ans, size_t maxlen, int filedes);
+struct pending  *pend_alloc(int filedes);
+void             pend_orphan(int filedes);
+struct pendpart *pendpart_alloc(ansfn fmt);
+void         reply_done(void *ctx, int ret, unsigned long int val);
+int          ans_lines(const char *ans);
+void         reply_finish(struct pending *pend);
 void         sendback(int filedes, char *s);
+void         run_command(int filedes, char *buffer);
 int          read_from_client(int filedes);
 //int          main(int argc, char *const argv[]);
+#ifndef SERVER_NO_MAIN
 int          main(void);
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,294 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync phase error spectral analysis    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+// twiddles of every radix-2 stage, stage with half size h at offset h-1
+static float fft_wr[SPEC_M], fft_wi[SPEC_M];
+static int   fft_rev[SPEC_M];
+// unpacking twiddles of the real FFT and the window
+static float rfft_wr[SPEC_M], rfft_wi[SPEC_M];
+static float window[SPEC_N];
+static double window_pow;
+static bool  fft_ready;
+// work buffers, too big for the stack
+static struct smp_sample spec_samples[SMP_RINGLEN];
+static float spec_x[SPEC_N], spec_re[SPEC_M], spec_im[SPEC_M];
+static double spec_sorted[SPEC_M+1];
+
+
+//-------------------------------------------------------------------
+
+void fft_init(void)
+  {
+  int h, k, i, j, bits;
+
+  for(h=1; h<SPEC_M; h<<=1)
+    for(k=0; k<h; k++)
+      {
+      fft_wr[h-1+k]=(float)cos(-M_PI*k/h);
+      fft_wi[h-1+k]=(float)sin(-M_PI*k/h);
+      }
+
+  for(bits=0; (1<<bits)<SPEC_M; bits++)
+    ;
+  for(i=0; i<SPEC_M; i++)
+    {
+    for(j=0, k=0; k<bits; k++)
+      j|=((i>>k)&1)<<(bits-1-k);
+    fft_rev[i]=j;
+    }
+
+  for(k=0; k<SPEC_M; k++)
+    {
+    rfft_wr[k]=(float)cos(-2.*M_PI*k/SPEC_N);
+    rfft_wi[k]=(float)sin(-2.*M_PI*k/SPEC_N);
+    }
+
+  window_pow=0;
+  for(i=0; i<SPEC_N; i++)
+    {
+    window[i]=(float)(0.5-0.5*cos(2.*M_PI*i/SPEC_N));
+    window_pow+=window[i]*window[i];
+    }
+  fft_ready=true;
+  }
+
+
+//-------------------------------------------------------------------
+
+// butterflies between re/im[0..h) and re/im[h..2h), twiddles wr/wi[0..h)
+
+void fft_span(float *re, float *im, const float *wr, const float *wi, int h)
+  {
+  float ar, ai, tr, ti;
+  int k;
+
+  k=0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for(; k+4<=h; k+=4)
+    {
+    float32x4_t vwr=vld1q_f32(wr+k), vwi=vld1q_f32(wi+k);
+    float32x4_t vbr=vld1q_f32(re+h+k), vbi=vld1q_f32(im+h+k);
+    float32x4_t var=vld1q_f32(re+k), vai=vld1q_f32(im+k);
+    float32x4_t vtr=vmlsq_f32(vmulq_f32(vbr, vwr), vbi, vwi);
+    float32x4_t vti=vmlaq_f32(vmulq_f32(vbr, vwi), vbi, vwr);
+    vst1q_f32(re+h+k, vsubq_f32(var, vtr));
+    vst1q_f32(im+h+k, vsubq_f32(vai, vti));
+    vst1q_f32(re+k, vaddq_f32(var, vtr));
+    vst1q_f32(im+k, vaddq_f32(vai, vti));
+    }
+#elif defined(__SSE2__)
+  for(; k+4<=h; k+=4)
+    {
+    __m128 vwr=_mm_loadu_ps(wr+k), vwi=_mm_loadu_ps(wi+k);
+    __m128 vbr=_mm_loadu_ps(re+h+k), vbi=_mm_loadu_ps(im+h+k);
+    __m128 var=_mm_loadu_ps(re+k), vai=_mm_loadu_ps(im+k);
+    __m128 vtr=_mm_sub_ps(_mm_mul_ps(vbr, vwr), _mm_mul_ps(vbi, vwi));
+    __m128 vti=_mm_add_ps(_mm_mul_ps(vbr, vwi), _mm_mul_ps(vbi, vwr));
+    _mm_storeu_ps(re+h+k, _mm_sub_ps(var, vtr));
+    _mm_storeu_ps(im+h+k, _mm_sub_ps(vai, vti));
+    _mm_storeu_ps(re+k, _mm_add_ps(var, vtr));
+    _mm_storeu_ps(im+k, _mm_add_ps(vai, vti));
+    }
+#endif
+  // first stages, and whatever the vectors left
+  for(; k<h; k++)
+    {
+    tr=re[h+k]*wr[k] - im[h+k]*wi[k];
+    ti=re[h+k]*wi[k] + im[h+k]*wr[k];
+    ar=re[k];
+    ai=im[k];
+    re[h+k]=ar-tr;
+    im[h+k]=ai-ti;
+    re[k]=ar+tr;
+    im[k]=ai+ti;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// in place, input in bit reversed order
+
+void fft_complex(float *re, float *im)
+  {
+  int h, j;
+
+  for(h=1; h<SPEC_M; h<<=1)
+    for(j=0; j<SPEC_M; j+=2*h)
+      fft_span(re+j, im+j, fft_wr+h-1, fft_wi+h-1, h);
+  }
+
+
+//-------------------------------------------------------------------
+
+// |X[k]|^2, k=0..SPEC_N/2, of a real block of SPEC_N samples, added to pow
+
+void fft_real(const float *x, double *pow)
+  {
+  double zr, zi, cr, ci, er, ei, or_, oi, xr, xi;
+  int k, i;
+
+  // even samples as real part, odd samples as imaginary part
+  for(i=0; i<SPEC_M; i++)
+    {
+    spec_re[fft_rev[i]]=x[2*i];
+    spec_im[fft_rev[i]]=x[2*i+1];
+    }
+  fft_complex(spec_re, spec_im);
+
+  // split into the spectra of the even and odd samples and recombine
+  pow[0]+=(double)(spec_re[0]+spec_im[0])*(spec_re[0]+spec_im[0]);
+  pow[SPEC_M]+=(double)(spec_re[0]-spec_im[0])*(spec_re[0]-spec_im[0]);
+  for(k=1; k<SPEC_M; k++)
+    {
+    zr=spec_re[k];
+    zi=spec_im[k];
+    cr=spec_re[SPEC_M-k];
+    ci=-spec_im[SPEC_M-k];
+    er=(zr+cr)/2.;
+    ei=(zi+ci)/2.;
+    // (Z[k]-conj(Z[M-k]))/2i
+    or_=(zi-ci)/2.;
+    oi=-(zr-cr)/2.;
+    xr=er + or_*rfft_wr[k] - oi*rfft_wi[k];
+    xi=ei + or_*rfft_wi[k] + oi*rfft_wr[k];
+    pow[k]+=xr*xr+xi*xi;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// phase error register to ns: sfix_24.7 counts of 8 ns, as PHERR?
+
+double spec_pherr_ns(uint32_t raw)
+  {
+  int n;
+
+  n=(int)(raw & PHERR_MASK);
+  n=(n ^ PHERR_SIGN)-PHERR_SIGN;
+  return n/POW_2_7*8.;
+  }
+
+
+//-------------------------------------------------------------------
+
+int spec_cmp(const void *a, const void *b)
+  {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x<y)? -1 : (x>y)? 1 : 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// Welch PSD of the phase error of a device from the samples in the
+// ring; returns -1 if there are fewer than SPEC_N samples
+
+int spec_compute(int dev, struct spectrum *sp)
+  {
+  double mean, scale;
+  int n, start, i, k;
+
+  if(!fft_ready)
+    fft_init();
+
+  n=sampler_snapshot(dev, spec_samples, SMP_RINGLEN);
+  if(n<SPEC_N)
+    return -1;
+
+  memset(sp, 0, sizeof(*sp));
+  sp->fs=smp.rate_hz;
+  sp->df=sp->fs/SPEC_N;
+  for(start=0; start+SPEC_N<=n; start+=SPEC_N/2)
+    {
+    mean=0;
+    for(i=0; i<SPEC_N; i++)
+      mean+=spec_pherr_ns(spec_samples[start+i].reg[SMP_IDX_PHERR]);
+    mean/=SPEC_N;
+    for(i=0; i<SPEC_N; i++)
+      spec_x[i]=(float)((spec_pherr_ns(spec_samples[start+i].reg[SMP_IDX_PHERR])-mean)*window[i]);
+    fft_real(spec_x, sp->psd);
+    sp->nseg++;
+    }
+
+  // one-sided density, corrected for the window power
+  scale=1./(sp->fs*window_pow*sp->nseg);
+  for(k=0; k<=SPEC_M; k++)
+    sp->psd[k]*=(k==0 || k==SPEC_M)? scale : 2.*scale;
+
+  sp->rms_total=spec_band_rms(sp, sp->df, sp->fs/2.);
+  memcpy(spec_sorted, sp->psd, sizeof(spec_sorted));
+  qsort(spec_sorted+1, SPEC_M, sizeof(double), spec_cmp);
+  sp->median=spec_sorted[1+SPEC_M/2];
+  spec_find_spurs(sp);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// RMS in ns of the phase error between f1 and f2 Hz (DC excluded)
+
+double spec_band_rms(struct spectrum *sp, double f1, double f2)
+  {
+  double sum;
+  int k, k1, k2;
+
+  k1=(int)ceil(f1/sp->df);
+  k2=(int)floor(f2/sp->df);
+  if(k1<1)
+    k1=1;
+  if(k2>SPEC_M)
+    k2=SPEC_M;
+  sum=0;
+  for(k=k1; k<=k2; k++)
+    sum+=sp->psd[k];
+  return sqrt(sum*sp->df);
+  }
+
+
+//-------------------------------------------------------------------
+
+// strongest local maxima standing SPEC_SPUR_RATIO over the median; the
+// Hann main lobe spreads a line over 3 bins, which are summed
+
+void spec_find_spurs(struct spectrum *sp)
+  {
+  struct spec_spur s;
+  double a, b, c;
+  int k, i;
+
+  sp->nspurs=0;
+  for(k=2; k<SPEC_M-1; k++)
+    {
+    if(sp->psd[k]<=sp->psd[k-1] || sp->psd[k]<sp->psd[k+1] || sp->psd[k]<SPEC_SPUR_RATIO*sp->median)
+      continue;
+    // parabolic interpolation of the log PSD for the line frequency
+    a=log(sp->psd[k-1]+1e-300);
+    b=log(sp->psd[k]);
+    c=log(sp->psd[k+1]+1e-300);
+    s.f=(k + ((a-2.*b+c)!=0.? 0.5*(a-c)/(a-2.*b+c) : 0.))*sp->df;
+    s.rms=sqrt((sp->psd[k-1]+sp->psd[k]+sp->psd[k+1])*sp->df);
+    s.db=10.*log10(sp->psd[k]/sp->median);
+    // keep the list sorted, strongest first
+    for(i=sp->nspurs; i>0 && sp->spur[i-1].rms<s.rms; i--)
+      if(i<SPEC_NSPURS)
+        sp->spur[i]=sp->spur[i-1];
+    if(i<SPEC_NSPURS)
+      {
+      sp->spur[i]=s;
+      if(sp->nspurs<SPEC_NSPURS)
+        sp->nspurs++;
+      }
+    }
+  }
@@ -0,0 +1,78 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync phase error spectral analysis    ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// Welch PSD of the phase error (register 6) from the sampler ring:
+// Hann-windowed blocks of SPEC_N samples, 50% overlap, real FFT done
+// as a half-size complex radix-2 FFT with NEON or SSE butterflies
+// when the compiler targets them (scalar otherwise)
+// from the PSD: RMS jitter over frequency bands, the strongest spurs,
+// and a log-binned PSD short enough to travel in one answer
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sampler.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SPEC_PATH "NEON"
+#elif defined(__SSE2__)
+#include <xmmintrin.h>
+#define SPEC_PATH "SSE"
+#else
+#define SPEC_PATH "scalar"
+#endif
+
+#define SPEC_N          4096            // block length, power of 2
+#define SPEC_M          (SPEC_N/2)      // complex FFT length
+#define SPEC_MAXBANDS   8
+#define SPEC_NSPURS     5
+#define SPEC_SPUR_RATIO 10.             // spur: local peak 10 dB over the median
+#define SPEC_PSD_PER_DECADE 8
+
+struct spec_band
+  {
+  double f1, f2;       // Hz
+  double rms;          // ns
+  };
+
+struct spec_spur
+  {
+  double f;            // Hz
+  double rms;          // ns
+  double db;           // over the median PSD
+  };
+
+struct spectrum
+  {
+  double fs, df;
+  int    nseg;
+  double psd[SPEC_M+1];    // one-sided, ns^2/Hz
+  double rms_total;
+  double median;
+  int    nspurs;
+  struct spec_spur spur[SPEC_NSPURS];
+  };
+
+
+/******* protos *******/
+
+void   fft_init(void);
+void   fft_span(float *re, float *im, const float *wr, const float *wi, int h);
+void   fft_complex(float *re, float *im);
+void   fft_real(const float *x, double *pow);
+double spec_pherr_ns(uint32_t raw);
+int    spec_cmp(const void *a, const void *b);
+int    spec_compute(int dev, struct spectrum *sp);
+double spec_band_rms(struct spectrum *sp, double f1, double f2);
+void   spec_find_spurs(struct spectrum *sp);
+
+#endif
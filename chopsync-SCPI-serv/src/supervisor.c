@@ -0,0 +1,305 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync loss-of-lock recovery supervisor ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+const char *sv_state_names[SV_NSTATES] = { "OFF", "WAITLOCK", "WATCH", "WAITMECOS", "RESET", "RELOCK", "GIVEUP" };
+const char *sv_result_names[SV_NRESULTS] = { "RECOVERED", "FAILED", "GAVEUP", "OVERRIDDEN" };
+struct supervisor sv[MAXDEV];
+int               sv_eventfd = -1;
+
+
+//-------------------------------------------------------------------
+
+// returns -1 if the supervisor can't run (no sampler)
+
+int supervisor_open(void)
+  {
+  int i;
+
+  if(!smp.running)
+    {
+    if(cfg.sv_on)
+      fprintf(stderr, "supervisor needs the real-time sampler (REALTIME); not started\n");
+    return -1;
+    }
+  sv_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(sv_eventfd < 0)
+    {
+    perror("supervisor eventfd");
+    return -1;
+    }
+  for(i=0; i<ndevs; i++)
+    {
+    if(cfg.sv_on && !supervisor_mecos_polled(&devs[i]))
+      {
+      fprintf(stderr, "DEV%d supervisor: MECOS max age set but MECOS_POLL is off, the cache would never be fresh; not switched on\n", i);
+      continue;
+      }
+    supervisor_enable(i, cfg.sv_on);
+    }
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+void supervisor_enable(int dev, bool on)
+  {
+  // the sampler thread picks the change up at its next sample
+  atomic_store(&sv[dev].enable, on);
+  if(on)
+    atomic_store(&sv[dev].rearm, true);
+  }
+
+
+//-------------------------------------------------------------------
+
+// the operator is switching the synchronizer off; called before the
+// register is written, so a supervisor about to switch it on again
+// sees it under the register lock
+
+void supervisor_synch_off(int dev)
+  {
+  atomic_store(&sv[dev].opoff, true);
+  }
+
+
+//-------------------------------------------------------------------
+
+// is the MECOS cache kept fresh enough to check? only the background
+// poll refreshes it
+
+bool supervisor_mecos_polled(struct chopdev *d)
+  {
+  return (cfg.sv_mecos_age_ms==0 || !d->can.present || cfg.mecos_poll>0);
+  }
+
+
+//-------------------------------------------------------------------
+
+// may we try to lock? with no CAN or no age limit MECOS is not checked
+
+bool supervisor_mecos_ok(struct chopdev *d)
+  {
+  unsigned long int val;
+  long age;
+
+  if(cfg.sv_mecos_age_ms==0 || !d->can.present)
+    return true;
+  if(can_cache_read(&d->can, MECOS_OBJ_EXTCTL, &val, &age)!=0)
+    return false;
+  return (val!=0 && age<=(long)cfg.sv_mecos_age_ms);
+  }
+
+
+//-------------------------------------------------------------------
+
+void supervisor_log(int dev, enum sv_result result, uint64_t t)
+  {
+  struct supervisor *s;
+  struct sv_attempt *a;
+  uint64_t head, one = 1;
+
+  s=&sv[dev];
+  head=atomic_load_explicit(&s->loghead, memory_order_relaxed);
+  a=&s->log[head&(SV_LOGLEN-1)];
+  a->when=s->when_lost;
+  a->n=s->attempt;
+  a->result=result;
+  a->dur_us=(long)((t-s->t_lost)/1000);
+  a->reg0=s->reg0_lost;
+  atomic_store_explicit(&s->loghead, head+1, memory_order_release);
+  // wake the main loop to print it
+  (void)write(sv_eventfd, &one, sizeof(one));
+  }
+
+
+//-------------------------------------------------------------------
+
+// one step of the state machine of a device, at sample time t;
+// runs in the sampler thread
+
+void supervisor_step(int dev, uint64_t t)
+  {
+  struct supervisor *s;
+  struct chopdev    *d;
+  uint32_t r0, r1;
+  bool locked, opoff;
+
+  s=&sv[dev];
+  d=&devs[dev];
+  if(!atomic_load_explicit(&s->enable, memory_order_relaxed))
+    {
+    s->state=SV_OFF;
+    s->held=false;
+    return;
+    }
+  if(atomic_exchange(&s->rearm, false))
+    {
+    s->state=SV_WAITLOCK;
+    s->attempt=0;
+    s->held=false;
+    }
+  opoff=atomic_exchange(&s->opoff, false);
+
+  r0=((volatile uint32_t *)d->regbank)[0];
+  r1=((volatile uint32_t *)d->regbank)[1];
+  locked=((r0 & (FREQUENCY|PHASE))==(FREQUENCY|PHASE)) && (r0 & STICKYLOL_MASK)==0;
+
+  // in a recovery, the synchronizer switched off by somebody else ends
+  // it; the operator's word stands, register 1 is left as it is
+  if((s->state==SV_WAITMECOS || s->state==SV_RESET || s->state==SV_RELOCK) &&
+     (opoff || ((r1 & SYNCH_RESET_MASK)!=0 && !s->held)))
+    {
+    s->overridden++;
+    supervisor_log(dev, SV_OVERRIDDEN, t);
+    s->held=false;
+    s->state=SV_WAITLOCK;
+    return;
+    }
+
+  switch(s->state)
+    {
+    case SV_OFF:
+    case SV_WAITLOCK:
+      if(locked && (r1 & SYNCH_RESET_MASK)==0)
+        s->state=SV_WATCH;
+      else
+        s->state=SV_WAITLOCK;
+      break;
+
+    case SV_WATCH:
+      if((r1 & SYNCH_RESET_MASK)!=0)
+        // switched off by the operator
+        s->state=SV_WAITLOCK;
+      else if(!locked)
+        {
+        s->losses++;
+        s->attempt=0;
+        s->t_lost=t;
+        s->reg0_lost=r0;
+        clock_gettime(CLOCK_REALTIME, &s->when_lost);
+        s->t_state=t;
+        s->state=SV_WAITMECOS;
+        }
+      break;
+
+    case SV_WAITMECOS:
+      if(supervisor_mecos_ok(d))
+        {
+        s->attempt++;
+        dev_modreg(d, 1, SYNCH_RESET_MASK|LOL_RESET_MASK, 0);
+        s->held=true;
+        s->t_state=t;
+        s->state=SV_RESET;
+        }
+      else if(t-s->t_state >= (uint64_t)cfg.sv_timeout_ms*1000000ULL)
+        {
+        // MECOS never stable (or never heard of): a failed attempt
+        s->attempt++;
+        s->failed++;
+        if(s->attempt>=(int)cfg.sv_attempts)
+          {
+          s->gaveup++;
+          supervisor_log(dev, SV_GAVEUP, t);
+          s->state=SV_GIVEUP;
+          }
+        else
+          {
+          supervisor_log(dev, SV_FAILED, t);
+          s->t_state=t;
+          }
+        }
+      break;
+
+    case SV_RESET:
+      // the LOL reset is a pulse one sample long
+      if(r1 & LOL_RESET_MASK)
+        dev_modreg(d, 1, 0, LOL_RESET_MASK);
+      if(t-s->t_state >= (uint64_t)cfg.sv_settle_ms*1000000ULL)
+        {
+        // a SYNCHRONIZER OFF that came in since the top of the step
+        // keeps it off; the next step logs the override
+        pthread_mutex_lock(&d->reglock);
+        if(!atomic_load(&s->opoff))
+          {
+          r1=d->regbank[1] & ~(SYNCH_RESET_MASK|LOL_RESET_MASK);
+          journal_reg(d->id, 1, d->regbank, r1);
+          d->regbank[1]=r1;
+          s->held=false;
+          }
+        pthread_mutex_unlock(&d->reglock);
+        s->t_state=t;
+        s->state=SV_RELOCK;
+        }
+      break;
+
+    case SV_RELOCK:
+      if(locked)
+        {
+        s->recovered++;
+        supervisor_log(dev, SV_RECOVERED, t);
+        s->state=SV_WATCH;
+        }
+      else if(t-s->t_state >= (uint64_t)cfg.sv_timeout_ms*1000000ULL)
+        {
+        s->failed++;
+        if(s->attempt>=(int)cfg.sv_attempts)
+          {
+          s->gaveup++;
+          supervisor_log(dev, SV_GAVEUP, t);
+          s->state=SV_GIVEUP;
+          }
+        else
+          {
+          supervisor_log(dev, SV_FAILED, t);
+          s->t_state=t;
+          s->state=SV_WAITMECOS;
+          }
+        }
+      break;
+
+    case SV_GIVEUP:
+    default:
+      break;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// print the attempts logged since last time; main thread
+
+void supervisor_report(void)
+  {
+  struct sv_attempt *a;
+  struct tm tm;
+  uint64_t head, cnt;
+  char tstr[32];
+  int i;
+
+  if(sv_eventfd>=0)
+    (void)read(sv_eventfd, &cnt, sizeof(cnt));
+  for(i=0; i<ndevs; i++)
+    {
+    head=atomic_load_explicit(&sv[i].loghead, memory_order_acquire);
+    // entries overwritten before we got to them are lost
+    if(head-sv[i].reported > SV_LOGLEN)
+      sv[i].reported=head-SV_LOGLEN;
+    for(; sv[i].reported<head; sv[i].reported++)
+      {
+      a=&sv[i].log[sv[i].reported&(SV_LOGLEN-1)];
+      localtime_r(&a->when.tv_sec, &tm);
+      strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+      fprintf(stderr, "DEV%d supervisor: lock lost at %s (reg0 0x%08X), attempt %d %s after %.3f ms\n",
+              i, tstr, a->reg0, a->n, sv_result_names[a->result], a->dur_us/1000.);
+      }
+    }
+  }
@@ -0,0 +1,111 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync loss-of-lock recovery supervisor ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// runs in the sampler thread, one state machine per device, so lock
+// loss is seen within one sample period; on loss it does what the
+// operator would do by hand:
+//
+//   wait until MECOS says rotation is stable (from the CAN cache, kept
+//   fresh by MECOS_POLL; without it the supervisor can't be switched
+//   on), at most sv_timeout_ms per attempt
+//   synchronizer off + pulse of the sticky LOL reset
+//   after sv_settle_ms synchronizer on again
+//   wait up to sv_timeout_ms for FLOCK, PHLOCK and no sticky LOL
+//
+// and gives up after sv_attempts failed attempts in a row, until it is
+// switched on again; a synchronizer switched off by the operator is
+// left alone, also in the middle of a recovery: SYNCH_RESET set by
+// anybody but the supervisor, or a SYNCHRONIZER OFF while the
+// supervisor holds it off, ends the recovery without touching
+// register 1 (logged OVERRIDDEN)
+// every attempt is logged; the sampler thread never writes to stderr
+// itself, it wakes the main loop through sv_eventfd instead
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "config.h"
+#include "device.h"
+
+#define SV_LOGLEN             32     // power of 2
+#define SV_DEFAULT_ATTEMPTS   3
+#define SV_DEFAULT_TIMEOUT_MS 2000
+#define SV_DEFAULT_SETTLE_MS  10
+#define SV_DEFAULT_MECOS_AGE_MS 2000
+
+enum sv_state
+  {
+  SV_OFF,
+  SV_WAITLOCK,      // armed, waiting for a first lock to watch
+  SV_WATCH,
+  SV_WAITMECOS,     // lock lost, MECOS not stable (yet); t_state from then
+  SV_RESET,         // synchronizer held off
+  SV_RELOCK,        // synchronizer on, waiting for lock
+  SV_GIVEUP,
+  SV_NSTATES
+  };
+
+enum sv_result
+  {
+  SV_RECOVERED,
+  SV_FAILED,
+  SV_GAVEUP,
+  SV_OVERRIDDEN,    // the operator switched the synchronizer off
+  SV_NRESULTS
+  };
+
+struct sv_attempt
+  {
+  struct timespec when;      // CLOCK_REALTIME at the loss of lock
+  int             n;         // attempt number for this loss
+  enum sv_result  result;
+  long            dur_us;    // from the loss of lock
+  uint32_t        reg0;      // status register when the loss was seen
+  };
+
+struct supervisor
+  {
+  atomic_bool      enable;
+  atomic_bool      rearm;
+  atomic_bool      opoff;               // SYNCHRONIZER OFF since the last sample
+  enum sv_state    state;
+  bool             held;                // SYNCH_RESET is set by us
+  int              attempt;
+  uint64_t         t_lost, t_state;     // CLOCK_MONOTONIC ns
+  struct timespec  when_lost;
+  uint32_t         reg0_lost;
+  unsigned long    losses, recovered, failed, gaveup, overridden;
+  _Atomic uint64_t loghead;
+  struct sv_attempt log[SV_LOGLEN];
+  uint64_t         reported;            // main thread: entries already printed
+  };
+
+extern const char        *sv_state_names[SV_NSTATES];
+extern const char        *sv_result_names[SV_NRESULTS];
+extern struct supervisor  sv[MAXDEV];
+extern int                sv_eventfd;
+
+
+/******* protos *******/
+
+int  supervisor_open(void);
+void supervisor_enable(int dev, bool on);
+void supervisor_synch_off(int dev);
+bool supervisor_mecos_polled(struct chopdev *d);
+bool supervisor_mecos_ok(struct chopdev *d);
+void supervisor_log(int dev, enum sv_result result, uint64_t t);
+void supervisor_step(int dev, uint64_t t);
+void supervisor_report(void);
+
+#endif
@@ -0,0 +1,198 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync UDP multicast telemetry          ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+struct telemetry telem = { .sock = -1, .timerfd = -1 };
+
+
+//-------------------------------------------------------------------
+
+// returns 0 if telemetry is configured and ready, -1 otherwise
+
+int telemetry_open(void)
+  {
+  unsigned char ttl;
+
+  if(cfg.tm_port==0)
+    return -1;
+
+  telem.sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if(telem.sock < 0)
+    {
+    perror("telemetry socket");
+    return -1;
+    }
+
+  ttl=(unsigned char)cfg.tm_ttl;
+  if(setsockopt(telem.sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+    perror("telemetry IP_MULTICAST_TTL");
+  if(cfg.tm_ifaddr.s_addr!=htonl(INADDR_ANY))
+    if(setsockopt(telem.sock, IPPROTO_IP, IP_MULTICAST_IF, &cfg.tm_ifaddr, sizeof(cfg.tm_ifaddr)) < 0)
+      perror("telemetry IP_MULTICAST_IF");
+
+  memset(&telem.dest, 0, sizeof(telem.dest));
+  telem.dest.sin_family = AF_INET;
+  telem.dest.sin_addr = cfg.tm_group;
+  telem.dest.sin_port = htons(cfg.tm_port);
+
+  telem.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(telem.timerfd < 0)
+    {
+    perror("telemetry timerfd");
+    close(telem.sock);
+    telem.sock=-1;
+    return -1;
+    }
+
+  if(telemetry_set_rate(cfg.tm_rate)!=0)
+    return -1;
+
+  fprintf(stderr,"Telemetry to %s:%d at %u Hz\n", inet_ntoa(telem.dest.sin_addr), cfg.tm_port, telem.rate_hz);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// 0 Hz disarms the timer
+
+int telemetry_set_rate(unsigned int hz)
+  {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if(hz>0)
+    {
+    its.it_interval.tv_sec = (hz==1)? 1 : 0;
+    its.it_interval.tv_nsec = (hz==1)? 0 : 1000000000L/hz;
+    its.it_value = its.it_interval;
+    }
+  if(timerfd_settime(telem.timerfd, 0, &its, NULL) < 0)
+    {
+    perror("telemetry timerfd_settime");
+    return -1;
+    }
+  telem.rate_hz=hz;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+unsigned char *tm_put16(unsigned char *p, uint16_t v)
+  {
+  p[0]=(unsigned char)(v>>8);
+  p[1]=(unsigned char)v;
+  return p+2;
+  }
+
+
+//-------------------------------------------------------------------
+
+unsigned char *tm_put32(unsigned char *p, uint32_t v)
+  {
+  p[0]=(unsigned char)(v>>24);
+  p[1]=(unsigned char)(v>>16);
+  p[2]=(unsigned char)(v>>8);
+  p[3]=(unsigned char)v;
+  return p+4;
+  }
+
+
+//-------------------------------------------------------------------
+
+unsigned char *tm_put64(unsigned char *p, uint64_t v)
+  {
+  p=tm_put32(p, (uint32_t)(v>>32));
+  return tm_put32(p, (uint32_t)v);
+  }
+
+
+//-------------------------------------------------------------------
+
+// assemble one datagram; layout is documented in telemetry.h
+
+size_t telemetry_build(unsigned char *buf, size_t maxlen)
+  {
+  unsigned char   *p;
+  struct syncstate st;
+  struct timespec  now;
+  struct chopdev  *d;
+  unsigned char    flags;
+  long             age;
+  int              i, n, nd;
+
+  nd=ndevs;
+  if(TM_HDRLEN+(size_t)nd*TM_DEVLEN > maxlen)
+    nd=(int)((maxlen-TM_HDRLEN)/TM_DEVLEN);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  p=buf;
+  p=tm_put32(p, TELEMETRY_MAGIC);
+  p=tm_put16(p, TELEMETRY_VERSION);
+  p=tm_put16(p, (uint16_t)nd);
+  p=tm_put32(p, telem.seq);
+  p=tm_put32(p, telem.rate_hz);
+  p=tm_put64(p, (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec);
+
+  for(i=0; i<nd; i++)
+    {
+    d=&devs[i];
+    read_syncstate(d, &st);
+    flags = (st.flock?0x01:0) | (st.phlock?0x02:0) | (st.stickylol?0x04:0) |
+            (st.synch?0x08:0) | (st.unwrap?0x10:0) | (st.unwres?0x20:0) |
+            (d->can.present?0x40:0);
+    *p++=(unsigned char)i;
+    *p++=flags;
+    p=tm_put16(p, (uint16_t)st.status);
+    p=tm_put32(p, (uint32_t)st.phsetp_ns);
+    p=tm_put32(p, (uint32_t)st.pherr_raw);
+    p=tm_put32(p, (uint32_t)st.mecos_cmd);
+    p=tm_put32(p, st.bunchfreq);
+    p=tm_put32(p, st.chopfreq);
+    p=tm_put16(p, (uint16_t)st.bunch_presc);
+    p=tm_put16(p, (uint16_t)st.chop_presc);
+    p=tm_put16(p, (uint16_t)st.trigout);
+    p=tm_put16(p, (uint16_t)st.gain_raw);
+    p=tm_put32(p, st.unwthr);
+    p=tm_put32(p, (uint32_t)st.siggen_dftw);
+
+    // cached MECOS state; telemetry never waits on the CAN bus
+    for(n=0; n<MECOS_NOBJ; n++)
+      {
+      age=can_cache_age_ms(&d->can, n);
+      p=tm_put32(p, (uint32_t)d->can.cache[n].val);
+      p=tm_put16(p, (age<0 || age>=TM_AGE_INVALID)? TM_AGE_INVALID : (uint16_t)age);
+      }
+    }
+
+  return (size_t)(p-buf);
+  }
+
+
+//-------------------------------------------------------------------
+
+void telemetry_tick(void)
+  {
+  unsigned char buf[TM_MAXDGRAM];
+  uint64_t      expirations;
+  size_t        len;
+
+  // drain the timer; missed ticks are not made up for
+  if(read(telem.timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return;
+
+  len=telemetry_build(buf, sizeof(buf));
+  if(sendto(telem.sock, buf, len, 0, (struct sockaddr *)&telem.dest, sizeof(telem.dest)) != (ssize_t)len)
+    telem.errors++;
+  else
+    telem.sent++;
+  telem.seq++;
+  }
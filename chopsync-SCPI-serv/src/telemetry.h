@@ -0,0 +1,85 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync UDP multicast telemetry          ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// one datagram per tick carries the decoded state of every device;
+// all fields are big endian (network order)
+//
+// header, 24 bytes
+//   u32  magic 0x4353594E ("CSYN")
+//   u16  version
+//   u16  number of device records
+//   u32  sequence number; a gap means lost datagrams
+//   u32  publishing rate, Hz
+//   u64  CLOCK_REALTIME timestamp, ns
+//
+// device record, 76 bytes each
+//   u8   device number
+//   u8   flags: bit0 FLOCK, bit1 PHLOCK, bit2 STICKYLOL, bit3 SYNCH ON,
+//               bit4 UNWRAP, bit5 UNW_RES, bit6 CAN present
+//   u16  combined status word, as *STB?
+//   i32  phase setpoint, ns
+//   i32  phase error, sfix_24.7 counts of 8 ns (ns = value/16)
+//   i32  MECOS_CMD, pulses
+//   u32  bunch marker frequency, Hz
+//   u32  chopper frequency, Hz
+//   u16  bunch marker prescaler
+//   u16  chopper prescaler
+//   u16  TRIGOUT phase
+//   u16  gain, ufix_16.12
+//   u32  unwrapper threshold
+//   i32  diagnostic generator deltaFTW (2199 counts = 1 Hz)
+//   6 x  MECOS cache entries (HZ_SETP, HZ_ACT, LIFTUP, ROTATION, FAULT, STABLE):
+//        u32 last value read
+//        u16 age in ms, 0xFFFF if never read or older than 65 s
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TELEMETRY_MAGIC   0x4353594E
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAXRATE 1000
+#define TM_HDRLEN         24
+#define TM_DEVLEN         76
+#define TM_MAXDGRAM       1472
+#define TM_AGE_INVALID    0xFFFF
+
+
+struct telemetry
+  {
+  int                sock;        // -1 when not configured
+  int                timerfd;
+  struct sockaddr_in dest;
+  unsigned int       rate_hz;
+  uint32_t           seq;
+  unsigned long      sent, errors;
+  };
+
+extern struct telemetry telem;
+
+
+/******* protos *******/
+
+int            telemetry_open(void);
+int            telemetry_set_rate(unsigned int hz);
+unsigned char *tm_put16(unsigned char *p, uint16_t v);
+unsigned char *tm_put32(unsigned char *p, uint32_t v);
+unsigned char *tm_put64(unsigned char *p, uint64_t v);
+size_t         telemetry_build(unsigned char *buf, size_t maxlen);
+void           telemetry_tick(void);
+
+#endif
@@ -0,0 +1,353 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync loop gain auto-tuning            ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#include "server.h"
+
+/***  globals  ***/
+const char   *tune_state_names[TUNE_NSTATES] = { "IDLE", "SETTLE", "NOISE", "STEP_UP", "STEP_DOWN", "DONE", "ABORTED", "FAILED" };
+const char   *tune_res_names[TUNE_NRES] = { "PENDING", "OK", "UNSETTLED", "LOL", "SKIPPED" };
+// conservative=4; high performance=default=6
+const double  tune_gains[TUNE_NGAINS] = { 2., 3., 4., 5., 6., 7., 8. };
+struct tune   tunes[MAXDEV];
+
+#if TUNE_NGAINS > TUNE_MAXCAND
+#error "more gains in tune_gains[] than TUNE_MAXCAND"
+#endif
+
+
+//-------------------------------------------------------------------
+
+// post a run with steps of step_ns; returns -1 without the sampler, 1
+// if a run is still going or a request not yet taken by the sampler
+// thread
+
+int tune_start(int dev, double step_ns, bool apply)
+  {
+  struct tune *u;
+
+  if(!smp.running)
+    return -1;
+  u=&tunes[dev];
+  if(tune_running(dev))
+    return 1;
+  u->req_step_ns=step_ns;
+  u->req_apply=apply;
+  // publishes the request fields to the sampler thread
+  atomic_store(&u->cmd, TUNE_CMD_START);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// gain and setpoint go back at the next sample; returns 1 if no run
+// is going
+
+int tune_abort(int dev)
+  {
+  if(!tune_running(dev))
+    return 1;
+  atomic_store(&tunes[dev].cmd, TUNE_CMD_ABORT);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+bool tune_running(int dev)
+  {
+  int st;
+
+  st=atomic_load(&tunes[dev].state);
+  return (st>=TUNE_SETTLE && st<=TUNE_STEP_DOWN) || atomic_load(&tunes[dev].cmd)==TUNE_CMD_START;
+  }
+
+
+//-------------------------------------------------------------------
+
+// sfix_24.7 in 8 ns counts to ns
+
+double tune_pherr_ns(uint32_t raw)
+  {
+  int n;
+
+  n=(int)(raw & PHERR_MASK);
+  n=(n ^ PHERR_SIGN)-PHERR_SIGN;
+  return n/16.;
+  }
+
+
+//-------------------------------------------------------------------
+
+void tune_phase(struct tune *u, enum tune_state st, uint64_t t)
+  {
+  memset(&u->acc, 0, sizeof(u->acc));
+  u->acc.t_out=t;
+  u->t_phase=t;
+  atomic_store_explicit(&u->state, st, memory_order_relaxed);
+  }
+
+
+//-------------------------------------------------------------------
+
+// one sample of PHERR e (ns, less the mean at rest once it is known)
+// into the current phase
+
+void tune_acc(struct tune *u, double e, double band, uint64_t t)
+  {
+  struct tune_acc *a;
+  double step_ns;
+
+  a=&u->acc;
+  a->n++;
+  a->sum+=e;
+  a->sumsq+=e*e;
+  if(fabs(e)>a->peak)
+    a->peak=fabs(e);
+  if(band<=0)
+    return;
+
+  // which way the step pushes the error is the first thing it does
+  step_ns=fabs(u->stepcnt*8.);
+  if(a->dir==0 && fabs(e)>step_ns/2)
+    a->dir=(e>0)? 1 : -1;
+  if(a->dir!=0 && -a->dir*e>a->over)
+    a->over=-a->dir*e;
+  if(fabs(e)>band)
+    a->t_out=t;
+  }
+
+
+//-------------------------------------------------------------------
+
+// on to the next gain, or the end
+
+void tune_next(int dev, uint64_t t)
+  {
+  struct tune *u;
+
+  u=&tunes[dev];
+  u->cur++;
+  if(u->cur>=u->ncand)
+    {
+    tune_finish(dev, TUNE_DONE, NULL, true);
+    return;
+    }
+  dev_writereg(&devs[dev], 11, u->cand[u->cur].gain_raw & GAIN_MASK);
+  u->sumsq=0;
+  u->nsum=0;
+  tune_phase(u, TUNE_SETTLE, t);
+  }
+
+
+//-------------------------------------------------------------------
+
+// pick the best gain, put the registers back if restore (or apply
+// the result) and publish; why is NULL if the run went through
+
+void tune_finish(int dev, enum tune_state st, const char *why, bool restore)
+  {
+  struct tune    *u;
+  struct chopdev *d;
+  double thr;
+  int i;
+
+  u=&tunes[dev];
+  d=&devs[dev];
+  // the gain being measured when the run stopped has no result
+  for(i=(u->cur>0)? u->cur : 0; i<u->ncand; i++)
+    if(u->cand[i].res==TUNE_PENDING)
+      u->cand[i].res=TUNE_SKIPPED;
+
+  u->best=-1;
+  for(i=0; i<u->ncand; i++)
+    if(u->cand[i].res==TUNE_OK && (u->best<0 || u->cand[i].rms_ns<u->cand[u->best].rms_ns))
+      u->best=i;
+  if(u->best>=0)
+    {
+    thr=ceil(TUNE_UNW_MARGIN*u->cand[u->best].peak_ns/8.);
+    u->unwthr=(thr>MAX_UNWTHR_CNTS)? MAX_UNWTHR_CNTS : (uint32_t)thr;
+    }
+  else if(st==TUNE_DONE)
+    {
+    st=TUNE_FAILED;
+    why="no gain settled";
+    }
+
+  if(restore)
+    {
+    if(st==TUNE_DONE && u->apply)
+      {
+      dev_writereg(d, 11, u->cand[u->best].gain_raw & GAIN_MASK);
+      dev_writereg(d, 2, u->unwthr & UNWTHR_MASK);
+      }
+    else
+      dev_writereg(d, 11, u->gain0 & GAIN_MASK);
+    dev_writereg(d, 3, ((unsigned int)u->base) & PHSETPOINT_MASK);
+    }
+  u->why=why;
+  atomic_store(&u->state, st);
+  }
+
+
+//-------------------------------------------------------------------
+
+// one sample of the run of a device at time t; runs in the sampler
+// thread, after sampler_take()
+
+void tune_step(int dev, uint64_t t)
+  {
+  struct smp_sample *s;
+  struct tune_cand  *c;
+  struct tune       *u;
+  struct chopdev    *d;
+  uint32_t r0;
+  double   e, band, step_ns;
+  int cmd, st, n, i, want;
+  bool locked;
+
+  u=&tunes[dev];
+  d=&devs[dev];
+  s=&smp.ring[dev].s[(atomic_load_explicit(&smp.ring[dev].head, memory_order_relaxed)-1)&(SMP_RINGLEN-1)];
+  r0=s->reg[SMP_IDX_STATUS];
+  locked=((r0 & (FREQUENCY|PHASE))==(FREQUENCY|PHASE)) && (r0 & STICKYLOL_MASK)==0;
+
+  cmd=atomic_exchange(&u->cmd, TUNE_CMD_NONE);
+  if(cmd==TUNE_CMD_START)
+    {
+    u->apply=u->req_apply;
+    u->why=NULL;
+    u->best=-1;
+    u->unwthr=0;
+    u->cur=-1;
+    u->ncand=TUNE_NGAINS;
+    for(i=0; i<u->ncand; i++)
+      {
+      memset(&u->cand[i], 0, sizeof(u->cand[i]));
+      u->cand[i].gain_raw=(uint32_t)lround(tune_gains[i]*POW_2_12);
+      u->cand[i].res=TUNE_PENDING;
+      }
+    n=(int)(dev_readreg(d, 3) & PHSETPOINT_MASK);
+    u->base=(n ^ PHSETPOINT_SIGN)-PHSETPOINT_SIGN;
+    u->gain0=dev_readreg(d, 11) & GAIN_MASK;
+    u->unwthr0=dev_readreg(d, 2) & UNWTHR_MASK;
+    u->stepcnt=(int)lround(u->req_step_ns/8.);
+    if(u->stepcnt<1)
+      u->stepcnt=1;
+    // stay inside the setpoint range
+    if(u->base+u->stepcnt>MAX_SETPOINT_CNTS)
+      u->stepcnt=-u->stepcnt;
+
+    if(!locked)
+      tune_finish(dev, TUNE_FAILED, "not locked", false);
+    else if(ramp_running(dev))
+      tune_finish(dev, TUNE_FAILED, "phase ramp running", false);
+    else
+      tune_next(dev, t);
+    return;
+    }
+  st=atomic_load_explicit(&u->state, memory_order_relaxed);
+  if(st<TUNE_SETTLE || st>TUNE_STEP_DOWN)
+    return;
+  if(cmd==TUNE_CMD_ABORT)
+    {
+    tune_finish(dev, TUNE_ABORTED, "by hand", true);
+    return;
+    }
+
+  c=&u->cand[u->cur];
+  // a setpoint or gain written by somebody else ends the run, and
+  // what they wrote stays
+  want=u->base+((st==TUNE_STEP_UP)? u->stepcnt : 0);
+  if((dev_readreg(d, 3) & PHSETPOINT_MASK)!=(((unsigned int)want) & PHSETPOINT_MASK) ||
+     (dev_readreg(d, 11) & GAIN_MASK)!=(c->gain_raw & GAIN_MASK))
+    {
+    tune_finish(dev, TUNE_ABORTED, "registers written from outside", false);
+    return;
+    }
+  if(!locked)
+    {
+    c->res=TUNE_LOL;
+    tune_finish(dev, TUNE_DONE, NULL, true);
+    return;
+    }
+
+  e=tune_pherr_ns(s->reg[SMP_IDX_PHERR]);
+  step_ns=fabs(u->stepcnt*8.);
+  switch(st)
+    {
+    case TUNE_SETTLE:
+      if(t-u->t_phase >= TUNE_SETTLE_MS*1000000ULL)
+        tune_phase(u, TUNE_NOISE, t);
+      break;
+
+    case TUNE_NOISE:
+      tune_acc(u, e, 0, t);
+      if(t-u->t_phase >= TUNE_NOISE_MS*1000000ULL)
+        {
+        c->mean_ns=u->acc.sum/u->acc.n;
+        c->noise_ns=sqrt(fmax(0., u->acc.sumsq/u->acc.n-c->mean_ns*c->mean_ns));
+        c->peak_ns=u->acc.peak;
+        u->sumsq=u->acc.n*c->noise_ns*c->noise_ns;
+        u->nsum=u->acc.n;
+        dev_writereg(d, 3, ((unsigned int)(u->base+u->stepcnt)) & PHSETPOINT_MASK);
+        tune_phase(u, TUNE_STEP_UP, t);
+        }
+      break;
+
+    case TUNE_STEP_UP:
+    case TUNE_STEP_DOWN:
+      band=fmax(step_ns*TUNE_BAND_PCT/100., 3*c->noise_ns);
+      tune_acc(u, e-c->mean_ns, band, t);
+      if(fabs(e)>c->peak_ns)
+        c->peak_ns=fabs(e);
+      if(t-u->t_phase < TUNE_STEP_MS*1000000ULL)
+        break;
+      c->overshoot_pct=fmax(c->overshoot_pct, 100.*u->acc.over/step_ns);
+      c->settle_ms=fmax(c->settle_ms, (u->acc.t_out-u->t_phase)/1e6);
+      u->sumsq+=u->acc.sumsq;
+      u->nsum+=u->acc.n;
+      // out of the band in the last tenth of the window: not settled
+      if(u->acc.t_out-u->t_phase > TUNE_STEP_MS*900000ULL)
+        c->res=TUNE_UNSETTLED;
+      if(st==TUNE_STEP_UP)
+        {
+        dev_writereg(d, 3, ((unsigned int)u->base) & PHSETPOINT_MASK);
+        tune_phase(u, TUNE_STEP_DOWN, t);
+        }
+      else
+        {
+        c->rms_ns=sqrt(u->sumsq/u->nsum);
+        if(c->res==TUNE_PENDING)
+          c->res=TUNE_OK;
+        tune_next(dev, t);
+        }
+      break;
+
+    default:
+      break;
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// write the recommendation of the last complete run; main thread
+// returns -1 if there is none
+
+int tune_apply(int dev)
+  {
+  struct tune *u;
+
+  u=&tunes[dev];
+  if(atomic_load(&u->state)!=TUNE_DONE || u->best<0 || tune_running(dev))
+    return -1;
+  dev_writereg(&devs[dev], 11, u->cand[u->best].gain_raw & GAIN_MASK);
+  dev_writereg(&devs[dev], 2, u->unwthr & UNWTHR_MASK);
+  return 0;
+  }
@@ -0,0 +1,153 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync loop gain auto-tuning            ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// AUTOTUNE measures the phase loop of a device at every gain in
+// tune_gains[] and recommends the one with the lowest RMS phase error,
+// with an unwrapper threshold to go with it; for each gain, with the
+// loop locked:
+//
+//   write the gain, wait TUNE_SETTLE_MS
+//   TUNE_NOISE_MS at rest: mean and RMS of PHERR (the noise)
+//   phase setpoint + step, TUNE_STEP_MS of response
+//   phase setpoint back, TUNE_STEP_MS of response
+//
+// from the two responses (PHERR less its mean at rest) come the
+// overshoot, in % of the step, and the settling time, after which the
+// error stays within TUNE_BAND_PCT % of the step or 3 noise RMS,
+// whichever is larger; the RMS phase error of a gain is taken over the
+// rest and both steps together, so that a fast but noisy loop and a
+// quiet but slow one are weighed on the same scale
+// gains are tried from the lowest up; if the lock is lost the gain and
+// setpoint are put back at once and the higher gains are not tried
+//
+// the recommended unwrapper threshold (register 2, in 8 ns counts like
+// the setpoint) is TUNE_UNW_MARGIN times the largest error seen at the
+// chosen gain, step included: above what the loop does in normal
+// operation, but as low as that allows
+//
+// everything runs in the sampler thread, one step per sample, so the
+// steps and the response are timed to the sample; at the end the
+// original gain and setpoint are back, unless the run was asked to
+// apply its result
+// the main thread only posts START/ABORT requests and reads the
+// results once the state says the run is over
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include "config.h"
+#include "device.h"
+
+#define TUNE_MAXCAND       8
+#define TUNE_NGAINS        7        // in tune_gains[]
+#define TUNE_SETTLE_MS     300
+#define TUNE_NOISE_MS      250
+#define TUNE_STEP_MS       250
+#define TUNE_BAND_PCT      5
+#define TUNE_UNW_MARGIN    2.
+#define TUNE_DEFAULT_STEP_NS 40
+#define TUNE_MAX_STEP_NS   1000
+
+enum tune_state
+  {
+  TUNE_IDLE,
+  TUNE_SETTLE,
+  TUNE_NOISE,
+  TUNE_STEP_UP,
+  TUNE_STEP_DOWN,
+  TUNE_DONE,
+  TUNE_ABORTED,
+  TUNE_FAILED,
+  TUNE_NSTATES
+  };
+
+enum tune_cmd
+  {
+  TUNE_CMD_NONE,
+  TUNE_CMD_START,
+  TUNE_CMD_ABORT
+  };
+
+// what became of one gain
+enum tune_res
+  {
+  TUNE_PENDING,
+  TUNE_OK,
+  TUNE_UNSETTLED,    // still outside the band at the end of a step
+  TUNE_LOL,          // lost the lock
+  TUNE_SKIPPED,      // not tried after a loss of lock
+  TUNE_NRES
+  };
+
+struct tune_cand
+  {
+  uint32_t      gain_raw;          // ufix_16.12
+  enum tune_res res;
+  double        noise_ns, mean_ns;
+  double        overshoot_pct, settle_ms;
+  double        rms_ns, peak_ns;
+  };
+
+// accumulators of one measuring phase
+struct tune_acc
+  {
+  unsigned long n;
+  double        sum, sumsq, peak;
+  double        over;              // furthest past zero, against the step
+  int           dir;               // sign of the error the step makes, 0 until seen
+  uint64_t      t_out;             // last sample outside the band
+  };
+
+struct tune
+  {
+  atomic_int       cmd;
+  atomic_int       state;
+  // request, valid while cmd is TUNE_CMD_START
+  double           req_step_ns;
+  bool             req_apply;
+  // run, sampler thread only
+  bool             apply;
+  int              stepcnt;        // step in 8 ns counts, signed
+  int              base;           // setpoint before the run, counts
+  uint32_t         gain0, unwthr0; // registers before the run
+  uint64_t         t_phase;        // CLOCK_MONOTONIC ns
+  struct tune_acc  acc;
+  double           sumsq;          // of the current gain, all phases
+  unsigned long    nsum;
+  // results, written by the sampler thread; complete once the state
+  // is DONE, ABORTED or FAILED
+  const char      *why;
+  int              cur, ncand, best;
+  uint32_t         unwthr;         // recommended threshold, counts
+  struct tune_cand cand[TUNE_MAXCAND];
+  };
+
+extern const char     *tune_state_names[TUNE_NSTATES];
+extern const char     *tune_res_names[TUNE_NRES];
+extern const double    tune_gains[TUNE_NGAINS];
+extern struct tune     tunes[MAXDEV];
+
+
+/******* protos *******/
+
+int    tune_start(int dev, double step_ns, bool apply);
+int    tune_abort(int dev);
+bool   tune_running(int dev);
+double tune_pherr_ns(uint32_t raw);
+void   tune_phase(struct tune *u, enum tune_state st, uint64_t t);
+void   tune_acc(struct tune *u, double e, double band, uint64_t t);
+void   tune_next(int dev, uint64_t t);
+void   tune_finish(int dev, enum tune_state st, const char *why, bool restore);
+void   tune_step(int dev, uint64_t t);
+int    tune_apply(int dev);
+
+#endif
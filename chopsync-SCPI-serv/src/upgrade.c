@@ -0,0 +1,852 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync hot upgrade                      ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <sys/wait.h>
+#include "server.h"
+
+/***  globals  ***/
+struct upgrade upg = { .sigfd = -1, .chan = -1 };
+
+extern char **environ;
+
+
+//-------------------------------------------------------------------
+
+// SIGUSR2 through a signalfd, before any thread exists so that all of
+// them keep it blocked; then take over the fds of an old server, or
+// those systemd passed; returns -1 if a handover was started and failed
+
+int upgrade_open(void)
+  {
+  sigset_t mask;
+  ssize_t  len;
+  char    *p;
+
+  len=readlink("/proc/self/exe", upg.exe, sizeof(upg.exe)-1);
+  upg.exe[(len>0)? len : 0]=0;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  if(sigprocmask(SIG_BLOCK, &mask, NULL)<0 || (upg.sigfd=signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC))<0)
+    {
+    perror("upgrade signalfd");
+    upg.sigfd=-1;
+    }
+
+  p=getenv(UPG_ENV);
+  if(p!=NULL)
+    {
+    upg.chan=atoi(p);
+    unsetenv(UPG_ENV);
+    fcntl(upg.chan, F_SETFD, FD_CLOEXEC);
+    if(upgrade_receive(upg.chan)!=0)
+      {
+      close(upg.chan);
+      upg.chan=-1;
+      return -1;
+      }
+    return 0;
+    }
+
+  upgrade_systemd();
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// one message, with the fds that come along; returns the length or -1
+
+int upgrade_recvmsg(int chan, void *buf, size_t len, int *fds, int maxfds, int *nfds)
+  {
+  char   cbuf[CMSG_SPACE(sizeof(int)*UPG_FDS_PER_MSG)];
+  struct msghdr   msg;
+  struct iovec    iov;
+  struct cmsghdr *cm;
+  ssize_t n;
+
+  iov.iov_base=buf;
+  iov.iov_len=len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  msg.msg_control=cbuf;
+  msg.msg_controllen=sizeof(cbuf);
+  n=recvmsg(chan, &msg, MSG_CMSG_CLOEXEC);
+  if(n<=0 || (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC))!=0)
+    return -1;
+
+  *nfds=0;
+  for(cm=CMSG_FIRSTHDR(&msg); cm!=NULL; cm=CMSG_NXTHDR(&msg, cm))
+    if(cm->cmsg_level==SOL_SOCKET && cm->cmsg_type==SCM_RIGHTS)
+      {
+      *nfds=(cm->cmsg_len-CMSG_LEN(0))/sizeof(int);
+      if(*nfds>maxfds)
+        return -1;
+      memcpy(fds, CMSG_DATA(cm), *nfds*sizeof(int));
+      }
+  return (int)n;
+  }
+
+
+//-------------------------------------------------------------------
+
+// new server: the state, then the fds in batches; an empty batch ends
+
+int upgrade_receive(int chan)
+  {
+  static struct upg_fdmsg m;
+  int fds[UPG_FDS_PER_MSG];
+  int i, n, nfds;
+
+  n=upgrade_recvmsg(chan, &upg.st, sizeof(upg.st), fds, 0, &nfds);
+  if(n!=(int)sizeof(upg.st) || upg.st.magic!=UPG_MAGIC ||
+     upg.st.version!=UPG_VERSION || upg.st.size!=sizeof(upg.st))
+    {
+    fprintf(stderr, "upgrade: state from the running server not understood (version %u); not taking over\n",
+            (n>=12)? upg.st.version : 0);
+    return -1;
+    }
+
+  while(1)
+    {
+    n=upgrade_recvmsg(chan, &m, sizeof(m), fds, UPG_FDS_PER_MSG, &nfds);
+    if(n<(int)sizeof(int) || m.n<0 || m.n>UPG_FDS_PER_MSG || m.n!=nfds || upg.nfds+m.n>UPG_MAXFDS)
+      {
+      fprintf(stderr, "upgrade: bad fd batch from the running server\n");
+      for(i=0; i<nfds; i++)
+        close(fds[i]);
+      return -1;
+      }
+    if(m.n==0)
+      break;
+    for(i=0; i<m.n; i++)
+      {
+      upg.fds[upg.nfds]=m.r[i];
+      upg.fds[upg.nfds].fd=fds[i];
+      upg.fds[upg.nfds].taken=false;
+      upg.nfds++;
+      }
+    }
+
+  upg.inherited=true;
+  upg.upgraded=true;
+  fprintf(stderr, "upgrade: %d fds from the running server\n", upg.nfds);
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// sd_listen_fds(): listeners are told apart by port or path
+
+int upgrade_systemd(void)
+  {
+  struct sockaddr_storage ss;
+  struct sockaddr_in *sin;
+  struct sockaddr_in6 *sin6;
+  struct sockaddr_un *sun;
+  struct upg_fd *r;
+  socklen_t len;
+  char *pid, *nfd;
+  int fd, n, port;
+
+  pid=getenv("LISTEN_PID");
+  nfd=getenv("LISTEN_FDS");
+  if(pid==NULL || nfd==NULL || atol(pid)!=(long)getpid())
+    return 0;
+  n=atoi(nfd);
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+
+  for(fd=SD_LISTEN_FDS_START; fd<SD_LISTEN_FDS_START+n && upg.nfds<UPG_MAXFDS; fd++)
+    {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    r=&upg.fds[upg.nfds];
+    memset(r, 0, sizeof(*r));
+    r->fd=fd;
+    r->kind=UPG_INTERNAL;
+    len=sizeof(ss);
+    memset(&ss, 0, sizeof(ss));
+    if(getsockname(fd, (struct sockaddr *)&ss, &len)==0)
+      {
+      if(ss.ss_family==AF_INET || ss.ss_family==AF_INET6)
+        {
+        // ListenStream=8888 gives a dual-stack IPv6 socket
+        sin=(struct sockaddr_in *)&ss;
+        sin6=(struct sockaddr_in6 *)&ss;
+        port=ntohs(ss.ss_family==AF_INET? sin->sin_port : sin6->sin6_port);
+        if(port==cfg.port)
+          r->kind=UPG_TCP_LISTEN;
+        else if(cfg.http_port!=0 && port==cfg.http_port)
+          r->kind=UPG_HTTP_LISTEN;
+        }
+      else if(ss.ss_family==AF_UNIX && len>offsetof(struct sockaddr_un, sun_path))
+        {
+        sun=(struct sockaddr_un *)&ss;
+        r->kind=UPG_UNIX_LISTEN;
+        if(sun->sun_path[0]==0)
+          {
+          // abstract: shown as '@' like in the config file
+          r->name[0]='@';
+          memcpy(r->name+1, sun->sun_path+1, len-offsetof(struct sockaddr_un, sun_path)-1);
+          }
+        else
+          memcpy(r->name, sun->sun_path, MAXUNIXPATH-1);
+        }
+      }
+    if(r->kind==UPG_INTERNAL)
+      {
+      fprintf(stderr, "systemd: fd %d is not a socket we listen on; closed\n", fd);
+      close(fd);
+      continue;
+      }
+    upg.nfds++;
+    }
+  upg.inherited=(upg.nfds>0);
+  fprintf(stderr, "systemd: %d listening sockets\n", upg.nfds);
+  return upg.nfds;
+  }
+
+
+//-------------------------------------------------------------------
+
+// an inherited fd for this use, or -1; name NULL and idx -1 match any
+
+int upgrade_take(int kind, const char *name, int idx)
+  {
+  struct upg_fd *r;
+  int i;
+
+  for(i=0; i<upg.nfds; i++)
+    {
+    r=&upg.fds[i];
+    if(r->taken || r->kind!=kind)
+      continue;
+    if(name!=NULL && strcmp(r->name, name)!=0)
+      continue;
+    if(idx>=0 && r->idx!=idx)
+      continue;
+    r->taken=true;
+    return r->fd;
+    }
+  return -1;
+  }
+
+
+//-------------------------------------------------------------------
+
+bool upgrade_has(int kind, const char *name)
+  {
+  int i;
+
+  for(i=0; i<upg.nfds; i++)
+    if(upg.fds[i].kind==kind && strcmp(upg.fds[i].name, name)==0)
+      return true;
+  return false;
+  }
+
+
+//-------------------------------------------------------------------
+
+// new server, devices open and sampler not started yet: take the CAN
+// state over, then tell the old server to stop its sampler and go
+
+int upgrade_commit(void)
+  {
+  struct upg_dev  *u;
+  struct upg_link *ul;
+  struct can_link *l;
+  struct supervisor *s;
+  struct pollfd pfd;
+  char   buf[32];
+  int    i, k, p;
+
+  if(!upg.upgraded)
+    return 0;
+
+  can_requests=upg.st.can_requests;
+  can_coalesced=upg.st.can_coalesced;
+  can_retries=upg.st.can_retries;
+  for(i=0; i<ndevs && i<upg.st.ndevs; i++)
+    {
+    u=&upg.st.dev[i];
+    // same device only if it still talks to the same MECOS
+    if(strcmp(u->ifname, devs[i].can.ifname)!=0 || u->nodeoff!=devs[i].can.nodeoff)
+      continue;
+    memcpy(devs[i].can.cache, u->cache, sizeof(u->cache));
+    memcpy(devs[i].can.rtt, u->rtt, sizeof(u->rtt));
+    memcpy(devs[i].can.rto_shift, u->rto_shift, sizeof(u->rto_shift));
+    s=&sv[i];
+    s->losses=u->sv_losses;
+    s->recovered=u->sv_recovered;
+    s->failed=u->sv_failed;
+    s->gaveup=u->sv_gaveup;
+    s->overridden=u->sv_overridden;
+    memcpy(s->log, u->sv_log, sizeof(s->log));
+    atomic_store(&s->loghead, u->sv_loghead);
+    s->reported=u->sv_reported;
+    }
+  for(k=0; k<CAN_MAXLINKS; k++)
+    {
+    ul=&upg.st.link[k];
+    if(ul->ifname[0]==0)
+      continue;
+    for(i=0; i<CAN_MAXLINKS; i++)
+      {
+      l=&can_links[i];
+      if(l->users==0 || strcmp(l->ifname, ul->ifname)!=0)
+        continue;
+      ul->mon.sock=l->mon.sock;
+      l->mon=ul->mon;
+      for(p=0; p<CAN_NPRIO; p++)
+        {
+        l->txq[p].maxdepth=ul->txq[p].maxdepth;
+        l->txq[p].maxwait_us=ul->txq[p].maxwait_us;
+        l->txq[p].sent=ul->txq[p].sent;
+        l->txq[p].deferred=ul->txq[p].deferred;
+        l->txq[p].dropped=ul->txq[p].dropped;
+        }
+      }
+    }
+
+  // systemd follows us from now on
+  snprintf(buf, sizeof(buf), "MAINPID=%d", (int)getpid());
+  upgrade_notify(buf);
+
+  if(write(upg.chan, "R", 1)!=1)
+    perror("upgrade READY");
+  // the old server answers once its sampler has stopped
+  pfd.fd=upg.chan;
+  pfd.events=POLLIN;
+  if(poll(&pfd, 1, UPG_READY_MS)!=1 || read(upg.chan, buf, 1)!=1 || buf[0]!='B')
+    fprintf(stderr, "upgrade: no goodbye from the old server; taking over anyway\n");
+  close(upg.chan);
+  upg.chan=-1;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// new server, everything open: clients back into the select set,
+// counters and switches as they were; inherited fds nobody wanted
+// any more are closed
+
+void upgrade_finish(int *maxfd)
+  {
+  struct upg_fd *r;
+  struct httpconn *c;
+  struct conn *cn;
+  int i, nclients;
+
+  if(!upg.inherited)
+    return;
+
+  nclients=0;
+  for(i=0; i<upg.nfds; i++)
+    {
+    r=&upg.fds[i];
+    if(r->taken)
+      continue;
+    if(r->kind==UPG_TCP_CLIENT || r->kind==UPG_LOCAL_CLIENT ||
+       (r->kind==UPG_HTTP_CLIENT && http.sock>=0 && r->idx>=0 && r->idx<HTTP_MAXCONN && http.c[r->idx].fd<0))
+      {
+      if(r->fd>=FD_SETSIZE)
+        {
+        close(r->fd);
+        continue;
+        }
+      if(r->kind!=UPG_HTTP_CLIENT)
+        {
+        // our pool may be smaller than the old one's
+        r->taken=true;
+        if((cn=conn_open(r->fd))==NULL)
+          continue;
+        if(r->kind==UPG_LOCAL_CLIENT)
+          cn->peer=r->peer;
+        *cn->in=r->in;
+        }
+      if(r->kind==UPG_HTTP_CLIENT)
+        {
+        c=&http.c[r->idx];
+        *c=upg.st.hc[r->idx];
+        c->fd=r->fd;
+        }
+      r->taken=true;
+      FD_SET(r->fd, &active_fd_set);
+      if(r->fd>*maxfd)
+        *maxfd=r->fd;
+      nclients++;
+      continue;
+      }
+    fprintf(stderr, "upgrade: inherited fd %d (kind %d %s) not used any more; closed\n", r->fd, r->kind, r->name);
+    close(r->fd);
+    r->taken=true;
+    }
+
+  if(upg.upgraded)
+    {
+    if(telem.sock>=0)
+      {
+      telem.seq=upg.st.tm_seq;
+      telem.sent=upg.st.tm_sent;
+      telem.errors=upg.st.tm_errors;
+      telemetry_set_rate(upg.st.tm_rate);
+      }
+    if(http.sock>=0)
+      {
+      http.requests=upg.st.http_requests;
+      http.pushes=upg.st.http_pushes;
+      http.dropped=upg.st.http_dropped;
+      http_set_rate(upg.st.http_rate);
+      }
+    if(sv_eventfd>=0)
+      for(i=0; i<ndevs && i<upg.st.ndevs; i++)
+        supervisor_enable(i, upg.st.dev[i].sv_enable && supervisor_mecos_polled(&devs[i]));
+    fprintf(stderr, "upgrade: took over %d clients\n", nclients);
+    }
+  }
+
+
+//-------------------------------------------------------------------
+
+// sd_notify() without libsystemd
+
+void upgrade_notify(const char *msg)
+  {
+  struct sockaddr_un name;
+  socklen_t len;
+  char *p;
+  int fd;
+
+  p=getenv("NOTIFY_SOCKET");
+  if(p==NULL || (p[0]!='/' && p[0]!='@') || strlen(p)>=sizeof(name.sun_path))
+    return;
+  memset(&name, 0, sizeof(name));
+  name.sun_family=AF_UNIX;
+  strcpy(name.sun_path, p);
+  len=offsetof(struct sockaddr_un, sun_path)+strlen(p);
+  if(p[0]=='@')
+    name.sun_path[0]=0;
+  fd=socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+  if(fd<0)
+    return;
+  if(sendto(fd, msg, strlen(msg), MSG_NOSIGNAL, (struct sockaddr *)&name, len)<0)
+    perror("sd_notify");
+  close(fd);
+  }
+
+
+//-------------------------------------------------------------------
+
+// SIGUSR2: hand over as soon as we are idle
+
+void upgrade_signal(void)
+  {
+  struct signalfd_siginfo si;
+  const char *why;
+
+  while(read(upg.sigfd, &si, sizeof(si))==sizeof(si))
+    ;
+  if(upg.requested)
+    return;
+  if(upg.exe[0]==0)
+    {
+    fprintf(stderr, "upgrade: don't know our own binary; not upgrading\n");
+    return;
+    }
+  // these may take minutes: refuse rather than keep clients waiting
+  why=upgrade_busy();
+  if(why!=NULL)
+    {
+    fprintf(stderr, "upgrade: refused, %s\n", why);
+    return;
+    }
+  fprintf(stderr, "upgrade: requested, waiting to be idle\n");
+  upg.requested=true;
+  clock_gettime(CLOCK_MONOTONIC, &upg.since);
+  }
+
+
+//-------------------------------------------------------------------
+
+// what an fd of the old server is, as the new one must know it
+
+int upgrade_kind(int fd, int lsock, int *idx)
+  {
+  struct httpconn *c;
+  struct chopdev  *d;
+  struct can_link *l;
+  struct conn     *cn;
+  int k;
+
+  *idx=-1;
+  if(fd==lsock)
+    return UPG_TCP_LISTEN;
+  if((k=local_listener_by_fd(fd))>=0)
+    {
+    *idx=k;
+    return UPG_UNIX_LISTEN;
+    }
+  if(http.sock>=0 && fd==http.sock)
+    return UPG_HTTP_LISTEN;
+  if((c=http_conn_by_fd(fd))!=NULL)
+    {
+    *idx=(int)(c-http.c);
+    return UPG_HTTP_CLIENT;
+    }
+  if((d=device_by_canfd(fd))!=NULL)
+    {
+    *idx=d->id;
+    return UPG_CAN_NODE;
+    }
+  if((l=can_link_by_monfd(fd))!=NULL)
+    {
+    *idx=(int)(l-can_links);
+    return UPG_CAN_MON;
+    }
+  if(fd==http.timerfd || fd==telem.timerfd || fd==sv_eventfd || fd==mecos_poll_fd || fd==upg.sigfd || fd==canlink_nlsock)
+    return UPG_INTERNAL;
+  if((cn=conn_by_fd(fd))!=NULL && cn->peer.local)
+    return UPG_LOCAL_CLIENT;
+  return UPG_TCP_CLIENT;
+  }
+
+
+//-------------------------------------------------------------------
+
+// work a new server could not pick up where we leave it; NULL if none
+
+const char *upgrade_busy(void)
+  {
+  enum sv_state st;
+  int i;
+
+  for(i=0; i<ndevs; i++)
+    {
+    if(ramp_running(i))
+      return "phase ramp running";
+    // the gain and the setpoint are only put back at the end of it
+    if(tune_running(i))
+      return "auto-tuning running";
+    st=sv[i].state;
+    if(atomic_load(&sv[i].enable) && (st==SV_WAITMECOS || st==SV_RESET || st==SV_RELOCK))
+      return "lock recovery running";
+    }
+  return NULL;
+  }
+
+
+//-------------------------------------------------------------------
+
+// nothing outstanding: no answer waiting for CAN, no request on the
+// bus, no frame queued
+
+bool upgrade_idle(void)
+  {
+  int i, p;
+
+  for(i=0; i<MAXPENDING; i++)
+    if(pendings[i].used)
+      return false;
+  for(i=0; i<CAN_MAXINFLIGHT; i++)
+    if(can_inflight[i].used)
+      return false;
+  for(i=0; i<CAN_MAXLINKS; i++)
+    if(can_links[i].users>0)
+      for(p=0; p<CAN_NPRIO; p++)
+        if(can_links[i].txq[p].count>0)
+          return false;
+  return true;
+  }
+
+
+//-------------------------------------------------------------------
+
+// while waiting to hand over, clients and the background MECOS poll
+// are not served: commands wait in the kernel for the new server;
+// select wakes up often enough to notice we are idle
+
+struct timeval *upgrade_quiesce(fd_set *set, int lsock, struct timeval *tv, struct timeval *tvp)
+  {
+  int fd, kind, idx;
+
+  for(fd=0; fd<FD_SETSIZE; fd++)
+    if(FD_ISSET(fd, set))
+      {
+      kind=upgrade_kind(fd, lsock, &idx);
+      if(kind==UPG_TCP_LISTEN || kind==UPG_UNIX_LISTEN || kind==UPG_HTTP_LISTEN ||
+         kind==UPG_TCP_CLIENT || kind==UPG_LOCAL_CLIENT || kind==UPG_HTTP_CLIENT || fd==mecos_poll_fd)
+        FD_CLR(fd, set);
+      }
+  if(tvp==NULL || tv->tv_sec>0 || tv->tv_usec>UPG_TICK_MS*1000)
+    {
+    tv->tv_sec=0;
+    tv->tv_usec=UPG_TICK_MS*1000;
+    }
+  return tv;
+  }
+
+
+//-------------------------------------------------------------------
+
+// end of every loop turn while an upgrade is requested
+
+void upgrade_poll(int lsock)
+  {
+  struct timespec now;
+  long waited_ms;
+
+  if(!upg.requested)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  waited_ms=(now.tv_sec-upg.since.tv_sec)*1000L + (now.tv_nsec-upg.since.tv_nsec)/1000000L;
+  if(!upgrade_idle())
+    {
+    if(waited_ms<UPG_IDLE_MS)
+      return;
+    fprintf(stderr, "upgrade: not idle after %ld ms; cancelled\n", waited_ms);
+    }
+  else if(upgrade_start(lsock)!=0)
+    fprintf(stderr, "upgrade: failed; this server goes on\n");
+  upg.requested=false;
+  }
+
+
+//-------------------------------------------------------------------
+
+int upgrade_sendfds(int chan, struct upg_fdmsg *m)
+  {
+  char   cbuf[CMSG_SPACE(sizeof(int)*UPG_FDS_PER_MSG)];
+  struct msghdr   msg;
+  struct iovec    iov;
+  struct cmsghdr *cm;
+  int    i;
+
+  iov.iov_base=m;
+  iov.iov_len=sizeof(*m);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  if(m->n>0)
+    {
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_control=cbuf;
+    msg.msg_controllen=CMSG_SPACE(sizeof(int)*m->n);
+    cm=CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level=SOL_SOCKET;
+    cm->cmsg_type=SCM_RIGHTS;
+    cm->cmsg_len=CMSG_LEN(sizeof(int)*m->n);
+    for(i=0; i<m->n; i++)
+      memcpy(CMSG_DATA(cm)+i*sizeof(int), &m->r[i].fd, sizeof(int));
+    }
+  if(sendmsg(chan, &msg, MSG_NOSIGNAL)!=(ssize_t)sizeof(*m))
+    {
+    perror("upgrade sendmsg");
+    return -1;
+    }
+  m->n=0;
+  return 0;
+  }
+
+
+//-------------------------------------------------------------------
+
+// old server: state first, then every fd the new one needs
+
+int upgrade_send(int chan, int lsock)
+  {
+  static struct upg_state st;
+  static struct upg_fdmsg m;
+  struct upg_fd *r;
+  struct upg_dev *u;
+  int fd, kind, idx, i, n;
+
+  memset(&st, 0, sizeof(st));
+  st.magic=UPG_MAGIC;
+  st.version=UPG_VERSION;
+  st.size=sizeof(st);
+  st.ndevs=ndevs;
+  st.can_requests=can_requests;
+  st.can_coalesced=can_coalesced;
+  st.can_retries=can_retries;
+  for(i=0; i<ndevs; i++)
+    {
+    u=&st.dev[i];
+    strcpy(u->ifname, devs[i].can.ifname);
+    u->nodeoff=devs[i].can.nodeoff;
+    memcpy(u->cache, devs[i].can.cache, sizeof(u->cache));
+    memcpy(u->rtt, devs[i].can.rtt, sizeof(u->rtt));
+    memcpy(u->rto_shift, devs[i].can.rto_shift, sizeof(u->rto_shift));
+    u->sv_enable=atomic_load(&sv[i].enable);
+    u->sv_losses=sv[i].losses;
+    u->sv_recovered=sv[i].recovered;
+    u->sv_failed=sv[i].failed;
+    u->sv_gaveup=sv[i].gaveup;
+    u->sv_overridden=sv[i].overridden;
+    u->sv_loghead=atomic_load(&sv[i].loghead);
+    u->sv_reported=sv[i].reported;
+    memcpy(u->sv_log, sv[i].log, sizeof(u->sv_log));
+    }
+  for(i=0; i<CAN_MAXLINKS; i++)
+    if(can_links[i].users>0)
+      {
+      strcpy(st.link[i].ifname, can_links[i].ifname);
+      st.link[i].mon=can_links[i].mon;
+      memcpy(st.link[i].txq, can_links[i].txq, sizeof(st.link[i].txq));
+      }
+  st.tm_rate=telem.rate_hz;
+  st.tm_seq=telem.seq;
+  st.tm_sent=telem.sent;
+  st.tm_errors=telem.errors;
+  st.http_rate=http.rate_hz;
+  st.http_requests=http.requests;
+  st.http_pushes=http.pushes;
+  st.http_dropped=http.dropped;
+  memcpy(st.hc, http.c, sizeof(st.hc));
+  if(send(chan, &st, sizeof(st), MSG_NOSIGNAL)!=(ssize_t)sizeof(st))
+    {
+    perror("upgrade send state");
+    return -1;
+    }
+
+  m.n=0;
+  n=0;
+  for(fd=0; fd<FD_SETSIZE; fd++)
+    {
+    if(!FD_ISSET(fd, &active_fd_set))
+      continue;
+    kind=upgrade_kind(fd, lsock, &idx);
+    if(kind==UPG_INTERNAL)
+      continue;
+    r=&m.r[m.n++];
+    memset(r, 0, sizeof(*r));
+    r->kind=kind;
+    r->fd=fd;
+    r->idx=idx;
+    if(kind==UPG_UNIX_LISTEN)
+      strcpy(r->name, cfg.ux[idx].path);
+    else if(kind==UPG_CAN_NODE)
+      {
+      strcpy(r->name, devs[idx].can.ifname);
+      r->idx=devs[idx].can.nodeoff;
+      }
+    else if(kind==UPG_CAN_MON)
+      strcpy(r->name, can_links[idx].ifname);
+    else if(kind==UPG_LOCAL_CLIENT)
+      r->peer=conn_by_fd(fd)->peer;
+    if((kind==UPG_TCP_CLIENT || kind==UPG_LOCAL_CLIENT) && conn_by_fd(fd)!=NULL)
+      r->in=*conn_by_fd(fd)->in;
+    n++;
+    if(m.n==UPG_FDS_PER_MSG && upgrade_sendfds(chan, &m)!=0)
+      return -1;
+    }
+  if(m.n>0 && upgrade_sendfds(chan, &m)!=0)
+    return -1;
+  // end of the list
+  if(upgrade_sendfds(chan, &m)!=0)
+    return -1;
+  return n;
+  }
+
+
+//-------------------------------------------------------------------
+
+// fork and exec the new binary, hand everything over and exit; returns
+// -1 (and this server goes on) if the new one does not say READY
+
+int upgrade_start(int lsock)
+  {
+  static char *envp[UPG_MAXENV+2];
+  static char  envfd[32];
+  char *argv[2];
+  sigset_t all;
+  struct pollfd pfd;
+  long  maxfd;
+  int   pair[2], fd, i, n, nfds;
+  pid_t pid;
+  char  c;
+
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pair)<0)
+    {
+    perror("upgrade socketpair");
+    return -1;
+    }
+
+  // everything the child needs is ready before fork(): between fork()
+  // and exec() only async-signal-safe calls
+  for(i=0, n=0; environ[i]!=NULL && n<UPG_MAXENV; i++)
+    if(strncmp(environ[i], UPG_ENV "=", strlen(UPG_ENV)+1)!=0)
+      envp[n++]=environ[i];
+  snprintf(envfd, sizeof(envfd), "%s=%d", UPG_ENV, SD_LISTEN_FDS_START);
+  envp[n++]=envfd;
+  envp[n]=NULL;
+  argv[0]=upg.exe;
+  argv[1]=NULL;
+  maxfd=sysconf(_SC_OPEN_MAX);
+  if(maxfd<0 || maxfd>65536)
+    maxfd=65536;
+  sigfillset(&all);
+
+  pid=fork();
+  if(pid<0)
+    {
+    perror("upgrade fork");
+    close(pair[0]);
+    close(pair[1]);
+    return -1;
+    }
+  if(pid==0)
+    {
+    // only the channel survives, as fd 3; the rest comes over it
+    if(pair[1]!=SD_LISTEN_FDS_START)
+      {
+      dup2(pair[1], SD_LISTEN_FDS_START);
+      close(pair[1]);
+      }
+    else
+      fcntl(SD_LISTEN_FDS_START, F_SETFD, 0);
+    for(fd=SD_LISTEN_FDS_START+1; fd<maxfd; fd++)
+      close(fd);
+    sigprocmask(SIG_UNBLOCK, &all, NULL);
+    execve(upg.exe, argv, envp);
+    _exit(127);
+    }
+
+  close(pair[1]);
+  fprintf(stderr, "upgrade: started %s as pid %d\n", upg.exe, (int)pid);
+  nfds=upgrade_send(pair[0], lsock);
+  if(nfds<0)
+    goto failed;
+
+  // READY once it has adopted everything
+  pfd.fd=pair[0];
+  pfd.events=POLLIN;
+  if(poll(&pfd, 1, UPG_READY_MS)!=1 || read(pair[0], &c, 1)!=1 || c!='R')
+    {
+    fprintf(stderr, "upgrade: pid %d did not get ready\n", (int)pid);
+    goto failed;
+    }
+
+  // from now on the new server drives the registers
+  sampler_stop();
+  if(write(pair[0], "B", 1)!=1)
+    perror("upgrade goodbye");
+  fprintf(stderr, "upgrade: handed %d fds over to pid %d; exiting\n", nfds, (int)pid);
+  exit(EXIT_SUCCESS);
+
+failed:
+  close(pair[0]);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+  }
@@ -0,0 +1,176 @@
+/**************************************************
+ ***                                            ***
+ ***  chopsync hot upgrade                      ***
+ ***                                            ***
+ ***  latest rev: oct 18 2026                   ***
+ ***                                            ***
+ **************************************************/
+// kill -USR2 <pid> (after installing a new build at the same path)
+// replaces the running server without dropping anybody:
+//
+//   the old server stops reading clients and waits until nothing is
+//   outstanding (answers, CAN requests); a running phase ramp or lock
+//   recovery refuses the upgrade
+//   it forks and execs the binary it was started from, with
+//   CHOPSYNC_UPGRADE_FD in the environment, and sends over that
+//   SEQPACKET socket its state, then its fds with SCM_RIGHTS:
+//   listeners (TCP, UNIX, HTTP), every client, CAN sockets and bus
+//   monitors, so that no CAN link is bounced
+//   the new server adopts them and says READY; the old one stops its
+//   sampler and exits, the new one starts its own sampler
+//
+// the state carries the MECOS cache, round trip statistics, CAN and
+// HTTP counters, the telemetry sequence, supervisor log and switches,
+// the HTTP/WebSocket connections with their unread input, and the
+// commands stream clients have pipelined
+// if the new binary dies before READY, or its state layout differs
+// (UPG_VERSION and the size of struct upg_state), the old server just
+// goes on serving
+//
+// started by systemd with socket activation (LISTEN_FDS), listeners
+// are taken from systemd the same way, matched by port or path;
+// NOTIFY_SOCKET gets READY=1, and MAINPID= from an upgraded server
+// (the unit needs NotifyAccess=all)
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+#include <net/if.h>
+#include "config.h"
+#include "can.h"
+#include "local.h"
+#include "http.h"
+#include "supervisor.h"
+#include "scpi.h"
+
+#define UPG_ENV          "CHOPSYNC_UPGRADE_FD"
+#define UPG_MAGIC        0x43535550     // "CSUP"
+#define UPG_VERSION      4
+#define UPG_MAXFDS       FD_SETSIZE
+#define UPG_FDS_PER_MSG  32
+#define UPG_MAXENV       256
+#define UPG_IDLE_MS      3000     // old server: wait this long to be idle
+#define UPG_READY_MS     5000     // old server: wait this long for READY
+#define UPG_TICK_MS      20
+#define SD_LISTEN_FDS_START 3
+
+enum upg_kind
+  {
+  UPG_INTERNAL=-1,        // timers and eventfds: every server makes its own
+  UPG_TCP_LISTEN,
+  UPG_UNIX_LISTEN,
+  UPG_HTTP_LISTEN,
+  UPG_CAN_NODE,
+  UPG_CAN_MON,
+  UPG_TCP_CLIENT,
+  UPG_LOCAL_CLIENT,
+  UPG_HTTP_CLIENT
+  };
+
+// one fd handed over; name and idx say what it is for:
+// UNIX listener path, CAN interface + node id offset, HTTP slot
+struct upg_fd
+  {
+  int            kind;
+  int            fd;
+  int            idx;
+  char           name[MAXUNIXPATH];
+  struct peer    peer;
+  struct linebuf in;          // stream clients: commands not run yet
+  bool           taken;
+  };
+
+struct upg_fdmsg
+  {
+  int           n;
+  struct upg_fd r[UPG_FDS_PER_MSG];
+  };
+
+struct upg_dev
+  {
+  char               ifname[IFNAMSIZ];
+  unsigned int       nodeoff;
+  struct mecos_cache cache[MECOS_NOBJ];
+  struct rtt_hist    rtt[MECOS_NOBJ+1];
+  int                rto_shift[MECOS_NOBJ+1];
+  bool               sv_enable;
+  unsigned long      sv_losses, sv_recovered, sv_failed, sv_gaveup, sv_overridden;
+  uint64_t           sv_loghead, sv_reported;
+  struct sv_attempt  sv_log[SV_LOGLEN];
+  };
+
+struct upg_link
+  {
+  char           ifname[IFNAMSIZ];
+  struct canmon  mon;
+  struct can_txq txq[CAN_NPRIO];    // counters only, the queues are empty
+  };
+
+struct upg_state
+  {
+  uint32_t        magic, version, size;
+  int             ndevs;
+  unsigned long   can_requests, can_coalesced, can_retries;
+  struct upg_dev  dev[MAXDEV];
+  struct upg_link link[CAN_MAXLINKS];
+  unsigned int    tm_rate;
+  uint32_t        tm_seq;
+  unsigned long   tm_sent, tm_errors;
+  unsigned int    http_rate;
+  unsigned long   http_requests, http_pushes, http_dropped;
+  struct httpconn hc[HTTP_MAXCONN];
+  };
+
+struct upgrade
+  {
+  int              sigfd;         // SIGUSR2; -1 if hot upgrade is not available
+  char             exe[PATH_MAX];
+  // old server
+  bool             requested;
+  struct timespec  since;
+  // new server
+  int              chan;          // to the old server until it is gone
+  bool             inherited;     // fds came from an old server or systemd
+  bool             upgraded;      // ... from an old server, with its state
+  int              nfds;
+  struct upg_fd    fds[UPG_MAXFDS];
+  struct upg_state st;
+  };
+
+extern struct upgrade upg;
+
+
+/******* protos *******/
+
+int   upgrade_open(void);
+int   upgrade_recvmsg(int chan, void *buf, size_t len, int *fds, int maxfds, int *nfds);
+int   upgrade_receive(int chan);
+int   upgrade_systemd(void);
+int   upgrade_take(int kind, const char *name, int idx);
+bool  upgrade_has(int kind, const char *name);
+int   upgrade_commit(void);
+void  upgrade_finish(int *maxfd);
+void  upgrade_notify(const char *msg);
+void  upgrade_signal(void);
+int   upgrade_kind(int fd, int lsock, int *idx);
+const char *upgrade_busy(void);
+bool  upgrade_idle(void);
+struct timeval *upgrade_quiesce(fd_set *set, int lsock, struct timeval *tv, struct timeval *tvp);
+void  upgrade_poll(int lsock);
+int   upgrade_sendfds(int chan, struct upg_fdmsg *m);
+int   upgrade_send(int chan, int lsock);
+int   upgrade_start(int lsock);
+
+#endif